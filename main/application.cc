@@ -5,9 +5,13 @@
 #include "audio_codec.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
+#if CONFIG_USE_SESSION_REPLAY
+#include "replay_protocol.h"
+#endif
 #include "font_awesome_symbols.h"
 #include "assets/lang_config.h"
 #include "mcp_server.h"
+#include "boot_profiler.h"
 
 #include <cstring>
 #include <esp_log.h>
@@ -35,6 +39,8 @@ static const char* const STATE_STRINGS[] = {
 
 Application::Application() {
     event_group_ = xEventGroupCreate();
+    // Set while no wake word preload is running
+    xEventGroupSetBits(event_group_, MAIN_EVENT_WAKE_WORD_PRELOADED);
 
 #if CONFIG_USE_DEVICE_AEC && CONFIG_USE_SERVER_AEC
 #error "CONFIG_USE_DEVICE_AEC and CONFIG_USE_SERVER_AEC cannot be enabled at the same time"
@@ -67,7 +73,7 @@ Application::~Application() {
     vEventGroupDelete(event_group_);
 }
 
-void Application::CheckNewVersion(Ota& ota) {
+void Application::CheckNewVersion(Ota& ota, bool checked) {
     const int MAX_RETRY = 10;
     int retry_count = 0;
     int retry_delay = 10; // 初始重试延迟为10秒
@@ -78,7 +84,8 @@ void Application::CheckNewVersion(Ota& ota) {
         auto display = board.GetDisplay();
         display->SetStatus(Lang::Strings::CHECKING_NEW_VERSION);
 
-        if (!ota.CheckVersion()) {
+        // The first round may use the response of a check the caller has done
+        if (!checked && !ota.CheckVersion()) {
             retry_count++;
             if (retry_count >= MAX_RETRY) {
                 ESP_LOGE(TAG, "Too many retries, exit version check");
@@ -99,6 +106,7 @@ void Application::CheckNewVersion(Ota& ota) {
             retry_delay *= 2; // 每次重试后延迟时间翻倍
             continue;
         }
+        checked = false;
         retry_count = 0;
         retry_delay = 10; // 重置重试延迟时间
 
@@ -114,6 +122,7 @@ void Application::CheckNewVersion(Ota& ota) {
             display->SetChatMessage("system", message.c_str());
 
             board.SetPowerSaveMode(false);
+            WaitForWakeWordPreload();
             audio_service_.Stop();
             vTaskDelay(pdMS_TO_TICKS(1000));
 
@@ -244,6 +253,8 @@ void Application::ToggleChatState() {
     }
 
     if (device_state_ == kDeviceStateIdle) {
+        // Power up the codec while the audio channel opens
+        audio_service_.PrepareAudioPath(true, true);
         Schedule([this]() {
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
@@ -281,6 +292,8 @@ void Application::StartListening() {
     }
     
     if (device_state_ == kDeviceStateIdle) {
+        // Power up the codec while the audio channel opens
+        audio_service_.PrepareAudioPath(true, true);
         Schedule([this]() {
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
@@ -325,16 +338,22 @@ void Application::StopListening() {
 }
 
 void Application::Start() {
+    auto& profiler = BootProfiler::GetInstance();
+    profiler.Begin("board");
     auto& board = Board::GetInstance();
+    SubscribeEvents();
     SetDeviceState(kDeviceStateStarting);
 
     /* Setup the display */
     auto display = board.GetDisplay();
+    profiler.End("board");
 
     /* Setup the audio service */
+    profiler.Begin("audio");
     auto codec = board.GetAudioCodec();
     audio_service_.Initialize(codec);
     audio_service_.Start();
+    profiler.End("audio");
 
     AudioServiceCallbacks callbacks;
     callbacks.on_send_queue_available = [this]() {
@@ -346,27 +365,56 @@ void Application::Start() {
     callbacks.on_vad_change = [this](bool speaking) {
         xEventGroupSetBits(event_group_, MAIN_EVENT_VAD_CHANGE);
     };
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    callbacks.on_speech_candidate = [this]() {
+        xEventGroupSetBits(event_group_, MAIN_EVENT_SPEECH_CANDIDATE);
+    };
+#endif
     audio_service_.SetCallbacks(callbacks);
 
+#if CONFIG_USE_PARALLEL_STARTUP
+    // Listen for the wake word while the network comes up, it only needs the audio service
+    PreloadWakeWord();
+#endif
+
     /* Start the clock timer to update the status bar */
     esp_timer_start_periodic(clock_timer_handle_, 1000000);
 
     /* Wait for the network to be ready */
+    profiler.Begin("network");
     board.StartNetwork();
+    profiler.End("network");
+    EventBus::GetInstance().Publish(Event{.type = kEventNetwork, .network = {kNetworkEventStarted}});
 
     // Update the status bar immediately to show the network state
     display->UpdateStatusBar(true);
 
     // Check for new firmware version or get the MQTT broker address
+    profiler.Begin("ota");
     Ota ota;
+#if CONFIG_USE_OTA_CACHE
+    // Connect with the cached config right away, the check runs again behind the protocol
+    if (ota.LoadCachedConfig()) {
+        RevalidateOtaConfig();
+    } else {
+        CheckNewVersion(ota);
+    }
+#else
     CheckNewVersion(ota);
+#endif
+    profiler.End("ota");
 
     // Initialize the protocol
+    profiler.Begin("protocol");
     display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
 
     // Add MCP common tools before initializing the protocol
     McpServer::GetInstance().AddCommonTools();
 
+#if CONFIG_USE_SESSION_REPLAY
+    ESP_LOGW(TAG, "Replaying session from %s instead of connecting to the server", CONFIG_SESSION_REPLAY_URL);
+    protocol_ = std::make_unique<ReplayProtocol>();
+#else
     if (ota.HasMqttConfig()) {
         protocol_ = std::make_unique<MqttProtocol>();
     } else if (ota.HasWebsocketConfig()) {
@@ -375,25 +423,37 @@ void Application::Start() {
         ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
         protocol_ = std::make_unique<MqttProtocol>();
     }
+#endif
 
     protocol_->OnNetworkError([this](const std::string& message) {
+        EventBus::GetInstance().Publish(Event{.type = kEventNetwork, .network = {kNetworkEventError}});
         last_error_message_ = message;
         xEventGroupSetBits(event_group_, MAIN_EVENT_ERROR);
     });
     protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
+#if CONFIG_USE_SESSION_RECORDER
+        session_recorder_.RecordIncomingAudio(*packet);
+#endif
         if (device_state_ == kDeviceStateSpeaking) {
             audio_service_.PushPacketToDecodeQueue(std::move(packet));
         }
     });
-    protocol_->OnAudioChannelOpened([this, codec, &board]() {
-        board.SetPowerSaveMode(false);
+    protocol_->OnAudioChannelOpened([this, codec]() {
+#if CONFIG_USE_SESSION_RECORDER
+        session_recorder_.OnChannelOpened(*protocol_);
+#endif
+        EventBus::GetInstance().Publish(Event{.type = kEventNetwork, .network = {kNetworkEventAudioChannelOpened}});
+        audio_service_.SetFrameDuration(protocol_->uplink_frame_duration(), protocol_->server_frame_duration());
         if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
     });
-    protocol_->OnAudioChannelClosed([this, &board]() {
-        board.SetPowerSaveMode(true);
+    protocol_->OnAudioChannelClosed([this]() {
+#if CONFIG_USE_SESSION_RECORDER
+        session_recorder_.OnChannelClosed();
+#endif
+        EventBus::GetInstance().Publish(Event{.type = kEventNetwork, .network = {kNetworkEventAudioChannelClosed}});
         Schedule([this]() {
             auto display = Board::GetInstance().GetDisplay();
             display->SetChatMessage("system", "");
@@ -401,11 +461,16 @@ void Application::Start() {
         });
     });
     protocol_->OnIncomingJson([this, display](const cJSON* root) {
+#if CONFIG_USE_SESSION_RECORDER
+        session_recorder_.RecordIncomingJson(root);
+#endif
         // Parse JSON data
         auto type = cJSON_GetObjectItem(root, "type");
         if (strcmp(type->valuestring, "tts") == 0) {
             auto state = cJSON_GetObjectItem(root, "state");
             if (strcmp(state->valuestring, "start") == 0) {
+                // The first audio packets follow, power up the speaker path now
+                audio_service_.PrepareAudioPath(false, true);
                 Schedule([this]() {
                     aborted_ = false;
                     if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
@@ -415,6 +480,13 @@ void Application::Start() {
             } else if (strcmp(state->valuestring, "stop") == 0) {
                 Schedule([this]() {
                     if (device_state_ == kDeviceStateSpeaking) {
+#if CONFIG_USE_STREAM_PLAYER
+                        if (!pending_stream_url_.empty()) {
+                            // The reply announcing the stream is over, end the session instead of listening again
+                            StartPendingStream();
+                            return;
+                        }
+#endif
                         if (listening_mode_ == kListeningModeManualStop) {
                             SetDeviceState(kDeviceStateIdle);
                         } else {
@@ -490,6 +562,7 @@ void Application::Start() {
         }
     });
     bool protocol_started = protocol_->Start();
+    profiler.End("protocol");
 
     SetDeviceState(kDeviceStateIdle);
 
@@ -502,6 +575,15 @@ void Application::Start() {
         audio_service_.PlaySound(Lang::Sounds::P3_SUCCESS);
     }
 
+    // A wake word heard during the startup is handled as soon as the main event loop runs
+    profiler.PrintSummary();
+    // Without the preload the wake word starts with the idle state, right after the protocol
+    int64_t wake_word_ready_ms = profiler.GetEndTimeMs("wake_word");
+    if (wake_word_ready_ms < 0) {
+        wake_word_ready_ms = profiler.GetEndTimeMs("protocol");
+    }
+    ESP_LOGI(TAG, "Time to first wake word: %lld ms", wake_word_ready_ms);
+
     // Print heap stats
     SystemInfo::PrintHeapStats();
     
@@ -509,6 +591,79 @@ void Application::Start() {
     MainEventLoop();
 }
 
+#if CONFIG_USE_OTA_CACHE
+// Check the version in a background task after starting from the cached response.
+// New config is saved to NVS and used by the next connection. An upgrade or an activation
+// waits for the idle state and then runs in this task, with the response of this check.
+void Application::RevalidateOtaConfig() {
+    xTaskCreate([](void* arg) {
+        Application* app = (Application*)arg;
+        Ota ota;
+        if (!ota.CheckVersion()) {
+            ESP_LOGW(TAG, "Revalidating the cached OTA response failed, keeping it");
+            vTaskDelete(NULL);
+            return;
+        }
+        ESP_LOGI(TAG, "Cached OTA response %s", ota.IsCachedResponse() ? "is current" : "was replaced");
+        bool has_server_time = ota.HasServerTime();
+        bool needs_check = ota.HasNewVersion() || ota.HasActivationCode() || ota.HasActivationChallenge();
+        if (!needs_check) {
+            ota.MarkCurrentVersionValid();
+        }
+        auto task = xTaskGetCurrentTaskHandle();
+        app->Schedule([app, has_server_time, needs_check, task]() {
+            if (has_server_time) {
+                app->has_server_time_ = true;
+            }
+            if (needs_check) {
+                app->ota_check_task_ = task;
+                if (app->device_state_ == kDeviceStateIdle) {
+                    app->StartPendingOtaCheck();
+                }
+            }
+        });
+        if (needs_check) {
+            // Notified by the main loop when the device is idle and held in the activating state
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            app->CheckNewVersion(ota, true);
+            app->Schedule([app]() {
+                app->SetDeviceState(kDeviceStateIdle);
+            });
+        }
+        vTaskDelete(NULL);
+    }, "ota_revalidate", 4096 * 2, this, 2, nullptr);
+}
+
+// Hand the idle device over to the revalidation task, the activating state keeps conversations out
+void Application::StartPendingOtaCheck() {
+    auto task = ota_check_task_;
+    ota_check_task_ = nullptr;
+    SetDeviceState(kDeviceStateActivating);
+    xTaskNotifyGive(task);
+}
+#endif
+
+// Load the wake word model in a background task and start the detection, it takes a few seconds
+// from flash and does not depend on the network
+void Application::PreloadWakeWord() {
+    xEventGroupClearBits(event_group_, MAIN_EVENT_WAKE_WORD_PRELOADED);
+    BootProfiler::GetInstance().Begin("wake_word");
+    xTaskCreate([](void* arg) {
+        Application* app = (Application*)arg;
+        app->audio_service_.EnableWakeWordDetection(true);
+        if (app->audio_service_.IsWakeWordRunning()) {
+            BootProfiler::GetInstance().End("wake_word");
+        }
+        xEventGroupSetBits(app->event_group_, MAIN_EVENT_WAKE_WORD_PRELOADED);
+        vTaskDelete(NULL);
+    }, "wake_word_preload", 4096 * 2, this, 2, nullptr);
+}
+
+// Anything that enables or disables the wake word waits for the preload, so they do not race
+void Application::WaitForWakeWordPreload() {
+    xEventGroupWaitBits(event_group_, MAIN_EVENT_WAKE_WORD_PRELOADED, pdFALSE, pdTRUE, portMAX_DELAY);
+}
+
 void Application::OnClockTimer() {
     clock_ticks_++;
 
@@ -544,6 +699,7 @@ void Application::MainEventLoop() {
             MAIN_EVENT_SEND_AUDIO |
             MAIN_EVENT_WAKE_WORD_DETECTED |
             MAIN_EVENT_VAD_CHANGE |
+            MAIN_EVENT_SPEECH_CANDIDATE |
             MAIN_EVENT_ERROR, pdTRUE, pdFALSE, portMAX_DELAY);
         if (bits & MAIN_EVENT_ERROR) {
             SetDeviceState(kDeviceStateIdle);
@@ -552,21 +708,30 @@ void Application::MainEventLoop() {
 
         if (bits & MAIN_EVENT_SEND_AUDIO) {
             while (auto packet = audio_service_.PopPacketFromSendQueue()) {
+#if CONFIG_USE_SESSION_RECORDER
+                session_recorder_.RecordOutgoingAudio(*packet);
+#endif
                 if (!protocol_->SendAudio(std::move(packet))) {
+                    audio_service_.OnSendAudioFailed();
                     break;
                 }
             }
         }
 
+        if (bits & MAIN_EVENT_SPEECH_CANDIDATE) {
+            // Someone starts talking, maybe the wake word, get the audio channel ready
+            if (device_state_ == kDeviceStateIdle && protocol_) {
+                protocol_->PrewarmAudioChannel();
+            }
+        }
+
         if (bits & MAIN_EVENT_WAKE_WORD_DETECTED) {
+            EventBus::GetInstance().Publish(Event{.type = kEventAudio, .audio = {kAudioEventWakeWordDetected}});
             OnWakeWordDetected();
         }
 
         if (bits & MAIN_EVENT_VAD_CHANGE) {
-            if (device_state_ == kDeviceStateListening) {
-                auto led = Board::GetInstance().GetLed();
-                led->OnStateChanged();
-            }
+            EventBus::GetInstance().Publish(Event{.type = kEventVadChange, .vad = {audio_service_.IsVoiceDetected()}});
         }
 
         if (bits & MAIN_EVENT_SCHEDULE) {
@@ -621,38 +786,98 @@ void Application::OnWakeWordDetected() {
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
+#if CONFIG_USE_STREAM_PLAYER
+    pending_stream_url_.clear();
+#endif
     protocol_->SendAbortSpeaking(reason);
 }
 
+#if CONFIG_USE_STREAM_PLAYER
+void Application::PlayUrl(const std::string& url) {
+    Schedule([this, url]() {
+        pending_stream_url_ = url;
+        // The tool is called in the middle of a session, the stream waits until the reply is over
+        // (tts stop) or the channel closes, so the tool result still reaches the server
+        if (device_state_ == kDeviceStateIdle) {
+            StartPendingStream();
+        }
+    });
+}
+
+void Application::StopUrl() {
+    Schedule([this]() {
+        pending_stream_url_.clear();
+        stream_player_.Stop();
+    });
+}
+
+// The stream plays in idle, waking the device up stops it
+void Application::StartPendingStream() {
+    auto url = std::move(pending_stream_url_);
+    pending_stream_url_.clear();
+    if (protocol_ && protocol_->IsAudioChannelOpened()) {
+        protocol_->CloseAudioChannel();
+    }
+    SetDeviceState(kDeviceStateIdle);
+    stream_player_.Play(url);
+}
+#endif
+
 void Application::SetListeningMode(ListeningMode mode) {
     listening_mode_ = mode;
     SetDeviceState(kDeviceStateListening);
 }
 
+void Application::SubscribeEvents() {
+    auto& bus = EventBus::GetInstance();
+    // The LED shows the device state, and the voice activity while listening
+    bus.Subscribe(EVENT_MASK(kEventDeviceState) | EVENT_MASK(kEventVadChange), [](const Event& event, void* arg) {
+        auto app = static_cast<Application*>(arg);
+        if (event.type == kEventVadChange && app->GetDeviceState() != kDeviceStateListening) {
+            return;
+        }
+        Board::GetInstance().GetLed()->OnStateChanged();
+    }, this);
+    // The network stays out of power save while the audio channel is open
+    bus.Subscribe(EVENT_MASK(kEventNetwork), [](const Event& event, void* arg) {
+        if (event.network.type == kNetworkEventAudioChannelOpened) {
+            Board::GetInstance().SetPowerSaveMode(false);
+        } else if (event.network.type == kNetworkEventAudioChannelClosed) {
+            Board::GetInstance().SetPowerSaveMode(true);
+        }
+    });
+}
+
 void Application::SetDeviceState(DeviceState state) {
     if (device_state_ == state) {
         return;
     }
+#if CONFIG_USE_STREAM_PLAYER
+    if (state == kDeviceStateConnecting || state == kDeviceStateListening) {
+        stream_player_.Stop();
+    }
+#endif
     
     clock_ticks_ = 0;
     auto previous_state = device_state_;
     device_state_ = state;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
 
-    // Send the state change event
-    DeviceStateEventManager::GetInstance().PostStateChangeEvent(previous_state, state);
+    EventBus::GetInstance().Publish(Event{.type = kEventDeviceState, .state = {previous_state, state}});
 
     auto& board = Board::GetInstance();
     auto display = board.GetDisplay();
-    auto led = board.GetLed();
-    led->OnStateChanged();
     switch (state) {
         case kDeviceStateUnknown:
         case kDeviceStateIdle:
             display->SetStatus(Lang::Strings::STANDBY);
             display->SetEmotion("neutral");
+            WaitForWakeWordPreload();
             audio_service_.EnableVoiceProcessing(false);
             audio_service_.EnableWakeWordDetection(true);
+#if CONFIG_USE_REALTIME_DTX
+            audio_service_.EnableDtx(false);
+#endif
             break;
         case kDeviceStateConnecting:
             display->SetStatus(Lang::Strings::CONNECTING);
@@ -662,6 +887,9 @@ void Application::SetDeviceState(DeviceState state) {
         case kDeviceStateListening:
             display->SetStatus(Lang::Strings::LISTENING);
             display->SetEmotion("neutral");
+#if CONFIG_USE_REALTIME_DTX
+            audio_service_.EnableDtx(listening_mode_ == kListeningModeRealtime);
+#endif
 
             // Make sure the audio processor is running
             if (!audio_service_.IsAudioProcessorRunning()) {
@@ -685,10 +913,34 @@ void Application::SetDeviceState(DeviceState state) {
             }
             audio_service_.ResetDecoder();
             break;
+#if CONFIG_USE_PARALLEL_STARTUP
+        case kDeviceStateWifiConfiguring:
+            // The wake word was started at boot, the configuration mode uses the microphone itself
+            WaitForWakeWordPreload();
+            audio_service_.EnableWakeWordDetection(false);
+            break;
+#endif
         default:
             // Do nothing
             break;
     }
+
+#if CONFIG_USE_STREAM_PLAYER
+    if (state == kDeviceStateIdle && !pending_stream_url_.empty()) {
+        // The session ended before its reply did, e.g. the channel closed
+        StartPendingStream();
+    }
+#endif
+#if CONFIG_USE_OTA_CACHE
+    if (state == kDeviceStateIdle && ota_check_task_ != nullptr) {
+        // The revalidation found an upgrade or an activation while the device was busy
+        Schedule([this]() {
+            if (device_state_ == kDeviceStateIdle && ota_check_task_ != nullptr) {
+                StartPendingOtaCheck();
+            }
+        });
+    }
+#endif
 }
 
 void Application::Reboot() {
@@ -15,7 +15,13 @@
 #include "protocol.h"
 #include "ota.h"
 #include "audio_service.h"
-#include "device_state_event.h"
+#include "event_bus.h"
+#if CONFIG_USE_SESSION_RECORDER
+#include "session_recorder.h"
+#endif
+#if CONFIG_USE_STREAM_PLAYER
+#include "stream_player.h"
+#endif
 
 #define MAIN_EVENT_SCHEDULE (1 << 0)
 #define MAIN_EVENT_SEND_AUDIO (1 << 1)
@@ -23,6 +29,8 @@
 #define MAIN_EVENT_VAD_CHANGE (1 << 3)
 #define MAIN_EVENT_ERROR (1 << 4)
 #define MAIN_EVENT_CHECK_NEW_VERSION_DONE (1 << 5)
+#define MAIN_EVENT_SPEECH_CANDIDATE (1 << 6)
+#define MAIN_EVENT_WAKE_WORD_PRELOADED (1 << 7)
 
 enum AecMode {
     kAecOff,
@@ -59,6 +67,11 @@ public:
     AecMode GetAecMode() const { return aec_mode_; }
     void PlaySound(const std::string_view& sound);
     AudioService& GetAudioService() { return audio_service_; }
+#if CONFIG_USE_STREAM_PLAYER
+    // Plays the URL in idle once the current reply has been spoken
+    void PlayUrl(const std::string& url);
+    void StopUrl();
+#endif
 
 private:
     Application();
@@ -74,6 +87,13 @@ private:
     AecMode aec_mode_ = kAecOff;
     std::string last_error_message_;
     AudioService audio_service_;
+#if CONFIG_USE_STREAM_PLAYER
+    StreamPlayer stream_player_{audio_service_};
+    std::string pending_stream_url_;
+#endif
+#if CONFIG_USE_SESSION_RECORDER
+    SessionRecorder session_recorder_;
+#endif
 
     bool has_server_time_ = false;
     bool aborted_ = false;
@@ -81,11 +101,23 @@ private:
     TaskHandle_t check_new_version_task_handle_ = nullptr;
 
     void MainEventLoop();
+    void SubscribeEvents();
     void OnWakeWordDetected();
-    void CheckNewVersion(Ota& ota);
+    void CheckNewVersion(Ota& ota, bool checked = false);
     void ShowActivationCode(const std::string& code, const std::string& message);
     void OnClockTimer();
     void SetListeningMode(ListeningMode mode);
+    void PreloadWakeWord();
+#if CONFIG_USE_OTA_CACHE
+    // The revalidation task waiting for the idle state to upgrade or activate, set in the main loop
+    TaskHandle_t ota_check_task_ = nullptr;
+    void RevalidateOtaConfig();
+    void StartPendingOtaCheck();
+#endif
+    void WaitForWakeWordPreload();
+#if CONFIG_USE_STREAM_PLAYER
+    void StartPendingStream();
+#endif
 };
 
 #endif // _APPLICATION_H_
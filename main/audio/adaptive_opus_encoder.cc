@@ -0,0 +1,169 @@
+#include "adaptive_opus_encoder.h"
+
+#include <sdkconfig.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "AdaptiveOpusEncoder"
+
+#define MAX_OPUS_PACKET_SIZE 1000
+
+struct OpusEncoderLevel {
+    int complexity;
+    int bitrate;
+    bool inband_fec;
+};
+
+// From the cheapest to the best quality, level 1 is the fixed setting used before
+static const OpusEncoderLevel kLevels[] = {
+    {0, 12000, false},
+    {0, OPUS_AUTO, false},
+    {3, 24000, true},
+    {5, 32000, true},
+};
+static const int kLevelCount = sizeof(kLevels) / sizeof(kLevels[0]);
+static const int kBaseLevel = 1;
+
+AdaptiveOpusEncoder::AdaptiveOpusEncoder(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), channels_(channels), duration_ms_(duration_ms) {
+    int error;
+    encoder_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        return;
+    }
+    frame_size_ = sample_rate / 1000 * channels * duration_ms;
+
+#if CONFIG_USE_ADAPTIVE_OPUS_ENCODER
+    max_level_ = std::min(CONFIG_ADAPTIVE_OPUS_ENCODER_MAX_LEVEL, kLevelCount - 1);
+#else
+    max_level_ = kBaseLevel;
+#endif
+    level_ = kBaseLevel;
+    ApplyLevel(level_);
+}
+
+AdaptiveOpusEncoder::~AdaptiveOpusEncoder() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+void AdaptiveOpusEncoder::ApplyLevel(int level) {
+    auto& setting = kLevels[level];
+    opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(setting.complexity));
+    opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(setting.bitrate));
+    opus_encoder_ctl(encoder_, OPUS_SET_INBAND_FEC(setting.inband_fec ? 1 : 0));
+    opus_encoder_ctl(encoder_, OPUS_SET_PACKET_LOSS_PERC(setting.inband_fec ? 10 : 0));
+    level_ = level;
+}
+
+void AdaptiveOpusEncoder::SetDuration(int duration_ms) {
+    duration_ms_ = duration_ms;
+    frame_size_ = sample_rate_ / 1000 * channels_ * duration_ms;
+    in_buffer_.clear();
+    // The window counts frames, start a new one with the new duration
+    window_frames_ = 0;
+    window_encode_us_ = 0;
+    window_max_encode_us_ = 0;
+    window_max_queue_size_ = 0;
+}
+
+void AdaptiveOpusEncoder::SetDtx(bool enable) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_DTX(enable ? 1 : 0));
+    }
+}
+
+bool AdaptiveOpusEncoder::Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus) {
+    if (encoder_ == nullptr) {
+        return false;
+    }
+
+    if (in_buffer_.empty()) {
+        in_buffer_ = std::move(pcm);
+    } else {
+        in_buffer_.insert(in_buffer_.end(), pcm.begin(), pcm.end());
+    }
+    if (in_buffer_.size() < (size_t)frame_size_) {
+        return false;
+    }
+
+    opus.resize(MAX_OPUS_PACKET_SIZE);
+    auto start_time = esp_timer_get_time();
+    auto ret = opus_encode(encoder_, in_buffer_.data(), frame_size_ / channels_, opus.data(), opus.size());
+    last_encode_us_ = esp_timer_get_time() - start_time;
+    in_buffer_.erase(in_buffer_.begin(), in_buffer_.begin() + frame_size_);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+        return false;
+    }
+    opus.resize(ret);
+
+    window_frames_++;
+    window_encode_us_ += last_encode_us_;
+    window_max_encode_us_ = std::max(window_max_encode_us_, last_encode_us_);
+    return true;
+}
+
+void AdaptiveOpusEncoder::ResetState() {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    }
+    in_buffer_.clear();
+}
+
+void AdaptiveOpusEncoder::OnFrameQueued(size_t send_queue_size) {
+    window_max_queue_size_ = std::max(window_max_queue_size_, send_queue_size);
+    if (window_frames_ * duration_ms_ >= ADAPTIVE_OPUS_ENCODER_WINDOW_MS) {
+        EvaluateWindow();
+    }
+}
+
+void AdaptiveOpusEncoder::EvaluateWindow() {
+    int64_t frame_us = duration_ms_ * 1000;
+    int load = window_encode_us_ * 100 / window_frames_ / frame_us;
+    int max_load = window_max_encode_us_ * 100 / frame_us;
+    uint32_t send_failures = send_failures_.load();
+    uint32_t new_failures = send_failures - window_send_failures_;
+    window_send_failures_ = send_failures;
+
+    int level = level_;
+    const char* reason = nullptr;
+    if (load >= ADAPTIVE_OPUS_ENCODER_HIGH_LOAD_PERCENT || max_load >= 100) {
+        reason = "encoder load";
+    } else if (window_max_queue_size_ >= ADAPTIVE_OPUS_ENCODER_HIGH_QUEUE_SIZE) {
+        reason = "send queue";
+    } else if (new_failures > 0) {
+        reason = "send failure";
+    }
+
+    if (reason != nullptr) {
+        good_windows_ = 0;
+        if (level > 0) {
+            level--;
+            // A level that failed once has to prove itself longer before we try it again
+            raise_windows_ = ADAPTIVE_OPUS_ENCODER_RAISE_WINDOWS_AFTER_DROP;
+        }
+    } else if (load < ADAPTIVE_OPUS_ENCODER_LOW_LOAD_PERCENT && window_max_queue_size_ <= 1) {
+        if (++good_windows_ >= raise_windows_ && level < max_level_) {
+            level++;
+            good_windows_ = 0;
+            reason = "headroom";
+        }
+    } else {
+        good_windows_ = 0;
+    }
+
+    if (level != level_) {
+        ESP_LOGI(TAG, "Level %d -> %d (%s): load avg %d%% max %d%%, send queue %u, send failures %lu",
+            level_, level, reason, load, max_load, window_max_queue_size_, new_failures);
+        ApplyLevel(level);
+    }
+
+    window_frames_ = 0;
+    window_encode_us_ = 0;
+    window_max_encode_us_ = 0;
+    window_max_queue_size_ = 0;
+}
@@ -0,0 +1,73 @@
+#ifndef ADAPTIVE_OPUS_ENCODER_H
+#define ADAPTIVE_OPUS_ENCODER_H
+
+#include <opus.h>
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+// Adjust once every window of frames (about one second)
+#define ADAPTIVE_OPUS_ENCODER_WINDOW_MS 1000
+// Good windows needed before raising the level, more after a drop to avoid oscillation
+#define ADAPTIVE_OPUS_ENCODER_RAISE_WINDOWS 5
+#define ADAPTIVE_OPUS_ENCODER_RAISE_WINDOWS_AFTER_DROP 30
+// Average encode time in percent of the frame duration
+#define ADAPTIVE_OPUS_ENCODER_HIGH_LOAD_PERCENT 40
+#define ADAPTIVE_OPUS_ENCODER_LOW_LOAD_PERCENT 15
+// Packets waiting in the send queue
+#define ADAPTIVE_OPUS_ENCODER_HIGH_QUEUE_SIZE 4
+
+/*
+ * Uplink Opus encoder, which adjusts complexity, bitrate and in-band FEC at runtime.
+ * The level drops when encoding takes too much of the frame time, the send queue backs up
+ * or the protocol fails to send, and rises again after a few good windows.
+ * Without CONFIG_USE_ADAPTIVE_OPUS_ENCODER it stays at the base level (complexity 0, auto bitrate).
+ */
+class AdaptiveOpusEncoder {
+public:
+    AdaptiveOpusEncoder(int sample_rate, int channels, int duration_ms);
+    ~AdaptiveOpusEncoder();
+
+    inline int sample_rate() const { return sample_rate_; }
+    inline int duration_ms() const { return duration_ms_; }
+    inline int level() const { return level_; }
+    inline int64_t last_encode_us() const { return last_encode_us_; }
+
+    void SetDtx(bool enable);
+    // Drops the samples buffered for the current frame
+    void SetDuration(int duration_ms);
+    bool Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus);
+    void ResetState();
+
+    // Called by the codec task after every frame put into the send queue
+    void OnFrameQueued(size_t send_queue_size);
+    // Called by the sender, from any task
+    void OnSendFailed() { send_failures_++; }
+
+private:
+    OpusEncoder* encoder_ = nullptr;
+    int sample_rate_;
+    int channels_;
+    int duration_ms_;
+    int frame_size_;
+    std::vector<int16_t> in_buffer_;
+    int level_;
+    int max_level_;
+    int64_t last_encode_us_ = 0;
+    std::atomic<uint32_t> send_failures_ = 0;
+
+    // Current window
+    int window_frames_ = 0;
+    int64_t window_encode_us_ = 0;
+    int64_t window_max_encode_us_ = 0;
+    size_t window_max_queue_size_ = 0;
+    uint32_t window_send_failures_ = 0;
+    int good_windows_ = 0;
+    int raise_windows_ = ADAPTIVE_OPUS_ENCODER_RAISE_WINDOWS;
+
+    void ApplyLevel(int level);
+    void EvaluateWindow();
+};
+
+#endif // ADAPTIVE_OPUS_ENCODER_H
@@ -3,6 +3,7 @@
 #include "settings.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <cstring>
 #include <driver/i2s_common.h>
 
@@ -35,6 +36,7 @@ void AudioCodec::Start() {
     }
 
     if (tx_handle_ != nullptr) {
+        EnableOutputClock();
         ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
     }
 
@@ -47,6 +49,41 @@ void AudioCodec::Start() {
     ESP_LOGI(TAG, "Audio codec started");
 }
 
+void AudioCodec::EnableOutputClock() {
+#if CONFIG_USE_SERVER_AEC
+    // Count the samples the DMA sends, so server AEC knows what the speaker is playing.
+    // Must be called before the TX channel is enabled
+    if (output_frame_bytes_ == 0) {
+        output_frame_bytes_ = sizeof(int16_t) * output_channels_;
+    }
+    i2s_event_callbacks_t callbacks = {};
+    callbacks.on_sent = OnOutputSent;
+    if (i2s_channel_register_event_callback(tx_handle_, &callbacks, this) == ESP_OK) {
+        output_clock_enabled_ = true;
+    } else {
+        ESP_LOGW(TAG, "Failed to register the output DMA callback, playback clock is unavailable");
+    }
+#endif
+}
+
+bool IRAM_ATTR AudioCodec::OnOutputSent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto codec = (AudioCodec*)user_ctx;
+    portENTER_CRITICAL_ISR(&codec->output_clock_lock_);
+    // The size of the DMA buffer just sent, which depends on the slot width and mode of the channel
+    codec->output_sent_frames_ += event->size / codec->output_frame_bytes_;
+    codec->output_sent_time_us_ = esp_timer_get_time();
+    portEXIT_CRITICAL_ISR(&codec->output_clock_lock_);
+    return false;
+}
+
+bool AudioCodec::GetOutputClock(uint64_t& frames, int64_t& time_us) {
+    portENTER_CRITICAL(&output_clock_lock_);
+    frames = output_sent_frames_;
+    time_us = output_sent_time_us_;
+    portEXIT_CRITICAL(&output_clock_lock_);
+    return output_clock_enabled_;
+}
+
 void AudioCodec::SetOutputVolume(int volume) {
     output_volume_ = volume;
     ESP_LOGI(TAG, "Set output volume to %d", output_volume_);
@@ -27,6 +27,8 @@ public:
     virtual void OutputData(std::vector<int16_t>& data);
     virtual bool InputData(std::vector<int16_t>& data);
     virtual void Start();
+    // Frames sent by the output DMA and the time the last DMA buffer finished, false if not tracked
+    bool GetOutputClock(uint64_t& frames, int64_t& time_us);
 
     inline bool duplex() const { return duplex_; }
     inline bool input_reference() const { return input_reference_; }
@@ -52,6 +54,18 @@ protected:
     int output_channels_ = 1;
     int output_volume_ = 70;
 
+    // Updated by the I2S interrupt
+    portMUX_TYPE output_clock_lock_ = portMUX_INITIALIZER_UNLOCKED;
+    bool output_clock_enabled_ = false;
+    uint64_t output_sent_frames_ = 0;
+    int64_t output_sent_time_us_ = 0;
+    // Bytes of one output frame in the DMA buffer, 16 bit per channel if left at 0
+    size_t output_frame_bytes_ = 0;
+
+    // Codecs overriding Start() call this before enabling tx_handle_, or the uplink is not tagged for server AEC
+    void EnableOutputClock();
+    static bool IRAM_ATTR OnOutputSent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
+
     virtual int Read(int16_t* dest, int samples) = 0;
     virtual int Write(const int16_t* data, int samples) = 0;
 };
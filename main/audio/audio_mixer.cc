@@ -0,0 +1,135 @@
+#include "audio_mixer.h"
+
+#include <algorithm>
+
+static inline int16_t Saturate(int32_t value) {
+    return value > INT16_MAX ? INT16_MAX : (value < INT16_MIN ? INT16_MIN : value);
+}
+
+static inline int32_t PercentToGain(int percent) {
+    return std::clamp(percent, 0, 100) * AUDIO_MIXER_UNITY_GAIN / 100;
+}
+
+void AudioMixAdd(int16_t* dst, const int16_t* src, size_t samples, int32_t gain_from, int32_t gain_to) {
+    if (gain_from == AUDIO_MIXER_UNITY_GAIN && gain_to == AUDIO_MIXER_UNITY_GAIN) {
+        for (size_t i = 0; i < samples; i++) {
+            dst[i] = Saturate(dst[i] + src[i]);
+        }
+        return;
+    }
+    // The gain steps in Q23, so a ramp over a long block does not round to nothing
+    int32_t gain = gain_from << 8;
+    int32_t step = samples > 0 ? (gain_to - gain_from) * 256 / static_cast<int32_t>(samples) : 0;
+    for (size_t i = 0; i < samples; i++) {
+        dst[i] = Saturate(dst[i] + ((src[i] * (gain >> 8)) >> 15));
+        gain += step;
+    }
+}
+
+void AudioMixScale(int16_t* dst, size_t samples, int32_t gain_from, int32_t gain_to) {
+    int32_t gain = gain_from << 8;
+    int32_t step = samples > 0 ? (gain_to - gain_from) * 256 / static_cast<int32_t>(samples) : 0;
+    for (size_t i = 0; i < samples; i++) {
+        dst[i] = Saturate((dst[i] * (gain >> 8)) >> 15);
+        gain += step;
+    }
+}
+
+AudioMixer::AudioMixer() {
+}
+
+void AudioMixer::SetGain(AudioSourceId source, int percent) {
+    sources_[source].gain = PercentToGain(percent);
+}
+
+void AudioMixer::SetDuckGain(int percent) {
+    duck_gain_ = PercentToGain(percent);
+}
+
+void AudioMixer::Push(AudioSourceId source, std::vector<int16_t>&& pcm) {
+    if (pcm.empty()) {
+        return;
+    }
+    sources_[source].buffered += pcm.size();
+    sources_[source].chunks.push_back(std::move(pcm));
+}
+
+void AudioMixer::Reset(AudioSourceId source) {
+    auto& s = sources_[source];
+    s.chunks.clear();
+    s.offset = 0;
+    s.buffered = 0;
+    s.current_gain = s.gain;
+}
+
+bool AudioMixer::IsEmpty() const {
+    for (auto& source : sources_) {
+        if (source.buffered > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t AudioMixer::MixSource(Source& source, int16_t* dst, size_t samples, int32_t target_gain) {
+    size_t total = std::min(samples, source.buffered);
+    int32_t gain_delta = target_gain - source.current_gain;
+    size_t mixed = 0;
+    while (mixed < total) {
+        auto& chunk = source.chunks.front();
+        size_t n = std::min(total - mixed, chunk.size() - source.offset);
+        // The ramp spans the whole frame, each chunk takes its part of it
+        int32_t from = source.current_gain + gain_delta * static_cast<int32_t>(mixed) / static_cast<int32_t>(samples);
+        int32_t to = source.current_gain + gain_delta * static_cast<int32_t>(mixed + n) / static_cast<int32_t>(samples);
+        AudioMixAdd(dst + mixed, chunk.data() + source.offset, n, from, to);
+        mixed += n;
+        source.offset += n;
+        if (source.offset == chunk.size()) {
+            source.chunks.pop_front();
+            source.offset = 0;
+        }
+    }
+    source.buffered -= total;
+    source.current_gain = target_gain;
+    return total;
+}
+
+void AudioMixer::Mix(std::vector<int16_t>& pcm, bool voice, uint32_t pending_sources) {
+    auto& effect = sources_[kAudioSourceEffect];
+    bool effect_playing = effect.buffered > 0 || (pending_sources & (1 << kAudioSourceEffect));
+
+    auto& voice_source = sources_[kAudioSourceVoice];
+    if (voice && (voice_source.gain != AUDIO_MIXER_UNITY_GAIN || voice_source.current_gain != AUDIO_MIXER_UNITY_GAIN)) {
+        AudioMixScale(pcm.data(), pcm.size(), voice_source.current_gain, voice_source.gain);
+    }
+    voice_source.current_gain = voice_source.gain;
+
+    if (voice || effect_playing) {
+        duck_hangover_ = AUDIO_MIXER_DUCK_HANGOVER_FRAMES;
+    } else if (duck_hangover_ > 0) {
+        duck_hangover_--;
+    }
+    bool duck = duck_hangover_ > 0;
+
+    for (int i = kAudioSourceEffect; i < kAudioSourceCount; i++) {
+        auto& source = sources_[i];
+        int32_t target_gain = source.gain;
+        if (i == kAudioSourceStream && duck) {
+            target_gain = target_gain * duck_gain_ / AUDIO_MIXER_UNITY_GAIN;
+        }
+        if (source.buffered == 0) {
+            // Nothing was playing to ramp from
+            source.current_gain = target_gain;
+            // Still has packets to decode, the whole frame is silent for it
+            if (pending_sources & (1 << i)) {
+                source.underruns++;
+            }
+            continue;
+        }
+        size_t mixed = MixSource(source, pcm.data(), pcm.size(), target_gain);
+        // Ran dry in the middle of the frame while its decoder is behind, the rest of the frame is silent for it only
+        if (mixed < pcm.size() && (pending_sources & (1 << i))) {
+            source.underruns++;
+        }
+    }
+}
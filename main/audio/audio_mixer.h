@@ -0,0 +1,74 @@
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Output period when only effects or streams are playing, the voice plays in the frames it was decoded in
+#define AUDIO_MIXER_PERIOD_MS 20
+// Decoded ahead per source, more than a voice frame so an effect keeps up with the frames it is mixed into
+#define AUDIO_MIXER_BUFFER_MS 120
+
+// Output frames the stream stays ducked after the last voice or effect frame, so it does not pump
+// up in the short gaps between voice frames
+#define AUDIO_MIXER_DUCK_HANGOVER_FRAMES 10
+
+// Unity gain in Q15
+#define AUDIO_MIXER_UNITY_GAIN 32768
+
+enum AudioSourceId {
+    kAudioSourceVoice,   // Replies from the server, the frames the others are mixed into
+    kAudioSourceEffect,  // Sounds from PlaySound, played over the voice
+    kAudioSourceStream,  // Media from StreamPlayer, ducked under the voice and the effects
+    kAudioSourceCount,
+};
+
+// Saturating kernels, the Q15 gain ramps linearly from gain_from to gain_to over the block to avoid clicks
+void AudioMixAdd(int16_t* dst, const int16_t* src, size_t samples, int32_t gain_from, int32_t gain_to);
+void AudioMixScale(int16_t* dst, size_t samples, int32_t gain_from, int32_t gain_to);
+
+/*
+ * Mixes the decoded effects and streams into the output frames. Each source has its own buffer and gain,
+ * so a sound plays over the voice without waiting behind it or being flushed with it.
+ * Not thread safe, AudioService guards it with the queue mutex.
+ */
+class AudioMixer {
+public:
+    AudioMixer();
+
+    void SetGain(AudioSourceId source, int percent);
+    // Gain of the stream while the voice or an effect is playing
+    void SetDuckGain(int percent);
+
+    // PCM at the output rate
+    void Push(AudioSourceId source, std::vector<int16_t>&& pcm);
+    void Reset(AudioSourceId source);
+    size_t buffered(AudioSourceId source) const { return sources_[source].buffered; }
+    uint32_t underruns(AudioSourceId source) const { return sources_[source].underruns; }
+    bool IsEmpty() const;
+
+    // Mixes the buffered sources into pcm, which holds a voice frame or silence.
+    // pending_sources has a bit for each source with packets still to decode, running dry then is an underrun
+    void Mix(std::vector<int16_t>& pcm, bool voice, uint32_t pending_sources);
+
+private:
+    struct Source {
+        std::deque<std::vector<int16_t>> chunks;
+        size_t offset = 0;
+        size_t buffered = 0;
+        int32_t gain = AUDIO_MIXER_UNITY_GAIN;
+        // The gain applied at the end of the last frame, where the next ramp starts
+        int32_t current_gain = AUDIO_MIXER_UNITY_GAIN;
+        uint32_t underruns = 0;
+    };
+
+    Source sources_[kAudioSourceCount];
+    int32_t duck_gain_ = AUDIO_MIXER_UNITY_GAIN;
+    int duck_hangover_ = 0;
+
+    size_t MixSource(Source& source, int16_t* dst, size_t samples, int32_t target_gain);
+};
+
+#endif // AUDIO_MIXER_H
@@ -1,5 +1,7 @@
 #include "audio_service.h"
 #include <esp_log.h>
+#include <algorithm>
+#include <cstdlib>
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
@@ -34,22 +36,49 @@ void AudioService::Initialize(AudioCodec* codec) {
     codec_->Start();
 
     /* Setup the audio codec */
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_->SetComplexity(0);
+    int decode_sample_rate = GetDecodeSampleRate(16000);
+    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(decode_sample_rate, 1, OPUS_FRAME_DURATION_MS);
+    if (decode_sample_rate != codec->output_sample_rate()) {
+        output_resampler_.Configure(decode_sample_rate, codec->output_sample_rate());
+    }
+    opus_encoder_ = std::make_unique<AdaptiveOpusEncoder>(16000, 1, frame_duration_ms_);
+
+#if CONFIG_USE_AUDIO_MIXER
+    mixer_.SetGain(kAudioSourceEffect, CONFIG_AUDIO_MIXER_EFFECT_GAIN);
+    mixer_.SetGain(kAudioSourceStream, CONFIG_AUDIO_MIXER_STREAM_GAIN);
+    mixer_.SetDuckGain(CONFIG_AUDIO_MIXER_DUCK_GAIN);
+#endif
 
     if (codec->input_sample_rate() != 16000) {
         input_resampler_.Configure(codec->input_sample_rate(), 16000);
         reference_resampler_.Configure(codec->input_sample_rate(), 16000);
     }
 
-#if CONFIG_USE_AUDIO_PROCESSOR
+#if CONFIG_USE_SERVER_AEC
+    playback_clock_ = std::make_unique<PlaybackClock>(codec);
+#endif
+
+#if CONFIG_USE_AUDIO_DEBUGGER
+    audio_debugger_ = std::make_unique<AudioDebugger>();
+#endif
+
+#if CONFIG_USE_SHARED_AFE
+    // One AFE pipeline for both, it stays warm when switching between wake word and listening
+    afe_front_end_ = std::make_unique<AfeFrontEnd>();
+    audio_processor_ = std::make_unique<AfeAudioProcessor>(afe_front_end_.get());
+#elif CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_ = std::make_unique<AfeAudioProcessor>();
 #else
     audio_processor_ = std::make_unique<NoAudioProcessor>();
 #endif
 
-#if CONFIG_USE_AFE_WAKE_WORD
+#if CONFIG_USE_WAKE_WORD_ENERGY_GATE
+    energy_gate_ = std::make_unique<EnergyGate>(codec->input_channels(), 16000);
+#endif
+
+#if CONFIG_USE_SHARED_AFE
+    wake_word_ = std::make_unique<AfeWakeWord>(afe_front_end_.get());
+#elif CONFIG_USE_AFE_WAKE_WORD
     wake_word_ = std::make_unique<AfeWakeWord>();
 #elif CONFIG_USE_ESP_WAKE_WORD
     wake_word_ = std::make_unique<EspWakeWord>();
@@ -60,6 +89,15 @@ void AudioService::Initialize(AudioCodec* codec) {
 #endif
 
     audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
+        if (audio_debugger_) {
+            audio_debugger_->Feed(kAudioDebugTapProcessorOutput, data, 16000);
+        }
+#if CONFIG_USE_REALTIME_DTX
+        if (dtx_enabled_) {
+            GateDtxFrame(std::move(data));
+            return;
+        }
+#endif
         PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data));
     });
 
@@ -76,26 +114,60 @@ void AudioService::Initialize(AudioCodec* codec) {
                 callbacks_.on_wake_word_detected(wake_word);
             }
         });
+        wake_word_->OnVadStateChange([this](bool speaking) {
+            if (!speaking) {
+                return;
+            }
+            // A wake word candidate if the energy gate also saw the level rise above the noise floor,
+            // the wake up sound or the reply may play soon. Steady noise that trips the VAD does not power the amp.
+            if (energy_gate_open_ && !codec_->output_enabled()) {
+                xTaskNotify(audio_power_task_handle_, AS_POWER_OUTPUT_UP, eSetBits);
+            }
+            if (callbacks_.on_speech_candidate) {
+                callbacks_.on_speech_candidate();
+            }
+        });
     }
 
-    esp_timer_create_args_t audio_power_timer_args = {
+    /* The codec is switched over I2C, which takes too long for the shared esp_timer task */
+    xTaskCreate([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->AudioPowerTask();
+        vTaskDelete(NULL);
+    }, "audio_power", 2048 + 1024, this, 4, &audio_power_task_handle_);
+
+    esp_timer_create_args_t input_power_timer_args = {
+        .callback = [](void* arg) {
+            AudioService* audio_service = (AudioService*)arg;
+            xTaskNotify(audio_service->audio_power_task_handle_, AS_POWER_INPUT_DOWN, eSetBits);
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "input_power_timer",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&input_power_timer_args, &input_power_timer_);
+
+    esp_timer_create_args_t output_power_timer_args = {
         .callback = [](void* arg) {
             AudioService* audio_service = (AudioService*)arg;
-            audio_service->CheckAndUpdateAudioPowerState();
+            xTaskNotify(audio_service->audio_power_task_handle_, AS_POWER_OUTPUT_DOWN, eSetBits);
         },
         .arg = this,
         .dispatch_method = ESP_TIMER_TASK,
-        .name = "audio_power_timer",
+        .name = "output_power_timer",
         .skip_unhandled_events = true,
     };
-    esp_timer_create(&audio_power_timer_args, &audio_power_timer_);
+    esp_timer_create(&output_power_timer_args, &output_power_timer_);
 }
 
 void AudioService::Start() {
     service_stopped_ = false;
     xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING | AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING);
 
-    esp_timer_start_periodic(audio_power_timer_, 1000000);
+    // Nothing uses the paths the codec powered up with yet
+    ArmPowerTimer(input_power_timer_);
+    ArmPowerTimer(output_power_timer_);
 
 #if CONFIG_USE_AUDIO_PROCESSOR
     /* Start the audio input task */
@@ -136,7 +208,8 @@ void AudioService::Start() {
 }
 
 void AudioService::Stop() {
-    esp_timer_stop(audio_power_timer_);
+    esp_timer_stop(input_power_timer_);
+    esp_timer_stop(output_power_timer_);
     service_stopped_ = true;
     xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
         AS_EVENT_WAKE_WORD_RUNNING |
@@ -147,18 +220,28 @@ void AudioService::Stop() {
     audio_decode_queue_.clear();
     audio_playback_queue_.clear();
     audio_testing_queue_.clear();
+#if CONFIG_USE_AUDIO_MIXER
+    for (int i = kAudioSourceEffect; i < kAudioSourceCount; i++) {
+        mixer_inputs_[i].decode_queue.clear();
+        mixer_inputs_[i].generation++;
+        mixer_.Reset(static_cast<AudioSourceId>(i));
+    }
+#endif
     audio_queue_cv_.notify_all();
 }
 
 bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
-    if (!codec_->input_enabled()) {
-        codec_->EnableInput(true);
-        esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
+    {
+        // The power task leaves the input on until the read is done
+        std::lock_guard<std::mutex> power_lock(codec_power_mutex_);
+        SetCodecInput(true);
+        input_busy_ = true;
     }
 
     if (codec_->input_sample_rate() != sample_rate) {
         data.resize(samples * codec_->input_sample_rate() / sample_rate);
         if (!codec_->InputData(data)) {
+            input_busy_ = false;
             return false;
         }
         if (codec_->input_channels() == 2) {
@@ -185,26 +268,24 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
     } else {
         data.resize(samples);
         if (!codec_->InputData(data)) {
+            input_busy_ = false;
             return false;
         }
     }
+    input_busy_ = false;
 
-    /* Update the last input time */
-    last_input_time_ = std::chrono::steady_clock::now();
     debug_statistics_.input_count++;
 
-#if CONFIG_USE_AUDIO_DEBUGGER
-    // 音频调试：发送原始音频数据
-    if (audio_debugger_ == nullptr) {
-        audio_debugger_ = std::make_unique<AudioDebugger>();
+    if (audio_debugger_) {
+        audio_debugger_->Feed(kAudioDebugTapMicInput, data, sample_rate, codec_->input_channels());
     }
-    audio_debugger_->Feed(data);
-#endif
 
     return true;
 }
 
 void AudioService::AudioInputTask() {
+    // Reused for every wake word chunk, the engine and the energy gate copy what they keep
+    std::vector<int16_t> wake_word_data;
     while (true) {
         EventBits_t bits = xEventGroupWaitBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
             AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING,
@@ -215,19 +296,20 @@ void AudioService::AudioInputTask() {
         }
         if (audio_input_need_warmup_) {
             audio_input_need_warmup_ = false;
-            vTaskDelay(pdMS_TO_TICKS(120));
+            WarmUpInput();
             continue;
         }
 
         /* Used for audio testing in NetworkConfiguring mode by clicking the BOOT button */
         if (bits & AS_EVENT_AUDIO_TESTING_RUNNING) {
-            if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+            int frame_duration_ms = frame_duration_ms_;
+            if (audio_testing_queue_.size() >= (size_t)(AUDIO_TESTING_MAX_DURATION_MS / frame_duration_ms)) {
                 ESP_LOGW(TAG, "Audio testing queue is full, stopping audio testing");
                 EnableAudioTesting(false);
                 continue;
             }
             std::vector<int16_t> data;
-            int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
+            int samples = frame_duration_ms * 16000 / 1000;
             if (ReadAudioData(data, 16000, samples)) {
                 // If input channels is 2, we need to fetch the left channel data
                 if (codec_->input_channels() == 2) {
@@ -243,12 +325,28 @@ void AudioService::AudioInputTask() {
         }
 
         /* Feed the wake word */
-        if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
-            std::vector<int16_t> data;
+#if CONFIG_USE_SHARED_AFE
+        // Both read the shared front end, while voice processing runs it is fed below,
+        // in full and past the energy gate, with the capture clock kept
+        bool feed_wake_word = (bits & AS_EVENT_WAKE_WORD_RUNNING) && !(bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING);
+#else
+        bool feed_wake_word = bits & AS_EVENT_WAKE_WORD_RUNNING;
+#endif
+        if (feed_wake_word) {
             int samples = wake_word_->GetFeedSize();
             if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
-                    wake_word_->Feed(data);
+                if (ReadAudioData(wake_word_data, 16000, samples)) {
+                    if (energy_gate_) {
+                        if (energy_gate_reset_.exchange(false)) {
+                            energy_gate_->Reset();
+                        }
+                        energy_gate_->Process(wake_word_data, [this](const std::vector<int16_t>& chunk) {
+                            wake_word_->Feed(chunk);
+                        });
+                        energy_gate_open_ = energy_gate_->is_open();
+                    } else {
+                        wake_word_->Feed(wake_word_data);
+                    }
                     continue;
                 }
             }
@@ -260,6 +358,13 @@ void AudioService::AudioInputTask() {
             int samples = audio_processor_->GetFeedSize();
             if (samples > 0) {
                 if (ReadAudioData(data, 16000, samples)) {
+#if CONFIG_USE_SERVER_AEC
+                    {
+                        std::lock_guard<std::mutex> lock(capture_clock_mutex_);
+                        processor_input_frames_ += data.size() / codec_->input_channels();
+                        processor_input_time_us_ = esp_timer_get_time();
+                    }
+#endif
                     audio_processor_->Feed(std::move(data));
                     continue;
                 }
@@ -274,52 +379,93 @@ void AudioService::AudioInputTask() {
 }
 
 void AudioService::AudioOutputTask() {
+#if CONFIG_USE_AUDIO_MIXER
+    uint32_t playing_sources = 0;
+#endif
     while (true) {
         std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() { return !audio_playback_queue_.empty() || service_stopped_; });
+        audio_queue_cv_.wait(lock, [this]() { return HasPlaybackData() || service_stopped_; });
         if (service_stopped_) {
             break;
         }
 
-        auto task = std::move(audio_playback_queue_.front());
-        audio_playback_queue_.pop_front();
+        std::unique_ptr<AudioTask> task;
+        if (!audio_playback_queue_.empty()) {
+            task = std::move(audio_playback_queue_.front());
+            audio_playback_queue_.pop_front();
+        }
+#if CONFIG_USE_AUDIO_MIXER
+        bool voice = task != nullptr;
+        if (!voice) {
+            // Only effects or streams are playing, mix a period of them into silence
+            task = std::make_unique<AudioTask>();
+            task->type = kAudioTaskTypeDecodeToPlaybackQueue;
+            task->pcm.resize(codec_->output_sample_rate() * AUDIO_MIXER_PERIOD_MS / 1000);
+        }
+        uint32_t pending_sources = GetPendingSources();
+        mixer_.Mix(task->pcm, voice, pending_sources);
+        for (int i = kAudioSourceEffect; i < kAudioSourceCount; i++) {
+            auto source = static_cast<AudioSourceId>(i);
+            bool playing = mixer_.buffered(source) > 0 || (pending_sources & (1 << i));
+            if (!playing && (playing_sources & (1 << i))) {
+                ESP_LOGI(TAG, "Mixer source %d finished, %lu underruns in total", i, mixer_.underruns(source));
+            }
+            playing_sources = playing ? (playing_sources | (1 << i)) : (playing_sources & ~(1 << i));
+        }
+#endif
         audio_queue_cv_.notify_all();
         lock.unlock();
 
-        if (!codec_->output_enabled()) {
-            codec_->EnableOutput(true);
-            esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
+        esp_timer_stop(output_power_timer_);
+        if (audio_debugger_) {
+            audio_debugger_->Feed(kAudioDebugTapSpeakerOutput, task->pcm, codec_->output_sample_rate());
+        }
+        {
+            // The power timer may already have fired, the power task leaves the output on until the write is done
+            std::lock_guard<std::mutex> power_lock(codec_power_mutex_);
+            SetCodecOutput(true);
+            output_busy_ = true;
         }
+#if CONFIG_USE_SERVER_AEC
+        playback_clock_->OnWrite(task->timestamp, task->pcm.size());
+#endif
         codec_->OutputData(task->pcm);
-
-        /* Update the last output time */
-        last_output_time_ = std::chrono::steady_clock::now();
+        output_busy_ = false;
         debug_statistics_.playback_count++;
 
-#if CONFIG_USE_SERVER_AEC
-        /* Record the timestamp for server AEC */
-        if (task->timestamp > 0) {
-            lock.lock();
-            timestamp_queue_.push_back(task->timestamp);
+        /* Power down the output if nothing follows for a while */
+        lock.lock();
+        if (!HasPlaybackData()) {
+            ArmPowerTimer(output_power_timer_);
         }
-#endif
     }
 
     ESP_LOGW(TAG, "Audio output task stopped");
 }
 
 void AudioService::OpusCodecTask() {
+    bool encoder_dtx = false;
     while (true) {
         std::unique_lock<std::mutex> lock(audio_queue_mutex_);
         audio_queue_cv_.wait(lock, [this]() {
             return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
+                (!audio_encode_queue_.empty() && audio_send_queue_.size() < max_send_packets_) ||
+#if CONFIG_USE_AUDIO_MIXER
+                GetMixerSourceToDecode() >= 0 ||
+#endif
                 (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
         });
         if (service_stopped_) {
             break;
         }
 
+#if CONFIG_USE_AUDIO_MIXER
+        /* Decode the effects and streams, a packet of each that needs one */
+        for (int source = GetMixerSourceToDecode(); source >= 0; source = GetMixerSourceToDecode()) {
+            DecodeMixerSource(lock, static_cast<AudioSourceId>(source));
+        }
+#endif
+
         /* Decode the audio from decode queue */
         if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
             auto packet = std::move(audio_decode_queue_.front());
@@ -331,8 +477,11 @@ void AudioService::OpusCodecTask() {
             task->type = kAudioTaskTypeDecodeToPlaybackQueue;
             task->timestamp = packet->timestamp;
 
-            SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
+            SetDecodeSampleRate(opus_decoder_, output_resampler_, packet->sample_rate, packet->frame_duration);
             if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
+                if (audio_debugger_) {
+                    audio_debugger_->Feed(kAudioDebugTapDecoderOutput, task->pcm, opus_decoder_->sample_rate());
+                }
                 // Resample if the sample rate is different
                 if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
                     int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
@@ -343,6 +492,7 @@ void AudioService::OpusCodecTask() {
 
                 lock.lock();
                 audio_playback_queue_.push_back(std::move(task));
+                debug_statistics_.max_playback_queue_size = std::max<uint32_t>(debug_statistics_.max_playback_queue_size, audio_playback_queue_.size());
                 audio_queue_cv_.notify_all();
             } else {
                 ESP_LOGE(TAG, "Failed to decode audio");
@@ -352,14 +502,26 @@ void AudioService::OpusCodecTask() {
         }
         
         /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
+        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < max_send_packets_) {
             auto task = std::move(audio_encode_queue_.front());
             audio_encode_queue_.pop_front();
             audio_queue_cv_.notify_all();
             lock.unlock();
 
+            // Opus DTX sends comfort noise frames instead of encoding background noise in full
+            if (encoder_dtx != dtx_enabled_) {
+                encoder_dtx = dtx_enabled_;
+                opus_encoder_->SetDtx(encoder_dtx);
+            }
+            // The frames carry the duration negotiated for the session, follow it
+            int frame_duration_ms = task->pcm.size() * 1000 / 16000;
+            if (frame_duration_ms != opus_encoder_->duration_ms()) {
+                ESP_LOGI(TAG, "Encoder frame duration %d ms -> %d ms", opus_encoder_->duration_ms(), frame_duration_ms);
+                opus_encoder_->SetDuration(frame_duration_ms);
+            }
+
             auto packet = std::make_unique<AudioStreamPacket>();
-            packet->frame_duration = OPUS_FRAME_DURATION_MS;
+            packet->frame_duration = frame_duration_ms;
             packet->sample_rate = 16000;
             packet->timestamp = task->timestamp;
             if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
@@ -367,10 +529,30 @@ void AudioService::OpusCodecTask() {
                 continue;
             }
 
+            debug_statistics_.total_encode_us += opus_encoder_->last_encode_us();
+            debug_statistics_.max_encode_us = std::max(debug_statistics_.max_encode_us, opus_encoder_->last_encode_us());
+
             if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+                if (encoder_dtx) {
+                    if (task->silence) {
+                        debug_statistics_.dtx_silence_packets++;
+                        debug_statistics_.dtx_silence_bytes += packet->payload.size();
+                    } else {
+                        debug_statistics_.dtx_speech_packets++;
+                        debug_statistics_.dtx_speech_bytes += packet->payload.size();
+                    }
+                }
+                size_t send_queue_size;
                 {
                     std::lock_guard<std::mutex> lock(audio_queue_mutex_);
                     audio_send_queue_.push_back(std::move(packet));
+                    send_queue_size = audio_send_queue_.size();
+                    debug_statistics_.max_send_queue_size = std::max<uint32_t>(debug_statistics_.max_send_queue_size, send_queue_size);
+                }
+                int level = opus_encoder_->level();
+                opus_encoder_->OnFrameQueued(send_queue_size);
+                if (opus_encoder_->level() != level) {
+                    debug_statistics_.encoder_level_changes++;
                 }
                 if (callbacks_.on_send_queue_available) {
                     callbacks_.on_send_queue_available();
@@ -387,58 +569,319 @@ void AudioService::OpusCodecTask() {
     ESP_LOGW(TAG, "Opus codec task stopped");
 }
 
-void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
-    if (opus_decoder_->sample_rate() == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
+static bool IsOpusSampleRate(int sample_rate) {
+    return sample_rate == 8000 || sample_rate == 12000 || sample_rate == 16000 ||
+        sample_rate == 24000 || sample_rate == 48000;
+}
+
+int AudioService::GetDecodeSampleRate(int stream_sample_rate) const {
+    // Opus decodes a stream of any rate at any of its own rates, so decode straight at the codec rate if possible
+    if (IsOpusSampleRate(codec_->output_sample_rate())) {
+        return codec_->output_sample_rate();
+    }
+    return stream_sample_rate;
+}
+
+void AudioService::SetDecodeSampleRate(std::unique_ptr<OpusDecoderWrapper>& decoder, OpusResampler& resampler,
+    int sample_rate, int frame_duration) {
+    int decode_sample_rate = GetDecodeSampleRate(sample_rate);
+    if (decoder && decoder->sample_rate() == decode_sample_rate && decoder->duration_ms() == frame_duration) {
         return;
     }
 
-    opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    decoder.reset();
+    decoder = std::make_unique<OpusDecoderWrapper>(decode_sample_rate, 1, frame_duration);
 
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+    if (decode_sample_rate != codec_->output_sample_rate()) {
+        ESP_LOGI(TAG, "Resampling audio from %d to %d", decode_sample_rate, codec_->output_sample_rate());
+        resampler.Configure(decode_sample_rate, codec_->output_sample_rate());
     }
 }
 
-void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
+bool AudioService::HasPlaybackData() {
+#if CONFIG_USE_AUDIO_MIXER
+    // A source is ready with a period decoded, or with the tail of it once nothing is left to decode
+    size_t period = codec_->output_sample_rate() * AUDIO_MIXER_PERIOD_MS / 1000;
+    for (int i = kAudioSourceEffect; i < kAudioSourceCount; i++) {
+        size_t buffered = mixer_.buffered(static_cast<AudioSourceId>(i));
+        if (buffered >= period || (buffered > 0 && mixer_inputs_[i].decode_queue.empty())) {
+            return true;
+        }
+    }
+#endif
+    return !audio_playback_queue_.empty();
+}
+
+#if CONFIG_USE_AUDIO_MIXER
+int AudioService::GetMixerSourceToDecode() {
+    size_t max_buffered = codec_->output_sample_rate() * AUDIO_MIXER_BUFFER_MS / 1000;
+    for (int i = kAudioSourceEffect; i < kAudioSourceCount; i++) {
+        if (!mixer_inputs_[i].decode_queue.empty() && mixer_.buffered(static_cast<AudioSourceId>(i)) < max_buffered) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void AudioService::DecodeMixerSource(std::unique_lock<std::mutex>& lock, AudioSourceId source) {
+    auto& input = mixer_inputs_[source];
+    auto packet = std::move(input.decode_queue.front());
+    input.decode_queue.pop_front();
+    uint32_t generation = input.generation;
+    bool reset_decoder = input.reset_decoder;
+    input.reset_decoder = false;
+    audio_queue_cv_.notify_all();
+    lock.unlock();
+
+    // Only this task touches the decoder, so it is used without the lock
+    std::vector<int16_t> pcm;
+    SetDecodeSampleRate(input.decoder, input.resampler, packet->sample_rate, packet->frame_duration);
+    if (reset_decoder) {
+        input.decoder->ResetState();
+    }
+    bool decoded = input.decoder->Decode(std::move(packet->payload), pcm);
+    if (decoded && input.decoder->sample_rate() != codec_->output_sample_rate()) {
+        std::vector<int16_t> resampled(input.resampler.GetOutputSamples(pcm.size()));
+        input.resampler.Process(pcm.data(), pcm.size(), resampled.data());
+        pcm = std::move(resampled);
+    }
+    if (!decoded) {
+        ESP_LOGE(TAG, "Failed to decode audio of mixer source %d", source);
+    }
+
+    lock.lock();
+    if (decoded && generation == input.generation) {
+        mixer_.Push(source, std::move(pcm));
+        audio_queue_cv_.notify_all();
+    }
+    debug_statistics_.decode_count++;
+}
+
+uint32_t AudioService::GetPendingSources() {
+    uint32_t pending = 0;
+    for (int i = kAudioSourceEffect; i < kAudioSourceCount; i++) {
+        if (!mixer_inputs_[i].decode_queue.empty()) {
+            pending |= 1 << i;
+        }
+    }
+    return pending;
+}
+#endif
+
+std::unique_ptr<AudioTask> AudioService::CreateEncodeTask(AudioTaskType type, std::vector<int16_t>&& pcm) {
     auto task = std::make_unique<AudioTask>();
     task->type = type;
     task->pcm = std::move(pcm);
-    
-    /* Push the task to the encode queue */
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
 
-    /* If the task is to send queue, we need to set the timestamp */
-    if (type == kAudioTaskTypeEncodeToSendQueue && !timestamp_queue_.empty()) {
-        if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
-            task->timestamp = timestamp_queue_.front();
-        } else {
-            ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+#if CONFIG_USE_SERVER_AEC
+    /* Tag the frame with the timestamp of the audio the speaker was playing when its first sample was captured */
+    if (type == kAudioTaskTypeEncodeToSendQueue) {
+        int64_t capture_time_us;
+        {
+            std::lock_guard<std::mutex> lock(capture_clock_mutex_);
+            capture_time_us = processor_input_time_us_ -
+                (int64_t)(processor_input_frames_ - processor_output_frames_) * 1000000 / 16000;
+            processor_output_frames_ += task->pcm.size();
         }
-        timestamp_queue_.pop_front();
+        task->timestamp = playback_clock_->GetTimestamp(capture_time_us);
     }
+#endif
+    return task;
+}
 
+void AudioService::PushTaskToEncodeQueue(std::unique_ptr<AudioTask> task) {
+    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
     audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
     audio_encode_queue_.push_back(std::move(task));
     audio_queue_cv_.notify_all();
 }
 
+void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
+    PushTaskToEncodeQueue(CreateEncodeTask(type, std::move(pcm)));
+}
+
+void AudioService::GateDtxFrame(std::vector<int16_t>&& pcm) {
+    auto task = CreateEncodeTask(kAudioTaskTypeEncodeToSendQueue, std::move(pcm));
+    if (dtx_reset_.exchange(false)) {
+        // Start every session in speech, so the first words are never gated
+        dtx_frame_duration_ms_ = task->pcm.size() * 1000 / 16000;
+        dtx_hangover_frames_ = DTX_HANGOVER_MS / dtx_frame_duration_ms_;
+        dtx_silence_frames_ = 0;
+        dtx_preroll_.clear();
+    }
+    if (voice_detected_) {
+        dtx_hangover_frames_ = DTX_HANGOVER_MS / dtx_frame_duration_ms_;
+    }
+
+    if (dtx_hangover_frames_ > 0) {
+        // Speech, or the hangover after it, the frames held back cover the onset the VAD reports late
+        if (!voice_detected_) {
+            dtx_hangover_frames_--;
+        }
+        while (!dtx_preroll_.empty()) {
+            auto& preroll = dtx_preroll_.front();
+            preroll->silence = false;
+            debug_statistics_.dtx_speech_ms += dtx_frame_duration_ms_;
+            PushTaskToEncodeQueue(std::move(preroll));
+            dtx_preroll_.pop_front();
+        }
+        debug_statistics_.dtx_speech_ms += dtx_frame_duration_ms_;
+        dtx_silence_frames_ = 0;
+        PushTaskToEncodeQueue(std::move(task));
+        return;
+    }
+
+    // Silence, send a keepalive frame now and then so the server keeps the stream alive
+    task->silence = true;
+    if (++dtx_silence_frames_ >= DTX_KEEPALIVE_MS / dtx_frame_duration_ms_) {
+        dtx_silence_frames_ = 0;
+        debug_statistics_.dtx_silence_ms += (dtx_preroll_.size() + 1) * dtx_frame_duration_ms_;
+        dtx_preroll_.clear();
+        PushTaskToEncodeQueue(std::move(task));
+        return;
+    }
+    dtx_preroll_.push_back(std::move(task));
+    if (dtx_preroll_.size() > (size_t)(DTX_PREROLL_MS / dtx_frame_duration_ms_)) {
+        dtx_preroll_.pop_front();
+        debug_statistics_.dtx_silence_ms += dtx_frame_duration_ms_;
+    }
+}
+
+void AudioService::EnableDtx(bool enable) {
+    if (dtx_enabled_ == enable) {
+        return;
+    }
+    ESP_LOGI(TAG, "%s realtime DTX", enable ? "Enabling" : "Disabling");
+    if (!enable) {
+        LogDtxStatistics();
+    }
+    // The gate runs in the audio processor task, reset it there
+    dtx_reset_ = true;
+    dtx_enabled_ = enable;
+}
+
+void AudioService::LogDtxStatistics() {
+    auto& stats = debug_statistics_;
+    auto log = [](const char* name, uint32_t duration_ms, uint32_t packets, uint32_t bytes) {
+        if (duration_ms == 0) {
+            return;
+        }
+        ESP_LOGI(TAG, "DTX %s: %lu s, %lu bits/min, %lu packets/min", name, duration_ms / 1000,
+            (uint32_t)((uint64_t)bytes * 8 * 60000 / duration_ms), (uint32_t)((uint64_t)packets * 60000 / duration_ms));
+    };
+    log("speech", stats.dtx_speech_ms, stats.dtx_speech_packets, stats.dtx_speech_bytes);
+    log("silence", stats.dtx_silence_ms, stats.dtx_silence_packets, stats.dtx_silence_bytes);
+}
+
+void AudioService::SetFrameDuration(int frame_duration_ms, int server_frame_duration_ms) {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    if (server_frame_duration_ms > 0) {
+        max_decode_packets_ = MAX_DECODE_QUEUE_DURATION_MS / server_frame_duration_ms;
+    }
+    if (frame_duration_ms != 20 && frame_duration_ms != 40 && frame_duration_ms != 60) {
+        ESP_LOGW(TAG, "Unsupported frame duration %d ms", frame_duration_ms);
+    } else if (frame_duration_ms_ != frame_duration_ms) {
+        ESP_LOGI(TAG, "Uplink frame duration: %d ms", frame_duration_ms);
+        frame_duration_ms_ = frame_duration_ms;
+        max_send_packets_ = MAX_SEND_QUEUE_DURATION_MS / frame_duration_ms;
+    }
+    audio_queue_cv_.notify_all();
+}
+
 bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
     std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
+    if (audio_decode_queue_.size() >= max_decode_packets_) {
         if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
+            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < max_decode_packets_; });
         } else {
             return false;
         }
     }
     audio_decode_queue_.push_back(std::move(packet));
+    debug_statistics_.max_decode_queue_size = std::max<uint32_t>(debug_statistics_.max_decode_queue_size, audio_decode_queue_.size());
+    audio_queue_cv_.notify_all();
+    return true;
+}
+
+bool AudioService::IsDecodeQueueFull() {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    return audio_decode_queue_.size() >= max_decode_packets_;
+}
+
+#if CONFIG_USE_AUDIO_MIXER
+bool AudioService::PushPacketToSource(AudioSourceId source, std::unique_ptr<AudioStreamPacket> packet, bool wait) {
+    if (source == kAudioSourceVoice) {
+        return PushPacketToDecodeQueue(std::move(packet), wait);
+    }
+    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
+    auto& input = mixer_inputs_[source];
+    if (packet->frame_duration > 0) {
+        input.max_packets = MAX_DECODE_QUEUE_DURATION_MS / packet->frame_duration;
+    }
+    if (input.decode_queue.size() >= input.max_packets) {
+        if (!wait) {
+            return false;
+        }
+        // A reset or a stop releases the waiting sender too
+        uint32_t generation = input.generation;
+        audio_queue_cv_.wait(lock, [this, &input, generation]() {
+            return service_stopped_ || input.generation != generation || input.decode_queue.size() < input.max_packets;
+        });
+        if (service_stopped_ || input.generation != generation) {
+            return false;
+        }
+    }
+    input.decode_queue.push_back(std::move(packet));
     audio_queue_cv_.notify_all();
     return true;
 }
 
+bool AudioService::IsSourceQueueFull(AudioSourceId source) {
+    if (source == kAudioSourceVoice) {
+        return IsDecodeQueueFull();
+    }
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    return mixer_inputs_[source].decode_queue.size() >= mixer_inputs_[source].max_packets;
+}
+
+void AudioService::ResetSource(AudioSourceId source) {
+    if (source == kAudioSourceVoice) {
+        ResetDecoder();
+        return;
+    }
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    auto& input = mixer_inputs_[source];
+    input.decode_queue.clear();
+    input.reset_decoder = true;
+    input.generation++;
+    mixer_.Reset(source);
+    audio_queue_cv_.notify_all();
+}
+#endif
+
+void AudioService::WaitForPlaybackQueueEmpty() {
+    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
+    audio_queue_cv_.wait(lock, [this]() {
+        if (service_stopped_) {
+            return true;
+        }
+#if CONFIG_USE_AUDIO_MIXER
+        // Effects and streams play from the mixer, not the playback queue
+        if (GetPendingSources() != 0 || !mixer_.IsEmpty()) {
+            return false;
+        }
+#endif
+        return audio_decode_queue_.empty() && audio_playback_queue_.empty();
+    });
+}
+
+void AudioService::OnSendAudioFailed() {
+    debug_statistics_.send_failures++;
+    if (opus_encoder_) {
+        opus_encoder_->OnSendFailed();
+    }
+}
+
 std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
     std::lock_guard<std::mutex> lock(audio_queue_mutex_);
     if (audio_send_queue_.empty()) {
@@ -452,7 +895,7 @@ std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
 
 void AudioService::EncodeWakeWord() {
     if (wake_word_) {
-        wake_word_->EncodeWakeWordData();
+        wake_word_->EncodeWakeWordData(frame_duration_ms_);
     }
 }
 
@@ -483,30 +926,55 @@ void AudioService::EnableWakeWordDetection(bool enable) {
             wake_word_initialized_ = true;
         }
         wake_word_->Start();
+        energy_gate_reset_ = true;
         xEventGroupSetBits(event_group_, AS_EVENT_WAKE_WORD_RUNNING);
     } else {
         wake_word_->Stop();
         xEventGroupClearBits(event_group_, AS_EVENT_WAKE_WORD_RUNNING);
+        if (energy_gate_) {
+            uint32_t total = energy_gate_->passed_chunks() + energy_gate_->gated_chunks();
+            ESP_LOGI(TAG, "Energy gate skipped %lu of %lu wake word chunks", energy_gate_->gated_chunks(), total);
+        }
     }
+    UpdateInputPowerTimer();
 }
 
 void AudioService::EnableVoiceProcessing(bool enable) {
     ESP_LOGD(TAG, "%s voice processing", enable ? "Enabling" : "Disabling");
     if (enable) {
         if (!audio_processor_initialized_) {
-            audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS);
+            audio_processor_->Initialize(codec_, frame_duration_ms_);
             audio_processor_initialized_ = true;
+        } else {
+            audio_processor_->SetFrameDuration(frame_duration_ms_);
         }
 
         /* We should make sure no audio is playing */
         ResetDecoder();
+#if CONFIG_USE_SERVER_AEC
+        {
+            std::lock_guard<std::mutex> lock(capture_clock_mutex_);
+            processor_input_frames_ = 0;
+            processor_output_frames_ = 0;
+        }
+#endif
+#if CONFIG_USE_SHARED_AFE
+        // The shared pipeline has been fed by the wake word until now, there is nothing stale to drop
+        audio_input_need_warmup_ = !IsWakeWordRunning();
+#else
         audio_input_need_warmup_ = true;
+#endif
         audio_processor_->Start();
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
     } else {
         audio_processor_->Stop();
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
+#if CONFIG_USE_SHARED_AFE
+        // The gate was bypassed meanwhile, its noise floor is stale
+        energy_gate_reset_ = true;
+#endif
     }
+    UpdateInputPowerTimer();
 }
 
 void AudioService::EnableAudioTesting(bool enable) {
@@ -520,6 +988,7 @@ void AudioService::EnableAudioTesting(bool enable) {
         audio_decode_queue_ = std::move(audio_testing_queue_);
         audio_queue_cv_.notify_all();
     }
+    UpdateInputPowerTimer();
 }
 
 void AudioService::EnableDeviceAec(bool enable) {
@@ -546,36 +1015,161 @@ void AudioService::PlaySound(const std::string_view& sound) {
         memcpy(packet->payload.data(), p3->payload, payload_size);
         p += payload_size;
 
+#if CONFIG_USE_AUDIO_MIXER
+        // Played over the voice, and not cleared when the voice is reset
+        PushPacketToSource(kAudioSourceEffect, std::move(packet), true);
+#else
         PushPacketToDecodeQueue(std::move(packet), true);
+#endif
     }
 }
 
 bool AudioService::IsIdle() {
     std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+#if CONFIG_USE_AUDIO_MIXER
+    if (GetPendingSources() != 0 || !mixer_.IsEmpty()) {
+        return false;
+    }
+#endif
     return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
 }
 
 void AudioService::ResetDecoder() {
     std::lock_guard<std::mutex> lock(audio_queue_mutex_);
     opus_decoder_->ResetState();
-    timestamp_queue_.clear();
     audio_decode_queue_.clear();
     audio_playback_queue_.clear();
     audio_testing_queue_.clear();
     audio_queue_cv_.notify_all();
 }
 
-void AudioService::CheckAndUpdateAudioPowerState() {
-    auto now = std::chrono::steady_clock::now();
-    auto input_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_input_time_).count();
-    auto output_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_output_time_).count();
-    if (input_elapsed > AUDIO_POWER_TIMEOUT_MS && codec_->input_enabled()) {
-        codec_->EnableInput(false);
+void AudioService::AudioPowerTask() {
+    while (true) {
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+
+        if (events & AS_POWER_INPUT_DOWN) {
+            std::unique_lock<std::mutex> lock(codec_power_mutex_);
+            if (!input_busy_) {
+                SetCodecInput(false);
+            } else {
+                // Read since the timer fired, check again once the input is unused
+                lock.unlock();
+                UpdateInputPowerTimer();
+            }
+        }
+        if (events & AS_POWER_OUTPUT_DOWN) {
+            // The output task arms the timer again after the write if nothing follows
+            std::lock_guard<std::mutex> lock(codec_power_mutex_);
+            if (!output_busy_) {
+                SetCodecOutput(false);
+            }
+        }
+        if (events & AS_POWER_OUTPUT_UP) {
+            PrepareAudioPath(false, true);
+        }
     }
-    if (output_elapsed > AUDIO_POWER_TIMEOUT_MS && codec_->output_enabled()) {
-        codec_->EnableOutput(false);
+}
+
+void AudioService::EnableCodecInput(bool enable) {
+    std::lock_guard<std::mutex> lock(codec_power_mutex_);
+    SetCodecInput(enable);
+}
+
+void AudioService::SetCodecInput(bool enable) {
+    if (codec_->input_enabled() == enable) {
+        return;
     }
-    if (!codec_->input_enabled() && !codec_->output_enabled()) {
-        esp_timer_stop(audio_power_timer_);
+    auto start_time = esp_timer_get_time();
+    codec_->EnableInput(enable);
+    if (enable) {
+        input_powered_up_ = true;
+        ESP_LOGI(TAG, "Input powered up in %lld ms", (esp_timer_get_time() - start_time) / 1000);
     }
-}
\ No newline at end of file
+}
+
+void AudioService::EnableCodecOutput(bool enable) {
+    std::lock_guard<std::mutex> lock(codec_power_mutex_);
+    SetCodecOutput(enable);
+}
+
+void AudioService::SetCodecOutput(bool enable) {
+    if (codec_->output_enabled() == enable) {
+        return;
+    }
+    auto start_time = esp_timer_get_time();
+    codec_->EnableOutput(enable);
+    if (enable) {
+        ESP_LOGI(TAG, "Output powered up in %lld ms", (esp_timer_get_time() - start_time) / 1000);
+    }
+}
+
+void AudioService::ArmPowerTimer(esp_timer_handle_t timer) {
+    esp_timer_stop(timer);
+    esp_timer_start_once(timer, AUDIO_POWER_TIMEOUT_MS * 1000);
+}
+
+void AudioService::UpdateInputPowerTimer() {
+    if (xEventGroupGetBits(event_group_) & (AS_EVENT_AUDIO_TESTING_RUNNING | AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING)) {
+        esp_timer_stop(input_power_timer_);
+    } else if (codec_->input_enabled()) {
+        ArmPowerTimer(input_power_timer_);
+    }
+}
+
+void AudioService::PrepareAudioPath(bool input, bool output) {
+    if (input && !codec_->input_enabled()) {
+        EnableCodecInput(true);
+        UpdateInputPowerTimer();
+    }
+    if (output && !codec_->output_enabled()) {
+        EnableCodecOutput(true);
+        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+        if (!HasPlaybackData()) {
+            ArmPowerTimer(output_power_timer_);
+        }
+    }
+}
+
+void AudioService::WarmUpInput() {
+    // Reads return at once while they drain the samples buffered before the start, then at the pace of the microphone.
+    // After powering up, also wait for the level to settle instead of sleeping a fixed time.
+    int samples = AUDIO_INPUT_WARMUP_CHUNK_MS * 16000 / 1000 * codec_->input_channels();
+    std::vector<int16_t> data;
+    auto start_time = esp_timer_get_time();
+    int dropped = 0;
+    int stable_chunks = 0;
+    int64_t last_level = -1;
+    bool powered_up = input_powered_up_;
+    input_powered_up_ = false;
+
+    while (esp_timer_get_time() - start_time < AUDIO_INPUT_WARMUP_MAX_MS * 1000) {
+        auto read_time = esp_timer_get_time();
+        if (!ReadAudioData(data, 16000, samples)) {
+            break;
+        }
+        dropped++;
+        if (esp_timer_get_time() - read_time < AUDIO_INPUT_WARMUP_CHUNK_MS * 1000 / 2) {
+            continue;
+        }
+        if (!powered_up) {
+            break;
+        }
+
+        int64_t level = 0;
+        for (auto sample : data) {
+            level += std::abs(sample);
+        }
+        level /= data.size();
+        if (last_level >= 0 && std::abs(level - last_level) <= std::max(level, last_level) / 4 + 16) {
+            if (++stable_chunks >= 3) {
+                break;
+            }
+        } else {
+            stable_chunks = 0;
+        }
+        last_level = level;
+    }
+    ESP_LOGI(TAG, "Input warm-up took %lld ms, %d chunks dropped%s", (esp_timer_get_time() - start_time) / 1000,
+        dropped, powered_up ? " after power up" : "");
+}
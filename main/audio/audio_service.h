@@ -6,6 +6,7 @@
 #include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -17,11 +18,22 @@
 #include <opus_resampler.h>
 
 #include "audio_codec.h"
+#include "adaptive_opus_encoder.h"
+#include "playback_clock.h"
+#include "energy_gate.h"
 #include "audio_processor.h"
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
 #include "protocol.h"
 
+#if CONFIG_USE_SHARED_AFE
+#include "processors/afe_front_end.h"
+#endif
+
+#if CONFIG_USE_AUDIO_MIXER
+#include "audio_mixer.h"
+#endif
+
 
 /*
  * There are two types of audio data flow:
@@ -32,18 +44,28 @@
  * 
  * Decode Queue and Send Queue are the main queues, because Opus packets are quite smaller than PCM packets.
  * 
+ * With the mixer, effects and streams have a decode queue and a decoder each, their PCM is mixed into
+ * the playback frames by the output task: (PlaySound / StreamPlayer) -> {Source Queue} -> [Opus Decoder] -> [Mixer]
  */
 
-#define OPUS_FRAME_DURATION_MS 60
+// The preferred uplink frame duration, the one used for a session is negotiated in the hello message
+#define OPUS_FRAME_DURATION_MS CONFIG_OPUS_FRAME_DURATION_MS
 #define MAX_ENCODE_TASKS_IN_QUEUE 2
 #define MAX_PLAYBACK_TASKS_IN_QUEUE 2
-#define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
-#define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+// The Opus queues hold the same duration of audio whatever the frame duration is
+#define MAX_DECODE_QUEUE_DURATION_MS 2400
+#define MAX_SEND_QUEUE_DURATION_MS 2400
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
-#define MAX_TIMESTAMPS_IN_QUEUE 3
+
+// Realtime DTX: keep sending after the VAD falls, hold back frames before the onset, one keepalive frame in silence
+#define DTX_HANGOVER_MS 600
+#define DTX_PREROLL_MS 120
+#define DTX_KEEPALIVE_MS 1200
 
 #define AUDIO_POWER_TIMEOUT_MS 15000
-#define AUDIO_POWER_CHECK_INTERVAL_MS 1000
+// Input warm-up: drop the samples buffered before the start, and the transient after powering up the ADC
+#define AUDIO_INPUT_WARMUP_CHUNK_MS 10
+#define AUDIO_INPUT_WARMUP_MAX_MS 200
 
 
 #define AS_EVENT_AUDIO_TESTING_RUNNING      (1 << 0)
@@ -51,10 +73,16 @@
 #define AS_EVENT_AUDIO_PROCESSOR_RUNNING    (1 << 2)
 #define AS_EVENT_PLAYBACK_NOT_EMPTY         (1 << 3)
 
+// Notification bits of the codec power task
+#define AS_POWER_INPUT_DOWN                 (1 << 0)
+#define AS_POWER_OUTPUT_DOWN                (1 << 1)
+#define AS_POWER_OUTPUT_UP                  (1 << 2)
+
 struct AudioServiceCallbacks {
     std::function<void(void)> on_send_queue_available;
     std::function<void(const std::string&)> on_wake_word_detected;
     std::function<void(bool)> on_vad_change;
+    std::function<void(void)> on_speech_candidate;
     std::function<void(void)> on_audio_testing_queue_full;
 };
 
@@ -68,7 +96,8 @@ enum AudioTaskType {
 struct AudioTask {
     AudioTaskType type;
     std::vector<int16_t> pcm;
-    uint32_t timestamp;
+    uint32_t timestamp = 0;
+    bool silence = false;
 };
 
 struct DebugStatistics {
@@ -76,6 +105,19 @@ struct DebugStatistics {
     uint32_t decode_count = 0;
     uint32_t encode_count = 0;
     uint32_t playback_count = 0;
+    uint32_t max_decode_queue_size = 0;
+    uint32_t max_playback_queue_size = 0;
+    uint32_t max_send_queue_size = 0;
+    int64_t total_encode_us = 0;
+    int64_t max_encode_us = 0;
+    uint32_t encoder_level_changes = 0;
+    uint32_t send_failures = 0;
+    uint32_t dtx_speech_ms = 0;
+    uint32_t dtx_speech_packets = 0;
+    uint32_t dtx_speech_bytes = 0;
+    uint32_t dtx_silence_ms = 0;
+    uint32_t dtx_silence_packets = 0;
+    uint32_t dtx_silence_bytes = 0;
 };
 
 class AudioService {
@@ -98,22 +140,47 @@ public:
     void EnableVoiceProcessing(bool enable);
     void EnableAudioTesting(bool enable);
     void EnableDeviceAec(bool enable);
+    // Power up the codec paths ahead of predicted use, they power down again if nothing uses them
+    void PrepareAudioPath(bool input, bool output);
+    void EnableDtx(bool enable);
+    // Frame durations of the session: the uplink one (20, 40 or 60 ms) is applied when voice processing starts,
+    // the server one sizes the decode queue
+    void SetFrameDuration(int frame_duration_ms, int server_frame_duration_ms);
+    int GetFrameDuration() const { return frame_duration_ms_; }
 
     void SetCallbacks(AudioServiceCallbacks& callbacks);
 
     bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
+    bool IsDecodeQueueFull();
+    void WaitForPlaybackQueueEmpty();
     std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
     void PlaySound(const std::string_view& sound);
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
+#if CONFIG_USE_AUDIO_MIXER
+    // Effects and streams, ResetDecoder only clears the voice
+    bool PushPacketToSource(AudioSourceId source, std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
+    bool IsSourceQueueFull(AudioSourceId source);
+    void ResetSource(AudioSourceId source);
+#endif
+    void OnSendAudioFailed();
+    int GetEncoderLevel() const { return opus_encoder_ ? opus_encoder_->level() : 0; }
+    const DebugStatistics& GetDebugStatistics() const { return debug_statistics_; }
+    void ResetDebugStatistics() { debug_statistics_ = DebugStatistics(); }
 
 private:
     AudioCodec* codec_ = nullptr;
     AudioServiceCallbacks callbacks_;
+#if CONFIG_USE_SHARED_AFE
+    std::unique_ptr<AfeFrontEnd> afe_front_end_;
+#endif
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<WakeWord> wake_word_;
+    std::unique_ptr<EnergyGate> energy_gate_;
+    std::atomic<bool> energy_gate_reset_ = false;
+    std::atomic<bool> energy_gate_open_ = false;
     std::unique_ptr<AudioDebugger> audio_debugger_;
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
+    std::unique_ptr<AdaptiveOpusEncoder> opus_encoder_;
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
@@ -133,10 +200,32 @@ private:
     std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
     std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
     std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    std::atomic<int> frame_duration_ms_ = OPUS_FRAME_DURATION_MS;
+    size_t max_send_packets_ = MAX_SEND_QUEUE_DURATION_MS / OPUS_FRAME_DURATION_MS;
+    size_t max_decode_packets_ = MAX_DECODE_QUEUE_DURATION_MS / 60;
+
+#if CONFIG_USE_AUDIO_MIXER
+    // Indexed by source, the voice uses the queues and the decoder above
+    struct MixerInput {
+        std::deque<std::unique_ptr<AudioStreamPacket>> decode_queue;
+        std::unique_ptr<OpusDecoderWrapper> decoder;
+        OpusResampler resampler;
+        size_t max_packets = MAX_DECODE_QUEUE_DURATION_MS / 60;
+        // Set by ResetSource, the codec task resets the decoder state before the next packet
+        bool reset_decoder = false;
+        // Decoded PCM of an older generation is dropped instead of mixed
+        uint32_t generation = 0;
+    };
+    MixerInput mixer_inputs_[kAudioSourceCount];
+    AudioMixer mixer_;
+#endif
 
-    // For server AEC
-    std::deque<uint32_t> timestamp_queue_;
-    std::mutex timestamp_mutex_;
+    // For server AEC, uplink frames are tagged with the timestamp of the audio playing when they were captured
+    std::unique_ptr<PlaybackClock> playback_clock_;
+    std::mutex capture_clock_mutex_;
+    uint64_t processor_input_frames_ = 0;
+    int64_t processor_input_time_us_ = 0;
+    uint64_t processor_output_frames_ = 0;
 
     bool wake_word_initialized_ = false;
     bool audio_processor_initialized_ = false;
@@ -144,16 +233,52 @@ private:
     bool service_stopped_ = true;
     bool audio_input_need_warmup_ = false;
 
-    esp_timer_handle_t audio_power_timer_ = nullptr;
-    std::chrono::steady_clock::time_point last_input_time_;
-    std::chrono::steady_clock::time_point last_output_time_;
+    // Realtime DTX
+    std::atomic<bool> dtx_enabled_ = false;
+    std::atomic<bool> dtx_reset_ = false;
+    int dtx_frame_duration_ms_ = OPUS_FRAME_DURATION_MS;
+    int dtx_hangover_frames_ = 0;
+    int dtx_silence_frames_ = 0;
+    std::deque<std::unique_ptr<AudioTask>> dtx_preroll_;
+
+    // Codec power, the timers only run while a path is powered but unused.
+    // The codec is switched in its own task, the timers only notify it.
+    std::mutex codec_power_mutex_;
+    TaskHandle_t audio_power_task_handle_ = nullptr;
+    esp_timer_handle_t input_power_timer_ = nullptr;
+    esp_timer_handle_t output_power_timer_ = nullptr;
+    bool input_powered_up_ = false;
+    // A read or write is in progress, set under codec_power_mutex_, the path is not powered down meanwhile
+    std::atomic<bool> input_busy_ = false;
+    std::atomic<bool> output_busy_ = false;
 
     void AudioInputTask();
     void AudioOutputTask();
+    void AudioPowerTask();
     void OpusCodecTask();
+    std::unique_ptr<AudioTask> CreateEncodeTask(AudioTaskType type, std::vector<int16_t>&& pcm);
+    void PushTaskToEncodeQueue(std::unique_ptr<AudioTask> task);
     void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
-    void SetDecodeSampleRate(int sample_rate, int frame_duration);
-    void CheckAndUpdateAudioPowerState();
+    void GateDtxFrame(std::vector<int16_t>&& pcm);
+    void LogDtxStatistics();
+    int GetDecodeSampleRate(int stream_sample_rate) const;
+    void SetDecodeSampleRate(std::unique_ptr<OpusDecoderWrapper>& decoder, OpusResampler& resampler,
+        int sample_rate, int frame_duration);
+    // Holding the queue mutex
+    bool HasPlaybackData();
+#if CONFIG_USE_AUDIO_MIXER
+    int GetMixerSourceToDecode();
+    void DecodeMixerSource(std::unique_lock<std::mutex>& lock, AudioSourceId source);
+    uint32_t GetPendingSources();
+#endif
+    void EnableCodecInput(bool enable);
+    void EnableCodecOutput(bool enable);
+    // Caller holds codec_power_mutex_
+    void SetCodecInput(bool enable);
+    void SetCodecOutput(bool enable);
+    void UpdateInputPowerTimer();
+    void ArmPowerTimer(esp_timer_handle_t timer);
+    void WarmUpInput();
 };
 
 #endif
\ No newline at end of file
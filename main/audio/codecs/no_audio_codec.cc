@@ -19,6 +19,7 @@ NoAudioCodecDuplex::NoAudioCodecDuplex(int input_sample_rate, int output_sample_
     duplex_ = true;
     input_sample_rate_ = input_sample_rate;
     output_sample_rate_ = output_sample_rate;
+    output_frame_bytes_ = sizeof(int32_t);
 
     i2s_chan_config_t chan_cfg = {
         .id = I2S_NUM_0,
@@ -79,6 +80,7 @@ NoAudioCodecSimplex::NoAudioCodecSimplex(int input_sample_rate, int output_sampl
     duplex_ = false;
     input_sample_rate_ = input_sample_rate;
     output_sample_rate_ = output_sample_rate;
+    output_frame_bytes_ = sizeof(int32_t);
 
     // Create a new channel for speaker
     i2s_chan_config_t chan_cfg = {
@@ -148,6 +150,7 @@ NoAudioCodecSimplex::NoAudioCodecSimplex(int input_sample_rate, int output_sampl
     duplex_ = false;
     input_sample_rate_ = input_sample_rate;
     output_sample_rate_ = output_sample_rate;
+    output_frame_bytes_ = sizeof(int32_t);
 
     // Create a new channel for speaker
     i2s_chan_config_t chan_cfg = {
@@ -218,6 +221,7 @@ NoAudioCodecSimplexPdm::NoAudioCodecSimplexPdm(int input_sample_rate, int output
     duplex_ = false;
     input_sample_rate_ = input_sample_rate;
     output_sample_rate_ = output_sample_rate;
+    output_frame_bytes_ = sizeof(int32_t);
 
     // Create a new channel for speaker
     i2s_chan_config_t tx_chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG((i2s_port_t)1, I2S_ROLE_MASTER);
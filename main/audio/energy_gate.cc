@@ -0,0 +1,103 @@
+#include "energy_gate.h"
+
+#include <cstdlib>
+
+EnergyGate::EnergyGate(int channels, int sample_rate) : channels_(channels), sample_rate_(sample_rate) {
+}
+
+void EnergyGate::Reset() {
+    noise_floor_ = -1;
+    hangover_chunks_ = 0;
+    chunk_ms_ = 0;
+    ring_head_ = 0;
+    ring_size_ = 0;
+    passed_chunks_ = 0;
+    gated_chunks_ = 0;
+}
+
+int EnergyGate::HangoverChunks() const {
+    return ENERGY_GATE_HANGOVER_MS / chunk_ms_;
+}
+
+bool EnergyGate::IsActive(const std::vector<int16_t>& data) {
+    // The first channel is the microphone, the others may be the playback reference
+    int32_t sum = 0;
+    int crossings = 0;
+    int16_t last = 0;
+    size_t samples = data.size() / channels_;
+    for (size_t i = 0; i < data.size(); i += channels_) {
+        int16_t sample = data[i];
+        sum += std::abs(sample);
+        if ((sample ^ last) < 0) {
+            crossings++;
+        }
+        last = sample;
+    }
+    int32_t level = sum / (int32_t)samples;
+
+    if (noise_floor_ < 0) {
+        noise_floor_ = level;
+    }
+    bool active = level > noise_floor_ + (noise_floor_ >> 1) + ENERGY_GATE_MIN_DELTA ||
+        (crossings > ENERGY_GATE_ZCR_PER_MS * chunk_ms_ && level > noise_floor_ + ENERGY_GATE_MIN_DELTA);
+
+    // The floor follows quiet chunks quickly and loud ones slowly, in about four seconds
+    if (level < noise_floor_) {
+        noise_floor_ -= (noise_floor_ - level + 3) >> 2;
+    } else {
+        noise_floor_ += ((level - noise_floor_) * chunk_ms_ >> 12) + 1;
+    }
+    return active;
+}
+
+void EnergyGate::Process(const std::vector<int16_t>& data, const std::function<void(const std::vector<int16_t>&)>& feed) {
+    if (chunk_ms_ == 0) {
+        chunk_ms_ = data.size() / channels_ * 1000 / sample_rate_;
+        if (chunk_ms_ == 0) {
+            chunk_ms_ = 1;
+        }
+        lookback_chunks_ = ENERGY_GATE_LOOKBACK_MS / chunk_ms_;
+        if (ring_.size() != lookback_chunks_) {
+            ring_.resize(lookback_chunks_);
+        }
+        for (auto& slot : ring_) {
+            slot.reserve(data.size());
+        }
+        // Start open, so the floor settles while the engine still sees everything
+        hangover_chunks_ = HangoverChunks();
+    }
+
+    bool was_open = hangover_chunks_ > 0;
+    if (IsActive(data)) {
+        hangover_chunks_ = HangoverChunks();
+    }
+
+    if (hangover_chunks_ > 0) {
+        if (!was_open) {
+            // Just opened, the onset held back goes first
+            for (; ring_size_ > 0; ring_size_--) {
+                feed(ring_[ring_head_]);
+                passed_chunks_++;
+                ring_head_ = (ring_head_ + 1) % ring_.size();
+            }
+        }
+        feed(data);
+        passed_chunks_++;
+        hangover_chunks_--;
+        return;
+    }
+
+    if (ring_.empty()) {
+        gated_chunks_++;
+        return;
+    }
+    // Copied into a slot that keeps its capacity, nothing is allocated once the ring is warm
+    if (ring_size_ == ring_.size()) {
+        // The oldest chunk falls out of the look-back without being fed
+        ring_head_ = (ring_head_ + 1) % ring_.size();
+        ring_size_--;
+        gated_chunks_++;
+    }
+    ring_[(ring_head_ + ring_size_) % ring_.size()].assign(data.begin(), data.end());
+    ring_size_++;
+}
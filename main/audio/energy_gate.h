@@ -0,0 +1,57 @@
+#ifndef ENERGY_GATE_H
+#define ENERGY_GATE_H
+
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+// Keep feeding this long after the last loud chunk, so a whole wake word gets through
+#define ENERGY_GATE_HANGOVER_MS 1500
+// Chunks held back while gated, fed first when the gate opens, covering the onset before the level rises
+#define ENERGY_GATE_LOOKBACK_MS 320
+// Level above the noise floor (mean absolute sample value) needed to open the gate
+#define ENERGY_GATE_MIN_DELTA 40
+// Zero crossings per millisecond of fricatives, which are quiet but sharp
+#define ENERGY_GATE_ZCR_PER_MS 4
+
+/*
+ * A cheap fixed-point gate in front of wake word inference. It tracks the noise floor of the mic
+ * channel, and only lets chunks through that rise above it, plus a hangover and a look-back ring.
+ * Skipping inference in a silent room saves most of the CPU time of the wake word engine.
+ *
+ * While the gate is open, chunks go straight to the engine. While it is closed, the last
+ * ENERGY_GATE_LOOKBACK_MS are held in a ring, and fed first when it opens, so the engine also gets the
+ * onset before the level rises. The ring slots are allocated once and reused.
+ */
+class EnergyGate {
+public:
+    EnergyGate(int channels, int sample_rate);
+
+    // Calls feed with the chunk if the gate is open, after the look-back ring if it has just opened
+    void Process(const std::vector<int16_t>& data, const std::function<void(const std::vector<int16_t>&)>& feed);
+    // Starts over for a new detection window, the counters included
+    void Reset();
+
+    // In the hangover of a loud chunk, the chunks reach the engine
+    inline bool is_open() const { return hangover_chunks_ > 0; }
+    inline uint32_t passed_chunks() const { return passed_chunks_; }
+    inline uint32_t gated_chunks() const { return gated_chunks_; }
+
+private:
+    int channels_;
+    int sample_rate_;
+    int chunk_ms_ = 0;
+    int32_t noise_floor_ = -1;
+    int hangover_chunks_ = 0;
+    size_t lookback_chunks_ = 0;
+    std::vector<std::vector<int16_t>> ring_;
+    size_t ring_head_ = 0;
+    size_t ring_size_ = 0;
+    uint32_t passed_chunks_ = 0;
+    uint32_t gated_chunks_ = 0;
+
+    bool IsActive(const std::vector<int16_t>& data);
+    int HangoverChunks() const;
+};
+
+#endif // ENERGY_GATE_H
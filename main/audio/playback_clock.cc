@@ -0,0 +1,63 @@
+#include "playback_clock.h"
+
+#include <algorithm>
+#include <esp_log.h>
+
+#define TAG "PlaybackClock"
+
+PlaybackClock::PlaybackClock(AudioCodec* codec) : codec_(codec) {
+}
+
+void PlaybackClock::OnWrite(uint32_t timestamp, size_t samples) {
+    uint64_t sent_frames;
+    int64_t sent_time_us;
+    if (!codec_->GetOutputClock(sent_frames, sent_time_us)) {
+        // The codec does not report its DMA, the uplink goes without timestamps
+        if (!warned_) {
+            ESP_LOGW(TAG, "Codec has no output clock, uplink audio is not tagged for server AEC");
+            warned_ = true;
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // After the DMA ran dry, new samples go into the buffer after the one being sent
+    uint64_t start = std::max<uint64_t>(written_frames_, sent_frames + AUDIO_CODEC_DMA_FRAME_NUM);
+    uint32_t frames = samples / codec_->output_channels();
+    written_frames_ = start + frames;
+
+    if (timestamp == 0) {
+        return;
+    }
+    segments_.push_back(Segment{start, frames, timestamp});
+    while (segments_.size() > PLAYBACK_CLOCK_MAX_SEGMENTS) {
+        segments_.pop_front();
+    }
+}
+
+uint32_t PlaybackClock::GetTimestamp(int64_t time_us) {
+    uint64_t sent_frames;
+    int64_t sent_time_us;
+    if (!codec_->GetOutputClock(sent_frames, sent_time_us)) {
+        return 0;
+    }
+
+    // The frame on the wire at time_us, counted from the last DMA buffer the codec reported as sent
+    int rate = codec_->output_sample_rate();
+    int64_t position = (int64_t)sent_frames + (time_us - sent_time_us) * rate / 1000000;
+    if (position < 0) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = segments_.rbegin(); it != segments_.rend(); ++it) {
+        if ((uint64_t)position >= it->start) {
+            uint64_t offset = position - it->start;
+            if (offset >= it->frames) {
+                return 0;
+            }
+            return it->timestamp + offset * 1000 / rate;
+        }
+    }
+    return 0;
+}
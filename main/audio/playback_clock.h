@@ -0,0 +1,41 @@
+#ifndef PLAYBACK_CLOCK_H
+#define PLAYBACK_CLOCK_H
+
+#include <deque>
+#include <mutex>
+#include <cstdint>
+
+#include "audio_codec.h"
+
+// About two seconds of 60ms packets, more than the uplink lags behind the speaker
+#define PLAYBACK_CLOCK_MAX_SEGMENTS 32
+
+/*
+ * Maps a point in time to the server timestamp of the audio the speaker was playing then,
+ * for server-side AEC. Written packets are placed on the stream of samples sent by the I2S DMA,
+ * which the codec counts in its DMA interrupt, so the DMA latency and gaps in playback are accounted for.
+ */
+class PlaybackClock {
+public:
+    explicit PlaybackClock(AudioCodec* codec);
+
+    // Called by the output task right before writing the samples of a packet
+    void OnWrite(uint32_t timestamp, size_t samples);
+    // Server timestamp in milliseconds of the sample played at time_us, 0 if nothing from the server was playing
+    uint32_t GetTimestamp(int64_t time_us);
+
+private:
+    struct Segment {
+        uint64_t start;
+        uint32_t frames;
+        uint32_t timestamp;
+    };
+
+    AudioCodec* codec_;
+    std::mutex mutex_;
+    std::deque<Segment> segments_;
+    uint64_t written_frames_ = 0;
+    bool warned_ = false;
+};
+
+#endif // PLAYBACK_CLOCK_H
@@ -5,8 +5,8 @@
 
 #define TAG "AfeAudioProcessor"
 
-AfeAudioProcessor::AfeAudioProcessor()
-    : afe_data_(nullptr) {
+AfeAudioProcessor::AfeAudioProcessor(AfeFrontEnd* front_end)
+    : front_end_(front_end), afe_data_(nullptr) {
     event_group_ = xEventGroupCreate();
 }
 
@@ -17,6 +17,14 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms) {
     // Pre-allocate output buffer capacity
     output_buffer_.reserve(frame_samples_);
 
+    if (front_end_ != nullptr) {
+        front_end_->Initialize(codec);
+        front_end_->OnFetch(kAfeFrontEndVoice, [this](afe_fetch_result_t* res) {
+            ProcessResult(res);
+        });
+        return;
+    }
+
     int ref_num = codec_->input_reference() ? 1 : 0;
 
     std::string input_format;
@@ -70,6 +78,12 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms) {
     }, "audio_communication", 4096, this, 3, NULL);
 }
 
+void AfeAudioProcessor::SetFrameDuration(int frame_duration_ms) {
+    frame_samples_ = frame_duration_ms * 16000 / 1000;
+    output_buffer_.clear();
+    output_buffer_.reserve(frame_samples_);
+}
+
 AfeAudioProcessor::~AfeAudioProcessor() {
     if (afe_data_ != nullptr) {
         afe_iface_->destroy(afe_data_);
@@ -78,6 +92,9 @@ AfeAudioProcessor::~AfeAudioProcessor() {
 }
 
 size_t AfeAudioProcessor::GetFeedSize() {
+    if (front_end_ != nullptr) {
+        return front_end_->GetFeedSize();
+    }
     if (afe_data_ == nullptr) {
         return 0;
     }
@@ -85,6 +102,10 @@ size_t AfeAudioProcessor::GetFeedSize() {
 }
 
 void AfeAudioProcessor::Feed(std::vector<int16_t>&& data) {
+    if (front_end_ != nullptr) {
+        front_end_->Feed(data.data());
+        return;
+    }
     if (afe_data_ == nullptr) {
         return;
     }
@@ -93,10 +114,19 @@ void AfeAudioProcessor::Feed(std::vector<int16_t>&& data) {
 
 void AfeAudioProcessor::Start() {
     xEventGroupSetBits(event_group_, PROCESSOR_RUNNING);
+    if (front_end_ != nullptr) {
+        front_end_->EnableOutput(kAfeFrontEndVoice, true);
+    }
 }
 
 void AfeAudioProcessor::Stop() {
     xEventGroupClearBits(event_group_, PROCESSOR_RUNNING);
+    if (front_end_ != nullptr) {
+        // The shared pipeline keeps its buffers, only drop the partial frame
+        front_end_->EnableOutput(kAfeFrontEndVoice, false);
+        output_buffer_.clear();
+        return;
+    }
     if (afe_data_ != nullptr) {
         afe_iface_->reset_buffer(afe_data_);
     }
@@ -134,41 +164,52 @@ void AfeAudioProcessor::AudioProcessorTask() {
             continue;
         }
 
-        // VAD state change
-        if (vad_state_change_callback_) {
-            if (res->vad_state == VAD_SPEECH && !is_speaking_) {
-                is_speaking_ = true;
-                vad_state_change_callback_(true);
-            } else if (res->vad_state == VAD_SILENCE && is_speaking_) {
-                is_speaking_ = false;
-                vad_state_change_callback_(false);
-            }
+        ProcessResult(res);
+    }
+}
+
+void AfeAudioProcessor::ProcessResult(afe_fetch_result_t* res) {
+    // VAD state change
+    if (vad_state_change_callback_) {
+        if (res->vad_state == VAD_SPEECH && !is_speaking_) {
+            is_speaking_ = true;
+            vad_state_change_callback_(true);
+        } else if (res->vad_state == VAD_SILENCE && is_speaking_) {
+            is_speaking_ = false;
+            vad_state_change_callback_(false);
         }
+    }
 
-        if (output_callback_) {
-            size_t samples = res->data_size / sizeof(int16_t);
-            
-            // Add data to buffer
-            output_buffer_.insert(output_buffer_.end(), res->data, res->data + samples);
-            
-            // Output complete frames when buffer has enough data
-            while (output_buffer_.size() >= frame_samples_) {
-                if (output_buffer_.size() == frame_samples_) {
-                    // If buffer size equals frame size, move the entire buffer
-                    output_callback_(std::move(output_buffer_));
-                    output_buffer_.clear();
-                    output_buffer_.reserve(frame_samples_);
-                } else {
-                    // If buffer size exceeds frame size, copy one frame and remove it
-                    output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples_));
-                    output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
-                }
+    if (output_callback_) {
+        size_t samples = res->data_size / sizeof(int16_t);
+        
+        // Add data to buffer
+        output_buffer_.insert(output_buffer_.end(), res->data, res->data + samples);
+        
+        // Output complete frames when buffer has enough data
+        while (output_buffer_.size() >= frame_samples_) {
+            if (output_buffer_.size() == frame_samples_) {
+                // If buffer size equals frame size, move the entire buffer
+                output_callback_(std::move(output_buffer_));
+                output_buffer_.clear();
+                output_buffer_.reserve(frame_samples_);
+            } else {
+                // If buffer size exceeds frame size, copy one frame and remove it
+                output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples_));
+                output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
             }
         }
     }
 }
 
 void AfeAudioProcessor::EnableDeviceAec(bool enable) {
+    if (front_end_ != nullptr) {
+        // The shared pipeline runs the SR AEC whenever the codec has a reference channel
+        if (enable) {
+            ESP_LOGE(TAG, "Device AEC is not supported with the shared AFE front end");
+        }
+        return;
+    }
     if (enable) {
 #if CONFIG_USE_DEVICE_AEC
         afe_iface_->disable_vad(afe_data_);
@@ -12,13 +12,16 @@
 
 #include "audio_processor.h"
 #include "audio_codec.h"
+#include "afe_front_end.h"
 
 class AfeAudioProcessor : public AudioProcessor {
 public:
-    AfeAudioProcessor();
+    // With a front end, the processor shares its AFE pipeline with the wake word
+    explicit AfeAudioProcessor(AfeFrontEnd* front_end = nullptr);
     ~AfeAudioProcessor();
 
     void Initialize(AudioCodec* codec, int frame_duration_ms) override;
+    void SetFrameDuration(int frame_duration_ms) override;
     void Feed(std::vector<int16_t>&& data) override;
     void Start() override;
     void Stop() override;
@@ -29,6 +32,7 @@ public:
     void EnableDeviceAec(bool enable) override;
 
 private:
+    AfeFrontEnd* front_end_ = nullptr;
     EventGroupHandle_t event_group_ = nullptr;
     esp_afe_sr_iface_t* afe_iface_ = nullptr;
     esp_afe_sr_data_t* afe_data_ = nullptr;
@@ -40,6 +44,7 @@ private:
     std::vector<int16_t> output_buffer_;
 
     void AudioProcessorTask();
+    void ProcessResult(afe_fetch_result_t* res);
 };
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "afe_front_end.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <string>
+
+#define AFE_FRONT_END_WAKE_WORD_EVENT (1 << kAfeFrontEndWakeWord)
+#define AFE_FRONT_END_VOICE_EVENT (1 << kAfeFrontEndVoice)
+
+#define TAG "AfeFrontEnd"
+
+AfeFrontEnd::AfeFrontEnd() {
+    event_group_ = xEventGroupCreate();
+}
+
+AfeFrontEnd::~AfeFrontEnd() {
+    if (afe_data_ != nullptr) {
+        afe_iface_->destroy(afe_data_);
+    }
+    if (models_ != nullptr) {
+        esp_srmodel_deinit(models_);
+    }
+    vEventGroupDelete(event_group_);
+}
+
+bool AfeFrontEnd::Initialize(AudioCodec* codec) {
+    if (afe_data_ != nullptr) {
+        return true;
+    }
+    codec_ = codec;
+    int ref_num = codec_->input_reference() ? 1 : 0;
+
+    models_ = esp_srmodel_init("model");
+    if (models_ == nullptr || models_->num == -1) {
+        ESP_LOGE(TAG, "Failed to initialize models");
+        return false;
+    }
+
+    std::string input_format;
+    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
+        input_format.push_back('M');
+    }
+    for (int i = 0; i < ref_num; i++) {
+        input_format.push_back('R');
+    }
+
+    // The SR pipeline runs WakeNet, and its NS and VAD output is also good for the server
+    afe_config_t* afe_config = afe_config_init(input_format.c_str(), models_, AFE_TYPE_SR, AFE_MODE_HIGH_PERF);
+    afe_config->aec_init = codec_->input_reference();
+    afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
+    afe_config->vad_init = true;
+    afe_config->vad_mode = VAD_MODE_0;
+    afe_config->vad_min_noise_ms = 100;
+    char* vad_model_name = esp_srmodel_filter(models_, ESP_VADN_PREFIX, NULL);
+    if (vad_model_name != nullptr) {
+        afe_config->vad_model_name = vad_model_name;
+    }
+    char* ns_model_name = esp_srmodel_filter(models_, ESP_NSNET_PREFIX, NULL);
+    if (ns_model_name != nullptr) {
+        afe_config->ns_init = true;
+        afe_config->ns_model_name = ns_model_name;
+        afe_config->afe_ns_mode = AFE_NS_MODE_NET;
+    }
+    afe_config->afe_perferred_core = 1;
+    afe_config->afe_perferred_priority = 1;
+    afe_config->agc_init = false;
+    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
+
+    afe_iface_ = esp_afe_handle_from_config(afe_config);
+    afe_data_ = afe_iface_->create_from_config(afe_config);
+    afe_iface_->disable_wakenet(afe_data_);
+
+    xTaskCreate([](void* arg) {
+        auto this_ = (AfeFrontEnd*)arg;
+        this_->FetchTask();
+        vTaskDelete(NULL);
+    }, "afe_front_end", 4096, this, 3, nullptr);
+    return true;
+}
+
+void AfeFrontEnd::Feed(const int16_t* data) {
+    if (afe_data_ == nullptr) {
+        return;
+    }
+    afe_iface_->feed(afe_data_, data);
+}
+
+size_t AfeFrontEnd::GetFeedSize() {
+    if (afe_data_ == nullptr) {
+        return 0;
+    }
+    return afe_iface_->get_feed_chunksize(afe_data_) * codec_->input_channels();
+}
+
+void AfeFrontEnd::OnFetch(AfeFrontEndOutput output, std::function<void(afe_fetch_result_t* result)> callback) {
+    fetch_callbacks_[output] = callback;
+}
+
+void AfeFrontEnd::EnableOutput(AfeFrontEndOutput output, bool enable) {
+    if (afe_data_ == nullptr) {
+        return;
+    }
+    if (output == kAfeFrontEndWakeWord) {
+        // WakeNet is the most expensive stage, only run it while someone listens for the wake word
+        if (enable) {
+            afe_iface_->enable_wakenet(afe_data_);
+        } else {
+            afe_iface_->disable_wakenet(afe_data_);
+        }
+    }
+    EventBits_t all = AFE_FRONT_END_WAKE_WORD_EVENT | AFE_FRONT_END_VOICE_EVENT;
+    if (enable) {
+        // Right after the wake word, the buffered audio may hold the start of the question, keep it
+        if ((xEventGroupGetBits(event_group_) & all) == 0 &&
+            esp_timer_get_time() - idle_since_us_ > AFE_FRONT_END_STALE_MS * 1000) {
+            afe_iface_->reset_buffer(afe_data_);
+        }
+        xEventGroupSetBits(event_group_, 1 << output);
+    } else {
+        if ((xEventGroupClearBits(event_group_, 1 << output) & all) == (EventBits_t)(1 << output)) {
+            idle_since_us_ = esp_timer_get_time();
+        }
+    }
+}
+
+void AfeFrontEnd::FetchTask() {
+    ESP_LOGI(TAG, "AFE front end task started, feed size: %d fetch size: %d",
+        afe_iface_->get_feed_chunksize(afe_data_), afe_iface_->get_fetch_chunksize(afe_data_));
+
+    while (true) {
+        xEventGroupWaitBits(event_group_, AFE_FRONT_END_WAKE_WORD_EVENT | AFE_FRONT_END_VOICE_EVENT,
+            pdFALSE, pdFALSE, portMAX_DELAY);
+
+        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
+        if (res == nullptr || res->ret_value == ESP_FAIL) {
+            continue;
+        }
+
+        EventBits_t bits = xEventGroupGetBits(event_group_);
+        for (int output = kAfeFrontEndWakeWord; output <= kAfeFrontEndVoice; output++) {
+            if ((bits & (1 << output)) && fetch_callbacks_[output]) {
+                fetch_callbacks_[output](res);
+            }
+        }
+    }
+}
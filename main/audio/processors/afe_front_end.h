@@ -0,0 +1,51 @@
+#ifndef AFE_FRONT_END_H
+#define AFE_FRONT_END_H
+
+#include <esp_afe_sr_models.h>
+#include <model_path.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include <functional>
+
+#include "audio_codec.h"
+
+// Audio buffered longer than this without any output enabled is dropped when an output is enabled again
+#define AFE_FRONT_END_STALE_MS 500
+
+enum AfeFrontEndOutput {
+    kAfeFrontEndWakeWord = 0,
+    kAfeFrontEndVoice = 1,
+};
+
+/*
+ * One AFE pipeline (AEC, NS, VAD and WakeNet) shared by AfeWakeWord and AfeAudioProcessor.
+ * Switching between wake word detection and voice processing only switches the outputs and WakeNet,
+ * the pipeline keeps running with its buffers and adaptive state, and the models are loaded once.
+ */
+class AfeFrontEnd {
+public:
+    AfeFrontEnd();
+    ~AfeFrontEnd();
+
+    bool Initialize(AudioCodec* codec);
+    void Feed(const int16_t* data);
+    size_t GetFeedSize();
+    void EnableOutput(AfeFrontEndOutput output, bool enable);
+    void OnFetch(AfeFrontEndOutput output, std::function<void(afe_fetch_result_t* result)> callback);
+    srmodel_list_t* models() const { return models_; }
+
+private:
+    AudioCodec* codec_ = nullptr;
+    srmodel_list_t* models_ = nullptr;
+    esp_afe_sr_iface_t* afe_iface_ = nullptr;
+    esp_afe_sr_data_t* afe_data_ = nullptr;
+    EventGroupHandle_t event_group_;
+    std::function<void(afe_fetch_result_t* result)> fetch_callbacks_[2];
+    int64_t idle_since_us_ = 0;
+
+    void FetchTask();
+};
+
+#endif // AFE_FRONT_END_H
@@ -1,49 +1,78 @@
 #include "audio_debugger.h"
 #include "sdkconfig.h"
 
-#if CONFIG_USE_AUDIO_DEBUGGER
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <errno.h>
 #include <cstring>
 #include <string>
-#endif
 
 #define TAG "AudioDebugger"
 
+#if CONFIG_USE_AUDIO_DEBUGGER
+static const uint32_t kEnabledTaps =
+#if CONFIG_AUDIO_DEBUG_TAP_MIC_INPUT
+    (1 << kAudioDebugTapMicInput) |
+#endif
+#if CONFIG_AUDIO_DEBUG_TAP_PROCESSOR_OUTPUT
+    (1 << kAudioDebugTapProcessorOutput) |
+#endif
+#if CONFIG_AUDIO_DEBUG_TAP_DECODER_OUTPUT
+    (1 << kAudioDebugTapDecoderOutput) |
+#endif
+#if CONFIG_AUDIO_DEBUG_TAP_SPEAKER_OUTPUT
+    (1 << kAudioDebugTapSpeakerOutput) |
+#endif
+    0;
+#endif
+
+static const int16_t kAdpcmStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t kAdpcmIndexTable[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
 
 AudioDebugger::AudioDebugger() {
 #if CONFIG_USE_AUDIO_DEBUGGER
-    udp_sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
-    if (udp_sockfd_ >= 0) {
-        // 解析配置的服务器地址 "IP:PORT"
-        std::string server_addr = CONFIG_AUDIO_DEBUG_UDP_SERVER;
-        size_t colon_pos = server_addr.find(':');
-        
-        if (colon_pos != std::string::npos) {
-            std::string ip = server_addr.substr(0, colon_pos);
-            int port = std::stoi(server_addr.substr(colon_pos + 1));
-            
-            memset(&udp_server_addr_, 0, sizeof(udp_server_addr_));
-            udp_server_addr_.sin_family = AF_INET;
-            udp_server_addr_.sin_port = htons(port);
-            inet_pton(AF_INET, ip.c_str(), &udp_server_addr_.sin_addr);
-            
-            ESP_LOGI(TAG, "Initialized server address: %s", CONFIG_AUDIO_DEBUG_UDP_SERVER);
-        } else {
-            ESP_LOGW(TAG, "Invalid server address: %s, should be IP:PORT", CONFIG_AUDIO_DEBUG_UDP_SERVER);
-            close(udp_sockfd_);
-            udp_sockfd_ = -1;
-        }
-    } else {
-        ESP_LOGW(TAG, "Failed to create UDP socket: %d", errno);
+#if CONFIG_SPIRAM
+    ring_buffer_ = xRingbufferCreateWithCaps(CONFIG_AUDIO_DEBUG_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT, MALLOC_CAP_SPIRAM);
+#else
+    ring_buffer_ = xRingbufferCreate(CONFIG_AUDIO_DEBUG_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
+#endif
+    if (ring_buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create ring buffer");
+        return;
     }
+
+    // The sender runs below the audio and main tasks so that the network never blocks audio
+    xTaskCreate([](void* arg) {
+        auto this_ = (AudioDebugger*)arg;
+        this_->SenderTask();
+        vTaskDelete(NULL);
+    }, "audio_debugger", 4096, this, 1, &sender_task_handle_);
 #endif
 }
 
 AudioDebugger::~AudioDebugger() {
 #if CONFIG_USE_AUDIO_DEBUGGER
+    if (sender_task_handle_ != nullptr) {
+        vTaskDelete(sender_task_handle_);
+    }
+    if (ring_buffer_ != nullptr) {
+        vRingbufferDelete(ring_buffer_);
+    }
     if (udp_sockfd_ >= 0) {
         close(udp_sockfd_);
         ESP_LOGI(TAG, "Closed UDP socket");
@@ -51,18 +80,162 @@ AudioDebugger::~AudioDebugger() {
 #endif
 }
 
-void AudioDebugger::Feed(const std::vector<int16_t>& data) {
+bool AudioDebugger::OpenSocket() {
 #if CONFIG_USE_AUDIO_DEBUGGER
-    if (udp_sockfd_ >= 0) {
-        ssize_t sent = sendto(udp_sockfd_, data.data(), data.size() * sizeof(int16_t), 0,
-                             (struct sockaddr*)&udp_server_addr_, sizeof(udp_server_addr_));
-        if (sent < 0) {
-            ESP_LOGW(TAG, "Failed to send audio data to %s: %d", CONFIG_AUDIO_DEBUG_UDP_SERVER, errno);
-        } else {
-            ESP_LOGD(TAG, "Sent %d bytes audio data to %s", sent, CONFIG_AUDIO_DEBUG_UDP_SERVER);
+    // 解析配置的服务器地址 "IP:PORT"
+    std::string server_addr = CONFIG_AUDIO_DEBUG_UDP_SERVER;
+    size_t colon_pos = server_addr.find(':');
+    if (colon_pos == std::string::npos) {
+        ESP_LOGW(TAG, "Invalid server address: %s, should be IP:PORT", CONFIG_AUDIO_DEBUG_UDP_SERVER);
+        return false;
+    }
+
+    udp_sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udp_sockfd_ < 0) {
+        ESP_LOGW(TAG, "Failed to create UDP socket: %d", errno);
+        return false;
+    }
+
+    std::string ip = server_addr.substr(0, colon_pos);
+    int port = std::stoi(server_addr.substr(colon_pos + 1));
+    memset(&udp_server_addr_, 0, sizeof(udp_server_addr_));
+    udp_server_addr_.sin_family = AF_INET;
+    udp_server_addr_.sin_port = htons(port);
+    inet_pton(AF_INET, ip.c_str(), &udp_server_addr_.sin_addr);
+    ESP_LOGI(TAG, "Initialized server address: %s", CONFIG_AUDIO_DEBUG_UDP_SERVER);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void AudioDebugger::Feed(AudioDebugTap tap, const int16_t* data, size_t samples, int sample_rate, int channels) {
+#if CONFIG_USE_AUDIO_DEBUGGER
+    if (ring_buffer_ == nullptr || !(kEnabledTaps & (1 << tap)) || samples == 0) {
+        return;
+    }
+    if (channels < 1 || channels > AUDIO_DEBUG_MAX_CHANNELS) {
+        // No ADPCM state for the extra channels, reported with the dropped frames
+        dropped_count_++;
+        return;
+    }
+
+    size_t payload_size = samples * sizeof(int16_t);
+    void* item = nullptr;
+    if (xRingbufferSendAcquire(ring_buffer_, &item, sizeof(AudioDebugPacketHeader) + payload_size, 0) != pdTRUE) {
+        // Never block the audio tasks, drop the data if the sender can not keep up
+        dropped_count_++;
+        return;
+    }
+
+    auto header = (AudioDebugPacketHeader*)item;
+    header->magic = AUDIO_DEBUG_PACKET_MAGIC;
+    header->version = AUDIO_DEBUG_PACKET_VERSION;
+    header->stream_id = tap;
+    header->encoding = kAudioDebugEncodingPcm16;
+    header->channels = channels;
+    header->sample_rate = sample_rate;
+    header->sequence = sequences_[tap]++;
+    header->timestamp_us = esp_timer_get_time();
+    header->samples = samples / channels;
+    header->payload_size = payload_size;
+    memcpy((uint8_t*)item + sizeof(AudioDebugPacketHeader), data, payload_size);
+    xRingbufferSendComplete(ring_buffer_, item);
+#endif
+}
+
+void AudioDebugger::SenderTask() {
+#if CONFIG_USE_AUDIO_DEBUGGER
+    while (udp_sockfd_ < 0) {
+        if (!OpenSocket()) {
+            vTaskDelay(pdMS_TO_TICKS(1000));
+        }
+    }
+
+    while (true) {
+        size_t item_size = 0;
+        auto item = (uint8_t*)xRingbufferReceive(ring_buffer_, &item_size, portMAX_DELAY);
+        if (item == nullptr) {
+            continue;
+        }
+        auto header = (AudioDebugPacketHeader*)item;
+        SendPacket(header, (const int16_t*)(item + sizeof(AudioDebugPacketHeader)));
+        vRingbufferReturnItem(ring_buffer_, item);
+
+        uint32_t dropped = dropped_count_.exchange(0);
+        if (dropped > 0) {
+            ESP_LOGW(TAG, "Dropped %lu audio debug frames", dropped);
         }
     }
 #endif
 }
 
- 
\ No newline at end of file
+void AudioDebugger::SendPacket(AudioDebugPacketHeader* header, const int16_t* pcm) {
+#if CONFIG_USE_AUDIO_DEBUGGER
+#if CONFIG_AUDIO_DEBUG_ENCODING_ADPCM
+    size_t max_size = sizeof(AudioDebugPacketHeader) + header->channels * 4 + (header->samples * header->channels + 1) / 2;
+    send_buffer_.resize(max_size);
+    auto adpcm_header = (AudioDebugPacketHeader*)send_buffer_.data();
+    *adpcm_header = *header;
+    adpcm_header->encoding = kAudioDebugEncodingImaAdpcm;
+    adpcm_header->payload_size = EncodeAdpcm(adpcm_states_[header->stream_id], header->channels, pcm,
+        header->samples * header->channels, send_buffer_.data() + sizeof(AudioDebugPacketHeader));
+    const void* packet = send_buffer_.data();
+    size_t packet_size = sizeof(AudioDebugPacketHeader) + adpcm_header->payload_size;
+#else
+    const void* packet = header;
+    size_t packet_size = sizeof(AudioDebugPacketHeader) + header->payload_size;
+#endif
+
+    ssize_t sent = sendto(udp_sockfd_, packet, packet_size, 0, (struct sockaddr*)&udp_server_addr_, sizeof(udp_server_addr_));
+    if (sent < 0) {
+        ESP_LOGW(TAG, "Failed to send audio data to %s: %d", CONFIG_AUDIO_DEBUG_UDP_SERVER, errno);
+    } else {
+        ESP_LOGD(TAG, "Sent %d bytes of stream %u to %s", sent, header->stream_id, CONFIG_AUDIO_DEBUG_UDP_SERVER);
+    }
+#endif
+}
+
+size_t AudioDebugger::EncodeAdpcm(AdpcmState* states, int channels, const int16_t* pcm, size_t samples, uint8_t* output) {
+    // Store the initial state of each channel, so every packet can be decoded on its own
+    uint8_t* p = output;
+    for (int ch = 0; ch < channels; ch++) {
+        memcpy(p, &states[ch].predictor, sizeof(int16_t));
+        p[2] = states[ch].step_index;
+        p[3] = 0;
+        p += 4;
+    }
+
+    memset(p, 0, (samples + 1) / 2);
+    for (size_t i = 0; i < samples; i++) {
+        auto& state = states[i % channels];
+        int step = kAdpcmStepTable[state.step_index];
+        int diff = pcm[i] - state.predictor;
+        uint8_t code = 0;
+        if (diff < 0) {
+            code = 8;
+            diff = -diff;
+        }
+
+        int delta = step >> 3;
+        if (diff >= step) { code |= 4; diff -= step; delta += step; }
+        step >>= 1;
+        if (diff >= step) { code |= 2; diff -= step; delta += step; }
+        step >>= 1;
+        if (diff >= step) { code |= 1; delta += step; }
+
+        int predictor = state.predictor + ((code & 8) ? -delta : delta);
+        if (predictor > 32767) {
+            predictor = 32767;
+        } else if (predictor < -32768) {
+            predictor = -32768;
+        }
+        state.predictor = predictor;
+
+        int index = state.step_index + kAdpcmIndexTable[code];
+        state.step_index = index < 0 ? 0 : (index > 88 ? 88 : index);
+
+        p[i / 2] |= (i & 1) ? (code << 4) : code;
+    }
+    return (p - output) + (samples + 1) / 2;
+}
@@ -2,21 +2,90 @@
 #define AUDIO_DEBUGGER_H
 
 #include <vector>
+#include <atomic>
 #include <cstdint>
+#include <cstddef>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/ringbuf.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
+/*
+ * Tap points in the audio pipeline. The value is used as the stream id on the wire,
+ * so do not reorder existing entries.
+ */
+enum AudioDebugTap : uint8_t {
+    kAudioDebugTapMicInput = 0,         // 16kHz PCM fed to the wake word / audio processor (before AFE)
+    kAudioDebugTapProcessorOutput = 1,  // 16kHz mono PCM produced by the audio processor (after AFE)
+    kAudioDebugTapDecoderOutput = 2,    // PCM produced by the Opus decoder
+    kAudioDebugTapSpeakerOutput = 3,    // PCM written to the codec (after the output resampler)
+    kAudioDebugTapCount
+};
+
+enum AudioDebugEncoding : uint8_t {
+    kAudioDebugEncodingPcm16 = 0,
+    kAudioDebugEncodingImaAdpcm = 1,
+};
+
+/*
+ * UDP packet format (little endian), followed by the payload:
+ * |magic 4u|version 1u|stream_id 1u|encoding 1u|channels 1u|sample_rate 4u|sequence 4u|timestamp_us 8u|samples 2u|payload_size 2u|
+ *
+ * samples is the number of frames per channel, timestamp_us is the esp_timer time when the first frame was tapped.
+ * For IMA ADPCM the payload starts with one |predictor 2s|step_index 1u|reserved 1u| block per channel,
+ * followed by interleaved 4-bit codes, low nibble first.
+ */
+#define AUDIO_DEBUG_PACKET_MAGIC 0x44415A58  // "XZAD"
+#define AUDIO_DEBUG_PACKET_VERSION 1
+// Most channels of a tap, each has its own ADPCM state
+#define AUDIO_DEBUG_MAX_CHANNELS 4
+
+struct AudioDebugPacketHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t stream_id;
+    uint8_t encoding;
+    uint8_t channels;
+    uint32_t sample_rate;
+    uint32_t sequence;
+    uint64_t timestamp_us;
+    uint16_t samples;
+    uint16_t payload_size;
+} __attribute__((packed));
+
 class AudioDebugger {
 public:
     AudioDebugger();
     ~AudioDebugger();
 
-    void Feed(const std::vector<int16_t>& data);
+    // Called from the audio tasks, only copies the data into the ring buffer
+    void Feed(AudioDebugTap tap, const int16_t* data, size_t samples, int sample_rate, int channels = 1);
+    void Feed(AudioDebugTap tap, const std::vector<int16_t>& data, int sample_rate, int channels = 1) {
+        Feed(tap, data.data(), data.size(), sample_rate, channels);
+    }
 
 private:
+    struct AdpcmState {
+        int16_t predictor = 0;
+        int8_t step_index = 0;
+    };
+
+    RingbufHandle_t ring_buffer_ = nullptr;
+    TaskHandle_t sender_task_handle_ = nullptr;
     int udp_sockfd_ = -1;
     struct sockaddr_in udp_server_addr_;
+    uint32_t sequences_[kAudioDebugTapCount] = {0};
+    AdpcmState adpcm_states_[kAudioDebugTapCount][AUDIO_DEBUG_MAX_CHANNELS];
+    // Counted by the audio tasks, reported by the sender task
+    std::atomic<uint32_t> dropped_count_ = 0;
+    std::vector<uint8_t> send_buffer_;
+
+    bool OpenSocket();
+    void SenderTask();
+    void SendPacket(AudioDebugPacketHeader* header, const int16_t* pcm);
+    size_t EncodeAdpcm(AdpcmState* states, int channels, const int16_t* pcm, size_t samples, uint8_t* output);
 };
 
-#endif 
\ No newline at end of file
+#endif
@@ -0,0 +1,294 @@
+#include "stream_player.h"
+#include "audio_service.h"
+#include "board.h"
+
+#include <cstring>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <arpa/inet.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define TAG "StreamPlayer"
+
+// Duration of an Opus packet in 0.1 ms from its TOC byte (RFC 6716, section 3.1), 0 if malformed
+static int GetOpusPacketDuration(const std::vector<uint8_t>& packet) {
+    if (packet.empty()) {
+        return 0;
+    }
+    static const int silk_durations[] = {100, 200, 400, 600};
+    static const int celt_durations[] = {25, 50, 100, 200};
+    uint8_t toc = packet[0];
+    int config = toc >> 3;
+    int frame_duration;
+    if (config < 12) {
+        frame_duration = silk_durations[config & 3];
+    } else if (config < 16) {
+        frame_duration = (config & 1) ? 200 : 100;
+    } else {
+        frame_duration = celt_durations[config & 3];
+    }
+
+    int frames;
+    switch (toc & 3) {
+        case 0:
+            frames = 1;
+            break;
+        case 1:
+        case 2:
+            frames = 2;
+            break;
+        default:
+            if (packet.size() < 2) {
+                return 0;
+            }
+            frames = packet[1] & 0x3F;
+            break;
+    }
+    return frame_duration * frames;
+}
+
+bool StreamDemuxer::Feed(const uint8_t* data, size_t size) {
+    buffer_.insert(buffer_.end(), data, data + size);
+    max_buffered_ = std::max(max_buffered_, buffer_.size());
+
+    if (format_ == kFormatUnknown) {
+        if (buffer_.size() < 4) {
+            return true;
+        }
+        format_ = memcmp(buffer_.data(), "OggS", 4) == 0 ? kFormatOgg : kFormatP3;
+    }
+
+    while (true) {
+        size_t consumed = 0;
+        bool ok = format_ == kFormatOgg ? ParseOggPage(consumed) : ParseP3Frame(consumed);
+        if (!ok) {
+            return false;
+        }
+        if (consumed == 0) {
+            break;
+        }
+        buffer_.erase(buffer_.begin(), buffer_.begin() + consumed);
+    }
+
+    if (buffer_.size() > STREAM_MAX_BUFFER_SIZE) {
+        ESP_LOGE(TAG, "Page larger than %d bytes", STREAM_MAX_BUFFER_SIZE);
+        return false;
+    }
+    return true;
+}
+
+bool StreamDemuxer::ParseP3Frame(size_t& consumed) {
+    if (buffer_.size() < sizeof(BinaryProtocol3)) {
+        return true;
+    }
+    auto p3 = reinterpret_cast<const BinaryProtocol3*>(buffer_.data());
+    size_t payload_size = ntohs(p3->payload_size);
+    if (buffer_.size() < sizeof(BinaryProtocol3) + payload_size) {
+        return true;
+    }
+
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->sample_rate = STREAM_P3_SAMPLE_RATE;
+    packet->frame_duration = STREAM_P3_FRAME_DURATION_MS;
+    packet->payload.assign(p3->payload, p3->payload + payload_size);
+    consumed = sizeof(BinaryProtocol3) + payload_size;
+    return callback_(std::move(packet));
+}
+
+bool StreamDemuxer::ParseOggPage(size_t& consumed) {
+    // Capture pattern, version, header type, granule position, serial, sequence, CRC, segment count
+    const size_t header_size = 27;
+    if (buffer_.size() < header_size) {
+        return true;
+    }
+    if (memcmp(buffer_.data(), "OggS", 4) != 0) {
+        ESP_LOGE(TAG, "Lost Ogg page sync");
+        return false;
+    }
+    size_t segments = buffer_[26];
+    if (buffer_.size() < header_size + segments) {
+        return true;
+    }
+    const uint8_t* lacing = buffer_.data() + header_size;
+    size_t body_size = 0;
+    for (size_t i = 0; i < segments; i++) {
+        body_size += lacing[i];
+    }
+    size_t page_size = header_size + segments + body_size;
+    if (buffer_.size() < page_size) {
+        return true;
+    }
+
+    // A packet not continued on this page was cut off, drop it
+    bool continued = buffer_[5] & 0x01;
+    if (!continued) {
+        packet_.clear();
+    }
+
+    const uint8_t* body = lacing + segments;
+    for (size_t i = 0; i < segments; i++) {
+        packet_.insert(packet_.end(), body, body + lacing[i]);
+        body += lacing[i];
+        if (lacing[i] < 255) {
+            if (!OnOggPacket()) {
+                return false;
+            }
+            packet_.clear();
+        } else if (packet_.size() > STREAM_MAX_BUFFER_SIZE) {
+            ESP_LOGE(TAG, "Ogg packet larger than %d bytes", STREAM_MAX_BUFFER_SIZE);
+            return false;
+        }
+    }
+    consumed = page_size;
+    return true;
+}
+
+bool StreamDemuxer::OnOggPacket() {
+    // A chained stream starts over with its own headers
+    if (packet_.size() >= 19 && memcmp(packet_.data(), "OpusHead", 8) == 0) {
+        channels_ = packet_[9];
+        header_seen_ = true;
+        tags_seen_ = false;
+        return true;
+    }
+    if (!header_seen_) {
+        ESP_LOGE(TAG, "Not an Ogg/Opus stream");
+        return false;
+    }
+    if (!tags_seen_) {
+        tags_seen_ = true;
+        return true;
+    }
+
+    int duration = GetOpusPacketDuration(packet_);
+    // The decoder is set up per whole millisecond
+    if (duration == 0 || duration % 10 != 0) {
+        ESP_LOGW(TAG, "Skipping Opus packet of %d.%d ms", duration / 10, duration % 10);
+        return true;
+    }
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->sample_rate = STREAM_OGG_SAMPLE_RATE;
+    packet->frame_duration = duration / 10;
+    packet->payload = std::move(packet_);
+    packet_ = std::vector<uint8_t>();
+    return callback_(std::move(packet));
+}
+
+void StreamPlayer::ResetAudio() {
+#if CONFIG_USE_AUDIO_MIXER
+    // The stream has a mixer source of its own, the voice and the effects play on
+    audio_service_.ResetSource(kAudioSourceStream);
+#else
+    audio_service_.ResetDecoder();
+#endif
+}
+
+void StreamPlayer::Play(const std::string& url) {
+    uint32_t generation = ++generation_;
+    playing_ = true;
+    ResetAudio();
+
+    struct PlayArgs {
+        StreamPlayer* player;
+        std::string url;
+        uint32_t generation;
+    };
+    auto args = new PlayArgs{this, url, generation};
+    xTaskCreate([](void* arg) {
+        auto args = static_cast<PlayArgs*>(arg);
+        args->player->PlayTask(args->url, args->generation);
+        delete args;
+        vTaskDelete(NULL);
+    }, "stream_player", 4096 * 2, args, 2, nullptr);
+}
+
+void StreamPlayer::Stop() {
+    ++generation_;
+    if (playing_.exchange(false)) {
+        ResetAudio();
+    }
+}
+
+bool StreamPlayer::PushPacket(std::unique_ptr<AudioStreamPacket> packet, uint32_t generation) {
+    // Wait here while the decode queue is full, the socket stops being read and TCP holds back the server
+#if CONFIG_USE_AUDIO_MIXER
+    while (audio_service_.IsSourceQueueFull(kAudioSourceStream)) {
+#else
+    while (audio_service_.IsDecodeQueueFull()) {
+#endif
+        if (generation != generation_) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(20));
+    }
+    if (generation != generation_) {
+        return false;
+    }
+#if CONFIG_USE_AUDIO_MIXER
+    return audio_service_.PushPacketToSource(kAudioSourceStream, std::move(packet));
+#else
+    return audio_service_.PushPacketToDecodeQueue(std::move(packet));
+#endif
+}
+
+void StreamPlayer::PlayTask(const std::string& url, uint32_t generation) {
+    std::lock_guard<std::mutex> lock(task_mutex_);
+    if (generation != generation_) {
+        return;
+    }
+
+    auto network = Board::GetInstance().GetNetwork();
+    auto http = network->CreateHttp(3);
+    if (!http->Open("GET", url)) {
+        ESP_LOGE(TAG, "Failed to open %s", url.c_str());
+        Finish(generation);
+        return;
+    }
+    if (http->GetStatusCode() != 200) {
+        ESP_LOGE(TAG, "Failed to get %s, status code: %d", url.c_str(), http->GetStatusCode());
+        http->Close();
+        Finish(generation);
+        return;
+    }
+    ESP_LOGI(TAG, "Playing %s, %u bytes", url.c_str(), http->GetBodyLength());
+
+    int64_t start_time = esp_timer_get_time();
+    size_t total_bytes = 0;
+    int packets = 0;
+    int duration_ms = 0;
+    StreamDemuxer demuxer([&](std::unique_ptr<AudioStreamPacket> packet) {
+        packets++;
+        duration_ms += packet->frame_duration;
+        return PushPacket(std::move(packet), generation);
+    });
+
+    char buffer[STREAM_READ_CHUNK_SIZE];
+    while (generation == generation_) {
+        int ret = http->Read(buffer, sizeof(buffer));
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to read %s", url.c_str());
+            break;
+        }
+        if (ret == 0) {
+            break;
+        }
+        total_bytes += ret;
+        if (!demuxer.Feed(reinterpret_cast<uint8_t*>(buffer), ret)) {
+            break;
+        }
+    }
+    http->Close();
+
+    ESP_LOGI(TAG, "%s %s: %u bytes, %d packets, %d ms of %s audio in %lld ms, at most %u bytes buffered",
+        generation == generation_ ? "Finished" : "Stopped", url.c_str(), total_bytes, packets, duration_ms,
+        demuxer.IsOgg() ? "Ogg/Opus" : "P3", (esp_timer_get_time() - start_time) / 1000, demuxer.max_buffered());
+    Finish(generation);
+}
+
+void StreamPlayer::Finish(uint32_t generation) {
+    // A newer stream may be starting already
+    if (generation == generation_) {
+        playing_ = false;
+    }
+}
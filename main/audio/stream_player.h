@@ -0,0 +1,86 @@
+#ifndef STREAM_PLAYER_H
+#define STREAM_PLAYER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+
+#include "protocol.h"
+
+class AudioService;
+
+// Opus packets rendered by the server have a fixed rate, Ogg/Opus always counts at 48 kHz
+#define STREAM_P3_SAMPLE_RATE 16000
+#define STREAM_P3_FRAME_DURATION_MS 60
+#define STREAM_OGG_SAMPLE_RATE 48000
+
+// Largest Ogg page or P3 frame kept while waiting for the rest of it
+#define STREAM_MAX_BUFFER_SIZE (32 * 1024)
+#define STREAM_READ_CHUNK_SIZE 1024
+
+/*
+ * Splits a byte stream into Opus packets as it arrives, Ogg/Opus or P3 (the format of the
+ * embedded sounds), told apart by the first bytes. Only the unfinished page or frame is buffered.
+ */
+class StreamDemuxer {
+public:
+    using PacketCallback = std::function<bool(std::unique_ptr<AudioStreamPacket> packet)>;
+
+    StreamDemuxer(PacketCallback callback) : callback_(callback) {}
+
+    // Returns false on a malformed stream, or when the callback asks to stop
+    bool Feed(const uint8_t* data, size_t size);
+
+    bool IsOgg() const { return format_ == kFormatOgg; }
+    int channels() const { return channels_; }
+    size_t max_buffered() const { return max_buffered_; }
+
+private:
+    enum Format {
+        kFormatUnknown,
+        kFormatOgg,
+        kFormatP3,
+    };
+
+    PacketCallback callback_;
+    Format format_ = kFormatUnknown;
+    std::vector<uint8_t> buffer_;
+    std::vector<uint8_t> packet_;
+    bool header_seen_ = false;
+    bool tags_seen_ = false;
+    int channels_ = 0;
+    size_t max_buffered_ = 0;
+
+    bool ParseOggPage(size_t& consumed);
+    bool ParseP3Frame(size_t& consumed);
+    bool OnOggPacket();
+};
+
+// Plays an HTTP URL through the decode queue (the stream source of the mixer if enabled), waiting while the queue is full,
+// so a long story or song plays with the memory of a few packets
+class StreamPlayer {
+public:
+    StreamPlayer(AudioService& audio_service) : audio_service_(audio_service) {}
+
+    // Stops the current stream and starts the new one in the background
+    void Play(const std::string& url);
+    void Stop();
+    bool IsPlaying() const { return playing_; }
+
+private:
+    AudioService& audio_service_;
+    std::atomic<uint32_t> generation_ = 0;
+    std::atomic<bool> playing_ = false;
+    // Held by the playing task, a new stream waits for the previous one to exit
+    std::mutex task_mutex_;
+
+    void ResetAudio();
+    void PlayTask(const std::string& url, uint32_t generation);
+    bool PushPacket(std::unique_ptr<AudioStreamPacket> packet, uint32_t generation);
+    void Finish(uint32_t generation);
+};
+
+#endif // STREAM_PLAYER_H
@@ -8,8 +8,9 @@
 
 #define TAG "AfeWakeWord"
 
-AfeWakeWord::AfeWakeWord()
-    : afe_data_(nullptr),
+AfeWakeWord::AfeWakeWord(AfeFrontEnd* front_end)
+    : front_end_(front_end),
+      afe_data_(nullptr),
       wake_word_pcm_(),
       wake_word_opus_() {
 
@@ -29,7 +30,7 @@ AfeWakeWord::~AfeWakeWord() {
         heap_caps_free(wake_word_encode_task_buffer_);
     }
 
-    if (models_ != nullptr) {
+    if (models_ != nullptr && front_end_ == nullptr) {
         esp_srmodel_deinit(models_);
     }
 
@@ -40,7 +41,14 @@ bool AfeWakeWord::Initialize(AudioCodec* codec) {
     codec_ = codec;
     int ref_num = codec_->input_reference() ? 1 : 0;
 
-    models_ = esp_srmodel_init("model");
+    if (front_end_ != nullptr) {
+        if (!front_end_->Initialize(codec)) {
+            return false;
+        }
+        models_ = front_end_->models();
+    } else {
+        models_ = esp_srmodel_init("model");
+    }
     if (models_ == nullptr || models_->num == -1) {
         ESP_LOGE(TAG, "Failed to initialize wakenet model");
         return false;
@@ -59,6 +67,13 @@ bool AfeWakeWord::Initialize(AudioCodec* codec) {
         }
     }
 
+    if (front_end_ != nullptr) {
+        front_end_->OnFetch(kAfeFrontEndWakeWord, [this](afe_fetch_result_t* res) {
+            ProcessResult(res);
+        });
+        return true;
+    }
+
     std::string input_format;
     for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
         input_format.push_back('M');
@@ -89,11 +104,25 @@ void AfeWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_
     wake_word_detected_callback_ = callback;
 }
 
+void AfeWakeWord::OnVadStateChange(std::function<void(bool speaking)> callback) {
+    vad_state_change_callback_ = callback;
+}
+
 void AfeWakeWord::Start() {
+    if (front_end_ != nullptr) {
+        front_end_->EnableOutput(kAfeFrontEndWakeWord, true);
+        return;
+    }
     xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
 }
 
 void AfeWakeWord::Stop() {
+    is_speaking_ = false;
+    if (front_end_ != nullptr) {
+        // The shared pipeline keeps its buffers, the audio processor may continue right away
+        front_end_->EnableOutput(kAfeFrontEndWakeWord, false);
+        return;
+    }
     xEventGroupClearBits(event_group_, DETECTION_RUNNING_EVENT);
     if (afe_data_ != nullptr) {
         afe_iface_->reset_buffer(afe_data_);
@@ -101,6 +130,10 @@ void AfeWakeWord::Stop() {
 }
 
 void AfeWakeWord::Feed(const std::vector<int16_t>& data) {
+    if (front_end_ != nullptr) {
+        front_end_->Feed(data.data());
+        return;
+    }
     if (afe_data_ == nullptr) {
         return;
     }
@@ -108,6 +141,9 @@ void AfeWakeWord::Feed(const std::vector<int16_t>& data) {
 }
 
 size_t AfeWakeWord::GetFeedSize() {
+    if (front_end_ != nullptr) {
+        return front_end_->GetFeedSize();
+    }
     if (afe_data_ == nullptr) {
         return 0;
     }
@@ -127,17 +163,28 @@ void AfeWakeWord::AudioDetectionTask() {
         if (res == nullptr || res->ret_value == ESP_FAIL) {
             continue;;
         }
+        ProcessResult(res);
+    }
+}
 
-        // Store the wake word data for voice recognition, like who is speaking
-        StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
+void AfeWakeWord::ProcessResult(afe_fetch_result_t* res) {
+    // Store the wake word data for voice recognition, like who is speaking
+    StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
 
-        if (res->wakeup_state == WAKENET_DETECTED) {
-            Stop();
-            last_detected_wake_word_ = wake_words_[res->wakenet_model_index - 1];
+    if (vad_state_change_callback_) {
+        bool speaking = res->vad_state == VAD_SPEECH;
+        if (speaking != is_speaking_) {
+            is_speaking_ = speaking;
+            vad_state_change_callback_(speaking);
+        }
+    }
 
-            if (wake_word_detected_callback_) {
-                wake_word_detected_callback_(last_detected_wake_word_);
-            }
+    if (res->wakeup_state == WAKENET_DETECTED) {
+        Stop();
+        last_detected_wake_word_ = wake_words_[res->wakenet_model_index - 1];
+
+        if (wake_word_detected_callback_) {
+            wake_word_detected_callback_(last_detected_wake_word_);
         }
     }
 }
@@ -151,8 +198,9 @@ void AfeWakeWord::StoreWakeWordData(const int16_t* data, size_t samples) {
     }
 }
 
-void AfeWakeWord::EncodeWakeWordData() {
+void AfeWakeWord::EncodeWakeWordData(int frame_duration_ms) {
     const size_t stack_size = 4096 * 7;
+    wake_word_frame_duration_ms_ = frame_duration_ms;
     wake_word_opus_.clear();
     if (wake_word_encode_task_stack_ == nullptr) {
         wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(stack_size, MALLOC_CAP_SPIRAM);
@@ -167,7 +215,7 @@ void AfeWakeWord::EncodeWakeWordData() {
         auto this_ = (AfeWakeWord*)arg;
         {
             auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, this_->wake_word_frame_duration_ms_);
             encoder->SetComplexity(0); // 0 is the fastest
 
             int packets = 0;
@@ -18,23 +18,27 @@
 
 #include "audio_codec.h"
 #include "wake_word.h"
+#include "processors/afe_front_end.h"
 
 class AfeWakeWord : public WakeWord {
 public:
-    AfeWakeWord();
+    // With a front end, the wake word shares its AFE pipeline with the audio processor
+    explicit AfeWakeWord(AfeFrontEnd* front_end = nullptr);
     ~AfeWakeWord();
 
     bool Initialize(AudioCodec* codec);
     void Feed(const std::vector<int16_t>& data);
     void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback);
+    void OnVadStateChange(std::function<void(bool speaking)> callback);
     void Start();
     void Stop();
     size_t GetFeedSize();
-    void EncodeWakeWordData();
+    void EncodeWakeWordData(int frame_duration_ms);
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
 
 private:
+    AfeFrontEnd* front_end_ = nullptr;
     srmodel_list_t *models_ = nullptr;
     esp_afe_sr_iface_t* afe_iface_ = nullptr;
     esp_afe_sr_data_t* afe_data_ = nullptr;
@@ -42,12 +46,15 @@ private:
     std::vector<std::string> wake_words_;
     EventGroupHandle_t event_group_;
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
+    std::function<void(bool speaking)> vad_state_change_callback_;
+    bool is_speaking_ = false;
     AudioCodec* codec_ = nullptr;
     std::string last_detected_wake_word_;
 
     TaskHandle_t wake_word_encode_task_ = nullptr;
     StaticTask_t* wake_word_encode_task_buffer_ = nullptr;
     StackType_t* wake_word_encode_task_stack_ = nullptr;
+    int wake_word_frame_duration_ms_ = 60;
     std::deque<std::vector<int16_t>> wake_word_pcm_;
     std::deque<std::vector<uint8_t>> wake_word_opus_;
     std::mutex wake_word_mutex_;
@@ -55,6 +62,7 @@ private:
 
     void StoreWakeWordData(const int16_t* data, size_t size);
     void AudioDetectionTask();
+    void ProcessResult(afe_fetch_result_t* res);
 };
 
 #endif
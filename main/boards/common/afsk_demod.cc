@@ -1,6 +1,8 @@
 #include "afsk_demod.h"
 #include <cstring>
 #include <algorithm>
+#include <numeric>
+#include <limits>
 #include "esp_log.h"
 #include "display.h"
 
@@ -19,9 +21,10 @@ namespace audio_wifi_config
                                     )
     {
         const int kInputSampleRate = 16000;                                    // Input sampling rate
-        const float kDownsampleStep = static_cast<float>(kInputSampleRate) / static_cast<float>(kAudioSampleRate); // Downsampling step
         std::vector<int16_t> audio_data;
-        AudioSignalProcessor signal_processor(kAudioSampleRate, kMarkFrequency, kSpaceFrequency, kBitRate, kWindowSize);
+        std::vector<float> probabilities;
+        AudioSignalProcessor signal_processor(kInputSampleRate, kAudioSampleRate, kMarkFrequency, kSpaceFrequency,
+                                              kBitRate, kWindowSize);
         AudioDataBuffer data_buffer;
 
         while (true)
@@ -33,70 +36,50 @@ namespace audio_wifi_config
                 continue;
             }
             
-            if (!app->GetAudioService().ReadAudioData(audio_data, 16000, 480)) { // 16kHz, 480 samples corresponds to 30ms data
+            if (!app->GetAudioService().ReadAudioData(audio_data, kInputSampleRate, 480)) { // 16kHz, 480 samples corresponds to 30ms data
                 // 读取音频失败，短暂延迟后重试
                 ESP_LOGI(kLogTag, "Failed to read audio data, retrying.");
                 vTaskDelay(pdMS_TO_TICKS(10));
                 continue;
             }
 
-            if (input_channels == 2) { // 如果是双声道输入，转换为单声道
-                auto mono_data = std::vector<int16_t>(audio_data.size() / 2);
-                for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                    mono_data[i] = audio_data[j];
-                }
-                audio_data = std::move(mono_data);
-            }
+            // Resample and demodulate in one pass, the first channel of stereo input is used
+            probabilities.clear();
+            signal_processor.ProcessAudioSamples(audio_data.data(), audio_data.size() / input_channels,
+                                                 input_channels, probabilities);
             
-            // Downsample the audio data
-            std::vector<float> downsampled_data;
-            size_t last_index = 0;
-
-            if (kDownsampleStep > 1.0f) {
-                downsampled_data.reserve(audio_data.size() / static_cast<size_t>(kDownsampleStep));
-                for (size_t i = 0; i < audio_data.size(); ++i) {
-                    size_t sample_index = static_cast<size_t>(i / kDownsampleStep);
-                    if ((sample_index + 1) > last_index) {
-                        downsampled_data.push_back(static_cast<float>(audio_data[i]));
-                        last_index = sample_index + 1;
-                    }
-                }
-            } else {
-                downsampled_data.reserve(audio_data.size());
-                for (int16_t sample : audio_data) {
-                    downsampled_data.push_back(static_cast<float>(sample));
-                }
-            }
-            
-            // Process audio samples to get probability data
-            auto probabilities = signal_processor.ProcessAudioSamples(downsampled_data);
-            
-            // Feed probability data to the data buffer
+            // Feed probability data to the data buffer, an MFSK frame is decoded by the signal processor itself
+            std::optional<std::string> decoded_text;
             if (data_buffer.ProcessProbabilityData(probabilities, 0.5f)) {
-                // If complete data was received, extract WiFi credentials
-                if (data_buffer.decoded_text.has_value()) {
-                    ESP_LOGI(kLogTag, "Received text data: %s", data_buffer.decoded_text->c_str());
-                    display->SetChatMessage("system", data_buffer.decoded_text->c_str());
-                    
-                    // Split SSID and password by newline character
-                    std::string wifi_ssid, wifi_password;
-                    size_t newline_position = data_buffer.decoded_text->find('\n');
-                    if (newline_position != std::string::npos) {
-                        wifi_ssid = data_buffer.decoded_text->substr(0, newline_position);
-                        wifi_password = data_buffer.decoded_text->substr(newline_position + 1);
-                        ESP_LOGI(kLogTag, "WiFi SSID: %s, Password: %s", wifi_ssid.c_str(), wifi_password.c_str());
-                    } else {
-                        ESP_LOGE(kLogTag, "Invalid data format, no newline character found");
-                        continue;
-                    }
-                    
-                    if (wifi_ap->ConnectToWifi(wifi_ssid, wifi_password)) {
-                        wifi_ap->Save(wifi_ssid, wifi_password);  // Save WiFi credentials
-                        esp_restart();                            // Restart device to apply new WiFi configuration
-                    } else {
-                        ESP_LOGE(kLogTag, "Failed to connect to WiFi with received credentials");
-                    }
-                    data_buffer.decoded_text.reset();  // Clear processed data
+                decoded_text = data_buffer.decoded_text;
+                data_buffer.decoded_text.reset();  // Clear processed data
+            } else if (signal_processor.decoded_text.has_value()) {
+                decoded_text = signal_processor.decoded_text;
+                signal_processor.decoded_text.reset();
+            }
+
+            // If complete data was received, extract WiFi credentials
+            if (decoded_text.has_value()) {
+                ESP_LOGI(kLogTag, "Received text data: %s", decoded_text->c_str());
+                display->SetChatMessage("system", decoded_text->c_str());
+                
+                // Split SSID and password by newline character
+                std::string wifi_ssid, wifi_password;
+                size_t newline_position = decoded_text->find('\n');
+                if (newline_position != std::string::npos) {
+                    wifi_ssid = decoded_text->substr(0, newline_position);
+                    wifi_password = decoded_text->substr(newline_position + 1);
+                    ESP_LOGI(kLogTag, "WiFi SSID: %s, Password: %s", wifi_ssid.c_str(), wifi_password.c_str());
+                } else {
+                    ESP_LOGE(kLogTag, "Invalid data format, no newline character found");
+                    continue;
+                }
+                
+                if (wifi_ap->ConnectToWifi(wifi_ssid, wifi_password)) {
+                    wifi_ap->Save(wifi_ssid, wifi_password);  // Save WiFi credentials
+                    esp_restart();                            // Restart device to apply new WiFi configuration
+                } else {
+                    ESP_LOGE(kLogTag, "Failed to connect to WiFi with received credentials");
                 }
             }
             vTaskDelay(pdMS_TO_TICKS(1));  // 1ms delay
@@ -112,110 +95,159 @@ namespace audio_wifi_config
     const std::vector<uint8_t> kDefaultEndTransmissionPattern = {
         0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 1, 0, 0};
 
-    // FrequencyDetector implementation
-    FrequencyDetector::FrequencyDetector(float frequency, size_t window_size)
-        : frequency_(frequency), window_size_(window_size) {
-        frequency_bin_ = std::floor(frequency_ * static_cast<float>(window_size_));
-        angular_frequency_ = 2.0f * M_PI * frequency_;
-        cos_coefficient_ = std::cos(angular_frequency_);
-        sin_coefficient_ = std::sin(angular_frequency_);
-        filter_coefficient_ = 2.0f * cos_coefficient_;
-
-        // Initialize state buffer
-        state_buffer_.push_back(0.0f);
-        state_buffer_.push_back(0.0f);
-    }
+    // Resampler implementation
+    Resampler::Resampler(size_t input_rate, size_t output_rate, size_t taps_per_phase)
+        : taps_per_phase_(taps_per_phase), history_index_(0), phase_(0) {
+        size_t divisor = std::gcd(input_rate, output_rate);
+        interpolation_ = output_rate / divisor;
+        decimation_ = input_rate / divisor;
+
+        // Windowed sinc at the interpolated rate, cut off a little below the lower Nyquist frequency
+        size_t length = interpolation_ * taps_per_phase_;
+        float cutoff = 0.48f * static_cast<float>(std::min(input_rate, output_rate)) /
+                       static_cast<float>(input_rate * interpolation_);
+        std::vector<float> prototype(length);
+        float sum = 0.0f;
+        for (size_t i = 0; i < length; ++i) {
+            float t = static_cast<float>(i) - static_cast<float>(length - 1) / 2.0f;
+            float sinc = (t == 0.0f) ? 2.0f * cutoff : std::sin(2.0f * M_PI * cutoff * t) / (M_PI * t);
+            float window = 0.54f - 0.46f * std::cos(2.0f * M_PI * i / (length - 1));  // Hamming
+            prototype[i] = sinc * window;
+            sum += prototype[i];
+        }
 
-    void FrequencyDetector::Reset() {
-        state_buffer_.clear();
-        state_buffer_.push_back(0.0f);
-        state_buffer_.push_back(0.0f);
+        // Each branch sees one of every L taps, so the gain of the prototype is L
+        coefficients_.resize(length);
+        for (size_t i = 0; i < length; ++i) {
+            float value = prototype[i] * static_cast<float>(interpolation_) / sum;
+            coefficients_[i] = static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 32767.0f / 32768.0f) * 32768.0f));
+        }
+        history_.assign(taps_per_phase_ * 2, 0);
     }
 
-    void FrequencyDetector::ProcessSample(float sample) {
-        if (state_buffer_.size() < 2) {
-            return;
+    size_t Resampler::Process(int16_t sample, int16_t *output) {
+        history_index_ = (history_index_ + 1) % taps_per_phase_;
+        history_[history_index_] = sample;
+        history_[history_index_ + taps_per_phase_] = sample;
+
+        // history_[newest + taps_per_phase_ - k] is the input k samples ago
+        const int16_t *newest = &history_[history_index_ + taps_per_phase_];
+        size_t count = 0;
+        while (phase_ < interpolation_) {
+            const int16_t *taps = &coefficients_[phase_];
+            int32_t accumulator = 1 << 14;
+            for (size_t k = 0; k < taps_per_phase_; ++k) {
+                accumulator += taps[k * interpolation_] * newest[-static_cast<ptrdiff_t>(k)];
+            }
+            output[count++] = static_cast<int16_t>(std::clamp<int32_t>(accumulator >> 15, INT16_MIN, INT16_MAX));
+            phase_ += decimation_;
         }
+        phase_ -= interpolation_;
+        return count;
+    }
 
-        float s_minus_2 = state_buffer_.front();  // S[-2]
-        state_buffer_.pop_front();
-        float s_minus_1 = state_buffer_.front();  // S[-1]
-        state_buffer_.pop_front();
-
-        float s_current = sample + filter_coefficient_ * s_minus_1 - s_minus_2;
+    // ToneDetector implementation
+    ToneDetector::ToneDetector(float mark_frequency, float space_frequency) {
+        mark_cosine_ = static_cast<int32_t>(std::lround(std::cos(2.0f * M_PI * mark_frequency) * 32767.0f));
+        space_cosine_ = static_cast<int32_t>(std::lround(std::cos(2.0f * M_PI * space_frequency) * 32767.0f));
+    }
 
-        state_buffer_.push_back(s_minus_1);  // Put S[-1] back
-        state_buffer_.push_back(s_current);  // Add new S[0]
+    float ToneDetector::GetAmplitude(int32_t cosine, int32_t s_minus_1, int32_t s_minus_2) {
+        // |X|^2 = S[-1]^2 + S[-2]^2 - 2cos(w) * S[-1] * S[-2]
+        int64_t power = static_cast<int64_t>(s_minus_1) * s_minus_1 + static_cast<int64_t>(s_minus_2) * s_minus_2 -
+                        ((static_cast<int64_t>(cosine) * s_minus_1 >> 14) * s_minus_2);
+        return std::sqrt(static_cast<float>(std::max<int64_t>(power, 0)));
     }
 
-    float FrequencyDetector::GetAmplitude() const {
-        if (state_buffer_.size() < 2) {
-            return 0.0f;
+    float ToneDetector::Process(const int16_t *window, size_t size) const {
+        // S[n] = x[n] + 2cos(w) * S[n-1] - S[n-2], a window of 16-bit samples stays well within 32 bits
+        int32_t mark_1 = 0, mark_2 = 0;
+        int32_t space_1 = 0, space_2 = 0;
+        for (size_t i = 0; i < size; ++i) {
+            int32_t sample = window[i];
+            int32_t mark = sample + static_cast<int32_t>(static_cast<int64_t>(mark_cosine_) * mark_1 >> 14) - mark_2;
+            mark_2 = mark_1;
+            mark_1 = mark;
+            int32_t space = sample + static_cast<int32_t>(static_cast<int64_t>(space_cosine_) * space_1 >> 14) - space_2;
+            space_2 = space_1;
+            space_1 = space;
         }
 
-        float s_minus_1 = state_buffer_[1];                      // S[-1]
-        float s_minus_2 = state_buffer_[0];                      // S[-2]
-        float real_part = cos_coefficient_ * s_minus_1 - s_minus_2;  // Real part
-        float imaginary_part = sin_coefficient_ * s_minus_1;         // Imaginary part
-
-        return std::sqrt(real_part * real_part + imaginary_part * imaginary_part) / 
-               (static_cast<float>(window_size_) / 2.0f);
+        float mark_amplitude = GetAmplitude(mark_cosine_, mark_1, mark_2);
+        float space_amplitude = GetAmplitude(space_cosine_, space_1, space_2);
+        // Avoid division by zero
+        return mark_amplitude / (space_amplitude + mark_amplitude + std::numeric_limits<float>::epsilon());
     }
 
     // AudioSignalProcessor implementation
-    AudioSignalProcessor::AudioSignalProcessor(size_t sample_rate, size_t mark_frequency, size_t space_frequency,
-                                             size_t bit_rate, size_t window_size)
-        : input_buffer_size_(window_size), output_sample_count_(0) {
+    AudioSignalProcessor::AudioSignalProcessor(size_t input_sample_rate, size_t sample_rate, size_t mark_frequency,
+                                             size_t space_frequency, size_t bit_rate, size_t window_size)
+        : resampler_(input_sample_rate, sample_rate, kResamplerTapsPerPhase),
+          tone_detector_(static_cast<float>(mark_frequency) / static_cast<float>(sample_rate),
+                         static_cast<float>(space_frequency) / static_cast<float>(sample_rate)),
+          window_(window_size),
+          window_fill_(0),
+          shifted_window_(window_size),
+          recent_bits_{0xFFFF, 0xFFFF},
+          mfsk_active_(false),
+          mfsk_demodulator_(sample_rate) {
         if (sample_rate % bit_rate != 0) {
             // On ESP32 we can continue execution, but log the error
             ESP_LOGW(kLogTag, "Sample rate %zu is not divisible by bit rate %zu", sample_rate, bit_rate);
         }
-
-        float normalized_mark_freq = static_cast<float>(mark_frequency) / static_cast<float>(sample_rate);
-        float normalized_space_freq = static_cast<float>(space_frequency) / static_cast<float>(sample_rate);
-
-        mark_detector_ = std::make_unique<FrequencyDetector>(normalized_mark_freq, window_size);
-        space_detector_ = std::make_unique<FrequencyDetector>(normalized_space_freq, window_size);
-
-        samples_per_bit_ = sample_rate / bit_rate;  // Number of samples per bit
+        if (sample_rate / bit_rate != window_size) {
+            // One decision is made per window, so a window should span exactly one bit
+            ESP_LOGW(kLogTag, "Window size %zu does not match %zu samples per bit", window_size, sample_rate / bit_rate);
+        }
     }
 
-    std::vector<float> AudioSignalProcessor::ProcessAudioSamples(const std::vector<float> &samples) {
-        std::vector<float> result;
-
-        for (float sample : samples) {
-            if (input_buffer_.size() < input_buffer_size_) {
-                input_buffer_.push_back(sample);  // Just add, don't process yet
-            } else {
-                // Input buffer is full, process the data
-                input_buffer_.pop_front();   // Remove oldest sample
-                input_buffer_.push_back(sample);  // Add new sample
-                output_sample_count_++;
-
-                if (output_sample_count_ >= samples_per_bit_) {
-                    // Process all samples in the window using Goertzel algorithm
-                    for (float window_sample : input_buffer_) {
-                        mark_detector_->ProcessSample(window_sample);
-                        space_detector_->ProcessSample(window_sample);
+    void AudioSignalProcessor::ProcessAudioSamples(const int16_t *samples, size_t frames, size_t channels,
+                                                   std::vector<float> &probabilities) {
+        int16_t resampled[8];
+        for (size_t i = 0; i < frames; ++i) {
+            size_t count = resampler_.Process(samples[i * channels], resampled);
+            for (size_t j = 0; j < count; ++j) {
+                if (mfsk_active_) {
+                    if (!mfsk_demodulator_.Process(resampled[j])) {
+                        mfsk_active_ = false;
+                        decoded_text = mfsk_demodulator_.decoded_text;
                     }
+                    continue;
+                }
 
-                    float mark_amplitude = mark_detector_->GetAmplitude();   // Mark amplitude
-                    float space_amplitude = space_detector_->GetAmplitude(); // Space amplitude
-
-                    // Avoid division by zero
-                    float mark_probability = mark_amplitude / 
-                                           (space_amplitude + mark_amplitude + std::numeric_limits<float>::epsilon());
-                    result.push_back(mark_probability);
-
-                    // Reset detector windows
-                    mark_detector_->Reset();
-                    space_detector_->Reset();
-                    output_sample_count_ = 0;  // Reset output counter
+                window_[window_fill_++] = resampled[j];
+#if CONFIG_ACOUSTIC_WIFI_PROVISIONING_MFSK
+                // A window straddling two bits blurs a lone '1' of the start pattern over two decisions,
+                // so the pattern is also searched in windows half a window later
+                const size_t half = window_.size() / 2;
+                if (window_fill_ == half) {
+                    std::copy(window_.begin(), window_.begin() + half, shifted_window_.begin() + half);
+                    DetectMfskStart(tone_detector_.Process(shifted_window_.data(), shifted_window_.size()),
+                                    recent_bits_[1], shifted_window_);
+                }
+#endif
+                if (window_fill_ == window_.size()) {
+                    float probability = tone_detector_.Process(window_.data(), window_.size());
+                    probabilities.push_back(probability);
+                    window_fill_ = 0;
+#if CONFIG_ACOUSTIC_WIFI_PROVISIONING_MFSK
+                    std::copy(window_.begin() + half, window_.end(), shifted_window_.begin());
+                    DetectMfskStart(probability, recent_bits_[0], window_);
+#endif
                 }
             }
         }
+    }
 
-        return result;
+    void AudioSignalProcessor::DetectMfskStart(float probability, uint16_t &bits, const std::vector<int16_t> &window) {
+        bits = (bits << 1) | (probability > 0.5f ? 1 : 0);
+        if (bits == kMfskStartPattern) {
+            // The frame starts right after this bit, the window holds the samples before it
+            ESP_LOGI(kLogTag, "Entering MFSK Receiving state");
+            mfsk_demodulator_.Begin(window.data(), window.size());
+            mfsk_active_ = true;
+            recent_bits_[0] = recent_bits_[1] = 0xFFFF;
+        }
     }
 
     // AudioDataBuffer implementation
@@ -2,11 +2,13 @@
 
 #include <vector>
 #include <deque>
+#include <cstdint>
 #include <string>
 #include <memory>
 #include <optional>
 #include <cmath>
 #include "wifi_configuration_ap.h"
+#include "mfsk_demod.h"
 #include "application.h"
 
 // Audio signal processing constants for WiFi configuration via audio
@@ -15,6 +17,7 @@ const size_t kMarkFrequency = 1800;
 const size_t kSpaceFrequency = 1500;
 const size_t kBitRate = 100;
 const size_t kWindowSize = 64;
+const size_t kResamplerTapsPerPhase = 24;
 
 namespace audio_wifi_config
 {
@@ -23,45 +26,65 @@ namespace audio_wifi_config
                                          size_t input_channels = 1);
 
     /**
-     * Goertzel algorithm implementation for single frequency detection
-     * Used to detect specific audio frequencies in the AFSK demodulation process
+     * Rational resampler with a polyphase low-pass FIR in Q15
+     * Interpolates by L and decimates by M in one step, only the output samples are computed
      */
-    class FrequencyDetector
+    class Resampler
     {
     private:
-        float frequency_;              // Target frequency (normalized, i.e., f / fs)
-        size_t window_size_;           // Window size for analysis
-        float frequency_bin_;          // Frequency bin
-        float angular_frequency_;      // Angular frequency
-        float cos_coefficient_;        // cos(w)
-        float sin_coefficient_;        // sin(w)
-        float filter_coefficient_;     // 2 * cos(w)
-        std::deque<float> state_buffer_;  // Circular buffer for storing S[-1] and S[-2]
+        size_t interpolation_;                // L
+        size_t decimation_;                   // M
+        size_t taps_per_phase_;               // Taps of one polyphase branch
+        std::vector<int16_t> coefficients_;   // Prototype filter, branch p holds taps p, p + L, p + 2L ...
+        std::vector<int16_t> history_;        // Ring buffer of the input, stored twice so a window never wraps
+        size_t history_index_;                // Position of the newest sample
+        size_t phase_;                        // Position of the next output between the current and next input
 
     public:
         /**
          * Constructor
-         * @param frequency Normalized frequency (f / fs)
-         * @param window_size Window size for analysis
+         * @param input_rate Input sampling rate
+         * @param output_rate Output sampling rate
+         * @param taps_per_phase Filter taps used for each output sample
          */
-        FrequencyDetector(float frequency, size_t window_size);
+        Resampler(size_t input_rate, size_t output_rate, size_t taps_per_phase);
 
         /**
-         * Reset the detector state
+         * Push one input sample
+         * @param sample Input sample
+         * @param output Receives the output samples due after this input, at most ceil(L / M)
+         * @return Number of output samples
          */
-        void Reset();
+        size_t Process(int16_t sample, int16_t *output);
+    };
+
+    /**
+     * Goertzel algorithm in Q15 fixed point for the Mark and Space frequencies at once
+     * Both filters run in the same pass over a window of samples
+     */
+    class ToneDetector
+    {
+    private:
+        int32_t mark_cosine_;    // cos(w) of the Mark frequency in Q15
+        int32_t space_cosine_;   // cos(w) of the Space frequency in Q15
+
+        static float GetAmplitude(int32_t cosine, int32_t s_minus_1, int32_t s_minus_2);
 
+    public:
         /**
-         * Process one audio sample
-         * @param sample Input audio sample
+         * Constructor
+         * @param mark_frequency Normalized Mark frequency (f / fs)
+         * @param space_frequency Normalized Space frequency (f / fs)
          */
-        void ProcessSample(float sample);
+        ToneDetector(float mark_frequency, float space_frequency);
 
         /**
-         * Calculate current amplitude
-         * @return Amplitude value
+         * Analyze one window of samples
+         * @param window Input samples
+         * @param size Window size
+         * @return Mark probability (0.0 to 1.0)
          */
-        float GetAmplitude() const;
+        float Process(const int16_t *window, size_t size) const;
     };
 
     /**
@@ -71,31 +94,47 @@ namespace audio_wifi_config
     class AudioSignalProcessor
     {
     private:
-        std::deque<float> input_buffer_;             // Input sample buffer
-        size_t input_buffer_size_;                   // Input buffer size = window size
-        size_t output_sample_count_;                 // Output sample counter
-        size_t samples_per_bit_;                     // Samples per bit threshold
-        std::unique_ptr<FrequencyDetector> mark_detector_;   // Mark frequency detector
-        std::unique_ptr<FrequencyDetector> space_detector_;  // Space frequency detector
+        Resampler resampler_;                   // Input rate to analysis rate
+        ToneDetector tone_detector_;            // Mark and Space detection
+        std::vector<int16_t> window_;           // Samples of the current bit window
+        size_t window_fill_;                    // Samples in the current bit window
+        std::vector<int16_t> shifted_window_;   // Bit window half a window behind, for the MFSK start pattern
+        uint16_t recent_bits_[2];               // Last bit decisions of both windows, all ones until 16 real bits
+        bool mfsk_active_;                      // Receiving an MFSK frame instead of AFSK bits
+        MfskDemodulator mfsk_demodulator_;      // MFSK frame receiver
+
+        /**
+         * Look for the MFSK start pattern in the bit decisions of one window alignment
+         * @param probability Mark probability of the window that just ended
+         * @param bits Bit history of that alignment
+         * @param window The window, the last samples before the frame if the pattern is complete
+         */
+        void DetectMfskStart(float probability, uint16_t &bits, const std::vector<int16_t> &window);
 
     public:
+        std::optional<std::string> decoded_text; // Text of a decoded MFSK frame
+
         /**
          * Constructor
-         * @param sample_rate Audio sampling rate
+         * @param input_sample_rate Sampling rate of the samples passed in
+         * @param sample_rate Analysis sampling rate
          * @param mark_frequency Mark frequency for digital '1'
          * @param space_frequency Space frequency for digital '0'
          * @param bit_rate Data transmission bit rate
          * @param window_size Analysis window size
          */
-        AudioSignalProcessor(size_t sample_rate, size_t mark_frequency, size_t space_frequency,
-                           size_t bit_rate, size_t window_size);
+        AudioSignalProcessor(size_t input_sample_rate, size_t sample_rate, size_t mark_frequency,
+                           size_t space_frequency, size_t bit_rate, size_t window_size);
 
         /**
          * Process input audio samples
-         * @param samples Input audio sample vector
-         * @return Vector of Mark probability values (0.0 to 1.0)
+         * @param samples Input audio samples, only the first channel of interleaved audio is used
+         * @param frames Number of samples per channel
+         * @param channels Number of interleaved channels
+         * @param probabilities Receives one Mark probability value (0.0 to 1.0) per window, none during an MFSK frame
          */
-        std::vector<float> ProcessAudioSamples(const std::vector<float> &samples);
+        void ProcessAudioSamples(const int16_t *samples, size_t frames, size_t channels,
+                                 std::vector<float> &probabilities);
     };
 
     /**
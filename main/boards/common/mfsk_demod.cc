@@ -0,0 +1,317 @@
+#include "mfsk_demod.h"
+#include <cmath>
+#include <algorithm>
+#include "esp_log.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define MFSK_RING_SIZE 512
+#define MFSK_HEADER_SYMBOLS 6
+// Samples the symbol clock is compared against on either side to follow the sender clock
+#define MFSK_TRACKING_OFFSET 4
+
+namespace audio_wifi_config
+{
+    static const char *kLogTag = "AUDIO_WIFI_CONFIG";
+
+    static const uint8_t kSyncSymbols[] = {0, kMfskToneCount - 1, 0, kMfskToneCount - 1};
+
+    // GF(16) with the primitive polynomial x^4 + x + 1
+    namespace
+    {
+        struct GaloisField16
+        {
+            uint8_t exp[30];
+            uint8_t log[16];
+
+            GaloisField16() {
+                uint8_t x = 1;
+                for (int i = 0; i < 15; ++i) {
+                    exp[i] = exp[i + 15] = x;
+                    log[x] = i;
+                    x <<= 1;
+                    if (x & 0x10) {
+                        x ^= 0x13;
+                    }
+                }
+                log[0] = 0;
+            }
+
+            uint8_t Multiply(uint8_t a, uint8_t b) const {
+                return (a == 0 || b == 0) ? 0 : exp[log[a] + log[b]];
+            }
+
+            uint8_t Divide(uint8_t a, uint8_t b) const {
+                return a == 0 ? 0 : exp[(log[a] + 15 - log[b]) % 15];
+            }
+        };
+
+        const GaloisField16 gf;
+    }
+
+    bool ReedSolomon16::Decode(uint8_t *codeword) {
+        const size_t parity = kLength - kDataLength;
+
+        // Syndromes S1..S6, the first symbol is the highest power
+        uint8_t syndromes[parity];
+        bool has_error = false;
+        for (size_t j = 0; j < parity; ++j) {
+            uint8_t value = 0;
+            for (size_t i = 0; i < kLength; ++i) {
+                value = gf.Multiply(value, gf.exp[j + 1]) ^ codeword[i];
+            }
+            syndromes[j] = value;
+            has_error |= value != 0;
+        }
+        if (!has_error) {
+            return true;
+        }
+
+        // Berlekamp-Massey for the error locator
+        uint8_t locator[parity + 1] = {1};
+        uint8_t previous[parity + 1] = {1};
+        size_t errors = 0;
+        size_t shift = 1;
+        uint8_t previous_discrepancy = 1;
+        for (size_t n = 0; n < parity; ++n) {
+            uint8_t discrepancy = syndromes[n];
+            for (size_t i = 1; i <= errors; ++i) {
+                discrepancy ^= gf.Multiply(locator[i], syndromes[n - i]);
+            }
+            if (discrepancy == 0) {
+                shift++;
+                continue;
+            }
+            uint8_t saved[parity + 1];
+            std::copy(locator, locator + parity + 1, saved);
+            uint8_t scale = gf.Divide(discrepancy, previous_discrepancy);
+            for (size_t i = 0; i + shift <= parity; ++i) {
+                locator[i + shift] ^= gf.Multiply(scale, previous[i]);
+            }
+            if (2 * errors <= n) {
+                errors = n + 1 - errors;
+                std::copy(saved, saved + parity + 1, previous);
+                previous_discrepancy = discrepancy;
+                shift = 1;
+            } else {
+                shift++;
+            }
+        }
+
+        // Error evaluator, S(x) * locator(x) mod x^6
+        uint8_t evaluator[parity] = {0};
+        for (size_t i = 0; i < parity; ++i) {
+            for (size_t j = 0; j <= i; ++j) {
+                evaluator[i] ^= gf.Multiply(syndromes[j], locator[i - j]);
+            }
+        }
+
+        // Chien search for the error positions, Forney for the values
+        size_t found = 0;
+        for (size_t position = 0; position < kLength; ++position) {
+            size_t degree = kLength - 1 - position;
+            uint8_t inverse = gf.exp[(15 - degree) % 15];
+            uint8_t value = 0;
+            for (int i = errors; i >= 0; --i) {
+                value = gf.Multiply(value, inverse) ^ locator[i];
+            }
+            if (value != 0) {
+                continue;
+            }
+            found++;
+
+            uint8_t numerator = 0;
+            for (int i = parity - 1; i >= 0; --i) {
+                numerator = gf.Multiply(numerator, inverse) ^ evaluator[i];
+            }
+            // Formal derivative, only the odd powers remain in GF(2^m)
+            uint8_t denominator = 0;
+            for (size_t i = 1; i <= errors; i += 2) {
+                denominator ^= gf.Multiply(locator[i], gf.exp[(gf.log[inverse] * (i - 1)) % 15]);
+            }
+            if (denominator == 0) {
+                return false;
+            }
+            codeword[position] ^= gf.Divide(numerator, denominator);
+        }
+        return found == errors;
+    }
+
+    MfskDemodulator::MfskDemodulator(size_t sample_rate)
+        : state_(State::kSync), ring_(MFSK_RING_SIZE), total_(0), cursor_(0), codeword_count_(0) {
+        for (size_t i = 0; i < kMfskToneCount; ++i) {
+            float frequency = static_cast<float>(kMfskBaseFrequency + i * kMfskToneSpacing) / static_cast<float>(sample_rate);
+            cosines_[i] = static_cast<int32_t>(std::lround(std::cos(2.0f * M_PI * frequency) * 32767.0f));
+        }
+    }
+
+    void MfskDemodulator::Begin(const int16_t *history, size_t size) {
+        state_ = State::kSync;
+        symbols_.clear();
+        decoded_text.reset();
+        total_ = 0;
+        for (size_t i = 0; i < size; ++i) {
+            ring_[total_++ % MFSK_RING_SIZE] = history[i];
+        }
+        cursor_ = total_;
+    }
+
+    bool MfskDemodulator::Process(int16_t sample) {
+        ring_[total_++ % MFSK_RING_SIZE] = sample;
+
+        if (state_ == State::kSync) {
+            // The start pattern was decided within half a symbol of its real end, search that range
+            if (total_ < cursor_ + kMfskSymbolSize / 2 + sizeof(kSyncSymbols) * kMfskSymbolSize) {
+                return true;
+            }
+            if (!Synchronize()) {
+                ESP_LOGW(kLogTag, "MFSK sync not found");
+                return false;
+            }
+            state_ = State::kHeader;
+            return true;
+        }
+
+        if (total_ < cursor_ + kMfskSymbolSize + MFSK_TRACKING_OFFSET) {
+            return true;
+        }
+        symbols_.push_back(DetectSymbol());
+
+        if (state_ == State::kHeader && symbols_.size() == MFSK_HEADER_SYMBOLS) {
+            // The codeword count is sent 3 times, take the majority of each half
+            uint8_t halves[2];
+            for (size_t i = 0; i < 2; ++i) {
+                uint8_t a = symbols_[i], b = symbols_[i + 2], c = symbols_[i + 4];
+                halves[i] = (a == b || a == c) ? a : (b == c ? b : a);
+            }
+            codeword_count_ = (halves[0] << 4) | halves[1];
+            if (codeword_count_ == 0 || codeword_count_ > kMfskMaxCodewords) {
+                ESP_LOGW(kLogTag, "Invalid MFSK codeword count %zu", codeword_count_);
+                return false;
+            }
+            symbols_.clear();
+            state_ = State::kPayload;
+        } else if (state_ == State::kPayload && symbols_.size() == codeword_count_ * ReedSolomon16::kLength) {
+            DecodePayload();
+            return false;
+        }
+        return true;
+    }
+
+    int64_t MfskDemodulator::GetPower(size_t tone, uint32_t start) const {
+        int32_t cosine = cosines_[tone];
+        int32_t s_minus_1 = 0, s_minus_2 = 0;
+        for (size_t i = 0; i < kMfskSymbolSize; ++i) {
+            int32_t s = ring_[(start + i) % MFSK_RING_SIZE] +
+                        static_cast<int32_t>(static_cast<int64_t>(cosine) * s_minus_1 >> 14) - s_minus_2;
+            s_minus_2 = s_minus_1;
+            s_minus_1 = s;
+        }
+        int64_t power = static_cast<int64_t>(s_minus_1) * s_minus_1 + static_cast<int64_t>(s_minus_2) * s_minus_2 -
+                        ((static_cast<int64_t>(cosine) * s_minus_1 >> 14) * s_minus_2);
+        return std::max<int64_t>(power, 0);
+    }
+
+    bool MfskDemodulator::Synchronize() {
+        // Try every offset for the largest share of the sync tones in the power of all tones,
+        // noise spreads over all of them and cannot pass for the sync by chance
+        const int range = kMfskSymbolSize / 2;
+        int best_offset = 0;
+        float best_score = 0.0f;
+        for (int offset = -range; offset <= range; offset += MFSK_TRACKING_OFFSET) {
+            float score = 0.0f;
+            for (size_t i = 0; i < sizeof(kSyncSymbols); ++i) {
+                uint32_t start = cursor_ + offset + i * kMfskSymbolSize;
+                float expected = 0.0f, total = 1.0f;
+                for (size_t tone = 0; tone < kMfskToneCount; ++tone) {
+                    float power = static_cast<float>(GetPower(tone, start));
+                    total += power;
+                    if (tone == kSyncSymbols[i]) {
+                        expected = power;
+                    }
+                }
+                score += expected / total;
+            }
+            if (score > best_score) {
+                best_score = score;
+                best_offset = offset;
+            }
+        }
+        if (best_score < 0.3f * sizeof(kSyncSymbols)) {
+            return false;
+        }
+        cursor_ += best_offset + sizeof(kSyncSymbols) * kMfskSymbolSize;
+        ESP_LOGI(kLogTag, "MFSK sync at offset %d, score %.2f", best_offset, best_score);
+        return true;
+    }
+
+    size_t MfskDemodulator::DetectSymbol() {
+        size_t symbol = 0;
+        int64_t best_power = -1;
+        for (size_t tone = 0; tone < kMfskToneCount; ++tone) {
+            int64_t power = GetPower(tone, cursor_);
+            if (power > best_power) {
+                best_power = power;
+                symbol = tone;
+            }
+        }
+
+        // Early-late gate on the detected tone, moves the symbol clock by one sample at a time
+        int64_t early = GetPower(symbol, cursor_ - MFSK_TRACKING_OFFSET);
+        int64_t late = GetPower(symbol, cursor_ + MFSK_TRACKING_OFFSET);
+        cursor_ += kMfskSymbolSize;
+        if (late > early + (early >> 3)) {
+            cursor_++;
+        } else if (early > late + (late >> 3)) {
+            cursor_--;
+        }
+        return symbol;
+    }
+
+    bool MfskDemodulator::DecodePayload() {
+        // Undo the interleaving, symbol i of every codeword was sent together
+        std::vector<uint8_t> data;
+        data.reserve(codeword_count_ * ReedSolomon16::kDataLength);
+        size_t corrected = 0;
+        for (size_t j = 0; j < codeword_count_; ++j) {
+            uint8_t codeword[ReedSolomon16::kLength];
+            for (size_t i = 0; i < ReedSolomon16::kLength; ++i) {
+                codeword[i] = symbols_[i * codeword_count_ + j];
+            }
+            uint8_t received[ReedSolomon16::kLength];
+            std::copy(codeword, codeword + ReedSolomon16::kLength, received);
+            if (!ReedSolomon16::Decode(codeword)) {
+                ESP_LOGW(kLogTag, "MFSK codeword %zu uncorrectable", j);
+                return false;
+            }
+            for (size_t i = 0; i < ReedSolomon16::kLength; ++i) {
+                corrected += received[i] != codeword[i];
+            }
+            data.insert(data.end(), codeword, codeword + ReedSolomon16::kDataLength);
+        }
+
+        std::vector<uint8_t> bytes;
+        for (size_t i = 0; i + 1 < data.size(); i += 2) {
+            bytes.push_back((data[i] << 4) | data[i + 1]);
+        }
+        size_t length = bytes[0];
+        if (length + 2 > bytes.size()) {
+            ESP_LOGW(kLogTag, "Invalid MFSK length %zu", length);
+            return false;
+        }
+        std::string text(bytes.begin() + 1, bytes.begin() + 1 + length);
+        uint8_t checksum = 0;
+        for (char character : text) {
+            checksum += static_cast<uint8_t>(character);
+        }
+        if (checksum != bytes[length + 1]) {
+            ESP_LOGW(kLogTag, "Checksum mismatch: expected %d, got %d", bytes[length + 1], checksum);
+            return false;
+        }
+        ESP_LOGI(kLogTag, "MFSK frame decoded, %zu symbols corrected", corrected);
+        decoded_text = text;
+        return true;
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <optional>
+#include <cstdint>
+
+// Multi-tone FSK mode of acoustic WiFi provisioning, announced by kMfskStartPattern in AFSK
+// \x01\x05 = 00000001 00000101, legacy receivers only start on \x01\x02 and ignore it
+const uint16_t kMfskStartPattern = 0x0105;
+const size_t kMfskToneCount = 16;           // 4 bits per symbol
+const size_t kMfskBaseFrequency = 1000;     // Tone i is at base + i * spacing
+const size_t kMfskToneSpacing = 100;        // Equals sample rate / symbol size, so the tones are orthogonal
+const size_t kMfskSymbolSize = 64;          // 10 ms at 6400 Hz
+const size_t kMfskMaxCodewords = 24;        // Enough for a 32 byte SSID and a 63 byte password
+
+namespace audio_wifi_config
+{
+    /**
+     * Reed-Solomon RS(15, 9) over GF(16), one 4-bit symbol per tone
+     * Corrects up to 3 symbol errors per codeword
+     */
+    class ReedSolomon16
+    {
+    public:
+        static const size_t kLength = 15;
+        static const size_t kDataLength = 9;
+
+        /**
+         * Correct a codeword in place, data symbols first
+         * @param codeword kLength symbols
+         * @return false if the errors cannot be corrected
+         */
+        static bool Decode(uint8_t *codeword);
+    };
+
+    /**
+     * MFSK frame receiver, fed with samples at the analysis rate right after the start pattern
+     *
+     * Frame: 4 sync symbols, the codeword count as 2 symbols sent 3 times, then the codewords
+     * interleaved symbol by symbol. The data is [length][text][checksum] as 4-bit symbols, high half first.
+     */
+    class MfskDemodulator
+    {
+    private:
+        enum class State
+        {
+            kSync,
+            kHeader,
+            kPayload,
+        };
+
+        State state_;
+        int32_t cosines_[kMfskToneCount];   // cos(w) of every tone in Q15
+        std::vector<int16_t> ring_;         // Recent samples, indexed by the absolute sample count
+        uint32_t total_;                    // Samples received
+        uint32_t cursor_;                   // Start of the next symbol
+        size_t codeword_count_;
+        std::vector<uint8_t> symbols_;
+
+        int64_t GetPower(size_t tone, uint32_t start) const;
+        size_t DetectSymbol();
+        bool Synchronize();
+        bool DecodePayload();
+
+    public:
+        std::optional<std::string> decoded_text;    // Successfully decoded text data
+
+        /**
+         * Constructor
+         * @param sample_rate Analysis sampling rate
+         */
+        MfskDemodulator(size_t sample_rate);
+
+        /**
+         * Start receiving a frame
+         * @param history The samples just before the frame is expected, at least half a symbol
+         * @param size Number of history samples
+         */
+        void Begin(const int16_t *history, size_t size);
+
+        /**
+         * Process one sample
+         * @return false once the frame is decoded or lost
+         */
+        bool Process(int16_t sample);
+    };
+}
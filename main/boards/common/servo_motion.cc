@@ -0,0 +1,222 @@
+#include "servo_motion.h"
+
+#include <esp_log.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#define TAG "ServoMotion"
+
+#define SINE_TABLE_BITS 8
+#define SINE_TABLE_SIZE (1 << SINE_TABLE_BITS)
+// Phase bits below the table index, used to interpolate between two entries
+#define SINE_FRACTION_BITS (14 - SINE_TABLE_BITS)
+
+namespace {
+
+// One quarter of a sine wave in Q15, with the end point so interpolation never wraps
+struct SineTable {
+    int16_t values[SINE_TABLE_SIZE + 1];
+
+    SineTable() {
+        for (int i = 0; i <= SINE_TABLE_SIZE; i++) {
+            values[i] = (int16_t)std::lround(std::sin(M_PI / 2 * i / SINE_TABLE_SIZE) * 32767);
+        }
+    }
+};
+
+const SineTable sine_table;
+
+}  // namespace
+
+ServoPhase ServoPhaseFromRadians(double radians) {
+    return (ServoPhase)(int32_t)std::lround(radians * 65536 / (2 * M_PI));
+}
+
+int32_t ServoSin(ServoPhase phase) {
+    int quadrant = phase >> 14;
+    uint32_t offset = phase & 0x3FFF;
+    if (quadrant & 1) {
+        offset = 0x4000 - offset;
+    }
+    uint32_t index = offset >> SINE_FRACTION_BITS;
+    int32_t value = sine_table.values[index];
+    if (index < SINE_TABLE_SIZE) {
+        int32_t fraction = offset & ((1 << SINE_FRACTION_BITS) - 1);
+        value += ((sine_table.values[index + 1] - value) * fraction) >> SINE_FRACTION_BITS;
+    }
+    return quadrant & 2 ? -value : value;
+}
+
+ServoMotion::ServoMotion(int servo_count, std::function<void(int servo, int position)> write)
+    : servo_count_(std::min(servo_count, SERVO_MOTION_MAX_SERVOS)), write_(write) {
+    for (int i = 0; i < SERVO_MOTION_MAX_SERVOS; i++) {
+        start_[i] = current_[i] = planned_[i] = 90;
+    }
+
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            auto motion = static_cast<ServoMotion*>(arg);
+            motion->OnTick();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "servo_motion",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer_));
+}
+
+ServoMotion::~ServoMotion() {
+    if (timer_ != nullptr) {
+        esp_timer_stop(timer_);
+        esp_timer_delete(timer_);
+    }
+}
+
+void ServoMotion::Move(int time_ms, const int target[]) {
+    ServoSegment segment = {};
+    segment.type = ServoSegment::kMove;
+    segment.duration_ms = std::max(time_ms, 0);
+    for (int i = 0; i < servo_count_; i++) {
+        segment.position[i] = target[i];
+    }
+    Push(segment);
+}
+
+void ServoMotion::Oscillate(const int amplitude[], const int offset[], int period_ms, const double phase_diff[],
+                            float cycles) {
+    if (period_ms <= 0 || cycles <= 0) {
+        return;
+    }
+    ServoSegment segment = {};
+    segment.type = ServoSegment::kOscillate;
+    segment.period_ms = period_ms;
+    segment.duration_ms = std::lround(period_ms * cycles);
+    for (int i = 0; i < servo_count_; i++) {
+        segment.position[i] = 90 + offset[i];
+        segment.amplitude[i] = amplitude[i];
+        segment.phase[i] = ServoPhaseFromRadians(phase_diff[i]);
+    }
+
+    // Blend into the first sample instead of jumping there
+    int distance = 0;
+    int first[SERVO_MOTION_MAX_SERVOS];
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int i = 0; i < servo_count_; i++) {
+            first[i] = Sample(segment, i, 0);
+            distance = std::max(distance, std::abs(first[i] - planned_[i]));
+        }
+    }
+    if (distance > 1) {
+        Move(distance * 1000 / SERVO_MOTION_BLEND_DEG_PER_SEC, first);
+    }
+    Push(segment);
+}
+
+void ServoMotion::Hold(int time_ms) {
+    ServoSegment segment = {};
+    segment.type = ServoSegment::kHold;
+    segment.duration_ms = std::max(time_ms, 0);
+    Push(segment);
+}
+
+void ServoMotion::SetPosition(int servo, int position) {
+    if (servo < 0 || servo >= servo_count_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    current_[servo] = start_[servo] = position;
+    if (segments_.empty()) {
+        planned_[servo] = position;
+    }
+    write_(servo, position);
+}
+
+void ServoMotion::Preempt() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    segments_.clear();
+    std::copy(current_, current_ + servo_count_, planned_);
+}
+
+bool ServoMotion::IsIdle() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return segments_.empty();
+}
+
+int ServoMotion::GetPlannedPosition(int servo) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return planned_[servo];
+}
+
+void ServoMotion::Push(const ServoSegment& segment) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    segments_.push_back(segment);
+    for (int i = 0; i < servo_count_; i++) {
+        if (segment.type != ServoSegment::kHold) {
+            planned_[i] = Sample(segment, i, segment.duration_ms);
+        }
+    }
+
+    if (segments_.size() == 1) {
+        segment_start_ms_ = esp_timer_get_time() / 1000;
+        BeginSegment();
+    }
+    if (!running_) {
+        running_ = true;
+        ESP_ERROR_CHECK(esp_timer_start_periodic(timer_, SERVO_MOTION_TICK_MS * 1000));
+    }
+}
+
+void ServoMotion::BeginSegment() {
+    std::copy(current_, current_ + servo_count_, start_);
+}
+
+int ServoMotion::Sample(const ServoSegment& segment, int servo, uint32_t elapsed_ms) {
+    switch (segment.type) {
+        case ServoSegment::kMove: {
+            if (segment.duration_ms == 0) {
+                return segment.position[servo];
+            }
+            int delta = segment.position[servo] - start_[servo];
+            return start_[servo] + delta * (int32_t)elapsed_ms / (int32_t)segment.duration_ms;
+        }
+        case ServoSegment::kOscillate: {
+            uint32_t position = elapsed_ms % segment.period_ms;
+            ServoPhase phase = segment.phase[servo] + (ServoPhase)((position << 16) / segment.period_ms);
+            return segment.position[servo] + ((segment.amplitude[servo] * ServoSin(phase) + (1 << 14)) >> 15);
+        }
+        default:
+            return current_[servo];
+    }
+}
+
+void ServoMotion::OnTick() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now_ms = esp_timer_get_time() / 1000;
+
+    while (!segments_.empty()) {
+        auto& segment = segments_.front();
+        int64_t elapsed_ms = now_ms - segment_start_ms_;
+        // Land exactly on the end of a finished segment before the next one starts from there
+        uint32_t sample_ms = std::min<int64_t>(elapsed_ms, segment.duration_ms);
+        for (int i = 0; i < servo_count_; i++) {
+            int position = Sample(segment, i, sample_ms);
+            if (position != current_[i]) {
+                current_[i] = position;
+                write_(i, position);
+            }
+        }
+        if (elapsed_ms < segment.duration_ms) {
+            return;
+        }
+        segment_start_ms_ += segment.duration_ms;
+        segments_.pop_front();
+        BeginSegment();
+    }
+
+    running_ = false;
+    esp_timer_stop(timer_);
+}
@@ -0,0 +1,82 @@
+#ifndef _SERVO_MOTION_H_
+#define _SERVO_MOTION_H_
+
+#include <esp_timer.h>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+// All servos are refreshed together at this interval, the servo PWM itself only runs at 50Hz
+#define SERVO_MOTION_TICK_MS 10
+#define SERVO_MOTION_MAX_SERVOS 8
+// Speed of the move inserted when an oscillation does not start where the servos are
+#define SERVO_MOTION_BLEND_DEG_PER_SEC 360
+
+// Phase in 1/65536 of a turn, wraps around by itself
+typedef uint16_t ServoPhase;
+
+ServoPhase ServoPhaseFromRadians(double radians);
+// sin() in Q15, looked up from a quarter wave table
+int32_t ServoSin(ServoPhase phase);
+
+/*
+ * A piece of a trajectory, precomputed when it is queued so the tick only does integer math.
+ * Positions are servo angles, 90 is the center.
+ */
+struct ServoSegment {
+    enum Type {
+        kHold,
+        kMove,
+        kOscillate,
+    };
+    Type type;
+    uint32_t duration_ms;
+    uint32_t period_ms;
+    int16_t position[SERVO_MOTION_MAX_SERVOS];   // kMove: the target, kOscillate: the center
+    int16_t amplitude[SERVO_MOTION_MAX_SERVOS];
+    ServoPhase phase[SERVO_MOTION_MAX_SERVOS];
+};
+
+/*
+ * Plays the queued segments back to back from one timer, so a gait is timed by the timer
+ * instead of by a task polling the servos. Queuing returns at once; the caller can preempt
+ * the rest of the trajectory at any time and the next segment starts from the current pose.
+ */
+class ServoMotion {
+public:
+    ServoMotion(int servo_count, std::function<void(int servo, int position)> write);
+    ~ServoMotion();
+
+    void Move(int time_ms, const int target[]);
+    void Oscillate(const int amplitude[], const int offset[], int period_ms, const double phase_diff[], float cycles);
+    void Hold(int time_ms);
+    // Moves one servo right away, the others keep their trajectories
+    void SetPosition(int servo, int position);
+    // Drops the queued segments, the servos stay where they are
+    void Preempt();
+
+    bool IsIdle();
+    // Where the servo will be when the queued segments are done
+    int GetPlannedPosition(int servo);
+
+private:
+    int servo_count_;
+    std::function<void(int servo, int position)> write_;
+    std::mutex mutex_;
+    std::deque<ServoSegment> segments_;
+    int64_t segment_start_ms_ = 0;
+    int16_t start_[SERVO_MOTION_MAX_SERVOS];
+    int16_t current_[SERVO_MOTION_MAX_SERVOS];
+    int16_t planned_[SERVO_MOTION_MAX_SERVOS];
+    esp_timer_handle_t timer_ = nullptr;
+    bool running_ = false;
+
+    void Push(const ServoSegment& segment);
+    void BeginSegment();
+    int Sample(const ServoSegment& segment, int servo, uint32_t elapsed_ms);
+    void OnTick();
+};
+
+#endif // _SERVO_MOTION_H_
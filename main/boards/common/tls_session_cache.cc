@@ -0,0 +1,285 @@
+#include <sdkconfig.h>
+
+#if CONFIG_USE_TLS_SESSION_CACHE
+
+#include "tls_session_cache.h"
+
+#include <http_client.h>
+#include <web_socket.h>
+#include <esp_crt_bundle.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <fcntl.h>
+#include <cstring>
+
+#define TAG "TlsSessionCache"
+
+#define CACHED_SSL_RECEIVE_TASK_EXITED (1 << 0)
+
+static void FreeClientSession(esp_tls_client_session_t* session) {
+    esp_tls_free_client_session(session);
+}
+
+std::shared_ptr<esp_tls_client_session_t> TlsSessionCache::Get(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->key == key) {
+            entries_.splice(entries_.begin(), entries_, it);
+            return it->session;
+        }
+    }
+    return nullptr;
+}
+
+void TlsSessionCache::Put(const std::string& key, esp_tls_client_session_t* session) {
+    // The connections still using the old session keep it alive until they finish the handshake
+    std::shared_ptr<esp_tls_client_session_t> shared(session, FreeClientSession);
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.remove_if([&key](const Entry& entry) { return entry.key == key; });
+    entries_.push_front(Entry{key, shared});
+    while (entries_.size() > TLS_SESSION_CACHE_MAX_ENTRIES) {
+        entries_.pop_back();
+    }
+}
+
+void TlsSessionCache::Remove(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.remove_if([&key](const Entry& entry) { return entry.key == key; });
+}
+
+void TlsSessionCache::RecordHandshake(const std::string& key, TlsHandshakeType type, int64_t duration_us) {
+    static const char* const kTypeNames[] = {"full", "resumed", "ticket presented"};
+    std::lock_guard<std::mutex> lock(mutex_);
+    handshakes_[type]++;
+    handshake_us_[type] += duration_us;
+    auto average_ms = [this](int i) {
+        return handshakes_[i] > 0 ? handshake_us_[i] / handshakes_[i] / 1000 : 0;
+    };
+    ESP_LOGI(TAG, "Handshake with %s in %lld ms, %s (full: %lu avg %lld ms, resumed: %lu avg %lld ms, "
+        "ticket presented: %lu avg %lld ms)", key.c_str(), duration_us / 1000, kTypeNames[type],
+        handshakes_[kTlsHandshakeFull], average_ms(kTlsHandshakeFull),
+        handshakes_[kTlsHandshakeResumed], average_ms(kTlsHandshakeResumed),
+        handshakes_[kTlsHandshakeTicketPresented], average_ms(kTlsHandshakeTicketPresented));
+}
+
+CachedSsl::CachedSsl() {
+    event_group_ = xEventGroupCreate();
+    xEventGroupSetBits(event_group_, CACHED_SSL_RECEIVE_TASK_EXITED);
+}
+
+CachedSsl::~CachedSsl() {
+    Disconnect();
+    vEventGroupDelete(event_group_);
+}
+
+bool CachedSsl::Connect(const std::string& host, int port) {
+    if (tls_ != nullptr) {
+        Disconnect();
+    }
+
+    auto& cache = TlsSessionCache::GetInstance();
+    auto key = host + ":" + std::to_string(port);
+    auto session = cache.Get(key);
+
+    esp_tls_cfg_t cfg = {};
+    cfg.crt_bundle_attach = esp_crt_bundle_attach;
+    cfg.client_session = session.get();
+
+    tls_ = esp_tls_init();
+    if (tls_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to initialize TLS");
+        return false;
+    }
+
+    auto start_time = esp_timer_get_time();
+    if (esp_tls_conn_new_sync(host.c_str(), host.length(), port, &cfg, tls_) != 1) {
+        ESP_LOGE(TAG, "Failed to connect to %s", key.c_str());
+        esp_tls_conn_destroy(tls_);
+        tls_ = nullptr;
+        // The server may have rejected the session, start over with a full handshake next time
+        cache.Remove(key);
+        return false;
+    }
+    auto duration = esp_timer_get_time() - start_time;
+
+    // In TLS 1.2 a server accepting the offered session (by ID or by ticket) echoes its session ID.
+    // TLS 1.3 has no session ID to tell, and mbedtls frees its resumption state with the handshake
+    auto new_session = esp_tls_get_client_session(tls_);
+    auto type = kTlsHandshakeFull;
+    if (session != nullptr) {
+        auto ssl = (mbedtls_ssl_context*)esp_tls_get_ssl_context(tls_);
+        if (ssl != nullptr && mbedtls_ssl_get_version_number(ssl) == MBEDTLS_SSL_VERSION_TLS1_3) {
+            type = kTlsHandshakeTicketPresented;
+        } else if (new_session != nullptr) {
+            auto& offered = session->saved_session;
+            auto& accepted = new_session->saved_session;
+            if (offered.MBEDTLS_PRIVATE(id_len) > 0 &&
+                offered.MBEDTLS_PRIVATE(id_len) == accepted.MBEDTLS_PRIVATE(id_len) &&
+                memcmp(offered.MBEDTLS_PRIVATE(id), accepted.MBEDTLS_PRIVATE(id), offered.MBEDTLS_PRIVATE(id_len)) == 0) {
+                type = kTlsHandshakeResumed;
+            }
+        }
+    }
+    cache.RecordHandshake(key, type, duration);
+    if (new_session != nullptr) {
+        cache.Put(key, new_session);
+    }
+
+    // The receive task waits in select(), so reads and writes must not block while holding the connection
+    int sockfd = -1;
+    if (esp_tls_get_conn_sockfd(tls_, &sockfd) == ESP_OK && sockfd >= 0) {
+        fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    alive_ = true;
+    connected_ = true;
+    xEventGroupClearBits(event_group_, CACHED_SSL_RECEIVE_TASK_EXITED);
+    xTaskCreate([](void* arg) {
+        auto this_ = (CachedSsl*)arg;
+        // Sets CACHED_SSL_RECEIVE_TASK_EXITED itself, the object may be gone when it returns
+        this_->ReceiveTask();
+        vTaskDelete(NULL);
+    }, "ssl_receive", 4096, this, 1, &receive_task_handle_);
+    return true;
+}
+
+void CachedSsl::Disconnect() {
+    alive_ = false;
+    connected_ = false;
+    if (tls_ == nullptr) {
+        return;
+    }
+
+    // Wake up the receive task, then wait for it before destroying the connection
+    int sockfd = -1;
+    if (esp_tls_get_conn_sockfd(tls_, &sockfd) == ESP_OK && sockfd >= 0) {
+        shutdown(sockfd, SHUT_RDWR);
+    }
+    if (xTaskGetCurrentTaskHandle() == receive_task_handle_ &&
+        !(xEventGroupGetBits(event_group_) & CACHED_SSL_RECEIVE_TASK_EXITED)) {
+        // Called from a stream callback, the receive task still reads from the connection.
+        // It stops after the callback, the next Disconnect() or the destructor destroys the connection
+        return;
+    }
+    xEventGroupWaitBits(event_group_, CACHED_SSL_RECEIVE_TASK_EXITED, pdFALSE, pdTRUE, portMAX_DELAY);
+    std::lock_guard<std::mutex> lock(tls_mutex_);
+    esp_tls_conn_destroy(tls_);
+    tls_ = nullptr;
+}
+
+int CachedSsl::Send(const std::string& data) {
+    size_t total_sent = 0;
+    while (total_sent < data.size()) {
+        int ret;
+        {
+            std::lock_guard<std::mutex> lock(tls_mutex_);
+            if (!alive_ || tls_ == nullptr) {
+                return -1;
+            }
+            ret = esp_tls_conn_write(tls_, data.data() + total_sent, data.size() - total_sent);
+        }
+        if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+            // Let the receive task have the connection meanwhile
+            vTaskDelay(pdMS_TO_TICKS(CACHED_SSL_SEND_RETRY_MS));
+            continue;
+        }
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to send data: %d", ret);
+            return ret;
+        }
+        total_sent += ret;
+    }
+    return total_sent;
+}
+
+// Waits until the socket has data or is shut down, false on a timeout or an error.
+// The TLS layer may already hold a decrypted record, then there is nothing to wait for
+bool CachedSsl::WaitReadable() {
+    int sockfd = -1;
+    {
+        std::lock_guard<std::mutex> lock(tls_mutex_);
+        if (esp_tls_get_bytes_avail(tls_) > 0) {
+            return true;
+        }
+        if (esp_tls_get_conn_sockfd(tls_, &sockfd) != ESP_OK || sockfd < 0) {
+            return false;
+        }
+    }
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(sockfd, &read_fds);
+    struct timeval timeout = {
+        .tv_sec = CACHED_SSL_RECEIVE_POLL_MS / 1000,
+        .tv_usec = (CACHED_SSL_RECEIVE_POLL_MS % 1000) * 1000,
+    };
+    return select(sockfd + 1, &read_fds, nullptr, nullptr, &timeout) > 0;
+}
+
+void CachedSsl::ReceiveTask() {
+    std::string data;
+    data.resize(1500);
+    while (alive_) {
+        if (!WaitReadable()) {
+            continue;
+        }
+        int ret;
+        {
+            std::lock_guard<std::mutex> lock(tls_mutex_);
+            ret = esp_tls_conn_read(tls_, data.data(), data.size());
+        }
+        if (ret == ESP_TLS_ERR_SSL_WANT_READ) {
+            // Part of a record, select() waits for the rest
+            continue;
+        }
+        if (ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+            vTaskDelay(pdMS_TO_TICKS(CACHED_SSL_SEND_RETRY_MS));
+            continue;
+        }
+        if (ret <= 0) {
+            if (alive_.exchange(false)) {
+                connected_ = false;
+                if (disconnect_callback_) {
+                    // The callback may disconnect or delete this object, so the task is done with it before
+                    auto callback = disconnect_callback_;
+                    xEventGroupSetBits(event_group_, CACHED_SSL_RECEIVE_TASK_EXITED);
+                    callback();
+                    return;
+                }
+            }
+            break;
+        }
+        if (stream_callback_) {
+            stream_callback_(data.substr(0, ret));
+        }
+    }
+    xEventGroupSetBits(event_group_, CACHED_SSL_RECEIVE_TASK_EXITED);
+}
+
+std::unique_ptr<Http> TlsSessionCacheNetwork::CreateHttp(int connect_id) {
+    // The clients create their transport through this network, so HTTPS uses CachedSsl
+    return std::make_unique<HttpClient>(this, connect_id);
+}
+
+std::unique_ptr<Tcp> TlsSessionCacheNetwork::CreateTcp(int connect_id) {
+    return network_->CreateTcp(connect_id);
+}
+
+std::unique_ptr<Tcp> TlsSessionCacheNetwork::CreateSsl(int connect_id) {
+    return std::make_unique<CachedSsl>();
+}
+
+std::unique_ptr<Udp> TlsSessionCacheNetwork::CreateUdp(int connect_id) {
+    return network_->CreateUdp(connect_id);
+}
+
+std::unique_ptr<Mqtt> TlsSessionCacheNetwork::CreateMqtt(int connect_id) {
+    return network_->CreateMqtt(connect_id);
+}
+
+std::unique_ptr<WebSocket> TlsSessionCacheNetwork::CreateWebSocket(int connect_id) {
+    return std::make_unique<WebSocket>(this, connect_id);
+}
+
+#endif // CONFIG_USE_TLS_SESSION_CACHE
@@ -0,0 +1,113 @@
+#ifndef TLS_SESSION_CACHE_H
+#define TLS_SESSION_CACHE_H
+
+#include <network_interface.h>
+#include <tcp.h>
+#include <esp_tls.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+
+#include <string>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <atomic>
+
+#define TLS_SESSION_CACHE_MAX_ENTRIES 4
+// Wait before retrying a write the TLS layer could not take yet
+#define CACHED_SSL_SEND_RETRY_MS 10
+// Longest wait of the receive task for incoming data, before it checks whether it should stop
+#define CACHED_SSL_RECEIVE_POLL_MS 1000
+
+// How a handshake went. Whether TLS 1.3 resumed with the ticket offered is not exposed by mbedtls,
+// so such handshakes only count as presenting a ticket
+enum TlsHandshakeType {
+    kTlsHandshakeFull,
+    kTlsHandshakeResumed,
+    kTlsHandshakeTicketPresented,
+    kTlsHandshakeTypeCount,
+};
+
+/*
+ * Saved TLS sessions keyed by host:port. A connection offers the saved session
+ * (session ID and session ticket) to skip the full handshake. The cache lives in RAM,
+ * so it survives light sleep but not a reboot or deep sleep.
+ */
+class TlsSessionCache {
+public:
+    static TlsSessionCache& GetInstance() {
+        static TlsSessionCache instance;
+        return instance;
+    }
+    // Delete copy constructor and assignment operator
+    TlsSessionCache(const TlsSessionCache&) = delete;
+    TlsSessionCache& operator=(const TlsSessionCache&) = delete;
+
+    std::shared_ptr<esp_tls_client_session_t> Get(const std::string& key);
+    void Put(const std::string& key, esp_tls_client_session_t* session);
+    void Remove(const std::string& key);
+
+    // Logs the handshake with the count and the average duration of each type
+    void RecordHandshake(const std::string& key, TlsHandshakeType type, int64_t duration_us);
+
+private:
+    TlsSessionCache() = default;
+
+    struct Entry {
+        std::string key;
+        std::shared_ptr<esp_tls_client_session_t> session;
+    };
+
+    std::mutex mutex_;
+    std::list<Entry> entries_;  // Most recently used first
+    uint32_t handshakes_[kTlsHandshakeTypeCount] = {};
+    int64_t handshake_us_[kTlsHandshakeTypeCount] = {};
+};
+
+/*
+ * TLS transport using esp_tls with the session cache, replaces the transport of EspNetwork
+ */
+class CachedSsl : public Tcp {
+public:
+    CachedSsl();
+    ~CachedSsl();
+
+    bool Connect(const std::string& host, int port) override;
+    void Disconnect() override;
+    int Send(const std::string& data) override;
+
+private:
+    esp_tls_t* tls_ = nullptr;
+    EventGroupHandle_t event_group_;
+    TaskHandle_t receive_task_handle_ = nullptr;
+    // Shared by the receive task and the callers, connected_ of Tcp mirrors it for connected()
+    std::atomic<bool> alive_ = false;
+    // esp_tls is not thread safe, the receive task, Send() and Disconnect() take turns on the connection.
+    // The socket is non-blocking, so nobody holds it while waiting for the network
+    std::mutex tls_mutex_;
+
+    void ReceiveTask();
+    bool WaitReadable();
+};
+
+/*
+ * Wraps a NetworkInterface, so that HTTP and WebSocket clients created by the board use CachedSsl.
+ * UDP and MQTT clients are created by the wrapped network.
+ */
+class TlsSessionCacheNetwork : public NetworkInterface {
+public:
+    explicit TlsSessionCacheNetwork(NetworkInterface* network) : network_(network) {}
+
+    std::unique_ptr<Http> CreateHttp(int connect_id = -1) override;
+    std::unique_ptr<Tcp> CreateTcp(int connect_id = -1) override;
+    std::unique_ptr<Tcp> CreateSsl(int connect_id = -1) override;
+    std::unique_ptr<Udp> CreateUdp(int connect_id = -1) override;
+    std::unique_ptr<Mqtt> CreateMqtt(int connect_id = -1) override;
+    std::unique_ptr<WebSocket> CreateWebSocket(int connect_id = -1) override;
+
+private:
+    NetworkInterface* network_;
+};
+
+#endif // TLS_SESSION_CACHE_H
@@ -16,6 +16,9 @@
 #include <wifi_configuration_ap.h>
 #include <ssid_manager.h>
 #include "afsk_demod.h"
+#if CONFIG_USE_TLS_SESSION_CACHE
+#include "tls_session_cache.h"
+#endif
 
 static const char *TAG = "WifiBoard";
 
@@ -118,7 +121,12 @@ void WifiBoard::StartNetwork() {
 
 NetworkInterface* WifiBoard::GetNetwork() {
     static EspNetwork network;
+#if CONFIG_USE_TLS_SESSION_CACHE
+    static TlsSessionCacheNetwork cached_network(&network);
+    return &cached_network;
+#else
     return &network;
+#endif
 }
 
 const char* WifiBoard::GetNetworkStateIcon() {
@@ -95,9 +95,17 @@ private:
                     // 复位动作
                     controller->electron_bot_.Home(true);
                 }
+
+                // 动作已排入运动引擎，等待其完成；期间来了新动作就中断当前动作，从当前姿态接着做新动作
+                ElectronBotActionParams next;
+                while (controller->electron_bot_.IsMoving()) {
+                    if (xQueuePeek(controller->action_queue_, &next, pdMS_TO_TICKS(50)) == pdTRUE) {
+                        controller->electron_bot_.Preempt();
+                        break;
+                    }
+                }
                 controller->is_action_in_progress_ = false;  // 动作执行完毕
             }
-            vTaskDelay(pdMS_TO_TICKS(20));
         }
     }
 
@@ -112,8 +120,8 @@ private:
 
     void StartActionTaskIfNeeded() {
         if (action_task_handle_ == nullptr) {
-            xTaskCreate(ActionTask, "electron_bot_action", 1024 * 4, this, configMAX_PRIORITIES - 1,
-                        &action_task_handle_);
+            // 舵机由运动引擎的定时器驱动，动作任务只负责排队，不需要高优先级
+            xTaskCreate(ActionTask, "electron_bot_action", 1024 * 4, this, 4, &action_task_handle_);
         }
     }
 
@@ -251,6 +259,7 @@ public:
                            [this](const PropertyList& properties) -> ReturnValue {
                                // 清空队列但保持任务常驻
                                xQueueReset(action_queue_);
+                               electron_bot_.Preempt();
                                is_action_in_progress_ = false;
                                QueueAction(ACTION_HOME, 1, 1000, 0, 0);
                                return true;
@@ -40,6 +40,7 @@ private:
     void SetupGifContainer();
 
     lv_obj_t* emotion_gif_;  ///< GIF表情组件
+    const void* current_gif_ = nullptr;  ///< 当前播放的GIF，相同时不重新解码
 
     // 表情映射
     struct EmotionMap {
@@ -7,6 +7,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "oscillator.h"
+#include "servo_motion.h"
 
 //-- Constants
 #define FORWARD 1
@@ -56,6 +57,11 @@ public:
     bool GetRestState();
     void SetRestState(bool state);
 
+    //-- The motions below only queue their trajectory and return at once
+    bool IsMoving();
+    // Stops the queued trajectory where it is, the next motion starts from there
+    void Preempt();
+
     // -- 手部动作
     void HandAction(int action, int times = 1, int amount = 30, int period = 1000);
     // action: 1=举左手, 2=举右手, 3=举双手, 4=放左手, 5=放右手, 6=放双手, 7=挥左手, 8=挥右手,
@@ -71,15 +77,12 @@ public:
 
 private:
     Oscillator servo_[SERVO_COUNT];
+    ServoMotion motion_;
 
     int servo_pins_[SERVO_COUNT];
     int servo_trim_[SERVO_COUNT];
     int servo_initial_[SERVO_COUNT] = {180, 180, 0, 0, 90, 90};
 
-    unsigned long final_time_;
-    unsigned long partial_time_;
-    float increment_[SERVO_COUNT];
-
     bool is_otto_resting_;
 
     void Execute(int amplitude[SERVO_COUNT], int offset[SERVO_COUNT], int period,
@@ -196,6 +196,7 @@ void AdcPdmAudioCodec::Start() {
         output_volume_ = 10;
     }
 
+    EnableOutputClock();
     ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
 
     EnableInput(true);
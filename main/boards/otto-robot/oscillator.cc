@@ -4,7 +4,6 @@
 #include <esp_timer.h>
 
 #include <algorithm>
-#include <cmath>
 
 static const char* TAG = "Oscillator";
 
@@ -19,8 +18,7 @@ Oscillator::Oscillator(int trim) {
 
     sampling_period_ = 30;
     period_ = 2000;
-    number_samples_ = period_ / sampling_period_;
-    inc_ = 2 * M_PI / number_samples_;
+    inc_ = (65536 * sampling_period_) / period_;
 
     amplitude_ = 45;
     phase_ = 0;
@@ -101,10 +99,8 @@ void Oscillator::Detach() {
 }
 
 void Oscillator::SetT(unsigned int T) {
-    period_ = T;
-
-    number_samples_ = period_ / sampling_period_;
-    inc_ = 2 * M_PI / number_samples_;
+    period_ = std::max(T, sampling_period_);
+    inc_ = (65536 * sampling_period_) / period_;
 }
 
 void Oscillator::SetPosition(int position) {
@@ -114,13 +110,14 @@ void Oscillator::SetPosition(int position) {
 void Oscillator::Refresh() {
     if (NextSample()) {
         if (!stop_) {
-            int pos = std::round(amplitude_ * std::sin(phase_ + phase0_) + offset_);
+            ServoPhase phase = phase_ + phase0_;
+            int pos = (((int)amplitude_ * ServoSin(phase) + (1 << 14)) >> 15) + offset_;
             if (rev_)
                 pos = -pos;
             Write(pos + 90);
         }
 
-        phase_ = phase_ + inc_;
+        phase_ += inc_;
     }
 }
 
@@ -146,7 +143,8 @@ void Oscillator::Write(int position) {
 
     angle = std::min(std::max(angle, 0), 180);
 
-    uint32_t duty = (uint32_t)(((angle / 180.0) * 2.0 + 0.5) * 8191 / 20.0);
+    uint32_t pulse_us = SERVO_MIN_PULSEWIDTH_US + angle * (SERVO_MAX_PULSEWIDTH_US - SERVO_MIN_PULSEWIDTH_US) / 180;
+    uint32_t duty = pulse_us * 8191 / SERVO_TIMEBASE_PERIOD;
 
     ESP_ERROR_CHECK(ledc_set_duty(ledc_speed_mode_, ledc_channel_, duty));
     ESP_ERROR_CHECK(ledc_update_duty(ledc_speed_mode_, ledc_channel_));
@@ -130,16 +130,24 @@ private:
                 if (params.action_type != ACTION_HOME) {
                     controller->otto_.Home(params.action_type < ACTION_HANDS_UP);
                 }
+
+                // 动作已排入运动引擎，等待其完成；期间来了新动作就中断当前动作，从当前姿态接着做新动作
+                OttoActionParams next;
+                while (controller->otto_.IsMoving()) {
+                    if (xQueuePeek(controller->action_queue_, &next, pdMS_TO_TICKS(50)) == pdTRUE) {
+                        controller->otto_.Preempt();
+                        break;
+                    }
+                }
                 controller->is_action_in_progress_ = false;
-                vTaskDelay(pdMS_TO_TICKS(20));
             }
         }
     }
 
     void StartActionTaskIfNeeded() {
         if (action_task_handle_ == nullptr) {
-            xTaskCreate(ActionTask, "otto_action", 1024 * 3, this, configMAX_PRIORITIES - 1,
-                        &action_task_handle_);
+            // 舵机由运动引擎的定时器驱动，动作任务只负责排队，不需要高优先级
+            xTaskCreate(ActionTask, "otto_action", 1024 * 3, this, 4, &action_task_handle_);
         }
     }
 
@@ -358,12 +366,8 @@ public:
         // 系统工具
         mcp_server.AddTool("self.otto.stop", "立即停止", PropertyList(),
                            [this](const PropertyList& properties) -> ReturnValue {
-                               if (action_task_handle_ != nullptr) {
-                                   vTaskDelete(action_task_handle_);
-                                   action_task_handle_ = nullptr;
-                               }
-                               is_action_in_progress_ = false;
                                xQueueReset(action_queue_);
+                               otto_.Preempt();
 
                                QueueAction(ACTION_HOME, 1, 1000, 1, 0);
                                return true;
@@ -93,6 +93,7 @@ void OttoEmojiDisplay::SetupGifContainer() {
     lv_obj_set_style_bg_opa(emotion_gif_, LV_OPA_TRANSP, 0);
     lv_obj_center(emotion_gif_);
     lv_gif_set_src(emotion_gif_, &staticstate);
+    current_gif_ = &staticstate;
 
     chat_message_label_ = lv_label_create(content_);
     lv_label_set_text(chat_message_label_, "");
@@ -120,13 +121,19 @@ void OttoEmojiDisplay::SetEmotion(const char* emotion) {
 
     for (const auto& map : emotion_maps_) {
         if (map.name && strcmp(map.name, emotion) == 0) {
-            lv_gif_set_src(emotion_gif_, map.gif);
+            if (current_gif_ != map.gif) {
+                lv_gif_set_src(emotion_gif_, map.gif);
+                current_gif_ = map.gif;
+            }
             ESP_LOGI(TAG, "设置表情: %s", emotion);
             return;
         }
     }
 
-    lv_gif_set_src(emotion_gif_, &staticstate);
+    if (current_gif_ != &staticstate) {
+        lv_gif_set_src(emotion_gif_, &staticstate);
+        current_gif_ = &staticstate;
+    }
     ESP_LOGI(TAG, "未知表情'%s'，使用默认", emotion);
 }
 
@@ -7,6 +7,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "oscillator.h"
+#include "servo_motion.h"
 
 //-- Constants
 #define FORWARD 1
@@ -57,6 +58,11 @@ public:
     bool GetRestState();
     void SetRestState(bool state);
 
+    //-- The motions below only queue their trajectory and return at once
+    bool IsMoving();
+    // Stops the queued trajectory where it is, the next motion starts from there
+    void Preempt();
+
     //-- Predetermined Motion Functions
     void Jump(float steps = 1, int period = 2000);
 
@@ -87,14 +93,11 @@ public:
 
 private:
     Oscillator servo_[SERVO_COUNT];
+    ServoMotion motion_;
 
     int servo_pins_[SERVO_COUNT];
     int servo_trim_[SERVO_COUNT];
 
-    unsigned long final_time_;
-    unsigned long partial_time_;
-    float increment_[SERVO_COUNT];
-
     bool is_otto_resting_;
     bool has_hands_;  // 是否有手部舵机
 
@@ -0,0 +1,70 @@
+#include "boot_profiler.h"
+
+#include <cstring>
+#include <algorithm>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "BootProfiler"
+
+BootProfiler& BootProfiler::GetInstance() {
+    static BootProfiler instance;
+    return instance;
+}
+
+BootProfiler::Phase* BootProfiler::Find(const char* phase) {
+    for (auto& p : phases_) {
+        if (strcmp(p.name, phase) == 0) {
+            return &p;
+        }
+    }
+    return nullptr;
+}
+
+void BootProfiler::Begin(const char* phase) {
+    int64_t now = esp_timer_get_time();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto p = Find(phase);
+    if (p == nullptr) {
+        phases_.push_back({phase, now, -1});
+    } else {
+        p->start_us = now;
+        p->end_us = -1;
+    }
+}
+
+void BootProfiler::End(const char* phase) {
+    int64_t now = esp_timer_get_time();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto p = Find(phase);
+    if (p == nullptr) {
+        ESP_LOGW(TAG, "Phase %s ended without beginning", phase);
+        return;
+    }
+    p->end_us = now;
+    ESP_LOGI(TAG, "%s done in %lld ms, %lld ms since power on", phase, (now - p->start_us) / 1000, now / 1000);
+}
+
+int64_t BootProfiler::GetEndTimeMs(const char* phase) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto p = Find(phase);
+    return (p == nullptr || p->end_us < 0) ? -1 : p->end_us / 1000;
+}
+
+void BootProfiler::PrintSummary() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto phases = phases_;
+    std::sort(phases.begin(), phases.end(), [](const Phase& a, const Phase& b) {
+        return a.start_us < b.start_us;
+    });
+
+    ESP_LOGI(TAG, "%-12s %8s %8s %8s", "phase", "start", "end", "ms");
+    for (auto& p : phases) {
+        if (p.end_us < 0) {
+            ESP_LOGI(TAG, "%-12s %8lld %8s %8s", p.name, p.start_us / 1000, "-", "-");
+        } else {
+            ESP_LOGI(TAG, "%-12s %8lld %8lld %8lld", p.name, p.start_us / 1000, p.end_us / 1000,
+                (p.end_us - p.start_us) / 1000);
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef _BOOT_PROFILER_H_
+#define _BOOT_PROFILER_H_
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+
+// Start and end of every boot phase, in microseconds since power on.
+// Phases may overlap when they run in parallel, so each one keeps its own start.
+class BootProfiler {
+public:
+    static BootProfiler& GetInstance();
+    BootProfiler(const BootProfiler&) = delete;
+    BootProfiler& operator=(const BootProfiler&) = delete;
+
+    // The name must be a string literal, it is kept as a pointer
+    void Begin(const char* phase);
+    void End(const char* phase);
+
+    // Milliseconds since power on when the phase ended, -1 if it did not
+    int64_t GetEndTimeMs(const char* phase);
+    void PrintSummary();
+
+private:
+    struct Phase {
+        const char* name;
+        int64_t start_us;
+        int64_t end_us;
+    };
+
+    BootProfiler() = default;
+
+    std::vector<Phase> phases_;
+    std::mutex mutex_;
+
+    Phase* Find(const char* phase);
+};
+
+#endif // _BOOT_PROFILER_H_
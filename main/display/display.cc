@@ -135,6 +135,12 @@ void Display::UpdateStatusBar(bool update_all) {
     bool charging, discharging;
     const char* icon = nullptr;
     if (board.GetBatteryLevel(battery_level, charging, discharging)) {
+        if (battery_level != battery_level_ || charging != battery_charging_ || discharging != battery_discharging_) {
+            battery_level_ = battery_level;
+            battery_charging_ = charging;
+            battery_discharging_ = discharging;
+            EventBus::GetInstance().Publish(Event{.type = kEventBattery, .battery = {battery_level, charging, discharging}});
+        }
         if (charging) {
             icon = FONT_AWESOME_BATTERY_CHARGING;
         } else {
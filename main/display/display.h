@@ -53,6 +53,10 @@ protected:
     lv_obj_t* low_battery_label_ = nullptr;
     
     const char* battery_icon_ = nullptr;
+    // Last published on the event bus
+    int battery_level_ = -1;
+    bool battery_charging_ = false;
+    bool battery_discharging_ = false;
     const char* network_icon_ = nullptr;
     bool muted_ = false;
     std::string current_theme_name_;
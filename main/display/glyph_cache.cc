@@ -0,0 +1,116 @@
+#include "glyph_cache.h"
+
+#include <cstring>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+#define TAG "GlyphCache"
+
+GlyphCache::GlyphCache(size_t capacity_bytes) : capacity_bytes_(capacity_bytes) {
+}
+
+GlyphCache::~GlyphCache() {
+    for (auto& entry : entries_) {
+        heap_caps_free(entry.data);
+    }
+}
+
+const lv_font_t* GlyphCache::Wrap(const lv_font_t* font) {
+    if (font == nullptr || font->get_glyph_bitmap == nullptr) {
+        return font;
+    }
+    for (auto& wrapped : fonts_) {
+        if (&wrapped->font == font) {
+            return font;
+        }
+    }
+
+    auto wrapped = std::make_unique<WrappedFont>();
+    wrapped->font = *font;
+    wrapped->get_glyph_bitmap = font->get_glyph_bitmap;
+    wrapped->cache = this;
+    wrapped->index = fonts_.size();
+    // LVGL hands the font that resolved the glyph to get_glyph_bitmap, so user_data finds the original
+    wrapped->font.get_glyph_bitmap = GetGlyphBitmap;
+    wrapped->font.user_data = wrapped.get();
+    auto result = &wrapped->font;
+    fonts_.push_back(std::move(wrapped));
+
+    result->fallback = Wrap(font->fallback);
+    return result;
+}
+
+GlyphCache::Stats GlyphCache::TakeStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto stats = stats_;
+    stats_ = {};
+    return stats;
+}
+
+const void* GlyphCache::GetGlyphBitmap(lv_font_glyph_dsc_t* g_dsc, lv_draw_buf_t* draw_buf) {
+    auto wrapped = static_cast<WrappedFont*>(g_dsc->resolved_font->user_data);
+    return wrapped->cache->GetBitmap(*wrapped, g_dsc, draw_buf);
+}
+
+const void* GlyphCache::GetBitmap(WrappedFont& wrapped, lv_font_glyph_dsc_t* g_dsc, lv_draw_buf_t* draw_buf) {
+    // Only A8 bitmaps rendered into the caller's buffer can be cached, images and vector glyphs pass through
+    if (draw_buf == nullptr || g_dsc->format < LV_FONT_GLYPH_FORMAT_A1 || g_dsc->format > LV_FONT_GLYPH_FORMAT_A8) {
+        return wrapped.get_glyph_bitmap(g_dsc, draw_buf);
+    }
+
+    uint64_t key = (static_cast<uint64_t>(wrapped.index) << 32) | g_dsc->gid.index;
+    uint32_t stride = draw_buf->header.stride;
+    uint32_t size = stride * g_dsc->box_h;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it != index_.end() && it->second->stride == stride && it->second->size <= draw_buf->data_size) {
+            entries_.splice(entries_.begin(), entries_, it->second);
+            memcpy(draw_buf->data, it->second->data, it->second->size);
+            stats_.hits++;
+            return draw_buf;
+        }
+    }
+
+    int64_t start = esp_timer_get_time();
+    auto result = wrapped.get_glyph_bitmap(g_dsc, draw_buf);
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.misses++;
+    stats_.decode_us += elapsed;
+    // A glyph larger than an eighth of the cache would push out too many others
+    if (result == draw_buf && size > 0 && size <= capacity_bytes_ / 8) {
+        Store(key, draw_buf, size);
+    }
+    return result;
+}
+
+void GlyphCache::Store(uint64_t key, const lv_draw_buf_t* draw_buf, uint32_t size) {
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        used_bytes_ -= it->second->size;
+        heap_caps_free(it->second->data);
+        entries_.erase(it->second);
+        index_.erase(it);
+    }
+
+    while (!entries_.empty() && used_bytes_ + size > capacity_bytes_) {
+        auto& last = entries_.back();
+        used_bytes_ -= last.size;
+        heap_caps_free(last.data);
+        index_.erase(last.key);
+        entries_.pop_back();
+    }
+
+    auto data = static_cast<uint8_t*>(heap_caps_malloc(size, MALLOC_CAP_SPIRAM));
+    if (data == nullptr) {
+        ESP_LOGW(TAG, "Failed to allocate %lu bytes for a glyph", size);
+        return;
+    }
+    memcpy(data, draw_buf->data, size);
+    entries_.push_front({key, draw_buf->header.stride, size, data});
+    index_[key] = entries_.begin();
+    used_bytes_ += size;
+}
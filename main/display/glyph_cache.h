@@ -0,0 +1,63 @@
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include <lvgl.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+// LRU cache of decoded glyph bitmaps in PSRAM, put in front of the bitmap decoder of an LVGL font.
+// A long CJK reply is drawn again on every scroll step, a hit copies the A8 bitmap
+// instead of decompressing the glyph from flash.
+class GlyphCache {
+public:
+    struct Stats {
+        uint32_t hits;
+        uint32_t misses;
+        int64_t decode_us;
+    };
+
+    GlyphCache(size_t capacity_bytes);
+    ~GlyphCache();
+
+    // Returns a font that draws like the given one through the cache, its fallbacks included.
+    // The copy lives as long as the cache.
+    const lv_font_t* Wrap(const lv_font_t* font);
+
+    // Counters since the previous call
+    Stats TakeStats();
+    size_t used_bytes() const { return used_bytes_; }
+
+private:
+    struct WrappedFont {
+        lv_font_t font;
+        const void* (*get_glyph_bitmap)(lv_font_glyph_dsc_t*, lv_draw_buf_t*);
+        GlyphCache* cache;
+        uint32_t index;
+    };
+
+    struct Entry {
+        uint64_t key;
+        uint32_t stride;
+        uint32_t size;
+        uint8_t* data;
+    };
+
+    size_t capacity_bytes_;
+    size_t used_bytes_ = 0;
+    std::vector<std::unique_ptr<WrappedFont>> fonts_;
+    std::list<Entry> entries_;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+    std::mutex mutex_;
+    Stats stats_ = {};
+
+    static const void* GetGlyphBitmap(lv_font_glyph_dsc_t* g_dsc, lv_draw_buf_t* draw_buf);
+    const void* GetBitmap(WrappedFont& wrapped, lv_font_glyph_dsc_t* g_dsc, lv_draw_buf_t* draw_buf);
+    void Store(uint64_t key, const lv_draw_buf_t* draw_buf, uint32_t size);
+};
+
+#endif // GLYPH_CACHE_H
@@ -0,0 +1,230 @@
+#include "image_cache.h"
+
+#include <cstring>
+#include <algorithm>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+#define TAG "ImageCache"
+
+// An image drawn within this time may still be referenced by a pending draw task
+#define IMAGE_CACHE_MIN_AGE_US 1000000
+
+// Compression methods of LVGLImage.py, stored ahead of the data as method, compressed and decompressed size
+#define IMAGE_COMPRESS_RLE 1
+#define IMAGE_COMPRESS_LZ4 2
+
+// LZ4 block format, the output size is known up front
+static bool Lz4Decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_size;
+
+    auto read_length = [&](size_t length) -> size_t {
+        if (length == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) {
+                    return SIZE_MAX;
+                }
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+        return length;
+    };
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t literal = read_length(token >> 4);
+        if (literal > static_cast<size_t>(iend - ip) || literal > static_cast<size_t>(oend - op)) {
+            return false;
+        }
+        memcpy(op, ip, literal);
+        op += literal;
+        ip += literal;
+        if (ip == iend) {
+            // The last sequence has literals only
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t match = read_length(token & 0x0F);
+        if (match == SIZE_MAX || offset == 0 || offset > static_cast<size_t>(op - dst)
+            || match + 4 > static_cast<size_t>(oend - op)) {
+            return false;
+        }
+        // The match may overlap the output, copy byte by byte
+        const uint8_t* m = op - offset;
+        for (size_t i = 0; i < match + 4; i++) {
+            *op++ = *m++;
+        }
+    }
+    return op == oend;
+}
+
+// LVGL RLE: a control byte with the top bit set is followed by that many literal pixels,
+// otherwise by one pixel repeated that many times
+static bool RleDecompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size, size_t pixel_size) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_size;
+    size_t out = 0;
+    while (ip < iend && out < dst_size) {
+        uint8_t ctrl = *ip++;
+        size_t count = ctrl & 0x7F;
+        if (ctrl & 0x80) {
+            size_t bytes = count * pixel_size;
+            if (bytes > static_cast<size_t>(iend - ip)) {
+                return false;
+            }
+            memcpy(dst + out, ip, std::min(bytes, dst_size - out));
+            ip += bytes;
+            out += bytes;
+        } else {
+            if (pixel_size > static_cast<size_t>(iend - ip)) {
+                return false;
+            }
+            for (size_t i = 0; i < count && out < dst_size; i++) {
+                memcpy(dst + out, ip, std::min(pixel_size, dst_size - out));
+                out += pixel_size;
+            }
+            ip += pixel_size;
+        }
+    }
+    return out >= dst_size;
+}
+
+ImageCache& ImageCache::GetInstance() {
+    static ImageCache instance;
+    return instance;
+}
+
+ImageCache::ImageCache() : capacity_bytes_(CONFIG_IMAGE_CACHE_SIZE_KB * 1024) {
+}
+
+const lv_image_dsc_t* ImageCache::Get(const lv_image_dsc_t* image) {
+    if (image == nullptr || image->header.magic != LV_IMAGE_HEADER_MAGIC
+        || !(image->header.flags & LV_IMAGE_FLAGS_COMPRESSED)) {
+        return image;
+    }
+
+    int64_t now = esp_timer_get_time();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(image);
+    if (it != index_.end()) {
+        it->second->last_used_us = now;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return &it->second->image;
+    }
+
+    Entry entry = {image, {}, now};
+    if (!Decompress(image, entry.image)) {
+        return image;
+    }
+    Evict(entry.image.data_size, now);
+    entries_.push_front(entry);
+    index_[image] = entries_.begin();
+    used_bytes_ += entry.image.data_size;
+    ESP_LOGI(TAG, "Decompressed %dx%d image in %lld us, %lu to %lu bytes, cache %u KB",
+        image->header.w, image->header.h, esp_timer_get_time() - now,
+        image->data_size, entry.image.data_size, used_bytes_ / 1024);
+    return &entries_.front().image;
+}
+
+bool ImageCache::Decompress(const lv_image_dsc_t* source, lv_image_dsc_t& image) {
+    uint32_t method, compressed_size, decompressed_size;
+    if (source->data_size < 12) {
+        return false;
+    }
+    memcpy(&method, source->data, 4);
+    memcpy(&compressed_size, source->data + 4, 4);
+    memcpy(&decompressed_size, source->data + 8, 4);
+    if (compressed_size > source->data_size - 12 || decompressed_size == 0) {
+        ESP_LOGE(TAG, "Invalid compressed image header");
+        return false;
+    }
+
+    auto data = static_cast<uint8_t*>(heap_caps_malloc(decompressed_size, MALLOC_CAP_SPIRAM));
+    if (data == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %lu bytes for an image", decompressed_size);
+        return false;
+    }
+
+    bool ok = false;
+    if (method == IMAGE_COMPRESS_LZ4) {
+        ok = Lz4Decompress(source->data + 12, compressed_size, data, decompressed_size);
+    } else if (method == IMAGE_COMPRESS_RLE) {
+        size_t pixel_size = (lv_color_format_get_bpp(static_cast<lv_color_format_t>(source->header.cf)) + 7) / 8;
+        ok = RleDecompress(source->data + 12, compressed_size, data, decompressed_size, pixel_size);
+    }
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to decompress image, method %lu", method);
+        heap_caps_free(data);
+        return false;
+    }
+
+    image = *source;
+    image.header.flags &= ~LV_IMAGE_FLAGS_COMPRESSED;
+    image.data = data;
+    image.data_size = decompressed_size;
+    return true;
+}
+
+void ImageCache::Evict(size_t size, int64_t now) {
+    // Oldest first, the cache may run over its size while every image is still in use
+    auto it = entries_.end();
+    while (it != entries_.begin() && used_bytes_ + size > capacity_bytes_) {
+        --it;
+        if (now - it->last_used_us < IMAGE_CACHE_MIN_AGE_US) {
+            break;
+        }
+        used_bytes_ -= it->image.data_size;
+        heap_caps_free(const_cast<uint8_t*>(it->image.data));
+        index_.erase(it->source);
+        it = entries_.erase(it);
+    }
+}
+
+const lv_font_t* ImageCache::WrapImageFont(const lv_font_t* font) {
+    if (font == nullptr || font->get_glyph_bitmap == nullptr) {
+        return font;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto wrapped = new WrappedFont();
+    wrapped->font = *font;
+    wrapped->get_glyph_bitmap = font->get_glyph_bitmap;
+    wrapped->font.get_glyph_bitmap = GetGlyphBitmap;
+    fonts_.push_back(wrapped);
+    return &wrapped->font;
+}
+
+const void* ImageCache::GetGlyphBitmap(lv_font_glyph_dsc_t* g_dsc, lv_draw_buf_t* draw_buf) {
+    // The image font keeps its own user_data, so the original is looked up by address
+    auto& cache = GetInstance();
+    WrappedFont* wrapped = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex_);
+        for (auto font : cache.fonts_) {
+            if (&font->font == g_dsc->resolved_font) {
+                wrapped = font;
+                break;
+            }
+        }
+    }
+    if (wrapped == nullptr) {
+        return nullptr;
+    }
+
+    auto src = wrapped->get_glyph_bitmap(g_dsc, draw_buf);
+    if (g_dsc->format != LV_FONT_GLYPH_FORMAT_IMAGE || lv_image_src_get_type(src) != LV_IMAGE_SRC_VARIABLE) {
+        return src;
+    }
+    return cache.Get(static_cast<const lv_image_dsc_t*>(src));
+}
@@ -0,0 +1,54 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <lvgl.h>
+
+#include <list>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+// Decompresses LZ4 or RLE compressed images (LVGLImage.py --compress) once into PSRAM and keeps
+// them in an LRU, so LVGL draws them like plain arrays instead of decompressing on every draw.
+class ImageCache {
+public:
+    static ImageCache& GetInstance();
+    ImageCache(const ImageCache&) = delete;
+    ImageCache& operator=(const ImageCache&) = delete;
+
+    // Returns the decompressed image, or the image itself when it is not compressed or fails to decode.
+    // Images used within the last second are never evicted, so the result is good for drawing right
+    // away, not for keeping.
+    const lv_image_dsc_t* Get(const lv_image_dsc_t* image);
+
+    // Returns an image font (emoji) that hands LVGL the decompressed glyph images. The copy lives forever.
+    const lv_font_t* WrapImageFont(const lv_font_t* font);
+
+private:
+    struct Entry {
+        const lv_image_dsc_t* source;
+        lv_image_dsc_t image;
+        int64_t last_used_us;
+    };
+
+    struct WrappedFont {
+        lv_font_t font;
+        const void* (*get_glyph_bitmap)(lv_font_glyph_dsc_t*, lv_draw_buf_t*);
+    };
+
+    ImageCache();
+
+    size_t capacity_bytes_;
+    size_t used_bytes_ = 0;
+    std::list<Entry> entries_;
+    std::unordered_map<const lv_image_dsc_t*, std::list<Entry>::iterator> index_;
+    std::vector<WrappedFont*> fonts_;
+    std::mutex mutex_;
+
+    static const void* GetGlyphBitmap(lv_font_glyph_dsc_t* g_dsc, lv_draw_buf_t* draw_buf);
+    bool Decompress(const lv_image_dsc_t* source, lv_image_dsc_t& image);
+    void Evict(size_t size, int64_t now);
+};
+
+#endif // IMAGE_CACHE_H
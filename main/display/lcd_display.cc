@@ -7,6 +7,7 @@
 #include <esp_err.h>
 #include <esp_lvgl_port.h>
 #include <esp_heap_caps.h>
+#include <esp_timer.h>
 #include "assets/lang_config.h"
 #include <cstring>
 #include "settings.h"
@@ -82,8 +83,35 @@ LcdDisplay::LcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_
     } else if (current_theme_name_ == "light") {
         current_theme_ = LIGHT_THEME;
     }
+
+#if CONFIG_USE_GLYPH_CACHE
+    glyph_cache_ = std::make_unique<GlyphCache>(CONFIG_GLYPH_CACHE_SIZE_KB * 1024);
+    fonts_.text_font = glyph_cache_->Wrap(fonts.text_font);
+#endif
+#if CONFIG_USE_IMAGE_CACHE
+    fonts_.emoji_font = ImageCache::GetInstance().WrapImageFont(fonts.emoji_font);
+#endif
 }
 
+#if CONFIG_USE_GLYPH_CACHE
+// Logs every refresh that drew a fair amount of text, which is how a new chat message shows up
+void LcdDisplay::OnRefreshEvent(lv_event_t* e) {
+    auto self = static_cast<LcdDisplay*>(lv_event_get_user_data(e));
+    if (lv_event_get_code(e) == LV_EVENT_REFR_START) {
+        self->refresh_start_us_ = esp_timer_get_time();
+        return;
+    }
+
+    auto stats = self->glyph_cache_->TakeStats();
+    if (stats.hits + stats.misses < 16) {
+        return;
+    }
+    ESP_LOGI(TAG, "Refresh with %lu glyphs took %lld ms: %lu cache hits, %lu misses decoded in %lld us, cache %u KB",
+        stats.hits + stats.misses, (esp_timer_get_time() - self->refresh_start_us_) / 1000,
+        stats.hits, stats.misses, stats.decode_us, self->glyph_cache_->used_bytes() / 1024);
+}
+#endif
+
 SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                            int width, int height, int offset_x, int offset_y, bool mirror_x, bool mirror_y, bool swap_xy,
                            DisplayFonts fonts)
@@ -307,6 +335,11 @@ void LcdDisplay::Unlock() {
 void LcdDisplay::SetupUI() {
     DisplayLockGuard lock(this);
 
+#if CONFIG_USE_GLYPH_CACHE
+    lv_display_add_event_cb(display_, OnRefreshEvent, LV_EVENT_REFR_START, this);
+    lv_display_add_event_cb(display_, OnRefreshEvent, LV_EVENT_REFR_READY, this);
+#endif
+
     auto screen = lv_screen_active();
     lv_obj_set_style_text_font(screen, fonts_.text_font, 0);
     lv_obj_set_style_text_color(screen, current_theme_.text, 0);
@@ -706,6 +739,11 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
 void LcdDisplay::SetupUI() {
     DisplayLockGuard lock(this);
 
+#if CONFIG_USE_GLYPH_CACHE
+    lv_display_add_event_cb(display_, OnRefreshEvent, LV_EVENT_REFR_START, this);
+    lv_display_add_event_cb(display_, OnRefreshEvent, LV_EVENT_REFR_READY, this);
+#endif
+
     auto screen = lv_screen_active();
     lv_obj_set_style_text_font(screen, fonts_.text_font, 0);
     lv_obj_set_style_text_color(screen, current_theme_.text, 0);
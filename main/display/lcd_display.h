@@ -8,6 +8,14 @@
 #include <font_emoji.h>
 
 #include <atomic>
+#include <memory>
+
+#if CONFIG_USE_GLYPH_CACHE
+#include "glyph_cache.h"
+#endif
+#if CONFIG_USE_IMAGE_CACHE
+#include "image_cache.h"
+#endif
 
 // Theme color structure
 struct ThemeColors {
@@ -38,6 +46,12 @@ protected:
     DisplayFonts fonts_;
     ThemeColors current_theme_;
 
+#if CONFIG_USE_GLYPH_CACHE
+    std::unique_ptr<GlyphCache> glyph_cache_;
+    int64_t refresh_start_us_ = 0;
+    static void OnRefreshEvent(lv_event_t* e);
+#endif
+
     void SetupUI();
     virtual bool Lock(int timeout_ms = 0) override;
     virtual void Unlock() override;
@@ -0,0 +1,32 @@
+#include "event_bus.h"
+
+#include <esp_log.h>
+
+#define TAG "EventBus"
+
+EventBus& EventBus::GetInstance() {
+    static EventBus instance;
+    return instance;
+}
+
+bool EventBus::Subscribe(uint32_t event_mask, EventHandler handler, void* arg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t count = count_.load(std::memory_order_relaxed);
+    if (count >= EVENT_BUS_MAX_SUBSCRIBERS) {
+        ESP_LOGE(TAG, "Too many subscribers, increase EVENT_BUS_MAX_SUBSCRIBERS");
+        return false;
+    }
+    subscribers_[count] = Subscriber{event_mask, handler, arg};
+    count_.store(count + 1, std::memory_order_release);
+    return true;
+}
+
+void EventBus::Publish(const Event& event) {
+    size_t count = count_.load(std::memory_order_acquire);
+    uint32_t mask = EVENT_MASK(event.type);
+    for (size_t i = 0; i < count; i++) {
+        if (subscribers_[i].event_mask & mask) {
+            subscribers_[i].handler(event, subscribers_[i].arg);
+        }
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef _EVENT_BUS_H_
+#define _EVENT_BUS_H_
+
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+#include "device_state.h"
+
+// Subscribers are registered at startup and never removed
+#define EVENT_BUS_MAX_SUBSCRIBERS 16
+
+enum EventType {
+    kEventDeviceState,
+    kEventVadChange,
+    kEventNetwork,
+    kEventBattery,
+    kEventAudio,
+};
+
+#define EVENT_MASK(type) (1u << (type))
+
+enum NetworkEventType {
+    kNetworkEventStarted,
+    kNetworkEventAudioChannelOpened,
+    kNetworkEventAudioChannelClosed,
+    kNetworkEventError,
+};
+
+enum AudioEventType {
+    kAudioEventWakeWordDetected,
+};
+
+// Fixed size, published by value, so no event allocates
+struct Event {
+    EventType type;
+    union {
+        struct {
+            DeviceState previous;
+            DeviceState current;
+        } state;
+        struct {
+            bool speaking;
+        } vad;
+        struct {
+            NetworkEventType type;
+        } network;
+        struct {
+            int level;
+            bool charging;
+            bool discharging;
+        } battery;
+        struct {
+            AudioEventType type;
+        } audio;
+    };
+};
+
+using EventHandler = void (*)(const Event& event, void* arg);
+
+/*
+ * Typed publish / subscribe between modules. Handlers run synchronously in the task of the publisher:
+ * the main loop for state, VAD and audio events, the protocol for network events and the clock timer
+ * for battery events, so they must not block. Publishing reads the registry without a lock or a copy.
+ */
+class EventBus {
+public:
+    static EventBus& GetInstance();
+    EventBus(const EventBus&) = delete;
+    EventBus& operator=(const EventBus&) = delete;
+
+    // Returns false when the registry is full
+    bool Subscribe(uint32_t event_mask, EventHandler handler, void* arg = nullptr);
+    void Publish(const Event& event);
+
+private:
+    struct Subscriber {
+        uint32_t event_mask;
+        EventHandler handler;
+        void* arg;
+    };
+
+    EventBus() = default;
+
+    Subscriber subscribers_[EVENT_BUS_MAX_SUBSCRIBERS];
+    // Slots below the count are complete, a subscriber is written before the count is raised
+    std::atomic<size_t> count_ = 0;
+    // Serializes subscribing only
+    std::mutex mutex_;
+};
+
+#endif // _EVENT_BUS_H_
@@ -1,16 +1,18 @@
 #include "circular_strip.h"
 #include "application.h"
 #include <esp_log.h>
+#include <soc/soc_caps.h>
+#include <algorithm>
+#include <cstdlib>
 
 #define TAG "CircularStrip"
 
-#define BLINK_INFINITE -1
-
 CircularStrip::CircularStrip(gpio_num_t gpio, uint8_t max_leds) : max_leds_(max_leds) {
     // If the gpio is not connected, you should use NoLed class
     assert(gpio != GPIO_NUM_NC);
 
     colors_.resize(max_leds_);
+    frame_.resize(max_leds_);
 
     led_strip_config_t strip_config = {};
     strip_config.strip_gpio_num = gpio;
@@ -20,28 +22,23 @@ CircularStrip::CircularStrip(gpio_num_t gpio, uint8_t max_leds) : max_leds_(max_
 
     led_strip_rmt_config_t rmt_config = {};
     rmt_config.resolution_hz = 10 * 1000 * 1000; // 10MHz
-
-    ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &led_strip_));
+#if SOC_RMT_SUPPORT_DMA
+    rmt_config.flags.with_dma = max_leds_ >= LED_STRIP_DMA_MIN_LEDS;
+#endif
+
+    esp_err_t err = led_strip_new_rmt_device(&strip_config, &rmt_config, &led_strip_);
+    if (err != ESP_OK && rmt_config.flags.with_dma) {
+        // The DMA channel may be taken by another strip
+        ESP_LOGW(TAG, "Failed to create the strip with DMA, error: %s", esp_err_to_name(err));
+        rmt_config.flags.with_dma = false;
+        err = led_strip_new_rmt_device(&strip_config, &rmt_config, &led_strip_);
+    }
+    ESP_ERROR_CHECK(err);
     led_strip_clear(led_strip_);
-
-    esp_timer_create_args_t strip_timer_args = {
-        .callback = [](void *arg) {
-            auto strip = static_cast<CircularStrip*>(arg);
-            std::lock_guard<std::mutex> lock(strip->mutex_);
-            if (strip->strip_callback_ != nullptr) {
-                strip->strip_callback_();
-            }
-        },
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "strip_timer",
-        .skip_unhandled_events = false,
-    };
-    ESP_ERROR_CHECK(esp_timer_create(&strip_timer_args, &strip_timer_));
 }
 
 CircularStrip::~CircularStrip() {
-    esp_timer_stop(strip_timer_);
+    LedEngine::GetInstance().Schedule(this, -1);
     if (led_strip_ != nullptr) {
         led_strip_del(led_strip_);
     }
@@ -50,130 +47,102 @@ CircularStrip::~CircularStrip() {
 
 void CircularStrip::SetAllColor(StripColor color) {
     std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(strip_timer_);
     for (int i = 0; i < max_leds_; i++) {
         colors_[i] = color;
-        led_strip_set_pixel(led_strip_, i, color.red, color.green, color.blue);
     }
-    led_strip_refresh(led_strip_);
+    Play(StripColor(), LedEffect::Solid());
 }
 
 void CircularStrip::SetSingleColor(uint8_t index, StripColor color) {
     std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(strip_timer_);
+    // Freeze the other pixels as they are now
+    colors_ = frame_;
     colors_[index] = color;
-    led_strip_set_pixel(led_strip_, index, color.red, color.green, color.blue);
-    led_strip_refresh(led_strip_);
+    Play(StripColor(), LedEffect::Solid());
 }
 
 void CircularStrip::Blink(StripColor color, int interval_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
     for (int i = 0; i < max_leds_; i++) {
         colors_[i] = color;
     }
-    StartStripTask(interval_ms, [this]() {
-        static bool on = true;
-        if (on) {
-            for (int i = 0; i < max_leds_; i++) {
-                led_strip_set_pixel(led_strip_, i, colors_[i].red, colors_[i].green, colors_[i].blue);
-            }
-            led_strip_refresh(led_strip_);
-        } else {
-            led_strip_clear(led_strip_);
-        }
-        on = !on;
-    });
+    Play(StripColor(), LedEffect::Blink(interval_ms));
 }
 
 void CircularStrip::FadeOut(int interval_ms) {
-    StartStripTask(interval_ms, [this]() {
-        bool all_off = true;
-        for (int i = 0; i < max_leds_; i++) {
-            colors_[i].red /= 2;
-            colors_[i].green /= 2;
-            colors_[i].blue /= 2;
-            if (colors_[i].red != 0 || colors_[i].green != 0 || colors_[i].blue != 0) {
-                all_off = false;
-            }
-            led_strip_set_pixel(led_strip_, i, colors_[i].red, colors_[i].green, colors_[i].blue);
-        }
-        if (all_off) {
-            led_strip_clear(led_strip_);
-            esp_timer_stop(strip_timer_);
-        } else {
-            led_strip_refresh(led_strip_);
-        }
-    });
+    std::lock_guard<std::mutex> lock(mutex_);
+    colors_ = frame_;
+    Play(StripColor(), LedEffect::FadeOut(interval_ms));
 }
 
 void CircularStrip::Breathe(StripColor low, StripColor high, int interval_ms) {
-    StartStripTask(interval_ms, [this, low, high]() {
-        static bool increase = true;
-        static StripColor color = low;
-        if (increase) {
-            if (color.red < high.red) {
-                color.red++;
-            }
-            if (color.green < high.green) {
-                color.green++;
-            }
-            if (color.blue < high.blue) {
-                color.blue++;
-            }
-            if (color.red == high.red && color.green == high.green && color.blue == high.blue) {
-                increase = false;
-            }
-        } else {
-            if (color.red > low.red) {
-                color.red--;
-            }
-            if (color.green > low.green) {
-                color.green--;
-            }
-            if (color.blue > low.blue) {
-                color.blue--;
-            }
-            if (color.red == low.red && color.green == low.green && color.blue == low.blue) {
-                increase = true;
-            }
-        }
-        for (int i = 0; i < max_leds_; i++) {
-            led_strip_set_pixel(led_strip_, i, color.red, color.green, color.blue);
-        }
-        led_strip_refresh(led_strip_);
-    });
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < max_leds_; i++) {
+        colors_[i] = high;
+    }
+    // One step of every channel per interval, up and down
+    int steps = std::max({std::abs(high.red - low.red), std::abs(high.green - low.green), std::abs(high.blue - low.blue), 1});
+    Play(low, LedEffect::Breathe(steps * interval_ms * 2));
 }
 
 void CircularStrip::Scroll(StripColor low, StripColor high, int length, int interval_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
     for (int i = 0; i < max_leds_; i++) {
-        colors_[i] = low;
+        colors_[i] = high;
     }
-    StartStripTask(interval_ms, [this, low, high, length]() {
-        static int offset = 0;
-        for (int i = 0; i < max_leds_; i++) {
-            colors_[i] = low;
-        }
-        for (int j = 0; j < length; j++) {
-            int i = (offset + j) % max_leds_;
-            colors_[i] = high;
-        }
-        for (int i = 0; i < max_leds_; i++) {
-            led_strip_set_pixel(led_strip_, i, colors_[i].red, colors_[i].green, colors_[i].blue);
-        }
-        led_strip_refresh(led_strip_);
-        offset = (offset + 1) % max_leds_;
-    });
+    Play(low, LedEffect::Scroll(max_leds_, length, interval_ms));
 }
 
-void CircularStrip::StartStripTask(int interval_ms, std::function<void()> cb) {
+void CircularStrip::SetEffect(StripColor low, StripColor high, const LedEffect& effect) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < max_leds_; i++) {
+        colors_[i] = high;
+    }
+    Play(low, effect);
+}
+
+void CircularStrip::Play(StripColor low, const LedEffect& effect) {
     if (led_strip_ == nullptr) {
         return;
     }
+    low_ = low;
+    effect_ = effect;
+    effect_start_us_ = esp_timer_get_time();
+    LedEngine::GetInstance().Schedule(this, Render(effect_start_us_));
+}
 
+int64_t CircularStrip::OnTick(int64_t now_us) {
     std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(strip_timer_);
-    
-    strip_callback_ = cb;
-    esp_timer_start_periodic(strip_timer_, interval_ms * 1000);
+    return Render(now_us);
+}
+
+int64_t CircularStrip::Render(int64_t now_us) {
+    int64_t next_ms;
+    int index = effect_.Seek((now_us - effect_start_us_) / 1000, &next_ms);
+    uint8_t level = effect_.LevelAt(index);
+    int scroll_length = effect_.scroll_length();
+
+    bool changed = false;
+    for (int i = 0; i < max_leds_; i++) {
+        int pixel_level = level;
+        if (scroll_length > 0 && (i - index + max_leds_) % max_leds_ >= scroll_length) {
+            pixel_level = 0;
+        }
+        auto& high = colors_[i];
+        StripColor color;
+        color.red = low_.red + ((high.red - low_.red) * pixel_level + 127) / 255;
+        color.green = low_.green + ((high.green - low_.green) * pixel_level + 127) / 255;
+        color.blue = low_.blue + ((high.blue - low_.blue) * pixel_level + 127) / 255;
+        if (color.red != frame_[i].red || color.green != frame_[i].green || color.blue != frame_[i].blue) {
+            frame_[i] = color;
+            led_strip_set_pixel(led_strip_, i, color.red, color.green, color.blue);
+            changed = true;
+        }
+    }
+    if (changed) {
+        led_strip_refresh(led_strip_);
+    }
+    return next_ms < 0 ? -1 : effect_start_us_ + next_ms * 1000;
 }
 
 void CircularStrip::SetBrightness(uint8_t default_brightness, uint8_t low_brightness) {
@@ -2,6 +2,7 @@
 #define _CIRCULAR_STRIP_H_
 
 #include "led.h"
+#include "led_engine.h"
 #include <driver/gpio.h>
 #include <led_strip.h>
 #include <esp_timer.h>
@@ -11,12 +12,14 @@
 
 #define DEFAULT_BRIGHTNESS 32
 #define LOW_BRIGHTNESS 4
+// Longer strips are sent in one DMA transfer where the RMT supports it
+#define LED_STRIP_DMA_MIN_LEDS 8
 
 struct StripColor {
     uint8_t red = 0, green = 0, blue = 0;
 };
 
-class CircularStrip : public Led {
+class CircularStrip : public Led, public LedTarget {
 public:
     CircularStrip(gpio_num_t gpio, uint8_t max_leds);
     virtual ~CircularStrip();
@@ -28,23 +31,27 @@ public:
     void Blink(StripColor color, int interval_ms);
     void Breathe(StripColor low, StripColor high, int interval_ms);
     void Scroll(StripColor low, StripColor high, int length, int interval_ms);
+    // Any effect of the engine, e.g. LedEffect::Level with the audio level as the source
+    void SetEffect(StripColor low, StripColor high, const LedEffect& effect);
 
 private:
     std::mutex mutex_;
-    TaskHandle_t blink_task_ = nullptr;
     led_strip_handle_t led_strip_ = nullptr;
     int max_leds_ = 0;
+    // The effect goes from the low color to the color of each pixel
     std::vector<StripColor> colors_;
-    int blink_counter_ = 0;
-    int blink_interval_ms_ = 0;
-    esp_timer_handle_t strip_timer_ = nullptr;
-    std::function<void()> strip_callback_ = nullptr;
+    StripColor low_;
+    LedEffect effect_ = LedEffect::Solid();
+    int64_t effect_start_us_ = 0;
+    // What the strip shows, it is only refreshed when a pixel changes
+    std::vector<StripColor> frame_;
 
     uint8_t default_brightness_ = DEFAULT_BRIGHTNESS;
     uint8_t low_brightness_ = LOW_BRIGHTNESS;
 
-    void StartStripTask(int interval_ms, std::function<void()> cb);
-    void Rainbow(StripColor low, StripColor high, int interval_ms);
+    void Play(StripColor low, const LedEffect& effect);
+    int64_t Render(int64_t now_us);
+    int64_t OnTick(int64_t now_us) override;
     void FadeOut(int interval_ms);
 };
 
@@ -14,8 +14,6 @@
 #define UPGRADING_BRIGHTNESS 25
 #define ACTIVATING_BRIGHTNESS 35
 
-#define BLINK_INFINITE -1
-
 // GPIO_LED
 #define LEDC_LS_TIMER          LEDC_TIMER_1
 #define LEDC_LS_MODE           LEDC_LOW_SPEED_MODE
@@ -70,23 +68,11 @@ GpioLed::GpioLed(gpio_num_t gpio, int output_invert, ledc_timer_t timer_num, led
     };
     ledc_cb_register(ledc_channel_.speed_mode, ledc_channel_.channel, &ledc_callbacks, this);
 
-    esp_timer_create_args_t blink_timer_args = {
-        .callback = [](void *arg) {
-            auto led = static_cast<GpioLed*>(arg);
-            led->OnBlinkTimer();
-        },
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "Blink Timer",
-        .skip_unhandled_events = false,
-    };
-    ESP_ERROR_CHECK(esp_timer_create(&blink_timer_args, &blink_timer_));
-
     ledc_initialized_ = true;
 }
 
 GpioLed::~GpioLed() {
-    esp_timer_stop(blink_timer_);
+    LedEngine::GetInstance().Schedule(this, -1);
     if (ledc_initialized_) {
         ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
         ledc_fade_func_uninstall();
@@ -103,27 +89,11 @@ void GpioLed::SetBrightness(uint8_t brightness) {
 }
 
 void GpioLed::TurnOn() {
-    if (!ledc_initialized_) {
-        return;
-    }
-
-    std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
-    ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
-    ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, duty_);
-    ledc_update_duty(ledc_channel_.speed_mode, ledc_channel_.channel);
+    Play(LedEffect::Solid());
 }
 
 void GpioLed::TurnOff() {
-    if (!ledc_initialized_) {
-        return;
-    }
-
-    std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
-    ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
-    ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, 0);
-    ledc_update_duty(ledc_channel_.speed_mode, ledc_channel_.channel);
+    Play(LedEffect::Solid(0));
 }
 
 void GpioLed::BlinkOnce() {
@@ -131,40 +101,48 @@ void GpioLed::BlinkOnce() {
 }
 
 void GpioLed::Blink(int times, int interval_ms) {
-    StartBlinkTask(times, interval_ms);
+    Play(LedEffect::Blink(interval_ms, times));
 }
 
 void GpioLed::StartContinuousBlink(int interval_ms) {
-    StartBlinkTask(BLINK_INFINITE, interval_ms);
+    Play(LedEffect::Blink(interval_ms));
 }
 
-void GpioLed::StartBlinkTask(int times, int interval_ms) {
+void GpioLed::Play(const LedEffect& effect) {
     if (!ledc_initialized_) {
         return;
     }
 
     std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
-    ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
-
-    blink_counter_ = times * 2;
-    blink_interval_ms_ = interval_ms;
-    esp_timer_start_periodic(blink_timer_, interval_ms * 1000);
+    if (fading_) {
+        fading_ = false;
+        ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
+        // The fade left the duty anywhere
+        frame_duty_ = UINT32_MAX;
+    }
+    effect_ = effect;
+    effect_start_us_ = esp_timer_get_time();
+    LedEngine::GetInstance().Schedule(this, Render(effect_start_us_));
 }
 
-void GpioLed::OnBlinkTimer() {
+int64_t GpioLed::OnTick(int64_t now_us) {
     std::lock_guard<std::mutex> lock(mutex_);
-    blink_counter_--;
-    if (blink_counter_ & 1) {
-        ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, duty_);
-    } else {
-        ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, 0);
+    if (fading_) {
+        return -1;
+    }
+    return Render(now_us);
+}
 
-        if (blink_counter_ == 0) {
-            esp_timer_stop(blink_timer_);
-        }
+int64_t GpioLed::Render(int64_t now_us) {
+    int64_t next_ms;
+    int level = effect_.LevelAt(effect_.Seek((now_us - effect_start_us_) / 1000, &next_ms));
+    uint32_t duty = duty_ * level / 255;
+    if (duty != frame_duty_) {
+        frame_duty_ = duty;
+        ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, duty);
+        ledc_update_duty(ledc_channel_.speed_mode, ledc_channel_.channel);
     }
-    ledc_update_duty(ledc_channel_.speed_mode, ledc_channel_.channel);
+    return next_ms < 0 ? -1 : effect_start_us_ + next_ms * 1000;
 }
 
 void GpioLed::StartFadeTask() {
@@ -172,9 +150,11 @@ void GpioLed::StartFadeTask() {
         return;
     }
 
+    // The LEDC fades in hardware and only interrupts at the ends, the engine does not need to tick for it
+    LedEngine::GetInstance().Schedule(this, -1);
     std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
     ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
+    fading_ = true;
     fade_up_ = true;
     ledc_set_fade_with_time(ledc_channel_.speed_mode,
                             ledc_channel_.channel, LEDC_DUTY, LEDC_FADE_TIME);
@@ -184,6 +164,9 @@ void GpioLed::StartFadeTask() {
 
 void GpioLed::OnFadeEnd() {
     std::lock_guard<std::mutex> lock(mutex_);
+    if (!fading_) {
+        return;
+    }
     fade_up_ = !fade_up_;
     ledc_set_fade_with_time(ledc_channel_.speed_mode,
                             ledc_channel_.channel, fade_up_ ? LEDC_DUTY : 0, LEDC_FADE_TIME);
@@ -4,13 +4,14 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include "led.h"
+#include "led_engine.h"
 #include <driver/gpio.h>
 #include <driver/ledc.h>
 #include <esp_timer.h>
 #include <atomic>
 #include <mutex>
 
-class GpioLed : public Led {
+class GpioLed : public Led, public LedTarget {
  public:
     GpioLed(gpio_num_t gpio);
     GpioLed(gpio_num_t gpio, int output_invert);
@@ -24,17 +25,19 @@ class GpioLed : public Led {
 
  private:
     std::mutex mutex_;
-    TaskHandle_t blink_task_ = nullptr;
     ledc_channel_config_t ledc_channel_ = {0};
     bool ledc_initialized_ = false;
     uint32_t duty_ = 0;
-    int blink_counter_ = 0;
-    int blink_interval_ms_ = 0;
-    esp_timer_handle_t blink_timer_ = nullptr;
+    LedEffect effect_ = LedEffect::Solid(0);
+    int64_t effect_start_us_ = 0;
+    // The duty set on the channel, it is only updated when it changes
+    uint32_t frame_duty_ = 0;
     bool fade_up_ = true;
+    bool fading_ = false;
 
-    void StartBlinkTask(int times, int interval_ms);
-    void OnBlinkTimer();
+    void Play(const LedEffect& effect);
+    int64_t Render(int64_t now_us);
+    int64_t OnTick(int64_t now_us) override;
 
     void BlinkOnce();
     void Blink(int times, int interval_ms);
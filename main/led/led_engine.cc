@@ -0,0 +1,200 @@
+#include "led_engine.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "LedEngine"
+
+LedEffect LedEffect::Solid(uint8_t level) {
+    LedEffect effect;
+    effect.keyframes_.push_back({UINT16_MAX, level});
+    effect.Finalize();
+    return effect;
+}
+
+LedEffect LedEffect::Blink(int interval_ms, int times) {
+    LedEffect effect;
+    effect.keyframes_.push_back({(uint16_t)interval_ms, 255});
+    effect.keyframes_.push_back({(uint16_t)interval_ms, 0});
+    effect.repeat_ = times;
+    effect.Finalize();
+    return effect;
+}
+
+LedEffect LedEffect::Breathe(int period_ms) {
+    // A triangle sampled every tick, ticks with the same level are merged into one keyframe
+    LedEffect effect;
+    int half = std::max(period_ms / 2, LED_ENGINE_TICK_MS);
+    for (int t = 0; t < half * 2; t += LED_ENGINE_TICK_MS) {
+        int phase = t < half ? t : half * 2 - t;
+        uint8_t level = phase * 255 / half;
+        if (!effect.keyframes_.empty() && effect.keyframes_.back().level == level) {
+            effect.keyframes_.back().duration_ms += LED_ENGINE_TICK_MS;
+        } else {
+            effect.keyframes_.push_back({LED_ENGINE_TICK_MS, level});
+        }
+    }
+    effect.Finalize();
+    return effect;
+}
+
+LedEffect LedEffect::FadeOut(int step_ms) {
+    LedEffect effect;
+    for (int level = 255; level > 0; level /= 2) {
+        effect.keyframes_.push_back({(uint16_t)step_ms, (uint8_t)level});
+    }
+    effect.keyframes_.push_back({(uint16_t)step_ms, 0});
+    effect.repeat_ = 1;
+    effect.Finalize();
+    return effect;
+}
+
+LedEffect LedEffect::Scroll(int pixels, int length, int interval_ms) {
+    LedEffect effect;
+    for (int i = 0; i < pixels; i++) {
+        effect.keyframes_.push_back({(uint16_t)interval_ms, 255});
+    }
+    effect.scroll_length_ = length;
+    effect.Finalize();
+    return effect;
+}
+
+LedEffect LedEffect::Level(std::function<uint8_t()> source) {
+    LedEffect effect;
+    effect.keyframes_.push_back({LED_ENGINE_TICK_MS, 255});
+    effect.level_source_ = source;
+    effect.Finalize();
+    return effect;
+}
+
+void LedEffect::Finalize() {
+    start_ms_.clear();
+    period_ms_ = 0;
+    for (auto& keyframe : keyframes_) {
+        start_ms_.push_back(period_ms_);
+        period_ms_ += keyframe.duration_ms;
+    }
+    if (period_ms_ == 0) {
+        // Nothing to animate, e.g. Blink(0), hold the last level as a static effect
+        uint8_t level = keyframes_.empty() ? 0 : keyframes_.back().level;
+        keyframes_.assign(1, {UINT16_MAX, level});
+        start_ms_.assign(1, 0);
+        period_ms_ = UINT16_MAX;
+    }
+}
+
+int LedEffect::Seek(int64_t elapsed_ms, int64_t* next_ms) const {
+    if (IsStatic()) {
+        *next_ms = -1;
+        return 0;
+    }
+    if (level_source_) {
+        *next_ms = elapsed_ms - elapsed_ms % LED_ENGINE_TICK_MS + LED_ENGINE_TICK_MS;
+        return 0;
+    }
+
+    int64_t cycle = elapsed_ms / period_ms_;
+    if (repeat_ != LED_EFFECT_INFINITE && cycle >= repeat_) {
+        // Ended, hold the last keyframe
+        *next_ms = -1;
+        return keyframes_.size() - 1;
+    }
+    uint32_t position = elapsed_ms % period_ms_;
+    int index = std::upper_bound(start_ms_.begin(), start_ms_.end(), position) - start_ms_.begin() - 1;
+    *next_ms = cycle * period_ms_ + start_ms_[index] + keyframes_[index].duration_ms;
+    return index;
+}
+
+uint8_t LedEffect::LevelAt(int index) const {
+    uint8_t level = keyframes_[index].level;
+    if (level_source_) {
+        level = level * level_source_() / 255;
+    }
+    return level;
+}
+
+LedEngine::LedEngine() {
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            auto engine = static_cast<LedEngine*>(arg);
+            engine->OnTimer();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "led_engine",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer_));
+}
+
+LedEngine::~LedEngine() {
+    if (timer_ != nullptr) {
+        esp_timer_stop(timer_);
+        esp_timer_delete(timer_);
+    }
+}
+
+void LedEngine::Schedule(LedTarget* target, int64_t deadline_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find_if(entries_.begin(), entries_.end(), [target](const Entry& entry) {
+        return entry.target == target;
+    });
+    if (deadline_us < 0) {
+        if (it != entries_.end()) {
+            entries_.erase(it);
+        }
+    } else if (it != entries_.end()) {
+        it->deadline_us = deadline_us;
+    } else {
+        entries_.push_back({target, deadline_us});
+    }
+    Rearm();
+}
+
+void LedEngine::OnTimer() {
+    int64_t now_us = esp_timer_get_time();
+    std::vector<Entry> due;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& entry : entries_) {
+            if (entry.deadline_us <= now_us) {
+                due.push_back(entry);
+            }
+        }
+    }
+
+    // Render without holding the engine lock, the targets call Schedule with their own lock held
+    for (auto& entry : due) {
+        int64_t next_us = entry.target->OnTick(now_us);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = std::find_if(entries_.begin(), entries_.end(), [&entry](const Entry& e) {
+            return e.target == entry.target;
+        });
+        // Unless the target started another effect in the meantime
+        if (it == entries_.end() || it->deadline_us != entry.deadline_us) {
+            continue;
+        }
+        if (next_us < 0) {
+            entries_.erase(it);
+        } else {
+            it->deadline_us = next_us;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Rearm();
+}
+
+void LedEngine::Rearm() {
+    esp_timer_stop(timer_);
+    if (entries_.empty()) {
+        return;
+    }
+    int64_t deadline_us = INT64_MAX;
+    for (auto& entry : entries_) {
+        deadline_us = std::min(deadline_us, entry.deadline_us);
+    }
+    int64_t delay_us = std::max<int64_t>(deadline_us - esp_timer_get_time(), 0);
+    esp_timer_start_once(timer_, delay_us);
+}
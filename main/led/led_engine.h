@@ -0,0 +1,93 @@
+#ifndef _LED_ENGINE_H_
+#define _LED_ENGINE_H_
+
+#include <esp_timer.h>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+// Frame time of the interpolated and level driven effects
+#define LED_ENGINE_TICK_MS 20
+
+#define LED_EFFECT_INFINITE -1
+
+struct LedKeyframe {
+    uint16_t duration_ms;
+    uint8_t level;      // 0-255, from the low color to the high color
+};
+
+/*
+ * A brightness envelope as a table of keyframes, computed once when the effect starts.
+ * Every keyframe is held for its duration, so a blink is two keyframes and only wakes the engine twice a period.
+ * With a scroll length, the keyframe index is also the offset of the lit window on a strip.
+ */
+class LedEffect {
+public:
+    static LedEffect Solid(uint8_t level = 255);
+    static LedEffect Blink(int interval_ms, int times = LED_EFFECT_INFINITE);
+    static LedEffect Breathe(int period_ms);
+    static LedEffect FadeOut(int step_ms);
+    static LedEffect Scroll(int pixels, int length, int interval_ms);
+    // Follows the source every tick, e.g. the audio level, scaled by 0-255
+    static LedEffect Level(std::function<uint8_t()> source);
+
+    bool IsStatic() const { return keyframes_.size() == 1 && !level_source_; }
+    int scroll_length() const { return scroll_length_; }
+
+    // Returns the keyframe index at elapsed_ms and when the next one starts, or -1 when the effect has ended
+    int Seek(int64_t elapsed_ms, int64_t* next_ms) const;
+    uint8_t LevelAt(int index) const;
+
+private:
+    std::vector<LedKeyframe> keyframes_;
+    std::vector<uint32_t> start_ms_;
+    uint32_t period_ms_ = 0;
+    int repeat_ = LED_EFFECT_INFINITE;
+    int scroll_length_ = 0;
+    std::function<uint8_t()> level_source_;
+
+    void Finalize();
+};
+
+// An LED output driven by the engine
+class LedTarget {
+public:
+    virtual ~LedTarget() = default;
+    // Render the frame at now_us, returns when it needs to render again, or -1 if the frame does not change anymore
+    virtual int64_t OnTick(int64_t now_us) = 0;
+};
+
+/*
+ * One timer for all LED outputs. It only fires when some output has a keyframe to show,
+ * so static colors and finished effects cost no wakeups at all.
+ */
+class LedEngine {
+public:
+    static LedEngine& GetInstance() {
+        static LedEngine instance;
+        return instance;
+    }
+    LedEngine(const LedEngine&) = delete;
+    LedEngine& operator=(const LedEngine&) = delete;
+
+    // Render target again at deadline_us, -1 to stop rendering it
+    void Schedule(LedTarget* target, int64_t deadline_us);
+
+private:
+    LedEngine();
+    ~LedEngine();
+
+    struct Entry {
+        LedTarget* target;
+        int64_t deadline_us;
+    };
+    std::mutex mutex_;
+    std::vector<Entry> entries_;
+    esp_timer_handle_t timer_ = nullptr;
+
+    void OnTimer();
+    void Rearm();
+};
+
+#endif // _LED_ENGINE_H_
@@ -8,9 +8,6 @@
 #define HIGH_BRIGHTNESS 16
 #define LOW_BRIGHTNESS 2
 
-#define BLINK_INFINITE -1
-
-
 SingleLed::SingleLed(gpio_num_t gpio) {
     // If the gpio is not connected, you should use NoLed class
     assert(gpio != GPIO_NUM_NC);
@@ -26,22 +23,10 @@ SingleLed::SingleLed(gpio_num_t gpio) {
 
     ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &led_strip_));
     led_strip_clear(led_strip_);
-
-    esp_timer_create_args_t blink_timer_args = {
-        .callback = [](void *arg) {
-            auto led = static_cast<SingleLed*>(arg);
-            led->OnBlinkTimer();
-        },
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "blink_timer",
-        .skip_unhandled_events = false,
-    };
-    ESP_ERROR_CHECK(esp_timer_create(&blink_timer_args, &blink_timer_));
 }
 
 SingleLed::~SingleLed() {
-    esp_timer_stop(blink_timer_);
+    LedEngine::GetInstance().Schedule(this, -1);
     if (led_strip_ != nullptr) {
         led_strip_del(led_strip_);
     }
@@ -55,24 +40,11 @@ void SingleLed::SetColor(uint8_t r, uint8_t g, uint8_t b) {
 }
 
 void SingleLed::TurnOn() {
-    if (led_strip_ == nullptr) {
-        return;
-    }
-    
-    std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
-    led_strip_set_pixel(led_strip_, 0, r_, g_, b_);
-    led_strip_refresh(led_strip_);
+    Play(LedEffect::Solid());
 }
 
 void SingleLed::TurnOff() {
-    if (led_strip_ == nullptr) {
-        return;
-    }
-
-    std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
-    led_strip_clear(led_strip_);
+    Play(LedEffect::Solid(0));
 }
 
 void SingleLed::BlinkOnce() {
@@ -80,39 +52,47 @@ void SingleLed::BlinkOnce() {
 }
 
 void SingleLed::Blink(int times, int interval_ms) {
-    StartBlinkTask(times, interval_ms);
+    Play(LedEffect::Blink(interval_ms, times));
 }
 
 void SingleLed::StartContinuousBlink(int interval_ms) {
-    StartBlinkTask(BLINK_INFINITE, interval_ms);
+    Play(LedEffect::Blink(interval_ms));
 }
 
-void SingleLed::StartBlinkTask(int times, int interval_ms) {
+void SingleLed::Play(const LedEffect& effect) {
     if (led_strip_ == nullptr) {
         return;
     }
 
     std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
-    
-    blink_counter_ = times * 2;
-    blink_interval_ms_ = interval_ms;
-    esp_timer_start_periodic(blink_timer_, interval_ms * 1000);
+    effect_ = effect;
+    effect_start_us_ = esp_timer_get_time();
+    LedEngine::GetInstance().Schedule(this, Render(effect_start_us_));
 }
 
-void SingleLed::OnBlinkTimer() {
+int64_t SingleLed::OnTick(int64_t now_us) {
     std::lock_guard<std::mutex> lock(mutex_);
-    blink_counter_--;
-    if (blink_counter_ & 1) {
-        led_strip_set_pixel(led_strip_, 0, r_, g_, b_);
-        led_strip_refresh(led_strip_);
-    } else {
-        led_strip_clear(led_strip_);
-
-        if (blink_counter_ == 0) {
-            esp_timer_stop(blink_timer_);
+    return Render(now_us);
+}
+
+int64_t SingleLed::Render(int64_t now_us) {
+    int64_t next_ms;
+    int level = effect_.LevelAt(effect_.Seek((now_us - effect_start_us_) / 1000, &next_ms));
+    uint8_t r = (r_ * level + 127) / 255;
+    uint8_t g = (g_ * level + 127) / 255;
+    uint8_t b = (b_ * level + 127) / 255;
+    if (r != frame_r_ || g != frame_g_ || b != frame_b_) {
+        frame_r_ = r;
+        frame_g_ = g;
+        frame_b_ = b;
+        if (r == 0 && g == 0 && b == 0) {
+            led_strip_clear(led_strip_);
+        } else {
+            led_strip_set_pixel(led_strip_, 0, r, g, b);
+            led_strip_refresh(led_strip_);
         }
     }
+    return next_ms < 0 ? -1 : effect_start_us_ + next_ms * 1000;
 }
 
 
@@ -2,13 +2,14 @@
 #define _SINGLE_LED_H_
 
 #include "led.h"
+#include "led_engine.h"
 #include <driver/gpio.h>
 #include <led_strip.h>
 #include <esp_timer.h>
 #include <atomic>
 #include <mutex>
 
-class SingleLed : public Led {
+class SingleLed : public Led, public LedTarget {
 public:
     SingleLed(gpio_num_t gpio);
     virtual ~SingleLed();
@@ -17,15 +18,16 @@ public:
 
 private:
     std::mutex mutex_;
-    TaskHandle_t blink_task_ = nullptr;
     led_strip_handle_t led_strip_ = nullptr;
     uint8_t r_ = 0, g_ = 0, b_ = 0;
-    int blink_counter_ = 0;
-    int blink_interval_ms_ = 0;
-    esp_timer_handle_t blink_timer_ = nullptr;
+    LedEffect effect_ = LedEffect::Solid(0);
+    int64_t effect_start_us_ = 0;
+    // The color on the led, it is only refreshed when it changes
+    uint8_t frame_r_ = 0, frame_g_ = 0, frame_b_ = 0;
 
-    void StartBlinkTask(int times, int interval_ms);
-    void OnBlinkTimer();
+    void Play(const LedEffect& effect);
+    int64_t Render(int64_t now_us);
+    int64_t OnTick(int64_t now_us) override;
 
     void BlinkOnce();
     void Blink(int times, int interval_ms);
@@ -55,6 +55,34 @@ void McpServer::AddCommonTools() {
             codec->SetOutputVolume(properties["volume"].value<int>());
             return true;
         });
+
+#if CONFIG_USE_STREAM_PLAYER
+    AddTool("self.audio.play_url",
+        "Play an audio stream from an HTTP URL on the speaker, for stories, music or other long audio the user asks for.\n"
+        "The stream must be Ogg/Opus or P3. It starts after your current reply and the conversation ends,\n"
+        "the user stops it by waking the device up.\n"
+        "Args:\n"
+        "  `url`: The http or https URL of the audio.",
+        PropertyList({
+            Property("url", kPropertyTypeString)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto url = properties["url"].value<std::string>();
+            if (url.rfind("http://", 0) != 0 && url.rfind("https://", 0) != 0) {
+                return "{\"success\": false, \"message\": \"Only http and https URLs can be played\"}";
+            }
+            Application::GetInstance().PlayUrl(url);
+            return true;
+        });
+
+    AddTool("self.audio.stop",
+        "Stop the audio stream started by `self.audio.play_url`.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            Application::GetInstance().StopUrl();
+            return true;
+        });
+#endif
     
     auto backlight = board.GetBacklight();
     if (backlight) {
@@ -15,6 +15,7 @@
 #endif
 
 #include <cstring>
+#include <ctime>
 #include <vector>
 #include <sstream>
 #include <algorithm>
@@ -87,6 +88,15 @@ bool Ota::CheckVersion() {
 
     auto http = SetupHttp();
 
+#if CONFIG_USE_OTA_CACHE
+    // Ask the server to answer 304 if the cached response is still current
+    std::string cached_response = GetCachedResponse();
+    if (!cached_response.empty()) {
+        Settings cache("ota", false);
+        http->SetHeader("If-None-Match", cache.GetString("etag"));
+    }
+#endif
+
     std::string data = board.GetJson();
     std::string method = data.length() > 0 ? "POST" : "GET";
     http->SetContent(std::move(data));
@@ -97,18 +107,105 @@ bool Ota::CheckVersion() {
     }
 
     auto status_code = http->GetStatusCode();
+#if CONFIG_USE_OTA_CACHE
+    if (status_code == 304 && !cached_response.empty()) {
+        std::string date = http->GetResponseHeader("Date");
+        http->Close();
+        ESP_LOGI(TAG, "Cached response is current");
+        is_cached_response_ = true;
+        if (!ParseResponse(cached_response, false)) {
+            return false;
+        }
+        SetServerTimeFromDate(date);
+        return true;
+    }
+#endif
     if (status_code != 200) {
         ESP_LOGE(TAG, "Failed to check version, status code: %d", status_code);
         return false;
     }
 
+    std::string etag = http->GetResponseHeader("ETag");
     data = http->ReadAll();
     http->Close();
 
-    // Response: { "firmware": { "version": "1.0.0", "url": "http://" } }
-    // Parse the JSON response and check if the version is newer
-    // If it is, set has_new_version_ to true and store the new version and URL
-    
+    is_cached_response_ = false;
+    if (!ParseResponse(data, true)) {
+        return false;
+    }
+#if CONFIG_USE_OTA_CACHE
+    SaveCachedResponse(data, etag);
+#endif
+    return true;
+}
+
+#if CONFIG_USE_OTA_CACHE
+// The cached response belongs to this firmware version and check version URL
+std::string Ota::GetCachedResponse() {
+    Settings cache("ota", false);
+    auto app_desc = esp_app_get_description();
+    if (cache.GetString("version") != app_desc->version || cache.GetString("url") != GetCheckVersionUrl()) {
+        return "";
+    }
+    if (cache.GetString("etag").empty()) {
+        return "";
+    }
+    return cache.GetString("response");
+}
+
+void Ota::SaveCachedResponse(const std::string& data, const std::string& etag) {
+    Settings cache("ota", true);
+    // An activation is pending or the server does not tag its responses, check in full on every boot.
+    // NVS strings are limited to 4000 bytes
+    if (etag.empty() || has_activation_code_ || has_activation_challenge_ || data.size() >= 4000) {
+        cache.EraseAll();
+        return;
+    }
+    if (cache.GetString("etag") == etag && cache.GetString("response") == data) {
+        return;
+    }
+    ESP_LOGI(TAG, "Caching the response, ETag %s", etag.c_str());
+    cache.SetString("response", data);
+    cache.SetString("etag", etag);
+    cache.SetString("version", esp_app_get_description()->version);
+    cache.SetString("url", GetCheckVersionUrl());
+}
+
+bool Ota::LoadCachedConfig() {
+    current_version_ = esp_app_get_description()->version;
+    std::string data = GetCachedResponse();
+    if (data.empty()) {
+        return false;
+    }
+    if (!ParseResponse(data, false)) {
+        return false;
+    }
+    // A stale firmware section must not start an upgrade, the revalidation decides that
+    has_new_version_ = false;
+    ESP_LOGI(TAG, "Loaded the cached response");
+    return true;
+}
+
+// A 304 has no body to carry the server time, the Date header has it to the second
+void Ota::SetServerTimeFromDate(const std::string& date) {
+    struct tm tm = {};
+    if (date.empty() || strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm) == NULL) {
+        ESP_LOGW(TAG, "No usable Date header: %s", date.c_str());
+        return;
+    }
+    // The system clock runs in local time without TZ, so mktime takes the time as UTC
+    struct timeval tv;
+    tv.tv_sec = mktime(&tm) + timezone_offset_minutes_ * 60;
+    tv.tv_usec = 0;
+    settimeofday(&tv, NULL);
+    has_server_time_ = true;
+}
+#endif
+
+// Response: { "firmware": { "version": "1.0.0", "url": "http://" } }
+// Parse the JSON response and check if the version is newer
+// If it is, set has_new_version_ to true and store the new version and URL
+bool Ota::ParseResponse(const std::string& data, bool fresh) {
     cJSON *root = cJSON_Parse(data.c_str());
     if (root == NULL) {
         ESP_LOGE(TAG, "Failed to parse JSON response");
@@ -186,8 +283,12 @@ bool Ota::CheckVersion() {
     if (cJSON_IsObject(server_time)) {
         cJSON *timestamp = cJSON_GetObjectItem(server_time, "timestamp");
         cJSON *timezone_offset = cJSON_GetObjectItem(server_time, "timezone_offset");
+        if (cJSON_IsNumber(timezone_offset)) {
+            timezone_offset_minutes_ = timezone_offset->valueint;
+        }
         
-        if (cJSON_IsNumber(timestamp)) {
+        // The timestamp of a cached response is stale
+        if (fresh && cJSON_IsNumber(timestamp)) {
             // 设置系统时间
             struct timeval tv;
             double ts = timestamp->valuedouble;
@@ -13,6 +13,10 @@ public:
     ~Ota();
 
     bool CheckVersion();
+    // Apply the last response cached by CheckVersion without a request, false if there is none
+    bool LoadCachedConfig();
+    // The last CheckVersion was answered with 304 and used the cached response
+    bool IsCachedResponse() { return is_cached_response_; }
     esp_err_t Activate();
     bool HasActivationChallenge() { return has_activation_challenge_; }
     bool HasNewVersion() { return has_new_version_; }
@@ -45,6 +49,8 @@ private:
     std::string activation_challenge_;
     std::string serial_number_;
     int activation_timeout_ms_ = 30000;
+    int timezone_offset_minutes_ = 0;
+    bool is_cached_response_ = false;
 
     bool Upgrade(const std::string& firmware_url);
     std::function<void(int progress, size_t speed)> upgrade_callback_;
@@ -52,6 +58,12 @@ private:
     bool IsNewVersionAvailable(const std::string& currentVersion, const std::string& newVersion);
     std::string GetActivationPayload();
     std::unique_ptr<Http> SetupHttp();
+    bool ParseResponse(const std::string& data, bool fresh);
+#if CONFIG_USE_OTA_CACHE
+    std::string GetCachedResponse();
+    void SaveCachedResponse(const std::string& data, const std::string& etag);
+    void SetServerTimeFromDate(const std::string& date);
+#endif
 };
 
 #endif // _OTA_H
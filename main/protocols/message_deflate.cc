@@ -0,0 +1,145 @@
+#include "message_deflate.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "MessageDeflate"
+
+// The end of a sync flush, left out of every message on the wire
+static const uint8_t kSyncFlushTail[] = {0x00, 0x00, 0xff, 0xff};
+
+MessageDeflate::MessageDeflate(int compress_window_bits, int decompress_window_bits, bool compress_context_takeover)
+    : compress_context_takeover_(compress_context_takeover) {
+    // Negative window bits for raw deflate, without the zlib header and checksum
+    if (deflateInit2(&deflate_stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -compress_window_bits,
+            CONFIG_WEBSOCKET_DEFLATE_MEM_LEVEL, Z_DEFAULT_STRATEGY) == Z_OK) {
+        deflate_ready_ = true;
+    } else {
+        ESP_LOGE(TAG, "Failed to initialize deflate");
+    }
+    if (inflateInit2(&inflate_stream_, -decompress_window_bits) == Z_OK) {
+        inflate_ready_ = true;
+    } else {
+        ESP_LOGE(TAG, "Failed to initialize inflate");
+    }
+    ESP_LOGI(TAG, "Window bits %d / %d, memory level %d, context takeover %s", compress_window_bits,
+        decompress_window_bits, CONFIG_WEBSOCKET_DEFLATE_MEM_LEVEL, compress_context_takeover ? "on" : "off");
+}
+
+MessageDeflate::~MessageDeflate() {
+    if (deflate_ready_) {
+        deflateEnd(&deflate_stream_);
+    }
+    if (inflate_ready_) {
+        inflateEnd(&inflate_stream_);
+    }
+}
+
+bool MessageDeflate::Compress(const std::string& message, std::string& out) {
+    std::lock_guard<std::mutex> lock(deflate_mutex_);
+    if (!deflate_ready_) {
+        return false;
+    }
+    auto start_time = esp_timer_get_time();
+    if (!compress_context_takeover_) {
+        deflateReset(&deflate_stream_);
+    }
+
+    size_t header_size = out.size();
+    size_t written = header_size;
+    out.resize(header_size + message.size() / 2 + 64);
+    deflate_stream_.next_in = (Bytef*)message.data();
+    deflate_stream_.avail_in = message.size();
+    while (true) {
+        deflate_stream_.next_out = (Bytef*)out.data() + written;
+        deflate_stream_.avail_out = out.size() - written;
+        int ret = deflate(&deflate_stream_, Z_SYNC_FLUSH);
+        written = out.size() - deflate_stream_.avail_out;
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            ESP_LOGE(TAG, "Failed to compress message: %d", ret);
+            deflateReset(&deflate_stream_);
+            out.resize(header_size);
+            return false;
+        }
+        // The flush is complete once it leaves room in the output
+        if (deflate_stream_.avail_out > 0) {
+            break;
+        }
+        out.resize(out.size() * 2);
+    }
+
+    if (written - header_size >= sizeof(kSyncFlushTail) &&
+        memcmp(out.data() + written - sizeof(kSyncFlushTail), kSyncFlushTail, sizeof(kSyncFlushTail)) == 0) {
+        written -= sizeof(kSyncFlushTail);
+    }
+    out.resize(written);
+
+    raw_sent_ += message.size();
+    wire_sent_ += written - header_size;
+    messages_sent_++;
+    compress_us_ += esp_timer_get_time() - start_time;
+    return true;
+}
+
+bool MessageDeflate::Decompress(const uint8_t* data, size_t size, std::string& out) {
+    if (!inflate_ready_ || inflate_failed_) {
+        return false;
+    }
+    auto start_time = esp_timer_get_time();
+
+    size_t written = 0;
+    out.resize(std::clamp<size_t>(size * 4, 256, MESSAGE_DEFLATE_MAX_SIZE));
+    const uint8_t* inputs[] = {data, kSyncFlushTail};
+    size_t input_sizes[] = {size, sizeof(kSyncFlushTail)};
+    bool stream_end = false;
+    for (int i = 0; i < 2 && !stream_end; i++) {
+        inflate_stream_.next_in = (Bytef*)inputs[i];
+        inflate_stream_.avail_in = input_sizes[i];
+        while (true) {
+            if (written == out.size()) {
+                if (out.size() >= MESSAGE_DEFLATE_MAX_SIZE) {
+                    ESP_LOGE(TAG, "Message larger than %d bytes", MESSAGE_DEFLATE_MAX_SIZE);
+                    inflate_failed_ = true;
+                    return false;
+                }
+                out.resize(std::min<size_t>(out.size() * 2, MESSAGE_DEFLATE_MAX_SIZE));
+            }
+            inflate_stream_.next_out = (Bytef*)out.data() + written;
+            inflate_stream_.avail_out = out.size() - written;
+            int ret = inflate(&inflate_stream_, Z_SYNC_FLUSH);
+            written = out.size() - inflate_stream_.avail_out;
+            if (ret == Z_STREAM_END) {
+                // The peer ended the stream with a final block, the next message starts a new one
+                inflateReset(&inflate_stream_);
+                stream_end = true;
+                break;
+            }
+            if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                ESP_LOGE(TAG, "Failed to decompress message: %d", ret);
+                inflate_failed_ = true;
+                return false;
+            }
+            if (inflate_stream_.avail_out > 0) {
+                break;
+            }
+        }
+    }
+    out.resize(written);
+
+    raw_received_ += written;
+    wire_received_ += size;
+    messages_received_++;
+    decompress_us_ += esp_timer_get_time() - start_time;
+    return true;
+}
+
+void MessageDeflate::LogStatistics() const {
+    if (messages_sent_ == 0 && messages_received_ == 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "Sent %lu messages, %u -> %u bytes in %lld us; received %lu messages, %u -> %u bytes in %lld us",
+        messages_sent_, raw_sent_, wire_sent_, compress_us_,
+        messages_received_, wire_received_, raw_received_, decompress_us_);
+}
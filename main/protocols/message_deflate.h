@@ -0,0 +1,49 @@
+#ifndef _MESSAGE_DEFLATE_H_
+#define _MESSAGE_DEFLATE_H_
+
+#include <zlib.h>
+#include <string>
+#include <mutex>
+#include <cstdint>
+
+// A larger inflated message is dropped, it would not fit cJSON in RAM either
+#define MESSAGE_DEFLATE_MAX_SIZE (64 * 1024)
+
+/*
+ * Raw deflate of whole JSON messages with the framing of RFC 7692: each message ends with a sync flush,
+ * whose trailing 00 00 ff ff is left out on the wire. The window is small to fit the ESP32, both ends
+ * agree on it in the hello. With context takeover, the window carries over between messages,
+ * so the keys repeated in every message compress to a few bytes.
+ */
+class MessageDeflate {
+public:
+    MessageDeflate(int compress_window_bits, int decompress_window_bits, bool compress_context_takeover);
+    ~MessageDeflate();
+
+    // Appends the compressed message to out, after what is already there (the frame header)
+    bool Compress(const std::string& message, std::string& out);
+    // A failure leaves the context out of sync with the peer, later calls fail until the connection is renegotiated
+    bool Decompress(const uint8_t* data, size_t size, std::string& out);
+    void LogStatistics() const;
+
+private:
+    z_stream deflate_stream_ = {};
+    z_stream inflate_stream_ = {};
+    bool deflate_ready_ = false;
+    bool inflate_ready_ = false;
+    bool inflate_failed_ = false;
+    bool compress_context_takeover_;
+    // Sending may come from several tasks, receiving only from the network task
+    std::mutex deflate_mutex_;
+
+    size_t raw_sent_ = 0;
+    size_t wire_sent_ = 0;
+    size_t raw_received_ = 0;
+    size_t wire_received_ = 0;
+    uint32_t messages_sent_ = 0;
+    uint32_t messages_received_ = 0;
+    int64_t compress_us_ = 0;
+    int64_t decompress_us_ = 0;
+};
+
+#endif // _MESSAGE_DEFLATE_H_
@@ -12,6 +12,7 @@
 
 MqttProtocol::MqttProtocol() {
     event_group_handle_ = xEventGroupCreate();
+    xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_PREWARM_DONE_EVENT);
 }
 
 MqttProtocol::~MqttProtocol() {
@@ -73,9 +74,18 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
             ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
             if (session_id == nullptr || session_id_ == session_id->valuestring) {
                 Application::GetInstance().Schedule([this]() {
-                    CloseAudioChannel();
+                    if (channel_opened_) {
+                        CloseAudioChannel();
+                    } else if (!CancelPrewarm()) {
+                        // The server ended a warm session
+                        CloseSession();
+                    }
                 });
             }
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+        } else if (!channel_opened_ && IsTurnMessage(type->valuestring)) {
+            ESP_LOGW(TAG, "Drop %s message of the parked session", type->valuestring);
+#endif
         } else if (on_incoming_json_ != nullptr) {
             on_incoming_json_(root);
         }
@@ -141,9 +151,61 @@ bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
     return udp_->Send(encrypted) > 0;
 }
 
+void MqttProtocol::WaitForPrewarm() {
+    {
+        // Opening the channel takes over the session being set up
+        std::lock_guard<std::mutex> lock(prewarm_mutex_);
+        prewarm_cancelled_ = false;
+    }
+    xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_PREWARM_DONE_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
+}
+
+bool MqttProtocol::CancelPrewarm() {
+    std::lock_guard<std::mutex> lock(prewarm_mutex_);
+    if (xEventGroupGetBits(event_group_handle_) & MQTT_PROTOCOL_PREWARM_DONE_EVENT) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Cancel the session being prewarmed");
+    prewarm_cancelled_ = true;
+    return true;
+}
+
 void MqttProtocol::CloseAudioChannel() {
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    if (CancelPrewarm()) {
+        if (on_audio_channel_closed_ != nullptr) {
+            on_audio_channel_closed_();
+        }
+        return;
+    }
+    if (channel_opened_ && !error_occurred_ && udp_ != nullptr && mqtt_ != nullptr && mqtt_->IsConnected()) {
+        // Keep the UDP session without saying goodbye, the next conversation resumes it.
+        // End the turn first, or a late tts start would bring the device back to speaking
+        ESP_LOGI(TAG, "Keep session %s warm", session_id_.c_str());
+        SendAbortSpeaking(kAbortReasonNone);
+        channel_opened_ = false;
+        StartKeepWarmTimer();
+        if (on_audio_channel_closed_ != nullptr) {
+            on_audio_channel_closed_();
+        }
+        return;
+    }
+    StopKeepWarmTimer();
+#endif
+    CloseSession();
+
+    if (on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+}
+
+void MqttProtocol::CloseSession() {
+    channel_opened_ = false;
     {
         std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (udp_ == nullptr && session_id_.empty()) {
+            return;
+        }
         udp_.reset();
     }
 
@@ -152,26 +214,111 @@ void MqttProtocol::CloseAudioChannel() {
     message += "\"type\":\"goodbye\"";
     message += "}";
     SendText(message);
+    session_id_ = "";
+}
 
-    if (on_audio_channel_closed_ != nullptr) {
-        on_audio_channel_closed_();
+void MqttProtocol::OnKeepWarmTimeout() {
+    auto bits = xEventGroupGetBits(event_group_handle_);
+    if (channel_opened_ || !(bits & MQTT_PROTOCOL_PREWARM_DONE_EVENT)) {
+        return;
     }
+    ESP_LOGI(TAG, "Close idle session %s", session_id_.c_str());
+    CloseSession();
+    DeferPrewarm();
+}
+
+void MqttProtocol::PrewarmAudioChannel() {
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    auto bits = xEventGroupGetBits(event_group_handle_);
+    if (channel_opened_ || !(bits & MQTT_PROTOCOL_PREWARM_DONE_EVENT) || mqtt_ == nullptr || !mqtt_->IsConnected()) {
+        return;
+    }
+    if (udp_ != nullptr) {
+        // Still warm, nothing to set up
+        StartKeepWarmTimer();
+        return;
+    }
+    if (!IsPrewarmAllowed()) {
+        return;
+    }
+
+    // Request the UDP session in background, OpenAudioChannel waits for it and reuses the session
+    prewarm_cancelled_ = false;
+    xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_PREWARM_DONE_EVENT);
+    xTaskCreate([](void* arg) {
+        auto this_ = (MqttProtocol*)arg;
+        std::string error;
+        bool opened = this_->OpenSession(error);
+        if (!opened) {
+            ESP_LOGW(TAG, "Failed to prewarm the session: %s", error.c_str());
+            this_->DeferPrewarm();
+        }
+
+        std::unique_lock<std::mutex> lock(this_->prewarm_mutex_);
+        if (this_->prewarm_cancelled_) {
+            this_->prewarm_cancelled_ = false;
+            lock.unlock();
+            this_->CloseSession();
+        } else if (opened) {
+            this_->StartKeepWarmTimer();
+        }
+        xEventGroupSetBits(this_->event_group_handle_, MQTT_PROTOCOL_PREWARM_DONE_EVENT);
+        vTaskDelete(NULL);
+    }, "mqtt_prewarm", 4096, this, 2, nullptr);
+#endif
 }
 
 bool MqttProtocol::OpenAudioChannel() {
+    // Wait for the speculative session if it is in progress, it takes the place of our own hello
+    WaitForPrewarm();
     if (mqtt_ == nullptr || !mqtt_->IsConnected()) {
         ESP_LOGI(TAG, "MQTT is not connected, try to connect now");
+        {
+            // A warm session does not survive the reconnection
+            std::lock_guard<std::mutex> lock(channel_mutex_);
+            udp_.reset();
+        }
         if (!StartMqttClient(true)) {
             return false;
         }
     }
 
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    StopKeepWarmTimer();
+    if (udp_ != nullptr) {
+        ESP_LOGI(TAG, "Resume session %s", session_id_.c_str());
+        error_occurred_ = false;
+        channel_opened_ = true;
+        last_incoming_time_ = std::chrono::steady_clock::now();
+        if (on_audio_channel_opened_ != nullptr) {
+            on_audio_channel_opened_();
+        }
+        return true;
+    }
+#endif
+
     error_occurred_ = false;
+    std::string error;
+    if (!OpenSession(error)) {
+        SetError(error);
+        return false;
+    }
+
+    channel_opened_ = true;
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+    return true;
+}
+
+bool MqttProtocol::OpenSession(std::string& error) {
     session_id_ = "";
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
     auto message = GetHelloMessage();
-    if (!SendText(message)) {
+    if (publish_topic_.empty() || !mqtt_->Publish(publish_topic_, message)) {
+        ESP_LOGE(TAG, "Failed to publish hello message");
+        error = Lang::Strings::SERVER_ERROR;
         return false;
     }
 
@@ -179,11 +326,14 @@ bool MqttProtocol::OpenAudioChannel() {
     EventBits_t bits = xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
     if (!(bits & MQTT_PROTOCOL_SERVER_HELLO_EVENT)) {
         ESP_LOGE(TAG, "Failed to receive server hello");
-        SetError(Lang::Strings::SERVER_TIMEOUT);
+        error = Lang::Strings::SERVER_TIMEOUT;
         return false;
     }
 
     std::lock_guard<std::mutex> lock(channel_mutex_);
+    // A new session starts both sequences over
+    local_sequence_ = 0;
+    remote_sequence_ = 0;
     auto network = Board::GetInstance().GetNetwork();
     udp_ = network->CreateUdp(2);
     udp_->OnMessage([this](const std::string& data) {
@@ -233,10 +383,7 @@ bool MqttProtocol::OpenAudioChannel() {
     });
 
     udp_->Connect(udp_server_, udp_port_);
-
-    if (on_audio_channel_opened_ != nullptr) {
-        on_audio_channel_opened_();
-    }
+    last_incoming_time_ = std::chrono::steady_clock::now();
     return true;
 }
 
@@ -251,12 +398,15 @@ std::string MqttProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+#if CONFIG_USE_REALTIME_DTX
+    cJSON_AddBoolToObject(features, "dtx", true);
+#endif
     cJSON_AddItemToObject(root, "features", features);
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    AddUplinkFrameDurations(audio_params);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -280,6 +430,7 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
 
     // Get sample rate from hello message
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
+    ParseUplinkFrameDuration(audio_params);
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
         if (cJSON_IsNumber(sample_rate)) {
@@ -331,5 +482,6 @@ std::string MqttProtocol::DecodeHexString(const std::string& hex_string) {
 }
 
 bool MqttProtocol::IsAudioChannelOpened() const {
-    return udp_ != nullptr && !error_occurred_ && !IsTimeout();
+    bool prewarming = !(xEventGroupGetBits(event_group_handle_) & MQTT_PROTOCOL_PREWARM_DONE_EVENT);
+    return channel_opened_ && !prewarming && udp_ != nullptr && !error_occurred_ && !IsTimeout();
 }
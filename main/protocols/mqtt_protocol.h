@@ -19,6 +19,7 @@
 #define MQTT_RECONNECT_INTERVAL_MS 10000
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define MQTT_PROTOCOL_PREWARM_DONE_EVENT (1 << 1)
 
 class MqttProtocol : public Protocol {
 public:
@@ -30,6 +31,7 @@ public:
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    void PrewarmAudioChannel() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
@@ -45,8 +47,16 @@ private:
     int udp_port_;
     uint32_t local_sequence_;
     uint32_t remote_sequence_;
+    bool channel_opened_ = false;
 
     bool StartMqttClient(bool report_error=false);
+    bool OpenSession(std::string& error);
+    // The prewarm task owns the session until it sets MQTT_PROTOCOL_PREWARM_DONE_EVENT,
+    // only OpenAudioChannel waits for it, closing cancels it
+    void WaitForPrewarm();
+    bool CancelPrewarm();
+    void CloseSession();
+    void OnKeepWarmTimeout() override;
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
 
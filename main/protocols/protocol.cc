@@ -1,9 +1,18 @@
 #include "protocol.h"
+#include "application.h"
 
 #include <esp_log.h>
+#include <cstring>
 
 #define TAG "Protocol"
 
+Protocol::~Protocol() {
+    if (keep_warm_timer_ != nullptr) {
+        esp_timer_stop(keep_warm_timer_);
+        esp_timer_delete(keep_warm_timer_);
+    }
+}
+
 void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
@@ -24,6 +33,26 @@ void Protocol::OnNetworkError(std::function<void(const std::string& message)> ca
     on_network_error_ = callback;
 }
 
+void Protocol::AddUplinkFrameDurations(cJSON* audio_params) {
+    static const int frame_durations[] = {20, 40, 60};
+    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    cJSON_AddItemToObject(audio_params, "frame_durations", cJSON_CreateIntArray(frame_durations, 3));
+}
+
+void Protocol::ParseUplinkFrameDuration(const cJSON* audio_params) {
+    uplink_frame_duration_ = OPUS_FRAME_DURATION_MS;
+    auto uplink_frame_duration = cJSON_GetObjectItem(audio_params, "uplink_frame_duration");
+    if (!cJSON_IsNumber(uplink_frame_duration)) {
+        return;
+    }
+    int value = uplink_frame_duration->valueint;
+    if (value == 20 || value == 40 || value == 60) {
+        uplink_frame_duration_ = value;
+    } else {
+        ESP_LOGW(TAG, "Unsupported uplink frame duration %d ms, using %d ms", value, uplink_frame_duration_);
+    }
+}
+
 void Protocol::SetError(const std::string& message) {
     error_occurred_ = true;
     if (on_network_error_ != nullptr) {
@@ -80,3 +109,45 @@ bool Protocol::IsTimeout() const {
     }
     return timeout;
 }
+
+void Protocol::StartKeepWarmTimer() {
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    if (keep_warm_timer_ == nullptr) {
+        esp_timer_create_args_t timer_args = {
+            .callback = [](void* arg) {
+                auto protocol = (Protocol*)arg;
+                Application::GetInstance().Schedule([protocol]() {
+                    protocol->OnKeepWarmTimeout();
+                });
+            },
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "keep_warm_timer",
+            .skip_unhandled_events = true,
+        };
+        esp_timer_create(&timer_args, &keep_warm_timer_);
+    }
+    esp_timer_stop(keep_warm_timer_);
+    esp_timer_start_once(keep_warm_timer_, CONFIG_AUDIO_CHANNEL_KEEP_WARM_SECONDS * 1000000LL);
+#endif
+}
+
+void Protocol::StopKeepWarmTimer() {
+    if (keep_warm_timer_ != nullptr) {
+        esp_timer_stop(keep_warm_timer_);
+    }
+}
+
+bool Protocol::IsPrewarmAllowed() const {
+    return std::chrono::steady_clock::now() >= next_prewarm_time_;
+}
+
+void Protocol::DeferPrewarm() {
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    next_prewarm_time_ = std::chrono::steady_clock::now() + std::chrono::seconds(CONFIG_AUDIO_CHANNEL_PREWARM_COOLDOWN_SECONDS);
+#endif
+}
+
+bool Protocol::IsTurnMessage(const char* type) {
+    return strcmp(type, "tts") == 0 || strcmp(type, "llm") == 0;
+}
@@ -2,10 +2,12 @@
 #define PROTOCOL_H
 
 #include <cJSON.h>
+#include <esp_timer.h>
 #include <string>
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <mutex>
 
 struct AudioStreamPacket {
     int sample_rate = 0;
@@ -16,7 +18,7 @@ struct AudioStreamPacket {
 
 struct BinaryProtocol2 {
     uint16_t version;
-    uint16_t type;          // Message type (0: OPUS, 1: JSON)
+    uint16_t type;          // Message type (0: OPUS, 1: JSON, 2: deflated JSON)
     uint32_t reserved;      // Reserved for future use
     uint32_t timestamp;     // Timestamp in milliseconds (used for server-side AEC)
     uint32_t payload_size;  // Payload size in bytes
@@ -43,7 +45,7 @@ enum ListeningMode {
 
 class Protocol {
 public:
-    virtual ~Protocol() = default;
+    virtual ~Protocol();
 
     inline int server_sample_rate() const {
         return server_sample_rate_;
@@ -51,6 +53,9 @@ public:
     inline int server_frame_duration() const {
         return server_frame_duration_;
     }
+    inline int uplink_frame_duration() const {
+        return uplink_frame_duration_;
+    }
     inline const std::string& session_id() const {
         return session_id_;
     }
@@ -65,6 +70,8 @@ public:
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
+    // Speculatively set up the transport before the audio channel is needed, e.g. when speech is detected
+    virtual void PrewarmAudioChannel() {}
     virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
@@ -81,13 +88,38 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int uplink_frame_duration_ = CONFIG_OPUS_FRAME_DURATION_MS;
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    esp_timer_handle_t keep_warm_timer_ = nullptr;
 
     virtual bool SendText(const std::string& text) = 0;
+    // The device proposes its frame duration in hello, the server may choose another supported one
+    void AddUplinkFrameDurations(cJSON* audio_params);
+    void ParseUplinkFrameDuration(const cJSON* audio_params);
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
+
+    // Keep an idle audio channel for CONFIG_AUDIO_CHANNEL_KEEP_WARM_SECONDS,
+    // OnKeepWarmTimeout is called in the main loop when it expires
+    void StartKeepWarmTimer();
+    void StopKeepWarmTimer();
+    virtual void OnKeepWarmTimeout() {}
+
+    // Speculative connections are held back for a while after one went unused or failed,
+    // so a noisy room does not reconnect over and over
+    std::chrono::time_point<std::chrono::steady_clock> next_prewarm_time_;
+    bool IsPrewarmAllowed() const;
+    void DeferPrewarm();
+
+    // Closing while the prewarm task sets up the transport cancels it instead of waiting for it,
+    // the task releases what it set up when it finishes
+    std::mutex prewarm_mutex_;
+    bool prewarm_cancelled_ = false;
+
+    // Replies of a turn, a parked session drops them until the audio channel opens again
+    static bool IsTurnMessage(const char* type);
 };
 
 #endif // PROTOCOL_H
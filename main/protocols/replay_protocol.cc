@@ -0,0 +1,305 @@
+#include "replay_protocol.h"
+#include "board.h"
+#include "application.h"
+#include "event_bus.h"
+#include "system_info.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+
+#define TAG "Replay"
+
+ReplayProtocol::ReplayProtocol() {
+    event_group_handle_ = xEventGroupCreate();
+
+    EventBus::GetInstance().Subscribe(EVENT_MASK(kEventDeviceState), [](const Event& event, void* arg) {
+        // Measure how long it takes from a tts message to the state transition it causes
+        auto self = static_cast<ReplayProtocol*>(arg);
+        auto current_state = event.state.current;
+        if (current_state == kDeviceStateSpeaking || current_state == kDeviceStateListening || current_state == kDeviceStateIdle) {
+            int64_t tts_time = self->last_tts_time_.exchange(0);
+            if (tts_time == 0) {
+                return;
+            }
+            int64_t latency = esp_timer_get_time() - tts_time;
+            self->total_state_latency_us_ += latency;
+            int64_t max_latency = self->max_state_latency_us_;
+            while (latency > max_latency && !self->max_state_latency_us_.compare_exchange_weak(max_latency, latency)) {
+            }
+            self->state_transitions_++;
+        }
+    }, this);
+}
+
+ReplayProtocol::~ReplayProtocol() {
+    if (data_ != nullptr) {
+        heap_caps_free(data_);
+    }
+    vEventGroupDelete(event_group_handle_);
+}
+
+bool ReplayProtocol::Load() {
+    auto network = Board::GetInstance().GetNetwork();
+    auto http = network->CreateHttp(0);
+    if (!http->Open("GET", CONFIG_SESSION_REPLAY_URL)) {
+        ESP_LOGE(TAG, "Failed to open %s", CONFIG_SESSION_REPLAY_URL);
+        return false;
+    }
+    if (http->GetStatusCode() != 200) {
+        ESP_LOGE(TAG, "Failed to get session, status code: %d", http->GetStatusCode());
+        return false;
+    }
+
+    size_t content_length = http->GetBodyLength();
+    if (content_length < sizeof(SessionFileHeader)) {
+        ESP_LOGE(TAG, "Invalid session length: %u", content_length);
+        return false;
+    }
+
+    // Keep the whole session in memory, so the replay speed does not depend on the network
+    data_ = (uint8_t*)heap_caps_malloc(content_length, MALLOC_CAP_SPIRAM);
+    if (data_ == nullptr) {
+        data_ = (uint8_t*)heap_caps_malloc(content_length, MALLOC_CAP_8BIT);
+    }
+    if (data_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for the session", content_length);
+        return false;
+    }
+
+    while (size_ < content_length) {
+        int ret = http->Read((char*)data_ + size_, content_length - size_);
+        if (ret <= 0) {
+            break;
+        }
+        size_ += ret;
+    }
+    http->Close();
+
+    auto file_header = (SessionFileHeader*)data_;
+    if (size_ != content_length || file_header->magic != SESSION_RECORD_FILE_MAGIC ||
+        file_header->version != SESSION_RECORD_FILE_VERSION) {
+        ESP_LOGE(TAG, "Invalid session file, size: %u/%u", size_, content_length);
+        return false;
+    }
+
+    // The first record describes the server audio params of the recorded session
+    auto record = (SessionRecordHeader*)(data_ + sizeof(SessionFileHeader));
+    if (record->type == kSessionRecordChannelOpened) {
+        server_sample_rate_ = record->sample_rate;
+        server_frame_duration_ = record->frame_duration;
+        session_id_ = std::string((const char*)record->payload, record->payload_size);
+    }
+    ESP_LOGI(TAG, "Loaded session %s, %u bytes, server sample rate: %d", session_id_.c_str(), size_, server_sample_rate_);
+    return true;
+}
+
+bool ReplayProtocol::Start() {
+    if (!Load()) {
+        return false;
+    }
+
+    xTaskCreate([](void* arg) {
+        auto this_ = (ReplayProtocol*)arg;
+        this_->ReplayTask();
+        vTaskDelete(NULL);
+    }, "session_replay", 4096, this, 2, nullptr);
+    return true;
+}
+
+void ReplayProtocol::ReplayTask() {
+    auto& app = Application::GetInstance();
+    auto& audio_service = app.GetAudioService();
+
+    for (int i = 0; i < CONFIG_SESSION_REPLAY_ITERATIONS; i++) {
+        while (app.GetDeviceState() != kDeviceStateIdle) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
+
+        sent_audio_packets_ = 0;
+        sent_text_messages_ = 0;
+        expected_audio_packets_ = 0;
+        total_state_latency_us_ = 0;
+        max_state_latency_us_ = 0;
+        state_transitions_ = 0;
+        audio_service.ResetDebugStatistics();
+        size_t free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+        multi_heap_info_t sram_before, psram_before;
+        heap_caps_get_info(&sram_before, MALLOC_CAP_INTERNAL);
+        heap_caps_get_info(&psram_before, MALLOC_CAP_SPIRAM);
+        configRUN_TIME_COUNTER_TYPE start_run_time = 0;
+        auto start_tasks = SystemInfo::GetTaskStates(start_run_time);
+
+        // Start the conversation like a button press
+        xEventGroupClearBits(event_group_handle_, REPLAY_PROTOCOL_CHANNEL_OPENED_EVENT | REPLAY_PROTOCOL_CHANNEL_CLOSED_EVENT);
+        app.ToggleChatState();
+        EventBits_t bits = xEventGroupWaitBits(event_group_handle_, REPLAY_PROTOCOL_CHANNEL_OPENED_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
+        if (!(bits & REPLAY_PROTOCOL_CHANNEL_OPENED_EVENT)) {
+            ESP_LOGE(TAG, "Audio channel was not opened");
+            return;
+        }
+
+        auto start_time = esp_timer_get_time();
+        bool completed = ReplayOnce();
+        audio_service.WaitForPlaybackQueueEmpty();
+        auto elapsed_ms = (esp_timer_get_time() - start_time) / 1000;
+
+        app.Schedule([this]() {
+            CloseAudioChannel();
+        });
+        xEventGroupWaitBits(event_group_handle_, REPLAY_PROTOCOL_CHANNEL_CLOSED_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+
+        auto& stats = audio_service.GetDebugStatistics();
+        ESP_LOGI(TAG, "Replay %d/%d %s in %ld ms", i + 1, CONFIG_SESSION_REPLAY_ITERATIONS,
+            completed ? "completed" : "aborted", (long)elapsed_ms);
+        ESP_LOGI(TAG, "  decoded: %lu, encoded: %lu, sent audio: %lu (recorded %lu), sent text: %lu",
+            stats.decode_count, stats.encode_count, sent_audio_packets_.load(), expected_audio_packets_, sent_text_messages_.load());
+        ESP_LOGI(TAG, "  queue peaks: decode %lu, playback %lu, send %lu",
+            stats.max_decode_queue_size, stats.max_playback_queue_size, stats.max_send_queue_size);
+        ESP_LOGI(TAG, "  encode: avg %lld us, max %lld us, encoder level %d (%lu changes), send failures %lu",
+            stats.encode_count > 0 ? stats.total_encode_us / stats.encode_count : 0, stats.max_encode_us,
+            audio_service.GetEncoderLevel(), stats.encoder_level_changes, stats.send_failures);
+        int transitions = state_transitions_;
+        ESP_LOGI(TAG, "  state transitions: %d, avg latency: %lld us, max latency: %lld us", transitions,
+            transitions > 0 ? total_state_latency_us_ / transitions : 0, max_state_latency_us_.load());
+        ESP_LOGI(TAG, "  internal sram: free before %u, minimum free %u", free_sram,
+            heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+
+        // Blocks and bytes still allocated after the iteration, growing over iterations is a leak
+        multi_heap_info_t sram_after, psram_after;
+        heap_caps_get_info(&sram_after, MALLOC_CAP_INTERNAL);
+        heap_caps_get_info(&psram_after, MALLOC_CAP_SPIRAM);
+        ESP_LOGI(TAG, "  allocated sram: %+d blocks, %+d bytes, psram: %+d blocks, %+d bytes",
+            (int)sram_after.allocated_blocks - (int)sram_before.allocated_blocks,
+            (int)sram_after.total_allocated_bytes - (int)sram_before.total_allocated_bytes,
+            (int)psram_after.allocated_blocks - (int)psram_before.allocated_blocks,
+            (int)psram_after.total_allocated_bytes - (int)psram_before.total_allocated_bytes);
+        SystemInfo::PrintTaskCpuUsage(std::move(start_tasks), start_run_time);
+    }
+}
+
+bool ReplayProtocol::ReplayOnce() {
+    auto& audio_service = Application::GetInstance().GetAudioService();
+    auto start_time = esp_timer_get_time();
+    size_t offset = sizeof(SessionFileHeader);
+
+    while (offset + sizeof(SessionRecordHeader) <= size_) {
+        auto record = (SessionRecordHeader*)(data_ + offset);
+        offset += sizeof(SessionRecordHeader) + record->payload_size;
+        if (offset > size_ || !channel_opened_) {
+            return false;
+        }
+
+        // Keep the recorded timing scaled by the replay speed, 0 means as fast as possible
+        if (CONFIG_SESSION_REPLAY_SPEED_PERCENT > 0) {
+            int64_t target = start_time + (int64_t)record->time_ms * 1000 * 100 / CONFIG_SESSION_REPLAY_SPEED_PERCENT;
+            int64_t wait_us = target - esp_timer_get_time();
+            if (wait_us > 1000) {
+                vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+            }
+        }
+
+        switch (record->type) {
+            case kSessionRecordIncomingJson: {
+                auto root = cJSON_ParseWithLength((const char*)record->payload, record->payload_size);
+                if (root == nullptr) {
+                    ESP_LOGE(TAG, "Failed to parse recorded json");
+                    break;
+                }
+                auto type = cJSON_GetObjectItem(root, "type");
+                if (cJSON_IsString(type) && strcmp(type->valuestring, "tts") == 0) {
+                    last_tts_time_ = esp_timer_get_time();
+                }
+                last_incoming_time_ = std::chrono::steady_clock::now();
+                if (on_incoming_json_ != nullptr) {
+                    on_incoming_json_(root);
+                }
+                cJSON_Delete(root);
+                WaitForMainLoop();
+                break;
+            }
+            case kSessionRecordIncomingAudio: {
+                if (CONFIG_SESSION_REPLAY_SPEED_PERCENT == 0) {
+                    // Apply backpressure instead of dropping packets
+                    while (audio_service.IsDecodeQueueFull()) {
+                        vTaskDelay(pdMS_TO_TICKS(5));
+                    }
+                }
+                last_incoming_time_ = std::chrono::steady_clock::now();
+                if (on_incoming_audio_ != nullptr) {
+                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
+                        .sample_rate = (int)record->sample_rate,
+                        .frame_duration = record->frame_duration,
+                        .timestamp = record->timestamp,
+                        .payload = std::vector<uint8_t>(record->payload, record->payload + record->payload_size)
+                    }));
+                }
+                break;
+            }
+            case kSessionRecordOutgoingAudio:
+                expected_audio_packets_++;
+                break;
+            case kSessionRecordChannelClosed:
+                return true;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+void ReplayProtocol::WaitForMainLoop() {
+    // Messages like tts start are handled by scheduled tasks, wait for them to make the replay deterministic
+    auto semaphore = xSemaphoreCreateBinary();
+    Application::GetInstance().Schedule([semaphore]() {
+        xSemaphoreGive(semaphore);
+    });
+    xSemaphoreTake(semaphore, portMAX_DELAY);
+    vSemaphoreDelete(semaphore);
+}
+
+bool ReplayProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    if (!channel_opened_) {
+        return false;
+    }
+    sent_audio_packets_++;
+    return true;
+}
+
+bool ReplayProtocol::SendText(const std::string& text) {
+    if (!channel_opened_) {
+        return false;
+    }
+    ESP_LOGD(TAG, "Send text: %s", text.c_str());
+    sent_text_messages_++;
+    return true;
+}
+
+bool ReplayProtocol::OpenAudioChannel() {
+    error_occurred_ = false;
+    channel_opened_ = true;
+    last_incoming_time_ = std::chrono::steady_clock::now();
+
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+    xEventGroupSetBits(event_group_handle_, REPLAY_PROTOCOL_CHANNEL_OPENED_EVENT);
+    return true;
+}
+
+void ReplayProtocol::CloseAudioChannel() {
+    if (!channel_opened_) {
+        return;
+    }
+    channel_opened_ = false;
+
+    if (on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+    xEventGroupSetBits(event_group_handle_, REPLAY_PROTOCOL_CHANNEL_CLOSED_EVENT);
+}
+
+bool ReplayProtocol::IsAudioChannelOpened() const {
+    return channel_opened_ && !error_occurred_;
+}
@@ -0,0 +1,57 @@
+#ifndef REPLAY_PROTOCOL_H
+#define REPLAY_PROTOCOL_H
+
+
+#include "protocol.h"
+#include "session_recorder.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <atomic>
+
+#define REPLAY_PROTOCOL_CHANNEL_OPENED_EVENT (1 << 0)
+#define REPLAY_PROTOCOL_CHANNEL_CLOSED_EVENT (1 << 1)
+
+/*
+ * Replays a session recorded by SessionRecorder into Application and AudioService,
+ * without a server. Used to benchmark the event loop, the decoder and the JSON handling.
+ */
+class ReplayProtocol : public Protocol {
+public:
+    ReplayProtocol();
+    ~ReplayProtocol();
+
+    bool Start() override;
+    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    bool OpenAudioChannel() override;
+    void CloseAudioChannel() override;
+    bool IsAudioChannelOpened() const override;
+
+private:
+    EventGroupHandle_t event_group_handle_;
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    bool channel_opened_ = false;
+
+    // Statistics of one replay iteration
+    std::atomic<uint32_t> sent_audio_packets_ = 0;
+    std::atomic<uint32_t> sent_text_messages_ = 0;
+    uint32_t expected_audio_packets_ = 0;
+    // Set by the replay task, taken by the event bus callback
+    std::atomic<int64_t> last_tts_time_ = 0;
+    // Updated by the event bus callback on the main task
+    std::atomic<int64_t> max_state_latency_us_ = 0;
+    std::atomic<int64_t> total_state_latency_us_ = 0;
+    std::atomic<int> state_transitions_ = 0;
+
+    bool Load();
+    void ReplayTask();
+    bool ReplayOnce();
+    void WaitForMainLoop();
+    bool SendText(const std::string& text) override;
+};
+
+#endif // REPLAY_PROTOCOL_H
@@ -0,0 +1,142 @@
+#include "session_recorder.h"
+#include "board.h"
+#include "system_info.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "SessionRecorder"
+
+SessionRecorder::SessionRecorder() {
+    capacity_ = CONFIG_SESSION_RECORDER_BUFFER_SIZE * 1024;
+    buffer_ = (uint8_t*)heap_caps_malloc(capacity_, MALLOC_CAP_SPIRAM);
+    if (buffer_ == nullptr) {
+        buffer_ = (uint8_t*)heap_caps_malloc(capacity_, MALLOC_CAP_8BIT);
+    }
+    if (buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for session recording", capacity_);
+        capacity_ = 0;
+    }
+}
+
+SessionRecorder::~SessionRecorder() {
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+}
+
+void SessionRecorder::OnChannelOpened(const Protocol& protocol) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buffer_ == nullptr || upload_task_handle_ != nullptr) {
+        ESP_LOGW(TAG, "Recorder is busy, this session will not be recorded");
+        return;
+    }
+
+    auto file_header = (SessionFileHeader*)buffer_;
+    file_header->magic = SESSION_RECORD_FILE_MAGIC;
+    file_header->version = SESSION_RECORD_FILE_VERSION;
+    size_ = sizeof(SessionFileHeader);
+    truncated_ = false;
+    recording_ = true;
+    start_time_ = esp_timer_get_time();
+
+    AudioStreamPacket params;
+    params.sample_rate = protocol.server_sample_rate();
+    params.frame_duration = protocol.server_frame_duration();
+    Append(kSessionRecordChannelOpened, &params, protocol.session_id().data(), protocol.session_id().size());
+}
+
+void SessionRecorder::OnChannelClosed() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!recording_) {
+            return;
+        }
+        Append(kSessionRecordChannelClosed, nullptr, nullptr, 0);
+        recording_ = false;
+    }
+
+    // Upload in a low priority task, so the main event loop is not blocked by HTTP
+    xTaskCreate([](void* arg) {
+        auto this_ = (SessionRecorder*)arg;
+        this_->Upload();
+        std::lock_guard<std::mutex> lock(this_->mutex_);
+        this_->upload_task_handle_ = nullptr;
+        vTaskDelete(NULL);
+    }, "session_upload", 4096, this, 1, &upload_task_handle_);
+}
+
+void SessionRecorder::RecordIncomingJson(const cJSON* root) {
+    auto json = cJSON_PrintUnformatted(root);
+    if (json == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Append(kSessionRecordIncomingJson, nullptr, json, strlen(json));
+    }
+    cJSON_free(json);
+}
+
+void SessionRecorder::RecordIncomingAudio(const AudioStreamPacket& packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Append(kSessionRecordIncomingAudio, &packet, packet.payload.data(), packet.payload.size());
+}
+
+void SessionRecorder::RecordOutgoingAudio(const AudioStreamPacket& packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Append(kSessionRecordOutgoingAudio, &packet, packet.payload.data(), packet.payload.size());
+}
+
+void SessionRecorder::Append(SessionRecordType type, const AudioStreamPacket* packet, const void* payload, size_t payload_size) {
+    if (!recording_ || truncated_) {
+        return;
+    }
+    if (size_ + sizeof(SessionRecordHeader) + payload_size > capacity_) {
+        ESP_LOGW(TAG, "Recording buffer is full, the rest of the session is dropped");
+        truncated_ = true;
+        return;
+    }
+
+    auto record = (SessionRecordHeader*)(buffer_ + size_);
+    record->type = type;
+    record->reserved = 0;
+    record->frame_duration = packet ? packet->frame_duration : 0;
+    record->sample_rate = packet ? packet->sample_rate : 0;
+    record->time_ms = (esp_timer_get_time() - start_time_) / 1000;
+    record->timestamp = packet ? packet->timestamp : 0;
+    record->payload_size = payload_size;
+    if (payload_size > 0) {
+        memcpy(record->payload, payload, payload_size);
+    }
+    size_ += sizeof(SessionRecordHeader) + payload_size;
+}
+
+void SessionRecorder::Upload() {
+    auto network = Board::GetInstance().GetNetwork();
+    auto http = network->CreateHttp(3);
+    http->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+    http->SetHeader("Content-Type", "application/octet-stream");
+    http->SetHeader("Transfer-Encoding", "chunked");
+    if (!http->Open("POST", CONFIG_SESSION_RECORDER_UPLOAD_URL)) {
+        ESP_LOGE(TAG, "Failed to connect to %s", CONFIG_SESSION_RECORDER_UPLOAD_URL);
+        return;
+    }
+
+    const size_t chunk_size = 4096;
+    for (size_t offset = 0; offset < size_; offset += chunk_size) {
+        size_t len = std::min(chunk_size, size_ - offset);
+        http->Write((const char*)buffer_ + offset, len);
+    }
+    http->Write("", 0);
+
+    if (http->GetStatusCode() != 200) {
+        ESP_LOGE(TAG, "Failed to upload session, status code: %d", http->GetStatusCode());
+    } else {
+        ESP_LOGI(TAG, "Uploaded session recording, %u bytes%s", size_, truncated_ ? " (truncated)" : "");
+    }
+    http->Close();
+}
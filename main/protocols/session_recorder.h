@@ -0,0 +1,80 @@
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <string>
+#include <cstdint>
+#include <mutex>
+#include <memory>
+
+#include "protocol.h"
+
+/*
+ * Session recording file format (little endian):
+ * |magic 4u|version 4u| followed by records:
+ * |type 1u|reserved 1u|frame_duration 2u|sample_rate 4u|time_ms 4u|timestamp 4u|payload_size 4u|payload payload_size|
+ *
+ * time_ms is relative to the moment the audio channel was opened.
+ * kSessionRecordChannelOpened carries the session id as payload and the server audio params.
+ */
+#define SESSION_RECORD_FILE_MAGIC 0x52535A58  // "XZSR"
+#define SESSION_RECORD_FILE_VERSION 1
+
+enum SessionRecordType : uint8_t {
+    kSessionRecordChannelOpened = 0,
+    kSessionRecordChannelClosed = 1,
+    kSessionRecordIncomingJson = 2,
+    kSessionRecordIncomingAudio = 3,
+    kSessionRecordOutgoingAudio = 4,
+};
+
+struct SessionFileHeader {
+    uint32_t magic;
+    uint32_t version;
+} __attribute__((packed));
+
+struct SessionRecordHeader {
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t frame_duration;
+    uint32_t sample_rate;
+    uint32_t time_ms;
+    uint32_t timestamp;
+    uint32_t payload_size;
+    uint8_t payload[];
+} __attribute__((packed));
+
+/*
+ * Records one audio channel session (from open to close) into a PSRAM buffer,
+ * and uploads it to CONFIG_SESSION_RECORDER_UPLOAD_URL when the channel is closed.
+ * The recording can be replayed with ReplayProtocol.
+ */
+class SessionRecorder {
+public:
+    SessionRecorder();
+    ~SessionRecorder();
+
+    void OnChannelOpened(const Protocol& protocol);
+    void OnChannelClosed();
+    void RecordIncomingJson(const cJSON* root);
+    void RecordIncomingAudio(const AudioStreamPacket& packet);
+    void RecordOutgoingAudio(const AudioStreamPacket& packet);
+
+private:
+    std::mutex mutex_;
+    uint8_t* buffer_ = nullptr;
+    size_t capacity_ = 0;
+    size_t size_ = 0;
+    bool recording_ = false;
+    bool truncated_ = false;
+    int64_t start_time_ = 0;
+    TaskHandle_t upload_task_handle_ = nullptr;
+
+    void Append(SessionRecordType type, const AudioStreamPacket* packet, const void* payload, size_t payload_size);
+    void Upload();
+};
+
+#endif // SESSION_RECORDER_H
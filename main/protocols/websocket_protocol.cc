@@ -14,6 +14,7 @@
 
 WebsocketProtocol::WebsocketProtocol() {
     event_group_handle_ = xEventGroupCreate();
+    xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_PREWARM_DONE_EVENT);
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
@@ -25,8 +26,31 @@ bool WebsocketProtocol::Start() {
     return true;
 }
 
+void WebsocketProtocol::WaitForPrewarm() {
+    {
+        // Opening the channel takes over the connection being set up
+        std::lock_guard<std::mutex> lock(prewarm_mutex_);
+        prewarm_cancelled_ = false;
+    }
+    xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_PREWARM_DONE_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
+}
+
+bool WebsocketProtocol::CancelPrewarm() {
+    std::lock_guard<std::mutex> lock(prewarm_mutex_);
+    if (!IsPrewarming()) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Cancel the connection being prewarmed");
+    prewarm_cancelled_ = true;
+    return true;
+}
+
+bool WebsocketProtocol::IsPrewarming() const {
+    return !(xEventGroupGetBits(event_group_handle_) & WEBSOCKET_PROTOCOL_PREWARM_DONE_EVENT);
+}
+
 bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
-    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+    if (IsPrewarming() || websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
 
@@ -58,10 +82,22 @@ bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
-    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+    // The channel is never open while the prewarm task owns the connection
+    if (IsPrewarming() || websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
 
+#if CONFIG_USE_WEBSOCKET_DEFLATE
+    if (deflate_ && text.size() >= CONFIG_WEBSOCKET_DEFLATE_MIN_SIZE) {
+        if (!SendDeflated(text)) {
+            ESP_LOGE(TAG, "Failed to send deflated text: %s", text.c_str());
+            SetError(Lang::Strings::SERVER_ERROR);
+            return false;
+        }
+        return true;
+    }
+#endif
+
     if (!websocket_->Send(text)) {
         ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
@@ -72,14 +108,137 @@ bool WebsocketProtocol::SendText(const std::string& text) {
 }
 
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    return channel_opened_ && !IsPrewarming() && websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    if (CancelPrewarm()) {
+        return;
+    }
+    if (channel_opened_ && session_ready_ && !error_occurred_ && websocket_ != nullptr && websocket_->IsConnected()) {
+        // Keep the connection and the server session, the next conversation resumes it.
+        // End the turn first, or a late tts start would bring the device back to speaking
+        ESP_LOGI(TAG, "Keep session %s warm", session_id_.c_str());
+        SendAbortSpeaking(kAbortReasonNone);
+        channel_opened_ = false;
+        StartKeepWarmTimer();
+        if (on_audio_channel_closed_ != nullptr) {
+            on_audio_channel_closed_();
+        }
+        return;
+    }
+    StopKeepWarmTimer();
+#endif
+    session_ready_ = false;
+    websocket_.reset();
+    channel_opened_ = false;
+#if CONFIG_USE_WEBSOCKET_DEFLATE
+    if (deflate_) {
+        deflate_->LogStatistics();
+        deflate_.reset();
+    }
+#endif
+}
+
+void WebsocketProtocol::OnKeepWarmTimeout() {
+    auto bits = xEventGroupGetBits(event_group_handle_);
+    if (channel_opened_ || !(bits & WEBSOCKET_PROTOCOL_PREWARM_DONE_EVENT)) {
+        return;
+    }
+    ESP_LOGI(TAG, "Close idle connection");
+    session_ready_ = false;
     websocket_.reset();
+    DeferPrewarm();
+}
+
+void WebsocketProtocol::PrewarmAudioChannel() {
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    auto bits = xEventGroupGetBits(event_group_handle_);
+    if (channel_opened_ || !(bits & WEBSOCKET_PROTOCOL_PREWARM_DONE_EVENT)) {
+        return;
+    }
+    if (session_ready_ && websocket_ != nullptr && websocket_->IsConnected()) {
+        // Still warm, nothing to set up
+        StartKeepWarmTimer();
+        return;
+    }
+    if (!IsPrewarmAllowed()) {
+        return;
+    }
+
+    // Connect in background, OpenAudioChannel waits for it and reuses the session
+    StopKeepWarmTimer();
+    prewarm_cancelled_ = false;
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_PREWARM_DONE_EVENT);
+    xTaskCreate([](void* arg) {
+        auto this_ = (WebsocketProtocol*)arg;
+        std::string error;
+        bool connected = this_->Connect(error);
+        if (!connected) {
+            ESP_LOGW(TAG, "Failed to prewarm the connection: %s", error.c_str());
+            this_->DeferPrewarm();
+        }
+
+        std::unique_lock<std::mutex> lock(this_->prewarm_mutex_);
+        if (this_->prewarm_cancelled_) {
+            this_->prewarm_cancelled_ = false;
+            lock.unlock();
+            this_->session_ready_ = false;
+            this_->websocket_.reset();
+        } else if (connected) {
+            this_->StartKeepWarmTimer();
+        }
+        xEventGroupSetBits(this_->event_group_handle_, WEBSOCKET_PROTOCOL_PREWARM_DONE_EVENT);
+        vTaskDelete(NULL);
+    }, "ws_prewarm", 4096 * 2, this, 2, nullptr);
+#endif
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    // Wait for the speculative connection if it is in progress, it takes the place of our own connect
+    WaitForPrewarm();
+    StopKeepWarmTimer();
+    if (session_ready_ && websocket_ != nullptr && websocket_->IsConnected()) {
+        ESP_LOGI(TAG, "Resume session %s", session_id_.c_str());
+        error_occurred_ = false;
+        channel_opened_ = true;
+        last_incoming_time_ = std::chrono::steady_clock::now();
+        if (on_audio_channel_opened_ != nullptr) {
+            on_audio_channel_opened_();
+        }
+        return true;
+    }
+#endif
+
+    error_occurred_ = false;
+    std::string error;
+    if (!Connect(error)) {
+        SetError(error);
+        return false;
+    }
+
+    channel_opened_ = true;
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+    return true;
+}
+
+bool WebsocketProtocol::Connect(std::string& error) {
+    session_ready_ = false;
+    websocket_.reset();
+#if CONFIG_USE_WEBSOCKET_DEFLATE
+    // The contexts belong to the connection, the new one negotiates again
+    if (deflate_) {
+        deflate_->LogStatistics();
+        deflate_.reset();
+    }
+#endif
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
+
+    // Read the settings on every connection, an OTA check may have updated them
     Settings settings("websocket", false);
     std::string url = settings.GetString("url");
     std::string token = settings.GetString("token");
@@ -88,12 +247,11 @@ bool WebsocketProtocol::OpenAudioChannel() {
         version_ = version;
     }
 
-    error_occurred_ = false;
-
     auto network = Board::GetInstance().GetNetwork();
     websocket_ = network->CreateWebSocket(1);
     if (websocket_ == nullptr) {
         ESP_LOGE(TAG, "Failed to create websocket");
+        error = Lang::Strings::SERVER_NOT_CONNECTED;
         return false;
     }
 
@@ -110,6 +268,42 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
+#if CONFIG_USE_WEBSOCKET_DEFLATE
+            if (deflate_ && (version_ == 2 || version_ == 3)) {
+                size_t header_size = version_ == 2 ? sizeof(BinaryProtocol2) : sizeof(BinaryProtocol3);
+                int type = -1;
+                size_t payload_size = 0;
+                if (len >= header_size && version_ == 2) {
+                    auto bp2 = (const BinaryProtocol2*)data;
+                    type = ntohs(bp2->type);
+                    payload_size = ntohl(bp2->payload_size);
+                } else if (len >= header_size) {
+                    auto bp3 = (const BinaryProtocol3*)data;
+                    type = bp3->type;
+                    payload_size = ntohs(bp3->payload_size);
+                }
+                if (type == WEBSOCKET_BINARY_TYPE_DEFLATED_JSON) {
+                    std::string json;
+                    last_incoming_time_ = std::chrono::steady_clock::now();
+                    if (payload_size <= len - header_size &&
+                        deflate_->Decompress((const uint8_t*)data + header_size, payload_size, json)) {
+                        ParseIncomingJson(json.c_str());
+                        return;
+                    }
+                    // The inflate context is out of sync with the server, no later message can be trusted.
+                    // Drop the connection, the next session connects and negotiates again
+                    ESP_LOGE(TAG, "Failed to inflate a message of %u bytes", payload_size);
+                    session_ready_ = false;
+                    SetError(Lang::Strings::SERVER_ERROR);
+                    Application::GetInstance().Schedule([this]() {
+                        if (error_occurred_) {
+                            CloseAudioChannel();
+                        }
+                    });
+                    return;
+                }
+            }
+#endif
             if (on_incoming_audio_ != nullptr) {
                 if (version_ == 2) {
                     BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
@@ -145,27 +339,20 @@ bool WebsocketProtocol::OpenAudioChannel() {
                 }
             }
         } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (cJSON_IsString(type)) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
-                    }
-                }
-            } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
-            }
-            cJSON_Delete(root);
+            ParseIncomingJson(data);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
     websocket_->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Websocket disconnected");
+        session_ready_ = false;
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+        if (!channel_opened_) {
+            // A warm connection closed by the server while idle, reconnect on the next conversation
+            return;
+        }
+#endif
         if (on_audio_channel_closed_ != nullptr) {
             on_audio_channel_closed_();
         }
@@ -174,13 +361,15 @@ bool WebsocketProtocol::OpenAudioChannel() {
     ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
     if (!websocket_->Connect(url.c_str())) {
         ESP_LOGE(TAG, "Failed to connect to websocket server");
-        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+        error = Lang::Strings::SERVER_NOT_CONNECTED;
         return false;
     }
 
     // Send hello message to describe the client
     auto message = GetHelloMessage();
-    if (!SendText(message)) {
+    if (!websocket_->Send(message)) {
+        ESP_LOGE(TAG, "Failed to send hello message");
+        error = Lang::Strings::SERVER_ERROR;
         return false;
     }
 
@@ -188,17 +377,36 @@ bool WebsocketProtocol::OpenAudioChannel() {
     EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
     if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
         ESP_LOGE(TAG, "Failed to receive server hello");
-        SetError(Lang::Strings::SERVER_TIMEOUT);
+        error = Lang::Strings::SERVER_TIMEOUT;
         return false;
     }
 
-    if (on_audio_channel_opened_ != nullptr) {
-        on_audio_channel_opened_();
-    }
-
+    session_ready_ = true;
+    last_incoming_time_ = std::chrono::steady_clock::now();
     return true;
 }
 
+void WebsocketProtocol::ParseIncomingJson(const char* data) {
+    auto root = cJSON_Parse(data);
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (cJSON_IsString(type)) {
+        if (strcmp(type->valuestring, "hello") == 0) {
+            ParseServerHello(root);
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+        } else if (!channel_opened_ && IsTurnMessage(type->valuestring)) {
+            ESP_LOGW(TAG, "Drop %s message of the parked session", type->valuestring);
+#endif
+        } else {
+            if (on_incoming_json_ != nullptr) {
+                on_incoming_json_(root);
+            }
+        }
+    } else {
+        ESP_LOGE(TAG, "Missing message type, data: %s", data);
+    }
+    cJSON_Delete(root);
+}
+
 std::string WebsocketProtocol::GetHelloMessage() {
     // keys: message type, version, audio_params (format, sample_rate, channels)
     cJSON* root = cJSON_CreateObject();
@@ -209,13 +417,19 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+#if CONFIG_USE_REALTIME_DTX
+    cJSON_AddBoolToObject(features, "dtx", true);
+#endif
+#if CONFIG_USE_WEBSOCKET_DEFLATE
+    AddDeflateOffer(features);
+#endif
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    AddUplinkFrameDurations(audio_params);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -238,6 +452,7 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
     }
 
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
+    ParseUplinkFrameDuration(audio_params);
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
         if (cJSON_IsNumber(sample_rate)) {
@@ -249,5 +464,77 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         }
     }
 
+#if CONFIG_USE_WEBSOCKET_DEFLATE
+    ParseDeflateResponse(cJSON_GetObjectItem(root, "features"));
+#endif
+
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
+
+#if CONFIG_USE_WEBSOCKET_DEFLATE
+void WebsocketProtocol::AddDeflateOffer(cJSON* features) {
+    // A deflated message is told apart from audio by the type field of protocol 2 or 3
+    if (version_ != 2 && version_ != 3) {
+        return;
+    }
+    // Parameters named as in RFC 7692, the device is the client
+    cJSON* deflate = cJSON_CreateObject();
+    cJSON_AddNumberToObject(deflate, "client_max_window_bits", CONFIG_WEBSOCKET_DEFLATE_WINDOW_BITS);
+    cJSON_AddNumberToObject(deflate, "server_max_window_bits", CONFIG_WEBSOCKET_DEFLATE_WINDOW_BITS);
+#if !CONFIG_WEBSOCKET_DEFLATE_CONTEXT_TAKEOVER
+    cJSON_AddBoolToObject(deflate, "client_no_context_takeover", true);
+    cJSON_AddBoolToObject(deflate, "server_no_context_takeover", true);
+#endif
+    cJSON_AddItemToObject(features, "deflate", deflate);
+}
+
+void WebsocketProtocol::ParseDeflateResponse(const cJSON* features) {
+    auto deflate = cJSON_GetObjectItem(features, "deflate");
+    if (!cJSON_IsObject(deflate) || (version_ != 2 && version_ != 3)) {
+        return;
+    }
+
+    // The server may lower the window of the device, its own must fit the window offered for it
+    int window_bits = CONFIG_WEBSOCKET_DEFLATE_WINDOW_BITS;
+    auto client_bits = cJSON_GetObjectItem(deflate, "client_max_window_bits");
+    if (cJSON_IsNumber(client_bits) && client_bits->valueint >= 9 && client_bits->valueint < window_bits) {
+        window_bits = client_bits->valueint;
+    }
+    auto server_bits = cJSON_GetObjectItem(deflate, "server_max_window_bits");
+    if (cJSON_IsNumber(server_bits) && server_bits->valueint > CONFIG_WEBSOCKET_DEFLATE_WINDOW_BITS) {
+        ESP_LOGE(TAG, "Server deflate window of %d bits is larger than offered, not using deflate", server_bits->valueint);
+        return;
+    }
+    bool context_takeover = CONFIG_WEBSOCKET_DEFLATE_CONTEXT_TAKEOVER &&
+        !cJSON_IsTrue(cJSON_GetObjectItem(deflate, "client_no_context_takeover"));
+    deflate_ = std::make_unique<MessageDeflate>(window_bits, CONFIG_WEBSOCKET_DEFLATE_WINDOW_BITS, context_takeover);
+}
+
+bool WebsocketProtocol::SendDeflated(const std::string& text) {
+    // The compressed message goes after the header of the binary protocol, in the same buffer
+    size_t header_size = version_ == 2 ? sizeof(BinaryProtocol2) : sizeof(BinaryProtocol3);
+    std::string frame(header_size, '\0');
+    if (!deflate_->Compress(text, frame)) {
+        return websocket_->Send(text);
+    }
+    size_t payload_size = frame.size() - header_size;
+    if (version_ == 2) {
+        auto bp2 = (BinaryProtocol2*)frame.data();
+        bp2->version = htons(version_);
+        bp2->type = htons(WEBSOCKET_BINARY_TYPE_DEFLATED_JSON);
+        bp2->reserved = 0;
+        bp2->timestamp = 0;
+        bp2->payload_size = htonl(payload_size);
+    } else {
+        if (payload_size > UINT16_MAX) {
+            ESP_LOGE(TAG, "Deflated message of %u bytes does not fit protocol 3", payload_size);
+            return false;
+        }
+        auto bp3 = (BinaryProtocol3*)frame.data();
+        bp3->type = WEBSOCKET_BINARY_TYPE_DEFLATED_JSON;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(payload_size);
+    }
+    return websocket_->Send(frame.data(), frame.size(), true);
+}
+#endif
@@ -8,7 +8,16 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 
+#if CONFIG_USE_WEBSOCKET_DEFLATE
+#include "message_deflate.h"
+#endif
+
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define WEBSOCKET_PROTOCOL_PREWARM_DONE_EVENT (1 << 1)
+
+// Binary message types of protocol 2 and 3, a deflated JSON message is sent instead of a text frame
+#define WEBSOCKET_BINARY_TYPE_OPUS 0
+#define WEBSOCKET_BINARY_TYPE_DEFLATED_JSON 2
 
 class WebsocketProtocol : public Protocol {
 public:
@@ -20,13 +29,33 @@ public:
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    void PrewarmAudioChannel() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
     std::unique_ptr<WebSocket> websocket_;
     int version_ = 1;
+    bool channel_opened_ = false;
+    bool session_ready_ = false;
+#if CONFIG_USE_WEBSOCKET_DEFLATE
+    // Set up when the server accepts the deflate feature in its hello, for the connection
+    std::unique_ptr<MessageDeflate> deflate_;
+#endif
 
+    bool Connect(std::string& error);
+    // The prewarm task owns the connection until it sets WEBSOCKET_PROTOCOL_PREWARM_DONE_EVENT,
+    // only OpenAudioChannel waits for it, closing cancels it
+    void WaitForPrewarm();
+    bool CancelPrewarm();
+    bool IsPrewarming() const;
+    void OnKeepWarmTimeout() override;
     void ParseServerHello(const cJSON* root);
+    void ParseIncomingJson(const char* data);
+#if CONFIG_USE_WEBSOCKET_DEFLATE
+    void AddDeflateOffer(cJSON* features);
+    void ParseDeflateResponse(const cJSON* features);
+    bool SendDeflated(const std::string& text);
+#endif
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
 };
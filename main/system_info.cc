@@ -48,88 +48,64 @@ std::string SystemInfo::GetChipModelName() {
 }
 
 esp_err_t SystemInfo::PrintTaskCpuUsage(TickType_t xTicksToWait) {
-    #define ARRAY_SIZE_OFFSET 5
-    TaskStatus_t *start_array = NULL, *end_array = NULL;
-    UBaseType_t start_array_size, end_array_size;
-    configRUN_TIME_COUNTER_TYPE start_run_time, end_run_time;
-    esp_err_t ret;
-    uint32_t total_elapsed_time;
-
-    //Allocate array to store current task states
-    start_array_size = uxTaskGetNumberOfTasks() + ARRAY_SIZE_OFFSET;
-    start_array = (TaskStatus_t*)malloc(sizeof(TaskStatus_t) * start_array_size);
-    if (start_array == NULL) {
-        ret = ESP_ERR_NO_MEM;
-        goto exit;
-    }
-    //Get current task states
-    start_array_size = uxTaskGetSystemState(start_array, start_array_size, &start_run_time);
-    if (start_array_size == 0) {
-        ret = ESP_ERR_INVALID_SIZE;
-        goto exit;
+    configRUN_TIME_COUNTER_TYPE start_run_time;
+    auto start_states = GetTaskStates(start_run_time);
+    if (start_states.empty()) {
+        return ESP_ERR_INVALID_SIZE;
     }
-
     vTaskDelay(xTicksToWait);
+    return PrintTaskCpuUsage(start_states, start_run_time);
+}
 
-    //Allocate array to store tasks states post delay
-    end_array_size = uxTaskGetNumberOfTasks() + ARRAY_SIZE_OFFSET;
-    end_array = (TaskStatus_t*)malloc(sizeof(TaskStatus_t) * end_array_size);
-    if (end_array == NULL) {
-        ret = ESP_ERR_NO_MEM;
-        goto exit;
-    }
-    //Get post delay task states
-    end_array_size = uxTaskGetSystemState(end_array, end_array_size, &end_run_time);
-    if (end_array_size == 0) {
-        ret = ESP_ERR_INVALID_SIZE;
-        goto exit;
+std::vector<TaskStatus_t> SystemInfo::GetTaskStates(configRUN_TIME_COUNTER_TYPE& run_time) {
+    #define ARRAY_SIZE_OFFSET 5
+    // Room for the tasks created while the array is filled
+    std::vector<TaskStatus_t> states(uxTaskGetNumberOfTasks() + ARRAY_SIZE_OFFSET);
+    states.resize(uxTaskGetSystemState(states.data(), states.size(), &run_time));
+    return states;
+}
+
+esp_err_t SystemInfo::PrintTaskCpuUsage(std::vector<TaskStatus_t> start_array, configRUN_TIME_COUNTER_TYPE start_run_time) {
+    configRUN_TIME_COUNTER_TYPE end_run_time;
+    auto end_array = GetTaskStates(end_run_time);
+    if (end_array.empty()) {
+        return ESP_ERR_INVALID_SIZE;
     }
 
     //Calculate total_elapsed_time in units of run time stats clock period.
-    total_elapsed_time = (end_run_time - start_run_time);
+    uint32_t total_elapsed_time = (end_run_time - start_run_time);
     if (total_elapsed_time == 0) {
-        ret = ESP_ERR_INVALID_STATE;
-        goto exit;
+        return ESP_ERR_INVALID_STATE;
     }
 
     printf("| Task | Run Time | Percentage\n");
     //Match each task in start_array to those in the end_array
-    for (int i = 0; i < start_array_size; i++) {
-        int k = -1;
-        for (int j = 0; j < end_array_size; j++) {
-            if (start_array[i].xHandle == end_array[j].xHandle) {
-                k = j;
+    for (auto& start : start_array) {
+        for (auto& end : end_array) {
+            if (start.xHandle == end.xHandle) {
+                uint32_t task_elapsed_time = end.ulRunTimeCounter - start.ulRunTimeCounter;
+                uint32_t percentage_time = (task_elapsed_time * 100UL) / (total_elapsed_time * CONFIG_FREERTOS_NUMBER_OF_CORES);
+                printf("| %-16s | %8lu | %4lu%%\n", start.pcTaskName, task_elapsed_time, percentage_time);
                 //Mark that task have been matched by overwriting their handles
-                start_array[i].xHandle = NULL;
-                end_array[j].xHandle = NULL;
+                start.xHandle = NULL;
+                end.xHandle = NULL;
                 break;
             }
         }
-        //Check if matching task found
-        if (k >= 0) {
-            uint32_t task_elapsed_time = end_array[k].ulRunTimeCounter - start_array[i].ulRunTimeCounter;
-            uint32_t percentage_time = (task_elapsed_time * 100UL) / (total_elapsed_time * CONFIG_FREERTOS_NUMBER_OF_CORES);
-            printf("| %-16s | %8lu | %4lu%%\n", start_array[i].pcTaskName, task_elapsed_time, percentage_time);
-        }
     }
 
     //Print unmatched tasks
-    for (int i = 0; i < start_array_size; i++) {
-        if (start_array[i].xHandle != NULL) {
-            printf("| %s | Deleted\n", start_array[i].pcTaskName);
+    for (auto& start : start_array) {
+        if (start.xHandle != NULL) {
+            printf("| %s | Deleted\n", start.pcTaskName);
         }
     }
-    for (int i = 0; i < end_array_size; i++) {
-        if (end_array[i].xHandle != NULL) {
-            printf("| %s | Created\n", end_array[i].pcTaskName);
+    for (auto& end : end_array) {
+        if (end.xHandle != NULL) {
+            printf("| %s | Created\n", end.pcTaskName);
         }
     }
-    ret = ESP_OK;
-
-exit:    //Common return path
-    free(start_array);
-    free(end_array);
-    return ret;
+    return ESP_OK;
 }
 
 void SystemInfo::PrintTaskList() {
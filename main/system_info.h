@@ -2,9 +2,11 @@
 #define _SYSTEM_INFO_H_
 
 #include <string>
+#include <vector>
 
 #include <esp_err.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 class SystemInfo {
 public:
@@ -14,6 +16,9 @@ public:
     static std::string GetMacAddress();
     static std::string GetChipModelName();
     static esp_err_t PrintTaskCpuUsage(TickType_t xTicksToWait);
+    // Takes the task states to print the CPU usage of an interval later
+    static std::vector<TaskStatus_t> GetTaskStates(configRUN_TIME_COUNTER_TYPE& run_time);
+    static esp_err_t PrintTaskCpuUsage(std::vector<TaskStatus_t> start_states, configRUN_TIME_COUNTER_TYPE start_run_time);
     static void PrintTaskList();
     static void PrintHeapStats();
 };
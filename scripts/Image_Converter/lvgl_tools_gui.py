@@ -18,7 +18,8 @@ HELP_TEXT = """LVGL图片转换工具使用说明：
 4. 颜色格式：选择“自动识别”会根据图片是否透明自动选择，或手动指定
    除非你了解这个选项，否则建议使用自动识别，不然可能会出现一些意想不到的问题……
 
-5. 压缩方式：选择NONE或RLE压缩
+5. 压缩方式：选择NONE、RLE或LZ4压缩
+   LZ4压缩率最高，需要固件开启 CONFIG_USE_IMAGE_CACHE，首次显示时解压到PSRAM
    除非你了解这个选项，否则建议保持默认NONE不压缩
 
 6. 输出目录：设置转换后文件的保存路径
@@ -61,7 +62,7 @@ class ImageConverterApp:
         # 压缩方式
         ttk.Label(settings_frame, text="压缩方式:").grid(row=0, column=4, padx=2)
         ttk.Combobox(settings_frame, textvariable=self.compress_method,
-                    values=["NONE", "RLE"], width=8).grid(row=0, column=5, padx=2)
+                    values=["NONE", "RLE", "LZ4"], width=8).grid(row=0, column=5, padx=2)
 
         # 文件操作框架
         file_frame = ttk.LabelFrame(self.root, text="选取文件")
@@ -187,7 +188,7 @@ class ImageConverterApp:
         
         # 解析转换参数
         width, height = map(int, self.resolution.get().split('x'))
-        compress = CompressMethod.RLE if self.compress_method.get() == "RLE" else CompressMethod.NONE
+        compress = CompressMethod[self.compress_method.get()]
 
         # 执行转换
         self.convert_images(input_files, width, height, compress)
@@ -0,0 +1,220 @@
+import sys
+import math
+import wave
+import struct
+import os
+import subprocess
+import tempfile
+import random
+import argparse
+
+
+'''
+  Write synthetic acoustic WiFi provisioning signals (CONFIG_USE_ACOUSTIC_WIFI_PROVISIONING), and measure the
+  decode rate at varying SNR with main/boards/common/afsk_demod.cc built for the host:
+
+  cmake -S test/host -B build-host && cmake --build build-host
+
+  python afsk_demod_check.py                              default SNR sweep, AFSK and MFSK
+  python afsk_demod_check.py --snr 0 -3 -6 --trials 50    more trials at low SNR
+  python afsk_demod_check.py --clock-ppm 3000             sender sample clock off by 0.3%
+  python afsk_demod_check.py --write-wav mfsk.wav --mode mfsk --text $'ssid\npassword'
+                                                          write a signal to play to a device
+
+  MFSK mode: the AFSK start pattern \\x01\\x05, then 16 tones 100 Hz apart at 100 symbols per second, carrying
+  RS(15, 9) codewords over GF(16) interleaved symbol by symbol. See MfskDemodulator for the frame layout.
+'''
+
+INPUT_RATE = 16000
+MARK_FREQUENCY = 1800
+SPACE_FREQUENCY = 1500
+BIT_RATE = 100
+
+START_PATTERN = [0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0]
+MFSK_START_PATTERN = [0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 0, 1]
+END_PATTERN = [0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 1, 0, 0]
+
+MFSK_BASE_FREQUENCY = 1000
+MFSK_TONE_SPACING = 100
+MFSK_MAX_CODEWORDS = 24
+MFSK_SYNC_SYMBOLS = [0, 15, 0, 15]
+RS_LENGTH = 15
+RS_DATA_LENGTH = 9
+
+
+def to_bits(data):
+    bits = []
+    for byte in data:
+        bits.extend((byte >> (7 - i)) & 1 for i in range(8))
+    return bits
+
+
+class GaloisField16:
+    def __init__(self):
+        self.exp = [0] * 30
+        self.log = [0] * 16
+        x = 1
+        for i in range(15):
+            self.exp[i] = self.exp[i + 15] = x
+            self.log[x] = i
+            x <<= 1
+            if x & 0x10:
+                x ^= 0x13
+
+    def mul(self, a, b):
+        return 0 if a == 0 or b == 0 else self.exp[self.log[a] + self.log[b]]
+
+    def div(self, a, b):
+        return 0 if a == 0 else self.exp[(self.log[a] + 15 - self.log[b]) % 15]
+
+
+GF = GaloisField16()
+PARITY = RS_LENGTH - RS_DATA_LENGTH
+
+
+def rs_generator():
+    generator = [1]
+    for i in range(1, PARITY + 1):
+        product = [0] * (len(generator) + 1)
+        for j, c in enumerate(generator):
+            product[j] ^= c
+            product[j + 1] ^= GF.mul(c, GF.exp[i])
+        generator = product
+    return generator
+
+
+RS_GENERATOR = rs_generator()
+
+
+def rs_encode(data):
+    remainder = list(data) + [0] * PARITY
+    for i in range(RS_DATA_LENGTH):
+        c = remainder[i]
+        if c:
+            for j in range(1, len(RS_GENERATOR)):
+                remainder[i + j] ^= GF.mul(RS_GENERATOR[j], c)
+    return list(data) + remainder[RS_DATA_LENGTH:]
+
+
+def mfsk_symbols(text):
+    '''Sync, codeword count sent 3 times, interleaved RS(15, 9) codewords of [length][text][checksum]'''
+    data = text.encode()
+    payload = bytes([len(data)]) + data + bytes([sum(data) & 0xFF])
+    nibbles = []
+    for byte in payload:
+        nibbles += [byte >> 4, byte & 0xF]
+    count = -(-len(nibbles) // RS_DATA_LENGTH)
+    if count > MFSK_MAX_CODEWORDS:
+        raise ValueError('text too long for MFSK')
+    nibbles += [0] * (count * RS_DATA_LENGTH - len(nibbles))
+    codewords = [rs_encode(nibbles[j * RS_DATA_LENGTH:(j + 1) * RS_DATA_LENGTH]) for j in range(count)]
+    symbols = list(MFSK_SYNC_SYMBOLS) + [count >> 4, count & 0xF] * 3
+    for i in range(RS_LENGTH):
+        symbols += [codewords[j][i] for j in range(count)]
+    return symbols
+
+
+def encode(text, amplitude, clock_ppm, rng, mode='afsk'):
+    '''Continuous phase FSK of the frame, with random silence around it'''
+    if mode == 'afsk':
+        data = text.encode()
+        bits = START_PATTERN + to_bits(data + bytes([sum(data) & 0xFF])) + END_PATTERN
+        tones = [MARK_FREQUENCY if bit else SPACE_FREQUENCY for bit in bits]
+    else:
+        tones = [MARK_FREQUENCY if bit else SPACE_FREQUENCY for bit in MFSK_START_PATTERN]
+        tones += [MFSK_BASE_FREQUENCY + symbol * MFSK_TONE_SPACING for symbol in mfsk_symbols(text)]
+    rate = INPUT_RATE * (1 + clock_ppm / 1e6)
+    samples = [0.0] * rng.randint(INPUT_RATE // 5, INPUT_RATE // 2)
+    lead = len(samples)
+    phase = 0.0
+    position = 0.0
+    for frequency in tones:
+        count = int(position + rate / BIT_RATE) - int(position)
+        position += rate / BIT_RATE
+        for _ in range(count):
+            samples.append(amplitude * math.sin(phase))
+            phase += 2 * math.pi * frequency / rate
+    duration = (len(samples) - lead) / INPUT_RATE
+    samples.extend([0.0] * (INPUT_RATE // 3))
+    return samples, duration
+
+
+def add_noise(samples, amplitude, snr_db, rng):
+    sigma = amplitude / math.sqrt(2) / (10 ** (snr_db / 20))
+    return [max(-32768, min(32767, int(round(s + rng.gauss(0, sigma))))) for s in samples]
+
+
+def write_wav(path, samples):
+    with wave.open(path, 'wb') as output:
+        output.setnchannels(1)
+        output.setsampwidth(2)
+        output.setframerate(INPUT_RATE)
+        output.writeframes(b''.join(struct.pack('<h', max(-32768, min(32767, int(s)))) for s in samples))
+
+
+def random_credentials(rng):
+    letters = 'abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789'
+    ssid = ''.join(rng.choice(letters) for _ in range(rng.randint(4, 16)))
+    password = ''.join(rng.choice(letters) for _ in range(rng.randint(8, 20)))
+    return ssid + '\n' + password
+
+
+def run_decoder(decoder, paths):
+    '''Decoded text of each WAV file, None if nothing was decoded'''
+    output = subprocess.run([decoder] + paths, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                            check=True, text=True).stdout
+    decoded = {}
+    for line in output.splitlines():
+        path, _, text = line.partition('\t')
+        decoded[path] = text.replace('\\n', '\n').replace('\\\\', '\\') if text else None
+    return [decoded.get(path) for path in paths]
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='声波配网解调器解码率测试')
+    parser.add_argument('--snr', type=float, nargs='*', default=[20, 10, 6, 3, 0, -3], help='信噪比 (dB)')
+    parser.add_argument('--trials', type=int, default=20, help='每个信噪比的测试次数 (默认: 20)')
+    parser.add_argument('--amplitude', type=float, default=8000, help='信号幅度 (默认: 8000)')
+    parser.add_argument('--clock-ppm', type=float, default=0, help='发送端采样时钟偏差 (ppm, 默认: 0)')
+    parser.add_argument('--mode', choices=['afsk', 'mfsk', 'all'], default='all', help='调制方式')
+    parser.add_argument('--write-wav', help='把 --text 调制后写入 16 kHz WAV 文件')
+    parser.add_argument('--text', default='Xiaozhi\npassword', help='--write-wav 的内容, SSID 和密码以换行分隔')
+    parser.add_argument('--decoder', default=os.path.join(os.path.dirname(__file__), '..', 'build-host', 'afsk_demod_check'),
+                        help='主机编译的解调器 (默认: build-host/afsk_demod_check)')
+    parser.add_argument('--expect', type=float, help='总解码率低于该百分比时返回失败')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    if args.write_wav:
+        mode = 'afsk' if args.mode == 'all' else args.mode
+        samples, duration = encode(args.text, args.amplitude, 0, random.Random(args.seed), mode)
+        write_wav(args.write_wav, samples)
+        print(f'{args.write_wav}: {mode}, {duration:.2f} s of signal')
+        sys.exit(0)
+
+    modes = ['afsk', 'mfsk'] if args.mode == 'all' else [args.mode]
+    print(f'{"SNR dB":>7} ' + ' '.join(f'{mode:>7}' for mode in modes))
+    decoded_total = 0
+    with tempfile.TemporaryDirectory() as directory:
+        for snr in args.snr:
+            rng = random.Random(args.seed)
+            paths, texts = [], []
+            for trial in range(args.trials):
+                text = random_credentials(rng)
+                for mode in modes:
+                    signal, _ = encode(text, args.amplitude, args.clock_ppm, rng, mode)
+                    path = os.path.join(directory, f'{mode}_{snr}_{trial}.wav')
+                    write_wav(path, add_noise(signal, args.amplitude, snr, rng))
+                    paths.append(path)
+                    texts.append(text)
+            decoded = {mode: 0 for mode in modes}
+            for i, (text, result) in enumerate(zip(texts, run_decoder(args.decoder, paths))):
+                if result == text:
+                    decoded[modes[i % len(modes)]] += 1
+            decoded_total += sum(decoded.values())
+            print(f'{snr:>7.1f} ' + ' '.join(f'{decoded[mode] * 100 / args.trials:>6.0f}%' for mode in modes))
+
+    rate = decoded_total * 100 / (len(args.snr) * args.trials * len(modes))
+    if args.expect is not None and rate < args.expect:
+        print(f'Decode rate {rate:.0f}% is below {args.expect:.0f}%')
+        sys.exit(1)
@@ -1,54 +1,221 @@
 import socket
+import struct
 import wave
 import argparse
+import array
 
 
 '''
   Create a UDP socket and bind it to the server's IP:8000.
-  Listen for incoming messages and print them to the console.
-  Save the audio to a WAV file.
+  Listen for incoming audio debug packets and save them to WAV files.
+
+  Packets sent by the firmware (CONFIG_USE_AUDIO_DEBUGGER) start with a header, see audio_debugger.h:
+  |magic 4u|version 1u|stream_id 1u|encoding 1u|channels 1u|sample_rate 4u|sequence 4u|timestamp_us 8u|samples 2u|payload_size 2u|
+
+  Every stream (tap point) is written to its own WAV file, placed on a common timeline using the
+  device timestamps, so gaps caused by dropped packets are filled with silence. All streams are also
+  mixed into one multichannel WAV file (one channel per stream channel) for AEC and latency analysis.
+
+  Packets without the header are treated as raw PCM from older firmware.
 '''
-def main(samplerate, channels):
+
+HEADER_FORMAT = '<IBBBBIIQHH'
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+PACKET_MAGIC = 0x44415A58
+
+ENCODING_PCM16 = 0
+ENCODING_IMA_ADPCM = 1
+
+STREAM_NAMES = {
+    0: 'mic_input',
+    1: 'processor_output',
+    2: 'decoder_output',
+    3: 'speaker_output',
+}
+
+ADPCM_STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+]
+ADPCM_INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8]
+
+
+def decode_adpcm(payload, channels, samples):
+    states = []
+    for ch in range(channels):
+        predictor, index, _ = struct.unpack_from('<hBB', payload, ch * 4)
+        states.append([predictor, index])
+    codes = payload[channels * 4:]
+    pcm = array.array('h', bytes(samples * channels * 2))
+    for i in range(samples * channels):
+        state = states[i % channels]
+        code = (codes[i // 2] >> 4) if (i & 1) else (codes[i // 2] & 0x0F)
+        step = ADPCM_STEP_TABLE[state[1]]
+        delta = step >> 3
+        if code & 4:
+            delta += step
+        if code & 2:
+            delta += step >> 1
+        if code & 1:
+            delta += step >> 2
+        predictor = state[0] - delta if (code & 8) else state[0] + delta
+        state[0] = max(-32768, min(32767, predictor))
+        state[1] = max(0, min(88, state[1] + ADPCM_INDEX_TABLE[code]))
+        pcm[i] = state[0]
+    return pcm
+
+
+class Stream:
+    def __init__(self, stream_id, sample_rate, channels):
+        self.stream_id = stream_id
+        self.sample_rate = sample_rate
+        self.channels = channels
+        self.first_timestamp_us = None
+        self.frames = array.array('h')
+        self.packets = 0
+        self.lost = 0
+        self.last_sequence = None
+
+    @property
+    def name(self):
+        return STREAM_NAMES.get(self.stream_id, f'stream{self.stream_id}')
+
+    def add(self, sequence, timestamp_us, pcm):
+        if self.first_timestamp_us is None:
+            self.first_timestamp_us = timestamp_us
+        if self.last_sequence is not None and sequence != self.last_sequence + 1:
+            self.lost += max(0, sequence - self.last_sequence - 1)
+        self.last_sequence = sequence
+        self.packets += 1
+
+        # Place the frames on the timeline, pad with silence if packets were lost
+        position = (timestamp_us - self.first_timestamp_us) * self.sample_rate // 1000000
+        current = len(self.frames) // self.channels
+        if position > current + self.sample_rate // 100:
+            self.frames.extend(array.array('h', [0]) * ((position - current) * self.channels))
+        self.frames.extend(pcm)
+
+
+def resample(samples, from_rate, to_rate):
+    if from_rate == to_rate or len(samples) == 0:
+        return samples
+    out_len = len(samples) * to_rate // from_rate
+    out = array.array('h', bytes(out_len * 2))
+    step = from_rate / to_rate
+    last = len(samples) - 1
+    for i in range(out_len):
+        pos = i * step
+        j = int(pos)
+        frac = pos - j
+        a = samples[min(j, last)]
+        b = samples[min(j + 1, last)]
+        out[i] = int(a + (b - a) * frac)
+    return out
+
+
+def write_wav(filename, sample_rate, channels, frames):
+    with wave.open(filename, 'wb') as wav_file:
+        wav_file.setnchannels(channels)
+        wav_file.setsampwidth(2)
+        wav_file.setframerate(sample_rate)
+        wav_file.writeframes(frames.tobytes())
+    print(f"WAV file '{filename}' saved successfully")
+
+
+def save_streams(streams, prefix, mix_rate):
+    if not streams:
+        return
+    t0 = min(s.first_timestamp_us for s in streams.values())
+
+    mix_channels = []
+    for stream in sorted(streams.values(), key=lambda s: s.stream_id):
+        # Align every stream to the earliest tap
+        offset = (stream.first_timestamp_us - t0) * stream.sample_rate // 1000000
+        aligned = array.array('h', [0]) * (offset * stream.channels) + stream.frames
+        filename = f"{prefix}_{stream.name}_{stream.sample_rate}_{stream.channels}.wav"
+        write_wav(filename, stream.sample_rate, stream.channels, aligned)
+        print(f"  {stream.name}: {stream.packets} packets, {stream.lost} lost, start offset {offset * 1000 // stream.sample_rate} ms")
+
+        for ch in range(stream.channels):
+            mix_channels.append(resample(aligned[ch::stream.channels], stream.sample_rate, mix_rate))
+
+    length = max(len(c) for c in mix_channels)
+    mixed = array.array('h', bytes(length * len(mix_channels) * 2))
+    for index, channel in enumerate(mix_channels):
+        mixed[index:index + len(channel) * len(mix_channels):len(mix_channels)] = channel
+    write_wav(f"{prefix}_aligned_{mix_rate}_{len(mix_channels)}.wav", mix_rate, len(mix_channels), mixed)
+
+
+def main(samplerate, channels, port, prefix, mix_rate):
     # Create a UDP socket
     server_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
-    server_socket.bind(('0.0.0.0', 8000))
-
-    # Create WAV file with parameters
-    filename = f"{samplerate}_{channels}.wav"
-    wav_file = wave.open(filename, "wb")
-    wav_file.setnchannels(channels)     # channels parameter
-    wav_file.setsampwidth(2)            # 2 bytes per sample (16-bit)
-    wav_file.setframerate(samplerate)   # samplerate parameter
+    server_socket.bind(('0.0.0.0', port))
 
-    print(f"Start saving audio from 0.0.0.0:8000 to {filename}...")
+    streams = {}
+    legacy_wav = None
+    print(f"Start receiving audio from 0.0.0.0:{port}...")
 
     try:
         while True:
             # Receive a message from the client
-            message, address = server_socket.recvfrom(8000)
-            
-            # Write PCM data to WAV file
-            wav_file.writeframes(message)
-
-            # Print length of the message
-            print(f"Received {len(message)} bytes from {address}")
-    
+            message, address = server_socket.recvfrom(65536)
+
+            if len(message) < HEADER_SIZE or struct.unpack_from('<I', message)[0] != PACKET_MAGIC:
+                # Old firmware sends raw PCM without a header
+                if legacy_wav is None:
+                    filename = f"{samplerate}_{channels}.wav"
+                    legacy_wav = wave.open(filename, "wb")
+                    legacy_wav.setnchannels(channels)
+                    legacy_wav.setsampwidth(2)
+                    legacy_wav.setframerate(samplerate)
+                    print(f"Saving raw audio to {filename}")
+                legacy_wav.writeframes(message)
+                continue
+
+            (_, version, stream_id, encoding, stream_channels, sample_rate,
+             sequence, timestamp_us, samples, payload_size) = struct.unpack_from(HEADER_FORMAT, message)
+            payload = message[HEADER_SIZE:HEADER_SIZE + payload_size]
+            if encoding == ENCODING_IMA_ADPCM:
+                pcm = decode_adpcm(payload, stream_channels, samples)
+            else:
+                pcm = array.array('h', payload)
+
+            stream = streams.get(stream_id)
+            if stream is None or stream.sample_rate != sample_rate or stream.channels != stream_channels:
+                if stream is not None:
+                    print(f"Stream {stream.name} format changed, restarting it")
+                stream = Stream(stream_id, sample_rate, stream_channels)
+                streams[stream_id] = stream
+                print(f"New stream {stream.name}: {sample_rate} Hz, {stream_channels} channels from {address}")
+            stream.add(sequence, timestamp_us, pcm)
+
     except KeyboardInterrupt:
         print("\nStopping recording...")
-    
+
     finally:
         # Close files and socket
-        wav_file.close()
+        if legacy_wav is not None:
+            legacy_wav.close()
         server_socket.close()
-        print(f"WAV file '{filename}' saved successfully")
+        save_streams(streams, prefix, mix_rate)
 
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description='UDP音频数据接收器，保存为WAV文件')
-    parser.add_argument('--samplerate', '-s', type=int, default=16000, 
-                        help='采样率 (默认: 16000)')
-    parser.add_argument('--channels', '-c', type=int, default=2, 
-                        help='声道数 (默认: 2)')
-    
+    parser.add_argument('--samplerate', '-s', type=int, default=16000,
+                        help='无包头的原始数据的采样率 (默认: 16000)')
+    parser.add_argument('--channels', '-c', type=int, default=2,
+                        help='无包头的原始数据的声道数 (默认: 2)')
+    parser.add_argument('--port', '-p', type=int, default=8000,
+                        help='UDP 端口 (默认: 8000)')
+    parser.add_argument('--prefix', default='audio_debug',
+                        help='输出文件名前缀 (默认: audio_debug)')
+    parser.add_argument('--mix-rate', type=int, default=16000,
+                        help='对齐后的多声道 WAV 文件采样率 (默认: 16000)')
+
     args = parser.parse_args()
-    main(args.samplerate, args.channels)
+    main(args.samplerate, args.channels, args.port, args.prefix, args.mix_rate)
@@ -0,0 +1,204 @@
+'''
+  Byte savings and CPU time of the deflated JSON messages (CONFIG_USE_WEBSOCKET_DEFLATE).
+
+  Every configuration compresses the same conversations in both directions: the device answers the MCP
+  initialize and tools/list requests (the tools are read from main/mcp_server.cc), then for each turn sends
+  the wake word, the listen start and the device status, and receives stt, llm, tts and MCP tool calls.
+  Every message is inflated again and compared, like the receiving end would.
+
+  Bytes are the WebSocket message payloads, including the binary protocol header of the deflated messages.
+  CPU time is zlib on this host with the parameters of MessageDeflate in main/protocols/message_deflate.cc,
+  the device logs its own in MessageDeflate::LogStatistics.
+  The RAM column is the zlib estimate for one connection: (1 << (w + 2)) + (1 << (m + 9)) for deflate,
+  (1 << w) + 7 KB for inflate.
+
+  python deflate_benchmark.py
+  python deflate_benchmark.py --turns 20 --version 3
+'''
+
+import os
+import re
+import json
+import time
+import zlib
+import argparse
+
+
+MCP_SERVER_CC = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'main', 'mcp_server.cc')
+MEM_LEVEL = 2
+
+# (label, window bits, context takeover), 0 bits for plain text frames
+CONFIGURATIONS = [
+    ('off', 0, True),
+    ('w9', 9, True),
+    ('w10', 10, True),
+    ('w12', 12, True),
+    ('w15', 15, True),
+    ('w10 no takeover', 10, False),
+    ('w15 no takeover', 15, False),
+]
+
+PROPERTY_TYPES = {'Boolean': 'boolean', 'Integer': 'integer', 'String': 'string'}
+
+
+def load_tools(path=MCP_SERVER_CC):
+    '''The tools/list entries as McpTool::to_json would print them.'''
+    with open(path, encoding='utf-8') as f:
+        source = f.read()
+    tools = []
+    parts = re.split(r'AddTool\(\s*"', source)[1:]
+    for part in parts:
+        name = part[:part.index('"')]
+        strings = re.match(r'"\s*,\s*((?:"(?:[^"\\]|\\.)*"\s*)+)', part[len(name):])
+        if not strings:
+            continue
+        description = ''.join(re.findall(r'"((?:[^"\\]|\\.)*)"', strings.group(1)))
+        description = description.encode().decode('unicode_escape').encode('latin-1').decode('utf-8')
+        properties = {}
+        for prop, prop_type in re.findall(r'Property\("(\w+)",\s*kPropertyType(\w+)', part.split('[](')[0]):
+            properties[prop] = {'type': PROPERTY_TYPES.get(prop_type, 'string')}
+        tools.append({
+            'name': name,
+            'description': description,
+            'inputSchema': {'type': 'object', 'properties': properties, 'required': list(properties)},
+        })
+    return tools
+
+
+def mcp(session_id, payload):
+    return {'session_id': session_id, 'type': 'mcp', 'payload': dict(jsonrpc='2.0', **payload)}
+
+
+def device_status(turn):
+    return json.dumps({
+        'audio_speaker': {'volume': 60 + turn % 5},
+        'screen': {'brightness': 80, 'theme': 'light'},
+        'battery': {'level': 87 - turn, 'charging': False},
+        'network': {'type': 'wifi', 'ssid': 'Xiaozhi-Office', 'signal': 'strong'},
+    }, separators=(',', ':'))
+
+
+def device_corpus(session_id, tools, turns):
+    messages = [
+        mcp(session_id, {'id': 1, 'result': {'protocolVersion': '2024-11-05', 'capabilities': {'tools': {}},
+                                             'serverInfo': {'name': 'xiaozhi', 'version': '1.8.0'}}}),
+        mcp(session_id, {'id': 2, 'result': {'tools': tools}}),
+    ]
+    for turn in range(turns):
+        # listen stop is left out, the mock server would answer it with a reply of its own
+        messages.append({'session_id': session_id, 'type': 'listen', 'state': 'detect', 'text': '你好小智'})
+        messages.append({'session_id': session_id, 'type': 'listen', 'state': 'start', 'mode': 'auto'})
+        messages.append(mcp(session_id, {'id': 10 + turn * 2, 'result': {
+            'content': [{'type': 'text', 'text': device_status(turn)}], 'isError': False}}))
+        messages.append(mcp(session_id, {'id': 11 + turn * 2, 'result': {
+            'content': [{'type': 'text', 'text': 'true'}], 'isError': False}}))
+    return messages
+
+
+def server_corpus(session_id, turns):
+    messages = [
+        mcp(session_id, {'method': 'initialize', 'id': 1, 'params': {
+            'protocolVersion': '2024-11-05', 'capabilities': {'vision': {'url': 'http://127.0.0.1:8003/vision/explain',
+                                                                          'token': 'test-token'}},
+            'clientInfo': {'name': 'xiaozhi-mock', 'version': '1.0.0'}}}),
+        mcp(session_id, {'method': 'tools/list', 'id': 2, 'params': {'cursor': ''}}),
+    ]
+    sentences = ['好的，我先看一下现在的音量。', '现在音量是百分之六十，我帮你调到百分之八十。', '已经调好了，还有什么需要吗？']
+    for turn in range(turns):
+        messages.append({'session_id': session_id, 'type': 'stt', 'text': '把音量调大一点'})
+        messages.append({'session_id': session_id, 'type': 'llm', 'text': '😊', 'emotion': 'happy'})
+        messages.append({'session_id': session_id, 'type': 'tts', 'state': 'start', 'sample_rate': 24000})
+        messages.append(mcp(session_id, {'method': 'tools/call', 'id': 10 + turn * 2, 'params': {
+            'name': 'self.get_device_status', 'arguments': {}}}))
+        messages.append(mcp(session_id, {'method': 'tools/call', 'id': 11 + turn * 2, 'params': {
+            'name': 'self.audio_speaker.set_volume', 'arguments': {'volume': 80}}}))
+        for sentence in sentences:
+            messages.append({'session_id': session_id, 'type': 'tts', 'state': 'sentence_start', 'text': sentence})
+        messages.append({'session_id': session_id, 'type': 'tts', 'state': 'stop'})
+    return messages
+
+
+# Binary protocol header in front of a deflated message, see BinaryProtocol2 / BinaryProtocol3 in protocol.h
+HEADER_SIZE = {2: 16, 3: 4}
+
+# MessageDeflate ends every message with a sync flush and leaves out its tail (RFC 7692)
+SYNC_FLUSH_TAIL = b'\x00\x00\xff\xff'
+
+
+class MessageDeflate:
+    def __init__(self, window_bits, context_takeover):
+        self.window_bits = window_bits
+        self.context_takeover = context_takeover
+        self.compressor = self._new_compressor()
+        self.decompressor = zlib.decompressobj(-window_bits)
+        self.compress_seconds = self.decompress_seconds = 0.0
+
+    def _new_compressor(self):
+        return zlib.compressobj(zlib.Z_DEFAULT_COMPRESSION, zlib.DEFLATED, -self.window_bits, MEM_LEVEL)
+
+    def compress(self, data):
+        start = time.process_time()
+        if not self.context_takeover:
+            self.compressor = self._new_compressor()
+        out = self.compressor.compress(data) + self.compressor.flush(zlib.Z_SYNC_FLUSH)
+        if out.endswith(SYNC_FLUSH_TAIL):
+            out = out[:-len(SYNC_FLUSH_TAIL)]
+        self.compress_seconds += time.process_time() - start
+        return out
+
+    def decompress(self, data):
+        start = time.process_time()
+        out = self.decompressor.decompress(data + SYNC_FLUSH_TAIL)
+        self.decompress_seconds += time.process_time() - start
+        return out
+
+
+def transfer(messages, version, window_bits, context_takeover, min_size):
+    '''Raw and wire bytes of one direction, and the zlib time of both ends.'''
+    raw = wire = 0
+    deflate = MessageDeflate(window_bits, context_takeover) if window_bits else None
+    for root in messages:
+        data = json.dumps(root, ensure_ascii=False).encode()
+        raw += len(data)
+        if deflate is None or len(data) < min_size:
+            wire += len(data)
+            continue
+        payload = deflate.compress(data)
+        assert deflate.decompress(payload) == data, 'message changed on the way'
+        wire += HEADER_SIZE[version] + len(payload)
+    seconds = (deflate.compress_seconds, deflate.decompress_seconds) if deflate else (0.0, 0.0)
+    return raw, wire, seconds
+
+
+def ram_estimate(window_bits):
+    if not window_bits:
+        return 0
+    return (1 << (window_bits + 2)) + (1 << (MEM_LEVEL + 9)) + (1 << window_bits) + 7 * 1024
+
+
+def benchmark(args):
+    tools = load_tools()
+    up = device_corpus('bench', tools, args.turns)
+    down = server_corpus('bench', args.turns)
+    print(f'{len(tools)} tools, {args.turns} turns, protocol version {args.version}, min size {args.min_size} bytes')
+    print(f'{"config":<16}{"up bytes":>18}{"saved":>7}{"down bytes":>18}{"saved":>7}'
+          f'{"deflate us":>12}{"inflate us":>12}{"RAM KB":>8}')
+    for label, window_bits, context_takeover in CONFIGURATIONS:
+        up_raw, up_wire, (up_compress, up_decompress) = transfer(up, args.version, window_bits, context_takeover, args.min_size)
+        down_raw, down_wire, (down_compress, down_decompress) = transfer(down, args.version, window_bits, context_takeover, args.min_size)
+        # The device compresses the uplink and inflates the downlink
+        compress_us = up_compress * 1e6
+        decompress_us = down_decompress * 1e6
+        up_text = f'{up_raw} -> {up_wire}'
+        down_text = f'{down_raw} -> {down_wire}'
+        print(f'{label:<16}{up_text:>18}{100 - up_wire * 100 / up_raw:>6.0f}%{down_text:>18}{100 - down_wire * 100 / down_raw:>6.0f}%'
+              f'{compress_us:>12.0f}{decompress_us:>12.0f}{ram_estimate(window_bits) / 1024:>8.1f}')
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='WebSocket JSON 消息压缩的节省字节数与 CPU 时间测试')
+    parser.add_argument('--turns', '-t', type=int, default=10, help='对话轮数 (默认: 10)')
+    parser.add_argument('--version', type=int, default=2, choices=[2, 3], help='二进制协议版本 (默认: 2)')
+    parser.add_argument('--min-size', type=int, default=64, help='压缩的最小消息长度 (默认: 64)')
+    args = parser.parse_args()
+    benchmark(args)
@@ -0,0 +1,195 @@
+import os
+import re
+import sys
+import json
+import shutil
+import argparse
+import tempfile
+import subprocess
+
+
+'''
+  Build a text font holding only the characters the firmware is likely to show (CONFIG_USE_FONT_SUBSET):
+  the strings of language.json, ASCII, CJK punctuation and the common characters of the language.
+  The other characters of the national charset go into a 1bpp fallback font, so rare characters
+  still show up, only thinner. The subset keeps the name of the board font (e.g. font_puhui_16_4) and
+  replaces the full font from xiaozhi-fonts at link time.
+
+  python font_subset.py --ttf puhui.ttf --name font_puhui_16_4 --size 16 --bpp 4 \
+      --lang ../main/assets/zh-CN/language.json --output-dir build/font_subset
+  python font_subset.py --lang ../main/assets/zh-CN/language.json --dry-run     count glyphs only
+'''
+
+
+PUNCTUATION = (
+    [chr(c) for c in range(0x20, 0x7F)] +       # ASCII
+    [chr(c) for c in range(0x2010, 0x2027)] +   # dashes, quotes, ellipsis
+    [chr(c) for c in range(0x3000, 0x3020)] +   # CJK punctuation
+    [chr(c) for c in range(0xFF01, 0xFF5F)]     # full width forms
+)
+
+
+def decode_range(encoding, first_bytes, second_bytes):
+    '''Characters of a double byte charset in code order'''
+    chars = []
+    for first in first_bytes:
+        for second in second_bytes:
+            try:
+                chars.append(bytes([first, second]).decode(encoding))
+            except UnicodeDecodeError:
+                pass
+    return chars
+
+
+def national_charset(language):
+    '''The common characters of the language and the rest of its national charset.
+    GB2312 level 1, the Big5 common characters and JIS level 1 were each picked by usage frequency.'''
+    kana = [chr(c) for c in range(0x3041, 0x3097)] + [chr(c) for c in range(0x30A1, 0x30FB)] + ['ー']
+    if language == 'zh-CN':
+        return (decode_range('gb2312', range(0xB0, 0xD8), range(0xA1, 0xFF)),
+                decode_range('gb2312', range(0xD8, 0xF8), range(0xA1, 0xFF)))
+    if language == 'zh-TW':
+        big5_second = list(range(0x40, 0x7F)) + list(range(0xA1, 0xFF))
+        common = decode_range('big5', range(0xA4, 0xC7), big5_second)
+        return ([c for c in common if ord(c) >= 0x4E00],
+                decode_range('big5', range(0xC9, 0xFA), big5_second))
+    if language == 'ja-JP':
+        return (kana + decode_range('euc_jp', range(0xB0, 0xD0), range(0xA1, 0xFF)),
+                decode_range('euc_jp', range(0xD0, 0xF5), range(0xA1, 0xFF)))
+    return [], []
+
+
+def load_language(path):
+    with open(path, encoding='utf-8') as f:
+        data = json.load(f)
+    return data['language']['type'], ''.join(data['strings'].values())
+
+
+def load_ranked(path, count):
+    '''The first `count` distinct CJK characters of a frequency ranked list, one or many per line'''
+    with open(path, encoding='utf-8') as f:
+        text = f.read()
+    ranked = []
+    for c in text:
+        if ord(c) > 0x2E80 and c not in ranked:
+            ranked.append(c)
+            if len(ranked) == count:
+                break
+    return ranked
+
+
+def build_charsets(language, strings, ranked=None):
+    '''Returns the characters of the subset and of the fallback font, both sorted'''
+    common, rest = national_charset(language)
+    if ranked is not None:
+        rest = [c for c in common + rest if c not in ranked]
+        common = ranked
+    subset = set(PUNCTUATION) | set(common) | set(c for c in strings if c.isprintable())
+    fallback = set(rest) - subset
+    return sorted(subset), sorted(fallback)
+
+
+def bitmap_bytes(source):
+    '''Size of the glyph_bitmap array in a font generated by lv_font_conv'''
+    match = re.search(r'glyph_bitmap\[\]\s*=\s*\{(.*?)\};', source, re.S)
+    if match is None:
+        return 0
+    return len(re.findall(r'0x[0-9a-fA-F]+', match.group(1)))
+
+
+def link_fallback(source, name, fallback_name):
+    '''Points the .fallback of the generated font at the fallback font'''
+    if '.fallback = NULL' not in source:
+        raise ValueError('The generated font has no .fallback field, lv_font_conv is too old')
+    source = source.replace('.fallback = NULL', f'.fallback = &{fallback_name}')
+    lines = source.split('\n')
+    for i, line in enumerate(lines):
+        if re.match(rf'^(const )?lv_font_t {name} = \{{', line):
+            if i > 0 and lines[i - 1].startswith('#if'):
+                i -= 1
+            lines.insert(i, f'extern const lv_font_t {fallback_name};\n')
+            return '\n'.join(lines)
+    raise ValueError(f'{name} is not defined in the generated font')
+
+
+def lv_font_conv():
+    path = shutil.which('lv_font_conv')
+    if path:
+        return [path]
+    if shutil.which('npx'):
+        return ['npx', '--yes', 'lv_font_conv']
+    sys.exit('lv_font_conv not found, install it with: npm install -g lv_font_conv')
+
+
+def convert(ttf, name, size, bpp, chars, output):
+    cmd = lv_font_conv() + ['--font', ttf, '--size', str(size), '--bpp', str(bpp), '--format', 'lvgl',
+                            '--lv-include', 'lvgl.h', '--lv-font-name', name, '--symbols', ''.join(chars),
+                            '-o', output]
+    subprocess.run(cmd, check=True)
+    with open(output, encoding='utf-8') as f:
+        return f.read()
+
+
+def report(label, glyphs, size, bpp, generated=None):
+    if generated is None:
+        estimate = glyphs * size * size * bpp // 8
+        print(f'{label:10} {glyphs:6} glyphs, at most {estimate / 1024:8.1f} KB of bitmaps')
+    else:
+        print(f'{label:10} {glyphs:6} glyphs, {generated / 1024:8.1f} KB of bitmaps')
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='按语言文件和常用字裁剪正文字体，其余字符生成 1bpp 后备字体')
+    parser.add_argument('--lang', help='language.json 路径')
+    parser.add_argument('--ttf', help='字体文件 (TTF/OTF/WOFF)')
+    parser.add_argument('--name', default='font_puhui_16_4', help='生成的字体名，与板子使用的字体同名 (默认: font_puhui_16_4)')
+    parser.add_argument('--size', type=int, default=16, help='字号 (像素, 默认: 16)')
+    parser.add_argument('--bpp', type=int, default=4, help='正文字体每像素位数 (默认: 4)')
+    parser.add_argument('--fallback-bpp', type=int, default=1, help='后备字体每像素位数 (默认: 1)')
+    parser.add_argument('--charset', help='按字频排序的常用字文件，为空时使用国家标准常用字集')
+    parser.add_argument('--common', type=int, default=3500, help='从常用字文件中取的字数 (默认: 3500)')
+    parser.add_argument('--no-fallback', action='store_true', help='不生成后备字体')
+    parser.add_argument('--compare', help='完整字体的 .c 文件，用于对比位图大小')
+    parser.add_argument('--output-dir', '-o', default='.', help='输出目录')
+    parser.add_argument('--dry-run', action='store_true', help='只统计字符数，不生成字体')
+    args = parser.parse_args()
+
+    if not args.lang or (not args.ttf and not args.dry_run):
+        parser.print_help()
+        sys.exit(1)
+
+    language, strings = load_language(args.lang)
+    ranked = load_ranked(args.charset, args.common) if args.charset else None
+    subset, fallback = build_charsets(language, strings, ranked)
+    if args.no_fallback:
+        fallback = []
+
+    if args.dry_run:
+        report('subset', len(subset), args.size, args.bpp)
+        report('fallback', len(fallback), args.size, args.fallback_bpp)
+        sys.exit(0)
+
+    os.makedirs(args.output_dir, exist_ok=True)
+    fallback_name = args.name + '_fallback'
+    fallback_path = os.path.join(args.output_dir, fallback_name + '.c')
+    if fallback:
+        source = convert(args.ttf, fallback_name, args.size, args.fallback_bpp, fallback, fallback_path)
+        report('fallback', len(fallback), args.size, args.fallback_bpp, bitmap_bytes(source))
+    else:
+        # CMake expects both files
+        with open(fallback_path, 'w', encoding='utf-8') as f:
+            f.write('// No fallback font\n')
+
+    subset_path = os.path.join(args.output_dir, args.name + '.c')
+    with tempfile.TemporaryDirectory() as directory:
+        source = convert(args.ttf, args.name, args.size, args.bpp, subset, os.path.join(directory, 'font.c'))
+    if fallback:
+        source = link_fallback(source, args.name, fallback_name)
+    with open(subset_path, 'w', encoding='utf-8') as f:
+        f.write(source)
+    report('subset', len(subset), args.size, args.bpp, bitmap_bytes(source))
+
+    if args.compare:
+        with open(args.compare, encoding='utf-8') as f:
+            full = bitmap_bytes(f.read())
+        print(f'{"full font":10} {"":6}         {full / 1024:8.1f} KB of bitmaps')
@@ -0,0 +1,125 @@
+import sys
+import random
+import argparse
+
+
+'''
+  Compare the uplink Opus frame durations (CONFIG_OPUS_FRAME_DURATION_MS, audio_params.uplink_frame_duration)
+  by simulating the path of the microphone audio to the server, frame by frame:
+
+    AFE output (32 ms chunks) -> frame buffer -> Opus encoder -> transport -> network -> server
+
+  python frame_duration_benchmark.py                                 default Wi-Fi link, both transports
+  python frame_duration_benchmark.py --uplink-kbps 64 --jitter-ms 30  a slow and unsteady link
+  python frame_duration_benchmark.py --encode-us 4200 --encode-frame-ms 60
+                                      encode time measured on the device (total_encode_us / encode_count)
+
+  Latency is measured from the capture of a sample to the arrival of the packet holding it at the server.
+  "last" is the latency of the last sample of an utterance, which the server waits for before it can answer.
+'''
+
+AFE_CHUNK_MS = 32
+SAMPLE_RATE = 16000
+
+# Bytes added to every Opus packet
+TRANSPORTS = {
+    # WebSocket binary frame (client, masked) + TLS 1.2 AES-GCM record + TCP/IPv4
+    'websocket': 6 + 29 + 40,
+    # 16 bytes nonce header + UDP/IPv4, AES-CTR adds nothing
+    'mqtt-udp': 16 + 28,
+}
+
+
+def opus_payload_bytes(frame_ms, bitrate):
+    # TOC byte and a few bytes of range coder padding per packet
+    return bitrate * frame_ms // 8000 + 3
+
+
+def simulate(frame_ms, transport, args, seed):
+    rng = random.Random(seed)
+    overhead = TRANSPORTS[transport]
+    encode_ms = args.encode_us / 1000 * frame_ms / args.encode_frame_ms
+    packet_bytes = opus_payload_bytes(frame_ms, args.bitrate) + overhead
+
+    latencies_first = []
+    latencies_last = []
+    link_free_at = 0.0
+    last_arrival = 0.0
+    encoder_free_at = 0.0
+    utterance_ms = args.utterance_ms
+    total_bytes = 0
+    packets = 0
+
+    for utterance in range(args.utterances):
+        start = utterance * (utterance_ms + 1000)
+        frames = -(-utterance_ms // frame_ms)
+        for i in range(frames):
+            first_sample = start + i * frame_ms
+            last_sample = first_sample + frame_ms
+            # The AFE outputs whole chunks, the frame is complete with the chunk holding its last sample
+            chunk_end = -(-(last_sample - start) // AFE_CHUNK_MS) * AFE_CHUNK_MS + start
+            ready = chunk_end + args.afe_delay_ms
+            encoded = max(ready, encoder_free_at) + encode_ms
+            encoder_free_at = encoded
+
+            # Serialize on the link, each packet also pays the Wi-Fi channel access time
+            sent = max(encoded, link_free_at) + args.airtime_ms + packet_bytes * 8 / args.uplink_kbps
+            link_free_at = sent
+            arrival = sent + args.delay_ms + rng.expovariate(1 / args.jitter_ms) if args.jitter_ms > 0 else sent + args.delay_ms
+            if transport == 'websocket':
+                # TCP delivers in order, a late packet holds back the ones behind it
+                arrival = max(arrival, last_arrival)
+            last_arrival = arrival
+
+            latencies_first.append(arrival - first_sample)
+            if i == frames - 1:
+                latencies_last.append(arrival - min(last_sample, start + utterance_ms))
+            total_bytes += packet_bytes
+            packets += 1
+
+    duration_ms = args.utterances * utterance_ms
+    return {
+        'first': percentiles(latencies_first),
+        'last': percentiles(latencies_last),
+        'packets_per_s': packets * 1000 / duration_ms,
+        'kbps': total_bytes * 8 / duration_ms,
+        'overhead': overhead * packets * 100 / total_bytes,
+    }
+
+
+def percentiles(values):
+    values = sorted(values)
+    return values[len(values) // 2], values[min(len(values) - 1, len(values) * 95 // 100)]
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='上行 Opus 帧长端到端延迟对比')
+    parser.add_argument('--frame-durations', type=int, nargs='*', default=[20, 40, 60], help='帧长 (ms)')
+    parser.add_argument('--transport', choices=list(TRANSPORTS) + ['all'], default='all', help='传输方式')
+    parser.add_argument('--bitrate', type=int, default=16000, help='Opus 码率 (bps, 默认: 16000)')
+    parser.add_argument('--encode-us', type=float, default=3000, help='编码一帧的耗时 (us, 默认: 3000)')
+    parser.add_argument('--encode-frame-ms', type=int, default=60, help='--encode-us 对应的帧长 (ms, 默认: 60)')
+    parser.add_argument('--afe-delay-ms', type=float, default=16, help='AFE 处理延迟 (ms, 默认: 16)')
+    parser.add_argument('--uplink-kbps', type=float, default=2000, help='上行带宽 (kbps, 默认: 2000)')
+    parser.add_argument('--airtime-ms', type=float, default=1.5, help='每包的 Wi-Fi 信道接入时间 (ms, 默认: 1.5)')
+    parser.add_argument('--delay-ms', type=float, default=20, help='单向网络延迟 (ms, 默认: 20)')
+    parser.add_argument('--jitter-ms', type=float, default=5, help='平均网络抖动 (ms, 指数分布, 默认: 5)')
+    parser.add_argument('--utterance-ms', type=int, default=3000, help='每句话的时长 (ms, 默认: 3000)')
+    parser.add_argument('--utterances', type=int, default=200, help='模拟的句数 (默认: 200)')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    for duration in args.frame_durations:
+        if duration not in (20, 40, 60):
+            print(f'Unsupported frame duration: {duration} ms')
+            sys.exit(1)
+
+    transports = list(TRANSPORTS) if args.transport == 'all' else [args.transport]
+    print(f'{"transport":<10} {"frame":>5} {"p50 ms":>7} {"p95 ms":>7} {"last p50":>9} {"last p95":>9} '
+          f'{"pkt/s":>6} {"kbps":>6} {"overhead":>8}')
+    for transport in transports:
+        for duration in args.frame_durations:
+            result = simulate(duration, transport, args, args.seed)
+            print(f'{transport:<10} {duration:>3}ms {result["first"][0]:>7.1f} {result["first"][1]:>7.1f} '
+                  f'{result["last"][0]:>9.1f} {result["last"][1]:>9.1f} {result["packets_per_s"]:>6.1f} '
+                  f'{result["kbps"]:>6.1f} {result["overhead"]:>7.1f}%')
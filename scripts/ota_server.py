@@ -0,0 +1,150 @@
+import sys
+import json
+import time
+import hashlib
+import argparse
+import urllib.request
+import urllib.error
+from email.utils import formatdate
+from http.server import ThreadingHTTPServer, BaseHTTPRequestHandler
+
+
+'''
+  Local stand-in for the OTA server, to test the cached version check (CONFIG_USE_OTA_CACHE).
+
+  POST /xiaozhi/ota/           version check, answers 304 when If-None-Match matches the ETag of the response
+  POST /xiaozhi/ota/activate   activation, always succeeds
+
+  The response is built from --config (a JSON file, read again on every request so it can be edited
+  while the device runs) or from --websocket-url. The ETag covers everything but server_time.
+
+  python ota_server.py serve --websocket-url ws://192.168.1.10:8000/xiaozhi/v1/ --latency-ms 300
+  python ota_server.py check http://127.0.0.1:8002/xiaozhi/ota/   request twice like a device, print the timing
+'''
+
+
+def build_response(args):
+    if args.config:
+        with open(args.config, encoding='utf-8') as f:
+            return json.load(f)
+    response = {'websocket': {'url': args.websocket_url, 'token': args.token}}
+    if args.firmware_version:
+        response['firmware'] = {'version': args.firmware_version, 'url': args.firmware_url}
+    return response
+
+
+def make_etag(response):
+    data = json.dumps(response, sort_keys=True, separators=(',', ':')).encode()
+    return '"' + hashlib.sha1(data).hexdigest()[:16] + '"'
+
+
+class OtaHandler(BaseHTTPRequestHandler):
+    args = None
+    stats = {'200': 0, '304': 0}
+
+    def do_GET(self):
+        self.do_POST()
+
+    def do_POST(self):
+        self.rfile.read(int(self.headers.get('Content-Length', 0)))
+        time.sleep(self.args.latency_ms / 1000)
+        if self.path.rstrip('/').endswith('/activate'):
+            self.send_body(200, b'{}')
+            return
+
+        response = build_response(self.args)
+        etag = make_etag(response)
+        device = self.headers.get('Device-Id', 'unknown')
+        if self.headers.get('If-None-Match') == etag:
+            self.stats['304'] += 1
+            print(f'{device}: 304, ETag {etag} is current')
+            self.send_response(304)
+            self.send_header('ETag', etag)
+            self.send_header('Date', formatdate(usegmt=True))
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+            return
+
+        self.stats['200'] += 1
+        print(f'{device}: 200, ETag {etag}' + (f', had {self.headers["If-None-Match"]}'
+                                               if 'If-None-Match' in self.headers else ''))
+        now = time.time()
+        response['server_time'] = {'timestamp': int(now * 1000),
+                                   'timezone_offset': time.localtime(now).tm_gmtoff // 60}
+        self.send_body(200, json.dumps(response).encode(), etag)
+
+    def send_body(self, status, data, etag=None):
+        self.send_response(status)
+        self.send_header('Content-Type', 'application/json')
+        if etag:
+            self.send_header('ETag', etag)
+        self.send_header('Content-Length', str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def log_message(self, format, *args):
+        pass
+
+
+def make_server(args, port):
+    OtaHandler.args = args
+    return ThreadingHTTPServer(('0.0.0.0', port), OtaHandler)
+
+
+def request(url, etag=None):
+    '''One version check like Ota::CheckVersion, returns the status, ETag, body and milliseconds'''
+    headers = {'Content-Type': 'application/json', 'Device-Id': '00:00:00:00:00:00'}
+    if etag:
+        headers['If-None-Match'] = etag
+    started = time.time()
+    try:
+        with urllib.request.urlopen(urllib.request.Request(url, b'{}', headers, method='POST')) as response:
+            status, headers, body = response.status, response.headers, response.read()
+    except urllib.error.HTTPError as e:
+        status, headers, body = e.code, e.headers, e.read()
+    return status, headers.get('ETag'), body, (time.time() - started) * 1000
+
+
+def check(url):
+    status, etag, body, ms = request(url)
+    print(f'First check: {status}, {len(body)} bytes, ETag {etag}, {ms:.0f} ms')
+    if not etag:
+        print('The server sends no ETag, the device checks in full on every boot')
+        return False
+    status, _, body, ms = request(url, etag)
+    print(f'Conditional check: {status}, {len(body)} bytes, {ms:.0f} ms')
+    if status != 304:
+        print('The server ignores If-None-Match')
+        return False
+    return True
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='本地 OTA 服务器，测试带 ETag 的版本检查缓存')
+    subparsers = parser.add_subparsers(dest='command')
+    serve_parser = subparsers.add_parser('serve', help='提供版本检查和激活接口')
+    serve_parser.add_argument('--port', '-p', type=int, default=8002, help='HTTP 端口 (默认: 8002)')
+    serve_parser.add_argument('--config', help='响应 JSON 文件，每次请求时重新读取')
+    serve_parser.add_argument('--websocket-url', default='ws://127.0.0.1:8000/', help='未指定 --config 时的 WebSocket 地址')
+    serve_parser.add_argument('--token', default='test-token', help='WebSocket token')
+    serve_parser.add_argument('--firmware-version', help='返回的固件版本，设置后设备会检查升级')
+    serve_parser.add_argument('--firmware-url', default='', help='固件下载地址')
+    serve_parser.add_argument('--latency-ms', type=int, default=0, help='模拟的服务器延迟 (毫秒)')
+    check_parser = subparsers.add_parser('check', help='像设备一样请求两次，检查服务器是否支持 ETag')
+    check_parser.add_argument('url')
+
+    args = parser.parse_args()
+    if args.command == 'serve':
+        server = make_server(args, args.port)
+        print(f'OTA server listening on 0.0.0.0:{args.port}')
+        try:
+            server.serve_forever()
+        except KeyboardInterrupt:
+            pass
+        print(f'Responses: {json.dumps(OtaHandler.stats)}')
+        server.server_close()
+    elif args.command == 'check':
+        sys.exit(0 if check(args.url) else 1)
+    else:
+        parser.print_help()
+        sys.exit(1)
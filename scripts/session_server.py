@@ -0,0 +1,142 @@
+import os
+import sys
+import json
+import time
+import struct
+import argparse
+from http.server import HTTPServer, BaseHTTPRequestHandler
+
+
+'''
+  Receive conversation sessions recorded by the firmware (CONFIG_USE_SESSION_RECORDER),
+  and serve them back for replay (CONFIG_USE_SESSION_REPLAY).
+
+  POST /sessions           save an uploaded session to the sessions directory
+  GET  /sessions/latest    download the latest uploaded session
+  GET  /sessions/<name>    download a session by file name
+
+  Use "dump <file>" to print the records of a session, see session_recorder.h for the format.
+'''
+
+FILE_HEADER_FORMAT = '<II'
+RECORD_HEADER_FORMAT = '<BBHIIII'
+FILE_MAGIC = 0x52535A58
+RECORD_TYPES = ['channel_opened', 'channel_closed', 'incoming_json', 'incoming_audio', 'outgoing_audio']
+
+
+def read_records(data):
+    magic, version = struct.unpack_from(FILE_HEADER_FORMAT, data)
+    if magic != FILE_MAGIC:
+        raise ValueError('Not a session file')
+    offset = struct.calcsize(FILE_HEADER_FORMAT)
+    header_size = struct.calcsize(RECORD_HEADER_FORMAT)
+    while offset + header_size <= len(data):
+        record_type, _, frame_duration, sample_rate, time_ms, timestamp, payload_size = \
+            struct.unpack_from(RECORD_HEADER_FORMAT, data, offset)
+        offset += header_size
+        payload = data[offset:offset + payload_size]
+        offset += payload_size
+        yield record_type, frame_duration, sample_rate, time_ms, timestamp, payload
+
+
+def dump(filename):
+    with open(filename, 'rb') as f:
+        data = f.read()
+    counts = {}
+    last_time = 0
+    for record_type, frame_duration, sample_rate, time_ms, timestamp, payload in read_records(data):
+        name = RECORD_TYPES[record_type] if record_type < len(RECORD_TYPES) else f'type{record_type}'
+        counts[name] = counts.get(name, 0) + 1
+        last_time = time_ms
+        if record_type == 2:
+            print(f'{time_ms:8d} ms  {name:16s} {payload.decode("utf-8", "replace")}')
+        elif record_type == 0:
+            print(f'{time_ms:8d} ms  {name:16s} session={payload.decode()} sample_rate={sample_rate} frame_duration={frame_duration}')
+        elif record_type == 1:
+            print(f'{time_ms:8d} ms  {name:16s}')
+    print(f'Duration: {last_time} ms, records: {json.dumps(counts)}')
+
+
+class SessionHandler(BaseHTTPRequestHandler):
+    directory = 'sessions'
+
+    def do_POST(self):
+        if self.path.rstrip('/') != '/sessions':
+            self.send_error(404)
+            return
+        data = self.read_body()
+        device_id = self.headers.get('Device-Id', 'unknown').replace(':', '')
+        filename = f'{time.strftime("%Y%m%d_%H%M%S")}_{device_id}.xzs'
+        with open(os.path.join(self.directory, filename), 'wb') as f:
+            f.write(data)
+        print(f'Saved {filename}, {len(data)} bytes')
+        self.send_response(200)
+        self.send_header('Content-Length', '0')
+        self.end_headers()
+
+    def do_GET(self):
+        if not self.path.startswith('/sessions/'):
+            self.send_error(404)
+            return
+        name = os.path.basename(self.path[len('/sessions/'):])
+        if name == 'latest':
+            files = sorted(f for f in os.listdir(self.directory) if f.endswith('.xzs'))
+            if not files:
+                self.send_error(404)
+                return
+            name = files[-1]
+        path = os.path.join(self.directory, name)
+        if not os.path.isfile(path):
+            self.send_error(404)
+            return
+        with open(path, 'rb') as f:
+            data = f.read()
+        print(f'Serving {name}, {len(data)} bytes')
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/octet-stream')
+        self.send_header('Content-Length', str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def read_body(self):
+        if self.headers.get('Transfer-Encoding', '').lower() == 'chunked':
+            data = bytearray()
+            while True:
+                size = int(self.rfile.readline().strip().split(b';')[0], 16)
+                if size == 0:
+                    self.rfile.readline()
+                    return bytes(data)
+                data += self.rfile.read(size)
+                self.rfile.readline()
+        return self.rfile.read(int(self.headers.get('Content-Length', 0)))
+
+
+def serve(port, directory):
+    os.makedirs(directory, exist_ok=True)
+    SessionHandler.directory = directory
+    server = HTTPServer(('0.0.0.0', port), SessionHandler)
+    print(f'Session server listening on 0.0.0.0:{port}, directory: {directory}')
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    server.server_close()
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='会话录制与回放服务器')
+    subparsers = parser.add_subparsers(dest='command')
+    serve_parser = subparsers.add_parser('serve', help='接收和提供会话文件')
+    serve_parser.add_argument('--port', '-p', type=int, default=8001, help='HTTP 端口 (默认: 8001)')
+    serve_parser.add_argument('--directory', '-d', default='sessions', help='会话文件目录 (默认: sessions)')
+    dump_parser = subparsers.add_parser('dump', help='打印会话文件内容')
+    dump_parser.add_argument('file')
+
+    args = parser.parse_args()
+    if args.command == 'dump':
+        dump(args.file)
+    elif args.command == 'serve':
+        serve(args.port, args.directory)
+    else:
+        parser.print_help()
+        sys.exit(1)
@@ -0,0 +1,175 @@
+import os
+import sys
+import time
+import struct
+import argparse
+from functools import partial
+from http.server import ThreadingHTTPServer, SimpleHTTPRequestHandler
+
+
+'''
+  Local file server for the URL player (CONFIG_USE_STREAM_PLAYER, MCP tool self.audio.play_url).
+
+  The device reads the stream only as fast as it plays it, --rate-kbps limits the server too,
+  to try a slow network. Each finished response prints how long the device took to read it.
+
+  python stream_server.py serve ./music --port 8080 --rate-kbps 64
+  python stream_server.py check story.ogg        demux like the device, print the packets and the buffer it needs
+
+  Ogg/Opus: ffmpeg -i in.mp3 -c:a libopus -b:a 32k -ac 1 -frame_duration 60 out.ogg
+  P3:       python p3_tools/convert_audio_to_p3.py in.mp3 out.p3
+'''
+
+
+MAX_BUFFER_SIZE = 32 * 1024
+
+
+def opus_packet_duration(packet):
+    '''Duration in 0.1 ms from the TOC byte, like GetOpusPacketDuration in stream_player.cc'''
+    if not packet:
+        return 0
+    toc = packet[0]
+    config = toc >> 3
+    if config < 12:
+        frame = [100, 200, 400, 600][config & 3]
+    elif config < 16:
+        frame = 200 if config & 1 else 100
+    else:
+        frame = [25, 50, 100, 200][config & 3]
+    code = toc & 3
+    if code == 0:
+        return frame
+    if code in (1, 2):
+        return frame * 2
+    return frame * (packet[1] & 0x3F) if len(packet) > 1 else 0
+
+
+def demux(data, chunk_size=1024):
+    '''Returns (format, [(sample_rate, frame_duration_ms, payload)], largest buffer), fed in chunks like the device'''
+    packets = []
+    buffer = b''
+    packet = b''
+    fmt = None
+    header_seen = tags_seen = False
+    max_buffered = 0
+
+    def on_ogg_packet(p):
+        nonlocal header_seen, tags_seen
+        if len(p) >= 19 and p[:8] == b'OpusHead':
+            header_seen, tags_seen = True, False
+            return
+        if not header_seen:
+            raise ValueError('not an Ogg/Opus stream')
+        if not tags_seen:
+            tags_seen = True
+            return
+        duration = opus_packet_duration(p)
+        if duration and duration % 10 == 0:
+            packets.append((48000, duration // 10, p))
+
+    for offset in range(0, len(data), chunk_size):
+        buffer += data[offset:offset + chunk_size]
+        max_buffered = max(max_buffered, len(buffer))
+        if fmt is None:
+            if len(buffer) < 4:
+                continue
+            fmt = 'ogg' if buffer[:4] == b'OggS' else 'p3'
+        while True:
+            if fmt == 'p3':
+                if len(buffer) < 4:
+                    break
+                size = struct.unpack('>H', buffer[2:4])[0]
+                if len(buffer) < 4 + size:
+                    break
+                packets.append((16000, 60, buffer[4:4 + size]))
+                buffer = buffer[4 + size:]
+                continue
+            if len(buffer) < 27:
+                break
+            if buffer[:4] != b'OggS':
+                raise ValueError('lost Ogg page sync')
+            segments = buffer[26]
+            if len(buffer) < 27 + segments:
+                break
+            lacing = buffer[27:27 + segments]
+            page_size = 27 + segments + sum(lacing)
+            if len(buffer) < page_size:
+                break
+            if not buffer[5] & 1:
+                packet = b''
+            body = 27 + segments
+            for value in lacing:
+                packet += buffer[body:body + value]
+                body += value
+                if value < 255:
+                    on_ogg_packet(packet)
+                    packet = b''
+            buffer = buffer[page_size:]
+        if len(buffer) > MAX_BUFFER_SIZE:
+            raise ValueError(f'page larger than {MAX_BUFFER_SIZE} bytes')
+    return fmt, packets, max_buffered
+
+
+class ThrottledHandler(SimpleHTTPRequestHandler):
+    rate_kbps = 0
+
+    def copyfile(self, source, outputfile):
+        started = time.time()
+        sent = 0
+        while True:
+            chunk = source.read(1024)
+            if not chunk:
+                break
+            try:
+                outputfile.write(chunk)
+            except (BrokenPipeError, ConnectionResetError):
+                print(f'{self.path}: closed by the device after {sent} bytes, {time.time() - started:.1f} s')
+                return
+            sent += len(chunk)
+            if self.rate_kbps:
+                time.sleep(len(chunk) * 8 / (self.rate_kbps * 1000))
+        print(f'{self.path}: {sent} bytes in {time.time() - started:.1f} s')
+
+    def log_message(self, format, *args):
+        pass
+
+
+def check(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    fmt, packets, max_buffered = demux(data)
+    duration = sum(p[1] for p in packets)
+    durations = sorted(set(p[1] for p in packets))
+    print(f'{fmt}: {len(packets)} packets, {duration / 1000:.1f} s, frame durations {durations} ms, '
+          f'{len(data) * 8 / max(duration, 1):.1f} kbps, at most {max_buffered} bytes buffered')
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='URL 音频播放的本地文件服务器与格式检查工具')
+    subparsers = parser.add_subparsers(dest='command')
+    serve_parser = subparsers.add_parser('serve', help='提供音频文件目录')
+    serve_parser.add_argument('directory', nargs='?', default='.', help='音频文件目录 (默认: 当前目录)')
+    serve_parser.add_argument('--port', '-p', type=int, default=8080, help='HTTP 端口 (默认: 8080)')
+    serve_parser.add_argument('--rate-kbps', type=int, default=0, help='限制发送速率 (kbps)，0 为不限制')
+    check_parser = subparsers.add_parser('check', help='像设备一样解析 Ogg/Opus 或 P3 文件')
+    check_parser.add_argument('file')
+
+    args = parser.parse_args()
+    if args.command == 'serve':
+        ThrottledHandler.rate_kbps = args.rate_kbps
+        server = ThreadingHTTPServer(('0.0.0.0', args.port), partial(ThrottledHandler, directory=args.directory))
+        print(f'Serving {os.path.abspath(args.directory)} on 0.0.0.0:{args.port}')
+        try:
+            server.serve_forever()
+        except KeyboardInterrupt:
+            pass
+        server.server_close()
+    elif args.command == 'check':
+        try:
+            check(args.file)
+        except ValueError as e:
+            print(f'The device cannot play {args.file}: {e}')
+            sys.exit(1)
+    else:
+        parser.print_help()
+        sys.exit(1)
@@ -0,0 +1,123 @@
+import os
+import ssl
+import sys
+import time
+import socket
+import argparse
+import tempfile
+import threading
+import subprocess
+
+
+'''
+  Check whether a server resumes TLS sessions, the way the firmware does with CONFIG_USE_TLS_SESSION_CACHE:
+  the first connection does a full handshake, the following connections offer the saved session.
+
+  python tls_resumption_check.py --host api.tenclass.net          check a real server
+  python tls_resumption_check.py --local                          check against a local TLS stand-in server
+  python tls_resumption_check.py --serve --port 8443              run the stand-in server only
+'''
+
+
+def create_self_signed_cert(directory):
+    cert_file = os.path.join(directory, 'cert.pem')
+    key_file = os.path.join(directory, 'key.pem')
+    subprocess.run(['openssl', 'req', '-x509', '-newkey', 'rsa:2048', '-nodes', '-days', '1',
+                    '-subj', '/CN=localhost', '-keyout', key_file, '-out', cert_file],
+                   check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return cert_file, key_file
+
+
+class StandInServer:
+    '''A TLS server answering every request with HTTP 200, and counting resumed handshakes.'''
+
+    def __init__(self, port, cert_file, key_file, max_version):
+        self.context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        self.context.load_cert_chain(cert_file, key_file)
+        self.context.maximum_version = max_version
+        self.sock = socket.create_server(('0.0.0.0', port))
+        self.port = self.sock.getsockname()[1]
+        self.full = 0
+        self.resumed = 0
+
+    def serve_forever(self):
+        while True:
+            conn, addr = self.sock.accept()
+            threading.Thread(target=self.handle, args=(conn, addr), daemon=True).start()
+
+    def handle(self, conn, addr):
+        try:
+            with self.context.wrap_socket(conn, server_side=True) as tls:
+                tls.recv(4096)
+                tls.sendall(b'HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nOK')
+                if tls.session_reused:
+                    self.resumed += 1
+                else:
+                    self.full += 1
+                print(f'{addr[0]}:{addr[1]} {tls.version()} {"resumed" if tls.session_reused else "full"} handshake '
+                      f'(full: {self.full}, resumed: {self.resumed})')
+        except (ssl.SSLError, OSError) as e:
+            print(f'{addr[0]}:{addr[1]} error: {e}')
+
+
+def check(host, port, count, verify, max_version):
+    context = ssl.create_default_context()
+    context.maximum_version = max_version
+    if not verify:
+        context.check_hostname = False
+        context.verify_mode = ssl.CERT_NONE
+
+    session = None
+    results = []
+    for i in range(count):
+        start = time.monotonic()
+        with socket.create_connection((host, port), timeout=10) as sock:
+            connect_time = time.monotonic()
+            with context.wrap_socket(sock, server_hostname=host, session=session) as tls:
+                handshake_ms = (time.monotonic() - connect_time) * 1000
+                tls.sendall(f'HEAD / HTTP/1.1\r\nHost: {host}\r\nConnection: close\r\n\r\n'.encode())
+                tls.recv(4096)  # TLS 1.3 tickets arrive after the handshake
+                reused = tls.session_reused
+                session = tls.session
+                print(f'#{i + 1} {tls.version()} {"resumed" if reused else "full"} handshake in {handshake_ms:.0f} ms '
+                      f'(tcp {(connect_time - start) * 1000:.0f} ms)')
+                results.append((reused, handshake_ms))
+
+    full = [ms for reused, ms in results if not reused]
+    resumed = [ms for reused, ms in results if reused]
+    print(f'Full: {len(full)}' + (f', avg {sum(full) / len(full):.0f} ms' if full else ''))
+    print(f'Resumed: {len(resumed)}' + (f', avg {sum(resumed) / len(resumed):.0f} ms' if resumed else ''))
+    return len(resumed) == count - 1
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='TLS 会话恢复检查工具')
+    parser.add_argument('--host', help='要检查的服务器地址')
+    parser.add_argument('--port', type=int, default=443, help='端口 (默认: 443)')
+    parser.add_argument('--count', '-n', type=int, default=5, help='连接次数 (默认: 5)')
+    parser.add_argument('--local', action='store_true', help='启动本地 TLS 模拟服务器并检查')
+    parser.add_argument('--serve', action='store_true', help='只运行本地 TLS 模拟服务器')
+    parser.add_argument('--tls12', action='store_true', help='限制为 TLS 1.2 (与固件默认配置一致)')
+    args = parser.parse_args()
+
+    max_version = ssl.TLSVersion.TLSv1_2 if args.tls12 else ssl.TLSVersion.MAXIMUM_SUPPORTED
+    if args.local or args.serve:
+        with tempfile.TemporaryDirectory() as directory:
+            cert_file, key_file = create_self_signed_cert(directory)
+            server = StandInServer(args.port if args.serve else 0, cert_file, key_file, max_version)
+            if args.serve:
+                print(f'TLS stand-in server listening on 0.0.0.0:{server.port}')
+                try:
+                    server.serve_forever()
+                except KeyboardInterrupt:
+                    pass
+                sys.exit(0)
+            threading.Thread(target=server.serve_forever, daemon=True).start()
+            ok = check('localhost', server.port, args.count, False, max_version)
+    elif args.host:
+        ok = check(args.host, args.port, args.count, True, max_version)
+    else:
+        parser.print_help()
+        sys.exit(1)
+    print('Session resumption works' if ok else 'Session resumption is NOT supported')
+    sys.exit(0 if ok else 1)
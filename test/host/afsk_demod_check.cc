@@ -0,0 +1,204 @@
+/*
+ * Runs the acoustic WiFi provisioning demodulator (main/boards/common/afsk_demod.cc) on the host.
+ *
+ *   afsk_demod_check --unit            checks of the resampler, the Goertzel pair and RS(15, 9) decoding
+ *   afsk_demod_check a.wav [...]       decodes 16 kHz WAV files as the firmware does, one line per file:
+ *                                      the path, a tab and the decoded text with \n escaped, nothing if none
+ *
+ * scripts/afsk_demod_check.py writes the signals and measures the decode rate with this program.
+ */
+#include "afsk_demod.h"
+#include "wav_file.h"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace audio_wifi_config;
+
+#define INPUT_RATE 16000
+#define CHUNK_SAMPLES 480
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do { \
+    if (!(condition)) { \
+        printf("FAILED %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while (0)
+
+static void CheckResampler() {
+    // The tones pass at unity gain
+    for (int frequency : {(int)kSpaceFrequency, (int)kMarkFrequency}) {
+        Resampler resampler(INPUT_RATE, kAudioSampleRate, kResamplerTapsPerPhase);
+        std::vector<int16_t> output;
+        int16_t resampled[8];
+        for (int i = 0; i < INPUT_RATE / 10; i++) {
+            size_t count = resampler.Process((int16_t)(10000 * sin(2 * M_PI * frequency * i / INPUT_RATE)), resampled);
+            output.insert(output.end(), resampled, resampled + count);
+        }
+        CHECK(output.size() == kAudioSampleRate / 10, "%zu samples out of %d", output.size(), INPUT_RATE / 10);
+        int peak = 0;
+        for (size_t i = output.size() / 2; i < output.size(); i++) {
+            peak = std::max(peak, std::abs((int)output[i]));
+        }
+        CHECK(peak > 9500 && peak < 10500, "%d Hz peak %d, expected 10000", frequency, peak);
+    }
+}
+
+static void CheckToneDetector() {
+    ToneDetector detector((float)kMarkFrequency / kAudioSampleRate, (float)kSpaceFrequency / kAudioSampleRate);
+    int16_t window[kWindowSize];
+    for (int amplitude : {300, 12000, 32767}) {
+        for (int frequency : {(int)kMarkFrequency, (int)kSpaceFrequency}) {
+            for (size_t i = 0; i < kWindowSize; i++) {
+                window[i] = (int16_t)(amplitude * sin(2 * M_PI * frequency * i / kAudioSampleRate));
+            }
+            float probability = detector.Process(window, kWindowSize);
+            if (frequency == (int)kMarkFrequency) {
+                CHECK(probability > 0.9f, "mark at %d: probability %.3f", amplitude, probability);
+            } else {
+                CHECK(probability < 0.1f, "space at %d: probability %.3f", amplitude, probability);
+            }
+        }
+    }
+}
+
+// Systematic RS(15, 9) encoder over GF(16) with x^4 + x + 1, the generator has the roots a^1..a^6 like the sender
+static void EncodeReedSolomon(const uint8_t* data, uint8_t* codeword) {
+    const size_t parity = ReedSolomon16::kLength - ReedSolomon16::kDataLength;
+    uint8_t exp[15], log[16] = {};
+    for (int i = 0, x = 1; i < 15; i++, x = (x << 1) ^ ((x & 0x8) ? 0x13 : 0)) {
+        exp[i] = x;
+        log[x] = i;
+    }
+    auto multiply = [&](uint8_t a, uint8_t b) -> uint8_t {
+        return (a == 0 || b == 0) ? 0 : exp[(log[a] + log[b]) % 15];
+    };
+    uint8_t generator[parity + 1] = {1};
+    for (size_t i = 1; i <= parity; i++) {
+        for (size_t j = i; j > 0; j--) {
+            generator[j] ^= multiply(generator[j - 1], exp[i]);
+        }
+    }
+    std::copy(data, data + ReedSolomon16::kDataLength, codeword);
+    std::fill(codeword + ReedSolomon16::kDataLength, codeword + ReedSolomon16::kLength, 0);
+    uint8_t remainder[ReedSolomon16::kLength];
+    std::copy(codeword, codeword + ReedSolomon16::kLength, remainder);
+    for (size_t i = 0; i < ReedSolomon16::kDataLength; i++) {
+        uint8_t c = remainder[i];
+        for (size_t j = 1; j <= parity && c != 0; j++) {
+            remainder[i + j] ^= multiply(generator[j], c);
+        }
+    }
+    std::copy(remainder + ReedSolomon16::kDataLength, remainder + ReedSolomon16::kLength,
+              codeword + ReedSolomon16::kDataLength);
+}
+
+static void CheckReedSolomon() {
+    std::mt19937 rng(1);
+    const size_t length = ReedSolomon16::kLength;
+    for (int errors = 0; errors <= 4; errors++) {
+        int corrected = 0, rejected = 0;
+        for (int trial = 0; trial < 2000; trial++) {
+            uint8_t data[ReedSolomon16::kDataLength], codeword[length], received[length];
+            for (auto& symbol : data) {
+                symbol = rng() % 16;
+            }
+            EncodeReedSolomon(data, codeword);
+            std::copy(codeword, codeword + length, received);
+            uint8_t positions[length];
+            for (size_t i = 0; i < length; i++) {
+                positions[i] = i;
+            }
+            std::shuffle(positions, positions + length, rng);
+            for (int i = 0; i < errors; i++) {
+                received[positions[i]] ^= 1 + rng() % 15;
+            }
+
+            bool decoded = ReedSolomon16::Decode(received);
+            if (errors <= 3) {
+                // Up to 3 symbol errors are always corrected
+                CHECK(decoded && std::equal(received, received + length, codeword),
+                      "%d errors not corrected in trial %d", errors, trial);
+                continue;
+            }
+            // Beyond that a decode may only land on another valid codeword
+            if (decoded) {
+                uint8_t reencoded[length];
+                EncodeReedSolomon(received, reencoded);
+                CHECK(std::equal(received, received + length, reencoded), "decoded to an invalid codeword in trial %d", trial);
+                corrected++;
+            } else {
+                rejected++;
+            }
+        }
+        if (errors > 3) {
+            printf("RS(15, 9) with %d errors: %d rejected, %d decoded to another codeword\n", errors, rejected, corrected);
+            CHECK(rejected > corrected, "too few uncorrectable codewords rejected");
+        }
+    }
+}
+
+// Same steps as ReceiveWifiCredentialsFromAudio, without the device
+static std::string Decode(const WavFile& wav) {
+    AudioSignalProcessor signal_processor(INPUT_RATE, kAudioSampleRate, kMarkFrequency, kSpaceFrequency,
+                                          kBitRate, kWindowSize);
+    AudioDataBuffer data_buffer;
+    std::vector<float> probabilities;
+    for (size_t start = 0; start < wav.frames(); start += CHUNK_SAMPLES) {
+        size_t frames = std::min<size_t>(CHUNK_SAMPLES, wav.frames() - start);
+        probabilities.clear();
+        signal_processor.ProcessAudioSamples(&wav.samples[start * wav.channels], frames, wav.channels, probabilities);
+        if (data_buffer.ProcessProbabilityData(probabilities, 0.5f)) {
+            return *data_buffer.decoded_text;
+        }
+        if (signal_processor.decoded_text.has_value()) {
+            return *signal_processor.decoded_text;
+        }
+    }
+    return "";
+}
+
+static std::string Escape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '\n') {
+            escaped += "\\n";
+        } else if (c == '\\') {
+            escaped += "\\\\";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 2 && std::string(argv[1]) == "--unit") {
+        CheckResampler();
+        CheckToneDetector();
+        CheckReedSolomon();
+        printf("%s\n", failures == 0 ? "all checks passed" : "some checks failed");
+        return failures == 0 ? 0 : 1;
+    }
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s --unit | signal.wav [...]\n", argv[0]);
+        return 2;
+    }
+    for (int i = 1; i < argc; i++) {
+        WavFile wav;
+        if (!wav.Read(argv[i]) || wav.sample_rate != INPUT_RATE) {
+            fprintf(stderr, "%s: need 16-bit %d Hz audio\n", argv[i], INPUT_RATE);
+            return 2;
+        }
+        printf("%s\t%s\n", argv[i], Escape(Decode(wav)).c_str());
+    }
+    return 0;
+}
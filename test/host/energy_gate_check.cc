@@ -0,0 +1,148 @@
+/*
+ * Runs main/audio/energy_gate.cc over recordings on the host, and checks that every labeled wake word
+ * reaches the wake word engine in full, and without delay at its end, where the engine detects it.
+ *
+ *   energy_gate_check                                  synthetic noise with speech-like bursts
+ *   energy_gate_check room.wav room.txt [...]          16 kHz 16-bit WAV, labels as exported by Audacity
+ *
+ * A label line is "start<TAB>end[<TAB>text]" in seconds. Each chunk carries its index in an extra channel,
+ * which the gate ignores, so the chunks the gate feeds can be told apart.
+ */
+#include "energy_gate.h"
+#include "wav_file.h"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#define SAMPLE_RATE 16000
+#define CHUNK_SAMPLES 512
+
+struct Label {
+    double start;
+    double end;
+    std::string text;
+};
+
+static std::vector<Label> ReadLabels(const char* path) {
+    std::vector<Label> labels;
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return labels;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        double start, end;
+        char text[200] = "";
+        if (sscanf(line, "%lf\t%lf\t%199[^\n]", &start, &end, text) >= 2) {
+            labels.push_back({start, end, text});
+        }
+    }
+    fclose(file);
+    return labels;
+}
+
+// Low noise with 1 s bursts of modulated tones, each starting with a soft fricative like the "x" of "xiao"
+static std::vector<int16_t> SyntheticRecording(int seconds, int seed, std::vector<Label>& labels) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> noise(0, 30);
+    std::normal_distribution<double> hiss(0, 0.3);
+    std::uniform_real_distribution<double> gap(4, 12);
+    const int amplitudes[] = {300, 800, 3000};
+
+    std::vector<int16_t> samples(seconds * SAMPLE_RATE);
+    for (auto& sample : samples) {
+        sample = (int16_t)noise(rng);
+    }
+    for (double t = 3.0; t < seconds - 2; t += gap(rng)) {
+        size_t start = (size_t)(t * SAMPLE_RATE);
+        int length = SAMPLE_RATE;
+        int amplitude = amplitudes[rng() % 3];
+        for (int i = 0; i < length; i++) {
+            double envelope = std::min({1.0, i / 800.0, (length - i) / 800.0});
+            double voiced = sin(2 * M_PI * 180 * i / SAMPLE_RATE) + 0.5 * sin(2 * M_PI * 900 * i / SAMPLE_RATE);
+            double signal = i < 2400 ? 0.1 * voiced + hiss(rng) : voiced;
+            double value = samples[start + i] + amplitude * envelope * signal;
+            samples[start + i] = (int16_t)std::clamp(value, -32768.0, 32767.0);
+        }
+        labels.push_back({t, t + 1.0, "burst " + std::to_string(amplitude)});
+    }
+    return samples;
+}
+
+// Returns the number of wake words that were cut or fed late
+static int Check(const std::string& name, const WavFile& wav, const std::vector<Label>& labels) {
+    int channels = wav.channels + 1;
+    size_t chunks = wav.frames() / CHUNK_SAMPLES;
+    // The call in which each chunk was fed, -1 if never
+    std::vector<long> fed_at(chunks, -1);
+    long call = 0;
+
+    EnergyGate gate(channels, SAMPLE_RATE);
+    std::vector<int16_t> data(CHUNK_SAMPLES * channels);
+    for (size_t i = 0; i < chunks; i++) {
+        for (size_t j = 0; j < CHUNK_SAMPLES; j++) {
+            auto frame = &wav.samples[(i * CHUNK_SAMPLES + j) * wav.channels];
+            std::copy(frame, frame + wav.channels, &data[j * channels]);
+            data[j * channels + wav.channels] = 0;
+        }
+        data[wav.channels] = i & 0x7FFF;
+        data[channels + wav.channels] = i >> 15;
+        call = i;
+        gate.Process(data, [&](const std::vector<int16_t>& chunk) {
+            size_t index = chunk[wav.channels] | (chunk[channels + wav.channels] << 15);
+            fed_at[index] = call;
+        });
+    }
+
+    int failed = 0;
+    for (auto& label : labels) {
+        size_t first = (size_t)(label.start * SAMPLE_RATE) / CHUNK_SAMPLES;
+        size_t last = std::min(chunks - 1, (size_t)(label.end * SAMPLE_RATE) / CHUNK_SAMPLES);
+        size_t missing = 0;
+        for (size_t i = first; i <= last; i++) {
+            missing += fed_at[i] < 0;
+        }
+        if (missing > 0) {
+            printf("  CUT %.2f-%.2f %s: %zu chunks not fed\n", label.start, label.end, label.text.c_str(), missing);
+            failed++;
+        } else if (fed_at[last] != (long)last) {
+            printf("  LATE %.2f-%.2f %s: end fed %ld chunks late\n", label.start, label.end, label.text.c_str(),
+                fed_at[last] - (long)last);
+            failed++;
+        }
+    }
+    printf("%s: %zu chunks, passed %lu, skipped %lu (%.1f%%), wake words cut or late: %d of %zu\n", name.c_str(),
+        chunks, (unsigned long)gate.passed_chunks(), (unsigned long)gate.gated_chunks(),
+        gate.gated_chunks() * 100.0 / std::max<size_t>(1, chunks), failed, labels.size());
+    return failed;
+}
+
+int main(int argc, char** argv) {
+    int failed = 0;
+    if (argc == 1) {
+        for (int seed = 0; seed < 3; seed++) {
+            WavFile wav;
+            std::vector<Label> labels;
+            wav.samples = SyntheticRecording(120, seed, labels);
+            failed += Check("synthetic #" + std::to_string(seed), wav, labels);
+        }
+    } else if (argc % 2 == 1) {
+        for (int i = 1; i < argc; i += 2) {
+            WavFile wav;
+            if (!wav.Read(argv[i]) || wav.sample_rate != SAMPLE_RATE) {
+                fprintf(stderr, "%s: need 16-bit %d Hz audio\n", argv[i], SAMPLE_RATE);
+                return 2;
+            }
+            failed += Check(argv[i], wav, ReadLabels(argv[i + 1]));
+        }
+    } else {
+        fprintf(stderr, "Usage: %s [recording.wav labels.txt ...]\n", argv[0]);
+        return 2;
+    }
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,34 @@
+#ifndef APPLICATION_H
+#define APPLICATION_H
+
+#include <cstdint>
+#include <vector>
+
+// Host stand-in, just enough for the sources under test to compile. The tests call their classes directly
+
+enum DeviceState {
+    kDeviceStateUnknown,
+    kDeviceStateWifiConfiguring,
+};
+
+class Display;
+
+class AudioService {
+public:
+    bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) { return false; }
+};
+
+class Application {
+public:
+    DeviceState GetDeviceState() const { return kDeviceStateUnknown; }
+    AudioService& GetAudioService() { return audio_service_; }
+
+private:
+    AudioService audio_service_;
+};
+
+#define pdMS_TO_TICKS(ms) (ms)
+inline void vTaskDelay(int ticks) {}
+inline void esp_restart() {}
+
+#endif // APPLICATION_H
@@ -0,0 +1,10 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+// Host stand-in, see application.h
+class Display {
+public:
+    void SetChatMessage(const char* role, const char* content) {}
+};
+
+#endif // DISPLAY_H
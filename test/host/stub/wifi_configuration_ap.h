@@ -0,0 +1,13 @@
+#ifndef WIFI_CONFIGURATION_AP_H
+#define WIFI_CONFIGURATION_AP_H
+
+#include <string>
+
+// Host stand-in, see application.h
+class WifiConfigurationAp {
+public:
+    bool ConnectToWifi(const std::string& ssid, const std::string& password) { return false; }
+    void Save(const std::string& ssid, const std::string& password) {}
+};
+
+#endif // WIFI_CONFIGURATION_AP_H
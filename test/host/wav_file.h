@@ -0,0 +1,52 @@
+#ifndef WAV_FILE_H
+#define WAV_FILE_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// 16-bit PCM WAV, the format the firmware captures and scripts/ write
+struct WavFile {
+    int channels = 1;
+    int sample_rate = 16000;
+    std::vector<int16_t> samples;   // Interleaved
+
+    size_t frames() const { return samples.size() / channels; }
+
+    bool Read(const char* path) {
+        FILE* file = fopen(path, "rb");
+        if (file == nullptr) {
+            return false;
+        }
+        char riff[12];
+        bool found_format = false;
+        bool ok = fread(riff, 1, sizeof(riff), file) == sizeof(riff) && memcmp(riff, "RIFF", 4) == 0 &&
+            memcmp(riff + 8, "WAVE", 4) == 0;
+        while (ok) {
+            char id[4];
+            uint32_t size;
+            if (fread(id, 1, 4, file) != 4 || fread(&size, 4, 1, file) != 1) {
+                ok = false;
+                break;
+            }
+            if (memcmp(id, "fmt ", 4) == 0 && size >= 16) {
+                uint8_t format[16];
+                ok = fread(format, 1, 16, file) == 16 && fseek(file, size - 16, SEEK_CUR) == 0;
+                channels = format[2] | (format[3] << 8);
+                sample_rate = format[4] | (format[5] << 8) | (format[6] << 16) | (format[7] << 24);
+                found_format = format[0] == 1 && format[14] == 16 && channels > 0;
+            } else if (memcmp(id, "data", 4) == 0) {
+                samples.resize(size / 2);
+                ok = found_format && fread(samples.data(), 2, samples.size(), file) == samples.size();
+                break;
+            } else {
+                ok = fseek(file, size + (size & 1), SEEK_CUR) == 0;
+            }
+        }
+        fclose(file);
+        return ok;
+    }
+};
+
+#endif // WAV_FILE_H